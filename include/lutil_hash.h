@@ -27,6 +27,12 @@ LDAP_BEGIN_DECL
 typedef union lutil_HASHContext {
 	ber_uint_t hash;
 	unsigned long long hash64;
+	struct {
+		unsigned long long v[4];
+		unsigned long long total;
+		unsigned char buf[32];
+		unsigned int len;
+	} xxh64;
 } lutil_HASH_CTX;
 
 #else /* !HAVE_LONG_LONG */
@@ -52,6 +58,15 @@ lutil_HASHFinal LDAP_P((
 	unsigned char digest[LUTIL_HASH_BYTES],
 	lutil_HASH_CTX *context));
 
+LDAP_LUTIL_F( void )
+lutil_HASHWindows LDAP_P((
+	lutil_HASH_CTX *context,
+	unsigned char const *buf,
+	ber_len_t wlen,
+	ber_len_t step,
+	ber_len_t n,
+	unsigned char *digests));
+
 #ifdef HAVE_LONG_LONG
 
 #define LUTIL_HASH64_BYTES	8
@@ -71,6 +86,43 @@ lutil_HASH64Final LDAP_P((
 	unsigned char digest[LUTIL_HASH64_BYTES],
 	lutil_HASH_CTX *context));
 
+LDAP_LUTIL_F( void )
+lutil_HASH64Windows LDAP_P((
+	lutil_HASH_CTX *context,
+	unsigned char const *buf,
+	ber_len_t wlen,
+	ber_len_t step,
+	ber_len_t n,
+	unsigned char *digests));
+
+LDAP_LUTIL_F( void )
+lutil_XXH64Init LDAP_P((
+	lutil_HASH_CTX *context));
+
+LDAP_LUTIL_F( void )
+lutil_XXH64Update LDAP_P((
+	lutil_HASH_CTX *context,
+	unsigned char const *buf,
+	ber_len_t len));
+
+LDAP_LUTIL_F( void )
+lutil_XXH64Final LDAP_P((
+	unsigned char digest[LUTIL_HASH64_BYTES],
+	lutil_HASH_CTX *context));
+
+LDAP_LUTIL_F( void )
+lutil_XXH64Seal LDAP_P((
+	lutil_HASH_CTX *context));
+
+LDAP_LUTIL_F( void )
+lutil_XXH64Windows LDAP_P((
+	lutil_HASH_CTX *context,
+	unsigned char const *buf,
+	ber_len_t wlen,
+	ber_len_t step,
+	ber_len_t n,
+	unsigned char *digests));
+
 #endif /* HAVE_LONG_LONG */
 
 LDAP_END_DECL
@@ -102,6 +102,61 @@ void ucstr2upper(
 	}
 }
 
+/*
+ * Most values are plain ASCII, which needs neither decomposition nor
+ * the Unicode case tables. These look at a machine word at a time:
+ * ONES has 0x01 in every byte, so ONES * 0x80 picks the high bit of
+ * each byte.
+ */
+#define	UC_WORD		unsigned long
+#define	UC_ONES		((UC_WORD)-1 / 0xff)
+#define	UC_HIGH		(UC_ONES * 0x80)
+
+/* length of the run of ASCII characters at the start of s */
+static int
+ascii_span( const char *s, int len )
+{
+	UC_WORD w;
+	int i = 0;
+
+	for ( ; i + (int)sizeof(w) <= len; i += sizeof(w) ) {
+		AC_MEMCPY( &w, s + i, sizeof(w) );
+		if ( w & UC_HIGH ) {
+			break;
+		}
+	}
+	for ( ; i < len && LDAP_UTF8_ISASCII( s + i ); i++ ) {
+		/* empty */
+	}
+	return i;
+}
+
+/* copy len ASCII characters from s to out, optionally lowercased */
+static void
+ascii_copy( char *out, const char *s, int len, unsigned casefold )
+{
+	UC_WORD w, upper;
+	int i = 0;
+
+	if ( !casefold ) {
+		AC_MEMCPY( out, s, len );
+		return;
+	}
+
+	for ( ; i + (int)sizeof(w) <= len; i += sizeof(w) ) {
+		AC_MEMCPY( &w, s + i, sizeof(w) );
+		/* high bit set in the bytes from 'A' to 'Z'; every byte is
+		 * below 0x80 so none of the additions carry over */
+		upper = ( w + UC_ONES * ( 0x80 - 'A' )) &
+			~( w + UC_ONES * ( 0x7f - 'Z' )) & UC_HIGH;
+		w |= upper >> 2;
+		AC_MEMCPY( out + i, &w, sizeof(w) );
+	}
+	for ( ; i < len; i++ ) {
+		out[i] = TOLOWER( s[i] );
+	}
+}
+
 struct berval * UTF8bvnormalize(
 	struct berval *bv,
 	struct berval *newbv,
@@ -142,55 +197,31 @@ struct berval * UTF8bvnormalize(
 	 */
 
 	/* finish off everything up to character before first non-ascii */
-	if ( LDAP_UTF8_ISASCII( s ) ) {
-		if ( casefold ) {
-			outsize = len + 7;
-			out = (char *) ber_memalloc_x( outsize, ctx );
-			if ( out == NULL ) {
-fail:
-				if ( didnewbv )
-					ber_memfree_x( newbv, ctx );
-				return NULL;
-			}
-			outpos = 0;
+	i = ascii_span( s, len );
+	if ( i == len && !casefold ) {
+		return ber_str2bv_x( s, len, 1, newbv, ctx );
+	}
 
-			for ( i = 1; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
-				out[outpos++] = TOLOWER( s[i-1] );
-			}
-			if ( i == len ) {
-				out[outpos++] = TOLOWER( s[len-1] );
-				out[outpos] = '\0';
-				newbv->bv_val = out;
-				newbv->bv_len = outpos;
-				return newbv;
-			}
-		} else {
-			for ( i = 1; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
-				/* empty */
-			}
+	outsize = len + 7;
+	out = (char *) ber_memalloc_x( outsize, ctx );
+	if ( out == NULL ) {
+fail:
+		if ( didnewbv )
+			ber_memfree_x( newbv, ctx );
+		return NULL;
+	}
 
-			if ( i == len ) {
-				return ber_str2bv_x( s, len, 1, newbv, ctx );
-			}
-				
-			outsize = len + 7;
-			out = (char *) ber_memalloc_x( outsize, ctx );
-			if ( out == NULL ) {
-				goto fail;
-			}
-			outpos = i - 1;
-			memcpy(out, s, outpos);
-		}
-	} else {
-		outsize = len + 7;
-		out = (char *) ber_memalloc_x( outsize, ctx );
-		if ( out == NULL ) {
-			goto fail;
-		}
-		outpos = 0;
-		i = 0;
+	if ( i == len ) {
+		ascii_copy( out, s, len, casefold );
+		out[len] = '\0';
+		newbv->bv_val = out;
+		newbv->bv_len = len;
+		return newbv;
 	}
 
+	outpos = i ? i - 1 : 0;
+	ascii_copy( out, s, outpos, casefold );
+
 	p = ucs = ber_memalloc_x( len * sizeof(*ucs), ctx );
 	if ( ucs == NULL ) {
 		ber_memfree_x(out, ctx);
@@ -287,13 +318,15 @@ fail:
 
 		/* s[i] is ascii */
 		/* finish off everything up to char before next non-ascii */
-		for ( i++; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
-			out[outpos++] = casefold ? TOLOWER( s[i-1] ) : s[i-1];
-		}
+		j = ascii_span( s + i, len - i );
+		i += j;
 		if ( i == len ) {
-			out[outpos++] = casefold ? TOLOWER( s[len-1] ) : s[len-1];
+			ascii_copy( &out[outpos], s + i - j, j, casefold );
+			outpos += j;
 			break;
 		}
+		ascii_copy( &out[outpos], s + i - j, j - 1, casefold );
+		outpos += j - 1;
 
 		/* convert character before next non-ascii to ucs-4 */
 		*ucs = casefold ? TOLOWER( s[i-1] ) : s[i-1];
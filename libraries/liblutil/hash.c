@@ -21,12 +21,19 @@
 
 #include "portable.h"
 
+#include <ac/string.h>
+
 #include <lutil_hash.h>
 
 /* offset and prime for 32-bit FNV-1 */
 #define HASH_OFFSET	0x811c9dc5U
 #define HASH_PRIME	16777619
 
+/* store a hash value in digest order, least significant octet first */
+#define PUT32(d, h) \
+	((d)[0] = (h) & 0xffU, (d)[1] = ((h)>>8) & 0xffU, \
+	 (d)[2] = ((h)>>16) & 0xffU, (d)[3] = ((h)>>24) & 0xffU)
+
 
 /*
  * Initialize context
@@ -76,6 +83,53 @@ lutil_HASHFinal( unsigned char *digest, lutil_HASH_CTX *ctx )
 	digest[3] = (h>>24) & 0xffU;
 }
 
+/*
+ * Hash n windows of wlen octets, the i'th one starting at buf[i*step],
+ * each continuing from the state in ctx, and save the digests one
+ * after another. Four windows are hashed side by side so their
+ * multiplies can overlap; the result is the same as running
+ * Update and Final on a copy of ctx for each window.
+ */
+void
+lutil_HASHWindows(
+    lutil_HASH_CTX	*ctx,
+    const unsigned char		*buf,
+    ber_len_t		wlen,
+    ber_len_t		step,
+    ber_len_t		n,
+    unsigned char	*digests )
+{
+	const unsigned char *p;
+	ber_uint_t h0, h1, h2, h3;
+	ber_len_t i, k;
+
+	for ( i = 0; i + 4 <= n; i += 4 ) {
+		p = &buf[i * step];
+		h0 = h1 = h2 = h3 = ctx->hash;
+		for ( k = 0; k < wlen; k++ ) {
+			h0 = ( h0 * HASH_PRIME ) ^ p[k];
+			h1 = ( h1 * HASH_PRIME ) ^ p[k + step];
+			h2 = ( h2 * HASH_PRIME ) ^ p[k + 2 * step];
+			h3 = ( h3 * HASH_PRIME ) ^ p[k + 3 * step];
+		}
+		PUT32( digests, h0 );
+		PUT32( digests + 4, h1 );
+		PUT32( digests + 8, h2 );
+		PUT32( digests + 12, h3 );
+		digests += 16;
+	}
+
+	for ( ; i < n; i++ ) {
+		p = &buf[i * step];
+		h0 = ctx->hash;
+		for ( k = 0; k < wlen; k++ ) {
+			h0 = ( h0 * HASH_PRIME ) ^ p[k];
+		}
+		PUT32( digests, h0 );
+		digests += 4;
+	}
+}
+
 #ifdef HAVE_LONG_LONG
 
 /* 64 bit Fowler/Noll/Vo-O FNV-1a hash code */
@@ -138,4 +192,279 @@ lutil_HASH64Final( unsigned char *digest, lutil_HASH_CTX *ctx )
 	digest[6] = (h>>48) & 0xffU;
 	digest[7] = (h>>56) & 0xffU;
 }
+
+/* multiply by the 64 bit FNV magic prime mod 2^64 */
+#define HASH64_MUL(h) \
+	((h) += ((h) << 1) + ((h) << 4) + ((h) << 5) + \
+		((h) << 7) + ((h) << 8) + ((h) << 40))
+
+#define PUT64(d, h) \
+	(PUT32( d, (h) & 0xffffffffU ), PUT32( (d) + 4, (h) >> 32 ))
+
+/*
+ * 64 bit version of lutil_HASHWindows
+ */
+void
+lutil_HASH64Windows(
+    lutil_HASH_CTX	*ctx,
+    const unsigned char		*buf,
+    ber_len_t		wlen,
+    ber_len_t		step,
+    ber_len_t		n,
+    unsigned char	*digests )
+{
+	const unsigned char *p;
+	unsigned long long h0, h1, h2, h3;
+	ber_len_t i, k;
+
+	for ( i = 0; i + 4 <= n; i += 4 ) {
+		p = &buf[i * step];
+		h0 = h1 = h2 = h3 = ctx->hash64;
+		for ( k = 0; k < wlen; k++ ) {
+			h0 ^= p[k];
+			h1 ^= p[k + step];
+			h2 ^= p[k + 2 * step];
+			h3 ^= p[k + 3 * step];
+			HASH64_MUL( h0 );
+			HASH64_MUL( h1 );
+			HASH64_MUL( h2 );
+			HASH64_MUL( h3 );
+		}
+		PUT64( digests, h0 );
+		PUT64( digests + 8, h1 );
+		PUT64( digests + 16, h2 );
+		PUT64( digests + 24, h3 );
+		digests += 32;
+	}
+
+	for ( ; i < n; i++ ) {
+		p = &buf[i * step];
+		h0 = ctx->hash64;
+		for ( k = 0; k < wlen; k++ ) {
+			h0 ^= p[k];
+			HASH64_MUL( h0 );
+		}
+		PUT64( digests, h0 );
+		digests += 8;
+	}
+}
+
+/* 64 bit xxHash (XXH64), seed 0.
+ * The algorithm is described at:
+ *   https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ * It consumes its input eight octets at a time, which makes it much
+ * faster than FNV on anything but very short values.
+ */
+
+#define XXH_PRIME1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3	0x165667B19E3779F9ULL
+#define XXH_PRIME4	0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5	0x27D4EB2F165667C5ULL
+
+#define XXH_ROTL(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static unsigned long long
+xxh_get64( const unsigned char *p )
+{
+	return (unsigned long long)p[0] |
+		((unsigned long long)p[1] << 8) |
+		((unsigned long long)p[2] << 16) |
+		((unsigned long long)p[3] << 24) |
+		((unsigned long long)p[4] << 32) |
+		((unsigned long long)p[5] << 40) |
+		((unsigned long long)p[6] << 48) |
+		((unsigned long long)p[7] << 56);
+}
+
+static unsigned long long
+xxh_round( unsigned long long acc, unsigned long long input )
+{
+	acc += input * XXH_PRIME2;
+	acc = XXH_ROTL( acc, 31 );
+	return acc * XXH_PRIME1;
+}
+
+static unsigned long long
+xxh_merge( unsigned long long h, unsigned long long v )
+{
+	h ^= xxh_round( 0, v );
+	return h * XXH_PRIME1 + XXH_PRIME4;
+}
+
+/* process one 32 octet stripe */
+static void
+xxh_stripe( unsigned long long *v, const unsigned char *p )
+{
+	v[0] = xxh_round( v[0], xxh_get64( p ));
+	v[1] = xxh_round( v[1], xxh_get64( p + 8 ));
+	v[2] = xxh_round( v[2], xxh_get64( p + 16 ));
+	v[3] = xxh_round( v[3], xxh_get64( p + 24 ));
+}
+
+static void
+xxh_init( lutil_HASH_CTX *ctx, unsigned long long seed )
+{
+	ctx->xxh64.v[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+	ctx->xxh64.v[1] = seed + XXH_PRIME2;
+	ctx->xxh64.v[2] = seed;
+	ctx->xxh64.v[3] = seed - XXH_PRIME1;
+	ctx->xxh64.total = 0;
+	ctx->xxh64.len = 0;
+}
+
+/*
+ * Initialize context
+ */
+void
+lutil_XXH64Init( lutil_HASH_CTX *ctx )
+{
+	xxh_init( ctx, 0 );
+}
+
+/*
+ * Update hash
+ */
+void
+lutil_XXH64Update(
+    lutil_HASH_CTX	*ctx,
+    const unsigned char		*buf,
+    ber_len_t		len )
+{
+	unsigned int n = ctx->xxh64.len;
+
+	ctx->xxh64.total += len;
+
+	if ( n + len < sizeof(ctx->xxh64.buf) ) {
+		AC_MEMCPY( ctx->xxh64.buf + n, buf, len );
+		ctx->xxh64.len = n + len;
+		return;
+	}
+
+	if ( n ) {
+		AC_MEMCPY( ctx->xxh64.buf + n, buf, sizeof(ctx->xxh64.buf) - n );
+		xxh_stripe( ctx->xxh64.v, ctx->xxh64.buf );
+		buf += sizeof(ctx->xxh64.buf) - n;
+		len -= sizeof(ctx->xxh64.buf) - n;
+	}
+
+	for ( ; len >= sizeof(ctx->xxh64.buf); len -= sizeof(ctx->xxh64.buf) ) {
+		xxh_stripe( ctx->xxh64.v, buf );
+		buf += sizeof(ctx->xxh64.buf);
+	}
+
+	AC_MEMCPY( ctx->xxh64.buf, buf, len );
+	ctx->xxh64.len = len;
+}
+
+/* mix in the last len % 32 octets and finish */
+static unsigned long long
+xxh_tail( unsigned long long h, const unsigned char *p, const unsigned char *e )
+{
+	for ( ; p + 8 <= e; p += 8 ) {
+		h ^= xxh_round( 0, xxh_get64( p ));
+		h = XXH_ROTL( h, 27 ) * XXH_PRIME1 + XXH_PRIME4;
+	}
+	if ( p + 4 <= e ) {
+		h ^= ( (unsigned long long)p[0] | (unsigned long long)p[1] << 8 |
+			(unsigned long long)p[2] << 16 |
+			(unsigned long long)p[3] << 24 ) * XXH_PRIME1;
+		h = XXH_ROTL( h, 23 ) * XXH_PRIME2 + XXH_PRIME3;
+		p += 4;
+	}
+	for ( ; p < e; p++ ) {
+		h ^= *p * XXH_PRIME5;
+		h = XXH_ROTL( h, 11 ) * XXH_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static unsigned long long
+xxh_digest( lutil_HASH_CTX *ctx )
+{
+	const unsigned long long *v = ctx->xxh64.v;
+	const unsigned char *p = ctx->xxh64.buf;
+	const unsigned char *e = p + ctx->xxh64.len;
+	unsigned long long h;
+
+	if ( ctx->xxh64.total >= sizeof(ctx->xxh64.buf) ) {
+		h = XXH_ROTL( v[0], 1 ) + XXH_ROTL( v[1], 7 ) +
+			XXH_ROTL( v[2], 12 ) + XXH_ROTL( v[3], 18 );
+		h = xxh_merge( h, v[0] );
+		h = xxh_merge( h, v[1] );
+		h = xxh_merge( h, v[2] );
+		h = xxh_merge( h, v[3] );
+	} else {
+		h = ctx->xxh64.v[2] + XXH_PRIME5;
+	}
+	h += ctx->xxh64.total;
+
+	return xxh_tail( h, p, e );
+}
+
+/*
+ * Save hash
+ */
+void
+lutil_XXH64Final( unsigned char digest[LUTIL_HASH64_BYTES], lutil_HASH_CTX *ctx )
+{
+	unsigned long long h = xxh_digest( ctx );
+
+	PUT64( digest, h );
+}
+
+/*
+ * Restart the hash, seeded with the hash of everything so far.
+ * Values hashed after a common prefix then only pay for their
+ * own length instead of the prefix's, which matters for the
+ * short values typical of index keys.
+ */
+void
+lutil_XXH64Seal( lutil_HASH_CTX *ctx )
+{
+	xxh_init( ctx, xxh_digest( ctx ));
+}
+
+/*
+ * XXH64 version of lutil_HASHWindows
+ */
+void
+lutil_XXH64Windows(
+    lutil_HASH_CTX	*ctx,
+    const unsigned char		*buf,
+    ber_len_t		wlen,
+    ber_len_t		step,
+    ber_len_t		n,
+    unsigned char	*digests )
+{
+	lutil_HASH_CTX wctx;
+	ber_len_t i;
+
+	/* windows shorter than a stripe hashed right after Init or
+	 * Seal never touch the lanes, only the seed */
+	if ( ctx->xxh64.total == 0 && wlen < sizeof(ctx->xxh64.buf) ) {
+		unsigned long long h0 = ctx->xxh64.v[2] + XXH_PRIME5 + wlen, h;
+
+		for ( i = 0; i < n; i++ ) {
+			h = xxh_tail( h0, &buf[i * step], &buf[i * step + wlen] );
+			PUT64( digests, h );
+			digests += 8;
+		}
+		return;
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		wctx = *ctx;
+		lutil_XXH64Update( &wctx, &buf[i * step], wlen );
+		lutil_XXH64Final( digests, &wctx );
+		digests += 8;
+	}
+}
 #endif /* HAVE_LONG_LONG */
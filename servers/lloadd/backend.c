@@ -268,10 +268,162 @@ fail:
     epoch_leave( epoch );
 }
 
+/*
+ * Upstream connection pool autoscaling.
+ *
+ * When max-numconns is configured, the regular connection pool is kept
+ * between numconns and max-numconns connections, b_target_numconns being the
+ * current size we aim for. We grow the pool by one connection when:
+ * - none of the connections could take a request
+ * - pending operations reach 3/4 of the pool's capacity (conn-max-pending)
+ * - the average response time exceeds latency-threshold
+ *
+ * and shrink it by one when pending operations stay under 1/4 of what the
+ * smaller pool could handle, the latency is back under the threshold and
+ * nothing has changed for LLOAD_AUTOSCALE_SHRINK_DELAY seconds.
+ *
+ * Bind connections are not affected.
+ */
+static int
+backend_autoscale_busy( LloadBackend *b, int num, int den )
+{
+    if ( b->b_latency_threshold &&
+            b->b_latency * num > (unsigned long)b->b_latency_threshold * 1000 * den ) {
+        return 1;
+    }
+    if ( b->b_max_conn_pending ) {
+        return b->b_n_ops_executing * den >=
+                (long)b->b_active * b->b_max_conn_pending * num;
+    }
+    return 0;
+}
+
+/*
+ * Called holding b->b_mutex when dispatching a request over the regular
+ * connection pool.
+ */
+static void
+backend_autoscale_up( LloadBackend *b, int saturated )
+{
+    time_t now;
+
+    assert_locked( &b->b_mutex );
+    if ( !b->b_max_numconns || b->b_target_numconns >= b->b_max_numconns ) {
+        return;
+    }
+
+    /* Still waiting for the last connection we asked for */
+    if ( b->b_active < b->b_target_numconns ) {
+        return;
+    }
+
+    if ( !saturated && !backend_autoscale_busy( b, 3, 4 ) ) {
+        return;
+    }
+
+    now = slap_get_time();
+    if ( now - b->b_last_scaled < LLOAD_AUTOSCALE_INTERVAL ) {
+        return;
+    }
+    b->b_last_scaled = now;
+    b->b_target_numconns++;
+
+    Debug( LDAP_DEBUG_CONNS, "backend_autoscale_up: "
+            "backend %s %s, growing pool to %d connections\n",
+            b->b_uri.bv_val, saturated ? "saturated" : "busy",
+            b->b_target_numconns );
+    backend_retry( b );
+}
+
+static void
+backend_autoscale_down( LloadBackend *b )
+{
+    LloadConnection *c, *victim = NULL;
+    long victim_ops = 0;
+    int busy, gentle = 1;
+    time_t now;
+
+    checked_lock( &b->b_mutex );
+    if ( !b->b_max_numconns || b->b_target_numconns <= b->b_numconns ||
+            b->b_active < b->b_target_numconns ) {
+        goto done;
+    }
+
+    /* Would the pool still cope with one connection less? */
+    b->b_active--;
+    if ( b->b_max_conn_pending || b->b_latency_threshold ) {
+        busy = backend_autoscale_busy( b, 1, 4 );
+    } else {
+        /* No metric to go by, only shrink once completely idle */
+        busy = ( b->b_n_ops_executing != 0 );
+    }
+    b->b_active++;
+
+    now = slap_get_time();
+    if ( busy ) {
+        b->b_last_busy = now;
+        goto done;
+    }
+    if ( now - b->b_last_scaled < LLOAD_AUTOSCALE_SHRINK_DELAY ||
+            now - b->b_last_busy < LLOAD_AUTOSCALE_SHRINK_DELAY ) {
+        goto done;
+    }
+
+    LDAP_CIRCLEQ_FOREACH ( c, &b->b_conns, c_next ) {
+        CONNECTION_LOCK(c);
+        if ( c->c_state == LLOAD_C_READY && IS_ALIVE( c, c_live ) &&
+                ( !victim || c->c_n_ops_executing < victim_ops ) ) {
+            victim = c;
+            victim_ops = c->c_n_ops_executing;
+        }
+        CONNECTION_UNLOCK(c);
+    }
+    if ( !victim || !acquire_ref( &victim->c_refcnt ) ) {
+        goto done;
+    }
+
+    b->b_last_scaled = now;
+    b->b_target_numconns--;
+    Debug( LDAP_DEBUG_CONNS, "backend_autoscale_down: "
+            "backend %s idle, shrinking pool to %d connections, closing "
+            "connid=%lu\n",
+            b->b_uri.bv_val, b->b_target_numconns, victim->c_connid );
+    checked_unlock( &b->b_mutex );
+
+    lload_connection_close( victim, &gentle );
+    RELEASE_REF( victim, c_refcnt, victim->c_destroy );
+    return;
+
+done:
+    checked_unlock( &b->b_mutex );
+}
+
+void
+backends_autoscale( evutil_socket_t s, short what, void *arg )
+{
+    LloadBackend *b;
+    epoch_t epoch;
+
+    epoch = epoch_join();
+    LDAP_CIRCLEQ_FOREACH ( b, &backend, b_next ) {
+        backend_autoscale_down( b );
+    }
+    epoch_leave( epoch );
+}
+
 LloadConnection *
 backend_select( LloadOperation *op, int *res )
 {
     LloadBackend *b, *first, *next;
+    int client_tid = -1;
+
+    if ( lload_features & LLOAD_FEATURE_IO_AFFINITY ) {
+        checked_lock( &op->o_link_mutex );
+        if ( op->o_client ) {
+            client_tid = LLOAD_DAEMON_ID( op->o_client->c_fd );
+        }
+        checked_unlock( &op->o_link_mutex );
+    }
 
     checked_lock( &backend_mutex );
     first = b = current_backend;
@@ -288,6 +440,7 @@ backend_select( LloadOperation *op, int *res )
     do {
         lload_c_head *head;
         LloadConnection *c;
+        int local;
 
         checked_lock( &b->b_mutex );
         next = LDAP_CIRCLEQ_LOOP_NEXT( &backend, b, b_next );
@@ -315,7 +468,17 @@ backend_select( LloadOperation *op, int *res )
             *res = LDAP_BUSY;
         }
 
+        /*
+         * With I/O affinity, try the connections serviced by the client's own
+         * I/O thread first and only hand the request over to another thread
+         * if none of those can take it.
+         */
+        local = ( client_tid >= 0 );
+retry:
         LDAP_CIRCLEQ_FOREACH ( c, head, c_next ) {
+            if ( local && LLOAD_DAEMON_ID( c->c_fd ) != client_tid ) {
+                continue;
+            }
             checked_lock( &c->c_io_mutex );
             CONNECTION_LOCK(c);
             if ( c->c_state == LLOAD_C_READY && !c->c_pendingber &&
@@ -349,6 +512,9 @@ backend_select( LloadOperation *op, int *res )
                 c->c_n_ops_executing++;
                 c->c_counters.lc_ops_received++;
 
+                if ( head == &b->b_conns ) {
+                    backend_autoscale_up( b, 0 );
+                }
                 checked_unlock( &b->b_mutex );
                 *res = LDAP_SUCCESS;
                 CONNECTION_ASSERT_LOCKED(c);
@@ -358,6 +524,14 @@ backend_select( LloadOperation *op, int *res )
             CONNECTION_UNLOCK(c);
             checked_unlock( &c->c_io_mutex );
         }
+        if ( local ) {
+            local = 0;
+            goto retry;
+        }
+        if ( head == &b->b_conns && !LDAP_CIRCLEQ_EMPTY( head ) ) {
+            /* None of the connections could take the request */
+            backend_autoscale_up( b, 1 );
+        }
         checked_unlock( &b->b_mutex );
 
         b = next;
@@ -382,7 +556,7 @@ backend_retry( LloadBackend *b )
     }
     assert_locked( &b->b_mutex );
 
-    requested = b->b_numconns;
+    requested = b->b_target_numconns;
 #ifdef LDAP_API_FEATURE_VERIFY_CREDENTIALS
     if ( !(lload_features & LLOAD_FEATURE_VC) )
 #endif /* LDAP_API_FEATURE_VERIFY_CREDENTIALS */
@@ -670,7 +844,7 @@ lload_backend_destroy( LloadBackend *b )
             b->b_uri.bv_val, b->b_numconns, b->b_numbindconns );
 
     checked_lock( &b->b_mutex );
-    b->b_numconns = b->b_numbindconns = 0;
+    b->b_numconns = b->b_numbindconns = b->b_target_numconns = 0;
     backend_reset( b, 0 );
 
     LDAP_CIRCLEQ_REMOVE( &backend, b, b_next );
@@ -107,6 +107,7 @@ request_process( LloadConnection *client, LloadOperation *op )
     op->o_upstream = upstream;
     op->o_upstream_connid = upstream->c_connid;
     op->o_res = LLOAD_OP_FAILED;
+    gettimeofday( &op->o_forwarded, NULL );
 
     /* Was it unlinked in the meantime? No need to send a response since the
      * client is dead */
@@ -183,16 +184,23 @@ request_process( LloadConnection *client, LloadOperation *op )
         }
 
         ber_printf( output, /* "{{" */ "}}" );
+        rc = 1;
     } else {
-        ber_printf( output, "t{titOtO}", LDAP_TAG_MESSAGE,
-                LDAP_TAG_MSGID, msgid,
-                op->o_tag, &op->o_request,
-                LDAP_TAG_CONTROLS, BER_BV_OPTIONAL( &op->o_ctrls ) );
+        rc = connection_forward_pdu(
+                upstream, msgid, op->o_tag, &op->o_request, &op->o_ctrls );
     }
     checked_unlock( &upstream->c_io_mutex );
 
-    connection_write_cb( -1, 0, upstream );
-    return rc;
+    if ( rc < 0 ) {
+        Debug( LDAP_DEBUG_ANY, "request_process: "
+                "failed to queue request for upstream connid=%lu\n",
+                op->o_upstream_connid );
+        goto fail;
+    }
+    if ( rc > 0 ) {
+        connection_write_cb( -1, 0, upstream );
+    }
+    return LDAP_SUCCESS;
 
 fail:
     if ( upstream ) {
@@ -178,6 +178,8 @@ enum {
     CFG_MAX_PENDING_CONNS,
     CFG_STARTTLS,
     CFG_CLIENT_PENDING,
+    CFG_MAX_NUMCONNS,
+    CFG_LATENCY_THRESHOLD,
 
     CFG_LAST
 };
@@ -611,7 +613,7 @@ static ConfigTable config_back_cf_table[] = {
         &config_generic,
         "( OLcfgBkAt:13.26 "
             "NAME 'olcBkLloadIOTimeout' "
-            "DESC 'I/O timeout threshold in miliseconds' "
+            "DESC 'I/O timeout threshold in milliseconds' "
             "EQUALITY integerMatch "
             "SYNTAX OMsInteger "
             "SINGLE-VALUE )",
@@ -708,6 +710,28 @@ static ConfigTable config_back_cf_table[] = {
             "SINGLE-VALUE )",
         NULL, NULL
     },
+    { "", NULL, 2, 2, 0,
+        ARG_UINT|ARG_MAGIC|CFG_MAX_NUMCONNS,
+        &backend_cf_gen,
+        "( OLcfgBkAt:13.36 "
+            "NAME 'olcBkLloadMaxNumconns' "
+            "DESC 'Maximum number of regular connections when autoscaling' "
+            "EQUALITY integerMatch "
+            "SYNTAX OMsInteger "
+            "SINGLE-VALUE )",
+        NULL, NULL
+    },
+    { "", NULL, 2, 2, 0,
+        ARG_UINT|ARG_MAGIC|CFG_LATENCY_THRESHOLD,
+        &backend_cf_gen,
+        "( OLcfgBkAt:13.37 "
+            "NAME 'olcBkLloadLatencyThreshold' "
+            "DESC 'Average response time in milliseconds to trigger autoscaling' "
+            "EQUALITY integerMatch "
+            "SYNTAX OMsInteger "
+            "SINGLE-VALUE )",
+        NULL, NULL
+    },
 #endif /* BALANCER_MODULE */
 
     { NULL, NULL, 0, 0, 0, ARG_IGNORED, NULL }
@@ -764,6 +788,8 @@ static ConfigOCs lloadocs[] = {
             "$ olcBkLloadMaxPendingOps "
             "$ olcBkLloadMaxPendingConns ) "
         "MAY ( olcBkLloadStartTLS "
+            "$ olcBkLloadMaxNumconns "
+            "$ olcBkLloadLatencyThreshold "
         ") )",
         Cft_Misc, config_back_cf_table,
         lload_backend_ldadd,
@@ -1007,6 +1033,25 @@ lload_backend_finish( ConfigArgs *ca )
         goto fail;
     }
 
+    if ( b->b_max_numconns && b->b_max_numconns < b->b_numconns ) {
+        Debug( LDAP_DEBUG_ANY, "lload_backend_finish: "
+                "max-numconns must not be lower than numconns\n" );
+        goto fail;
+    }
+
+    if ( b->b_latency_threshold < 0 ) {
+        Debug( LDAP_DEBUG_ANY, "lload_backend_finish: "
+                "invalid latency threshold configuration\n" );
+        goto fail;
+    }
+
+    /* Keep the autoscaled pool size within the configured bounds */
+    if ( !b->b_max_numconns || b->b_target_numconns < b->b_numconns ) {
+        b->b_target_numconns = b->b_numconns;
+    } else if ( b->b_target_numconns > b->b_max_numconns ) {
+        b->b_target_numconns = b->b_max_numconns;
+    }
+
     if ( b->b_retry_timeout < 0 ) {
         Debug( LDAP_DEBUG_ANY, "lload_backend_finish: "
                 "invalid retry timeout configuration\n" );
@@ -1857,6 +1902,7 @@ config_feature( ConfigArgs *c )
 #endif /* LDAP_API_FEATURE_VERIFY_CREDENTIALS */
         { BER_BVC("proxyauthz"), LLOAD_FEATURE_PROXYAUTHZ },
         { BER_BVC("read_pause"), LLOAD_FEATURE_PAUSE },
+        { BER_BVC("io_affinity"), LLOAD_FEATURE_IO_AFFINITY },
         { BER_BVNULL, 0 }
     };
     slap_mask_t mask = 0;
@@ -2758,6 +2804,8 @@ static slap_cf_aux_table backendkey[] = {
 
     { BER_BVC("max-pending-ops="), offsetof(LloadBackend, b_max_pending), 'i', 0, NULL },
     { BER_BVC("conn-max-pending="), offsetof(LloadBackend, b_max_conn_pending), 'i', 0, NULL },
+    { BER_BVC("max-numconns="), offsetof(LloadBackend, b_max_numconns), 'i', 0, NULL },
+    { BER_BVC("latency-threshold="), offsetof(LloadBackend, b_latency_threshold), 'i', 0, NULL },
     { BER_BVC("starttls="), offsetof(LloadBackend, b_tls_conf), 'i', 0, tlskey },
     { BER_BVNULL, 0, 0, 0, NULL }
 };
@@ -3601,6 +3649,20 @@ backend_cf_gen( ConfigArgs *c )
             case CFG_MAX_PENDING_OPS:
                 c->value_uint = b->b_max_pending;
                 break;
+            case CFG_MAX_NUMCONNS:
+                if ( !b->b_max_numconns ) {
+                    rc = 1;
+                    break;
+                }
+                c->value_uint = b->b_max_numconns;
+                break;
+            case CFG_LATENCY_THRESHOLD:
+                if ( !b->b_latency_threshold ) {
+                    rc = 1;
+                    break;
+                }
+                c->value_uint = b->b_latency_threshold;
+                break;
             case CFG_STARTTLS:
                 enum_to_verb( tlskey, b->b_tls_conf, &c->value_bv );
                 break;
@@ -3617,6 +3679,14 @@ backend_cf_gen( ConfigArgs *c )
             case CFG_STARTTLS:
                 b->b_tls_conf = LLOAD_CLEARTEXT;
                 break;
+            case CFG_MAX_NUMCONNS:
+                /* Autoscaling switched off, shrink back to numconns */
+                b->b_max_numconns = 0;
+                flag = LLOAD_BACKEND_MOD_CONNS;
+                goto done;
+            case CFG_LATENCY_THRESHOLD:
+                b->b_latency_threshold = 0;
+                break;
             default:
                 break;
         }
@@ -3663,6 +3733,13 @@ backend_cf_gen( ConfigArgs *c )
         case CFG_MAX_PENDING_OPS:
             b->b_max_pending = c->value_uint;
             break;
+        case CFG_MAX_NUMCONNS:
+            b->b_max_numconns = c->value_uint;
+            flag = LLOAD_BACKEND_MOD_CONNS;
+            break;
+        case CFG_LATENCY_THRESHOLD:
+            b->b_latency_threshold = c->value_uint;
+            break;
         case CFG_STARTTLS: {
             int i = bverb_to_mask( &c->value_bv, tlskey );
             if ( BER_BVISNULL( &tlskey[i].word ) ) {
@@ -3677,6 +3754,7 @@ backend_cf_gen( ConfigArgs *c )
             break;
     }
 
+done:
     /* do not set this if it has already been set by another callback, e.g.
      * lload_backend_ldadd */
     if ( lload_change.type == LLOAD_CHANGE_UNDEFINED ) {
@@ -36,6 +36,10 @@
 #include <ac/time.h>
 #include <ac/unistd.h>
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #include "lload.h"
 
 #include "lutil.h"
@@ -64,6 +68,10 @@ lload_connection_assign_nextid( LloadConnection *conn )
  * happen when changing the state or when client is blocked on writing and
  * already has a pdu pending on the same operation, it's their job to make sure
  * we're woken up again.
+ *
+ * With LLOAD_FEATURE_IO_AFFINITY, this is called directly from
+ * connection_read_cb on the connection's own I/O thread rather than from the
+ * thread pool.
  */
 void *
 handle_pdus( void *ctx, void *arg )
@@ -258,6 +266,17 @@ connection_read_cb( evutil_socket_t s, short what, void *arg )
     checked_unlock( &c->c_io_mutex );
     event_del( c->c_read_event );
 
+    if ( lload_features & LLOAD_FEATURE_IO_AFFINITY ) {
+        /*
+         * Run to completion on the I/O thread that owns the connection, the
+         * thread pool is never involved. handle_pdus takes over our
+         * reference and manages its own epoch.
+         */
+        epoch_leave( epoch );
+        handle_pdus( NULL, c );
+        return;
+    }
+
     if ( !lload_conn_max_pdus_per_cycle ||
             ldap_pvt_thread_pool_submit( &connection_pool, handle_pdus, c ) ) {
         /* If we're overloaded or configured as such, process one and resume in
@@ -372,6 +391,183 @@ done:
     epoch_leave( epoch );
 }
 
+static ber_len_t
+pdu_len_size( ber_len_t len )
+{
+    ber_len_t size = 1;
+
+    if ( len >= 0x80 ) {
+        for ( ; len; len >>= 8 ) {
+            size++;
+        }
+    }
+    return size;
+}
+
+static unsigned char *
+pdu_put_len( unsigned char *p, ber_len_t len )
+{
+    ber_len_t size = pdu_len_size( len ) - 1;
+
+    if ( !size ) {
+        *p++ = len;
+        return p;
+    }
+
+    *p++ = 0x80 | size;
+    while ( size-- ) {
+        *p++ = ( len >> ( size * 8 ) ) & 0xffU;
+    }
+    return p;
+}
+
+static ber_len_t
+pdu_tag_size( ber_tag_t tag )
+{
+    ber_len_t size = 1;
+
+    for ( tag >>= 8; tag; tag >>= 8 ) {
+        size++;
+    }
+    return size;
+}
+
+static unsigned char *
+pdu_put_tag( unsigned char *p, ber_tag_t tag )
+{
+    ber_len_t size = pdu_tag_size( tag );
+
+    while ( size-- ) {
+        *p++ = ( tag >> ( size * 8 ) ) & 0xffU;
+    }
+    return p;
+}
+
+/*
+ * Queue an LDAPMessage with the given messageID, protocolOp tag and contents
+ * and (optional) controls contents on the connection, the caller holds
+ * c_io_mutex.
+ *
+ * Only the envelope, messageID and the tag+length headers are encoded here,
+ * the contents are passed through as they are. If there is nothing queued on
+ * the connection yet and it is not using TLS, they are written to the socket
+ * straight from the buffers provided, only what could not be written
+ * immediately is copied into c_pendingber.
+ *
+ * Returns 0 if the PDU has been sent in full, 1 if c_pendingber needs to be
+ * flushed (connection_write_cb) and -1 on failure.
+ */
+int
+connection_forward_pdu(
+        LloadConnection *c,
+        ber_int_t msgid,
+        ber_tag_t tag,
+        struct berval *body,
+        struct berval *ctrls )
+{
+    unsigned char header[64], ctrl_header[16], *p;
+    struct berval parts[4];
+    ber_len_t len, msgid_size = 1, skip = 0;
+    int i, n = 2;
+
+    assert_locked( &c->c_io_mutex );
+    assert( msgid >= 0 );
+
+    while ( msgid_size < sizeof(ber_int_t) &&
+            msgid >= ( 1 << ( msgid_size * 8 - 1 ) ) ) {
+        msgid_size++;
+    }
+
+    len = 2 + msgid_size + pdu_tag_size( tag ) +
+            pdu_len_size( body->bv_len ) + body->bv_len;
+
+    if ( ctrls && !BER_BVISNULL( ctrls ) ) {
+        p = pdu_put_tag( ctrl_header, LDAP_TAG_CONTROLS );
+        p = pdu_put_len( p, ctrls->bv_len );
+
+        parts[2].bv_val = (char *)ctrl_header;
+        parts[2].bv_len = p - ctrl_header;
+        parts[3] = *ctrls;
+        n = 4;
+
+        len += parts[2].bv_len + ctrls->bv_len;
+    }
+
+    p = pdu_put_tag( header, LDAP_TAG_MESSAGE );
+    p = pdu_put_len( p, len );
+    p = pdu_put_tag( p, LDAP_TAG_MSGID );
+    p = pdu_put_len( p, msgid_size );
+    for ( i = msgid_size; i--; ) {
+        *p++ = ( msgid >> ( i * 8 ) ) & 0xffU;
+    }
+    p = pdu_put_tag( p, tag );
+    p = pdu_put_len( p, body->bv_len );
+
+    parts[0].bv_val = (char *)header;
+    parts[0].bv_len = p - header;
+    parts[1] = *body;
+
+#ifdef HAVE_SYS_UIO_H
+    if ( c->c_is_tls == LLOAD_CLEARTEXT && IS_ALIVE( c, c_live ) ) {
+        ber_len_t queued = 0;
+
+        if ( c->c_pendingber ) {
+            ber_get_option(
+                    c->c_pendingber, LBER_OPT_BER_BYTES_TO_WRITE, &queued );
+        }
+
+        if ( !queued ) {
+            struct iovec iov[4];
+            ber_len_t total = 0;
+            ssize_t rc;
+
+            for ( i = 0; i < n; i++ ) {
+                iov[i].iov_base = parts[i].bv_val;
+                iov[i].iov_len = parts[i].bv_len;
+                total += parts[i].bv_len;
+            }
+
+            do {
+                rc = writev( c->c_fd, iov, n );
+            } while ( rc < 0 && sock_errno() == EINTR );
+
+            if ( rc == (ssize_t)total ) {
+                if ( c->c_pendingber ) {
+                    ber_free( c->c_pendingber, 1 );
+                    c->c_pendingber = NULL;
+                }
+                return 0;
+            }
+
+            /* Anything else is left to connection_write_cb, including
+             * reporting errors */
+            if ( rc > 0 ) {
+                skip = rc;
+            }
+        }
+    }
+#endif /* HAVE_SYS_UIO_H */
+
+    if ( c->c_pendingber == NULL &&
+            (c->c_pendingber = ber_alloc()) == NULL ) {
+        return -1;
+    }
+
+    for ( i = 0; i < n; i++ ) {
+        if ( skip >= parts[i].bv_len ) {
+            skip -= parts[i].bv_len;
+            continue;
+        }
+        if ( ber_write( c->c_pendingber, parts[i].bv_val + skip,
+                     parts[i].bv_len - skip, 0 ) < 0 ) {
+            return -1;
+        }
+        skip = 0;
+    }
+
+    return 1;
+}
+
 void
 connection_destroy( LloadConnection *c )
 {
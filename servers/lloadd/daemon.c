@@ -92,6 +92,7 @@ struct event_base *daemon_base = NULL;
 struct evdns_base *dnsbase;
 
 struct event *lload_timeout_event;
+static struct event *lload_autoscale_event;
 
 /*
  * global lload statistics. Not mutex protected to preserve performance -
@@ -103,7 +104,7 @@ lload_global_stats_t lload_stats = {};
 #define SLAPD_LISTEN_BACKLOG 1024
 #endif /* ! SLAPD_LISTEN_BACKLOG */
 
-#define DAEMON_ID(fd) ( fd & lload_daemon_mask )
+#define DAEMON_ID(fd) LLOAD_DAEMON_ID(fd)
 
 #ifdef HAVE_WINSOCK
 ldap_pvt_thread_mutex_t slapd_ws_mutex;
@@ -1340,6 +1341,18 @@ lloadd_daemon( struct event_base *daemon_base )
         event_add( event, lload_timeout_api );
     }
 
+    event = event_new( daemon_base, -1, EV_PERSIST, backends_autoscale, NULL );
+    if ( !event ) {
+        Debug( LDAP_DEBUG_ANY, "lloadd: "
+                "failed to allocate autoscaling event\n" );
+        return -1;
+    }
+    lload_autoscale_event = event;
+    {
+        struct timeval tv = { LLOAD_AUTOSCALE_INTERVAL, 0 };
+        event_add( event, &tv );
+    }
+
     lloadd_inited = 1;
     rc = event_base_dispatch( daemon_base );
     Debug( LDAP_DEBUG_ANY, "lloadd shutdown: "
@@ -1349,13 +1362,16 @@ lloadd_daemon( struct event_base *daemon_base )
     /* shutdown */
     event_base_loopexit( listener_base, 0 );
 
+    event_free( lload_autoscale_event );
+    lload_autoscale_event = NULL;
+
     /* wait for the listener threads to complete */
     destroy_listeners();
 
     /* Mark upstream connections closing and prevent from opening new ones */
     LDAP_CIRCLEQ_FOREACH ( b, &backend, b_next ) {
         checked_lock( &b->b_mutex );
-        b->b_numconns = b->b_numbindconns = 0;
+        b->b_numconns = b->b_numbindconns = b->b_target_numconns = 0;
         backend_reset( b, 1 );
         checked_unlock( &b->b_mutex );
     }
@@ -1524,9 +1540,9 @@ lload_handle_backend_invalidation( LloadChange *change )
             need_open = 1;
         }
 
-        if ( b->b_active > b->b_numconns ) {
-            need_close += b->b_active - b->b_numconns;
-        } else if ( b->b_active < b->b_numconns ) {
+        if ( b->b_active > b->b_target_numconns ) {
+            need_close += b->b_active - b->b_target_numconns;
+        } else if ( b->b_active < b->b_target_numconns ) {
             need_open = 1;
         }
 
@@ -1582,8 +1598,8 @@ lload_handle_backend_invalidation( LloadChange *change )
             assert( diff == 0 );
         }
 
-        if ( b->b_active > b->b_numconns ) {
-            int diff = b->b_active - b->b_numconns;
+        if ( b->b_active > b->b_target_numconns ) {
+            int diff = b->b_active - b->b_target_numconns;
 
             assert( need_close >= diff );
 
@@ -1639,6 +1655,8 @@ lload_handle_global_invalidation( LloadChange *change )
          *   - off: clear c_auth/privileged on each client
          * - read pause (WIP):
          *   - nothing needed?
+         * - I/O affinity:
+         *   - nothing needed, only affects how new PDUs are dispatched
          */
 
         assert( change->target );
@@ -1649,6 +1667,9 @@ lload_handle_global_invalidation( LloadChange *change )
         if ( feature_diff & LLOAD_FEATURE_PAUSE ) {
             feature_diff &= ~LLOAD_FEATURE_PAUSE;
         }
+        if ( feature_diff & LLOAD_FEATURE_IO_AFFINITY ) {
+            feature_diff &= ~LLOAD_FEATURE_IO_AFFINITY;
+        }
         if ( feature_diff & LLOAD_FEATURE_PROXYAUTHZ ) {
             if ( !(lload_features & LLOAD_FEATURE_PROXYAUTHZ) ) {
                 LloadConnection *c;
@@ -82,8 +82,15 @@ LDAP_BEGIN_DECL
 
 #define LLOAD_CONN_MAX_PDUS_PER_CYCLE_DEFAULT 10
 
+/* Upstream pool autoscaling, intervals in seconds */
+#define LLOAD_AUTOSCALE_INTERVAL 1
+#define LLOAD_AUTOSCALE_SHRINK_DELAY 30
+
 #define BER_BV_OPTIONAL( bv ) ( BER_BVISNULL( bv ) ? NULL : ( bv ) )
 
+/* Which I/O thread (event base) services the socket */
+#define LLOAD_DAEMON_ID( fd ) ( (fd) & lload_daemon_mask )
+
 #include <epoch.h>
 
 #define checked_lock( mutex ) \
@@ -175,10 +182,12 @@ typedef enum {
 #endif /* LDAP_API_FEATURE_VERIFY_CREDENTIALS */
     LLOAD_FEATURE_PROXYAUTHZ = 1 << 1,
     LLOAD_FEATURE_PAUSE = 1 << 2,
+    LLOAD_FEATURE_IO_AFFINITY = 1 << 3,
 } lload_features_t;
 
 #define LLOAD_FEATURE_SUPPORTED_MASK ( \
     LLOAD_FEATURE_PROXYAUTHZ | \
+    LLOAD_FEATURE_IO_AFFINITY | \
     0 )
 
 #ifdef BALANCER_MODULE
@@ -239,6 +248,12 @@ struct LloadBackend {
 
     int b_numconns, b_numbindconns;
     int b_bindavail, b_active, b_opening;
+
+    /* Regular connection pool autoscaling, see backend_autoscale() */
+    int b_max_numconns, b_target_numconns;
+    int b_latency_threshold; /* in milliseconds */
+    unsigned long b_latency; /* moving average of response time in us */
+    time_t b_last_scaled, b_last_busy;
     lload_c_head b_conns, b_bindconns, b_preparing;
     LDAP_LIST_HEAD(ConnectingSt, LloadPendingConnection) b_connecting;
     LloadConnection *b_last_conn, *b_last_bindconn;
@@ -457,6 +472,8 @@ struct LloadOperation {
     enum op_result o_res;
     BerElement *o_ber;
     BerValue o_request, o_ctrls;
+
+    struct timeval o_forwarded; /* when the request was sent upstream */
 };
 
 /*
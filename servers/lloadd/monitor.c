@@ -92,6 +92,8 @@ static AttributeDescription *ad_olmPendingConnections;
 static AttributeDescription *ad_olmActiveConnections;
 static AttributeDescription *ad_olmIncomingConnections;
 static AttributeDescription *ad_olmOutgoingConnections;
+static AttributeDescription *ad_olmTargetConnections;
+static AttributeDescription *ad_olmResponseLatency;
 
 static struct {
     char *name;
@@ -198,6 +200,22 @@ static struct {
       "NO-USER-MODIFICATION "
       "USAGE dSAOperation )",
         &ad_olmOutgoingConnections },
+    { "( olmBalancerAttributes:13 "
+      "NAME ( 'olmTargetConnections' ) "
+      "DESC 'monitor number of regular connections the pool is sized for' "
+      "EQUALITY integerMatch "
+      "SYNTAX 1.3.6.1.4.1.1466.115.121.1.27 "
+      "NO-USER-MODIFICATION "
+      "USAGE dSAOperation )",
+        &ad_olmTargetConnections },
+    { "( olmBalancerAttributes:14 "
+      "NAME ( 'olmResponseLatency' ) "
+      "DESC 'monitor average response time in microseconds' "
+      "EQUALITY integerMatch "
+      "SYNTAX 1.3.6.1.4.1.1466.115.121.1.27 "
+      "NO-USER-MODIFICATION "
+      "USAGE dSAOperation )",
+        &ad_olmResponseLatency },
 
     { NULL }
 };
@@ -235,6 +253,8 @@ static struct {
       "$ olmReceivedOps "
       "$ olmCompletedOps "
       "$ olmFailedOps "
+      "$ olmTargetConnections "
+      "$ olmResponseLatency "
       ") )",
         &oc_olmBalancerServer },
 
@@ -719,11 +739,13 @@ lload_monitor_server_update(
     LloadConnection *c;
     LloadPendingConnection *pc;
     ldap_pvt_mp_t active = 0, pending = 0, received = 0, completed = 0,
-                  failed = 0;
+                  failed = 0, target, latency;
     int i;
 
     checked_lock( &b->b_mutex );
     active = b->b_active + b->b_bindavail;
+    target = b->b_target_numconns;
+    latency = b->b_latency;
 
     LDAP_CIRCLEQ_FOREACH ( c, &b->b_preparing, c_next ) {
         pending++;
@@ -771,6 +793,14 @@ lload_monitor_server_update(
     assert( a != NULL );
     UI2BV( &a->a_vals[0], failed );
 
+    a = attr_find( e->e_attrs, ad_olmTargetConnections );
+    assert( a != NULL );
+    UI2BV( &a->a_vals[0], target );
+
+    a = attr_find( e->e_attrs, ad_olmResponseLatency );
+    assert( a != NULL );
+    UI2BV( &a->a_vals[0], latency );
+
     return SLAP_CB_CONTINUE;
 }
 
@@ -814,6 +844,8 @@ lload_monitor_backend_open( BackendDB *be, monitor_subsys_t *ms )
     attr_merge_normalize_one( e, ad_olmReceivedOps, &value, NULL );
     attr_merge_normalize_one( e, ad_olmCompletedOps, &value, NULL );
     attr_merge_normalize_one( e, ad_olmFailedOps, &value, NULL );
+    attr_merge_normalize_one( e, ad_olmTargetConnections, &value, NULL );
+    attr_merge_normalize_one( e, ad_olmResponseLatency, &value, NULL );
 
     rc = mbe->register_entry( e, cb, ms, MONITOR_F_VOLATILE_CH );
 
@@ -690,6 +690,19 @@ operation_update_backend_counters( LloadOperation *op, LloadBackend *b )
     assert( b != NULL );
     if ( op->o_res == LLOAD_OP_COMPLETED ) {
         b->b_counters[stat_type].lc_ops_completed++;
+
+        if ( op->o_forwarded.tv_sec ) {
+            struct timeval now;
+            long sample;
+
+            /* Moving average of response times, feeds autoscaling */
+            gettimeofday( &now, NULL );
+            sample = ( now.tv_sec - op->o_forwarded.tv_sec ) * 1000000 +
+                    ( now.tv_usec - op->o_forwarded.tv_usec );
+            if ( sample > 0 ) {
+                b->b_latency += ( sample - (long)b->b_latency ) / 8;
+            }
+        }
     } else {
         b->b_counters[stat_type].lc_ops_failed++;
     }
@@ -40,6 +40,7 @@ LDAP_BEGIN_DECL
 LDAP_SLAPD_F (void) backend_connect( evutil_socket_t s, short what, void *arg );
 LDAP_SLAPD_F (void *) backend_connect_task( void *ctx, void *arg );
 LDAP_SLAPD_F (void) backend_retry( LloadBackend *b );
+LDAP_SLAPD_F (void) backends_autoscale( evutil_socket_t s, short what, void *arg );
 LDAP_SLAPD_F (LloadConnection *) backend_select( LloadOperation *op, int *res );
 LDAP_SLAPD_F (void) backend_reset( LloadBackend *b, int gentle );
 LDAP_SLAPD_F (void) lload_backend_destroy( LloadBackend *b );
@@ -90,6 +91,7 @@ LDAP_SLAPD_V (ldap_pvt_thread_mutex_t) clients_mutex;
 LDAP_SLAPD_F (void *) handle_pdus( void *ctx, void *arg );
 LDAP_SLAPD_F (void) connection_write_cb( evutil_socket_t s, short what, void *arg );
 LDAP_SLAPD_F (void) connection_read_cb( evutil_socket_t s, short what, void *arg );
+LDAP_SLAPD_F (int) connection_forward_pdu( LloadConnection *c, ber_int_t msgid, ber_tag_t tag, struct berval *body, struct berval *ctrls );
 LDAP_SLAPD_F (int) lload_connection_close( LloadConnection *c, void *arg );
 LDAP_SLAPD_F (LloadConnection *) lload_connection_init( ber_socket_t s, const char *peername, int use_tls );
 LDAP_SLAPD_F (void) connection_destroy( LloadConnection *c );
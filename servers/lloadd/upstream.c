@@ -43,11 +43,11 @@ static void upstream_unlink( LloadConnection *upstream );
 int
 forward_response( LloadConnection *client, LloadOperation *op, BerElement *ber )
 {
-    BerElement *output;
     BerValue response, controls = BER_BVNULL;
     ber_int_t msgid;
     ber_tag_t tag, response_tag;
     ber_len_t len;
+    int rc;
 
     CONNECTION_LOCK(client);
     if ( op->o_client_msgid ) {
@@ -70,24 +70,20 @@ forward_response( LloadConnection *client, LloadOperation *op, BerElement *ber )
             "%s to client connid=%lu request msgid=%d\n",
             lload_msgtype2str( response_tag ), op->o_client_connid, msgid );
 
+    /* Only the messageID is rewritten, response and controls are passed on
+     * from the buffer we received them in */
     checked_lock( &client->c_io_mutex );
-    output = client->c_pendingber;
-    if ( output == NULL && (output = ber_alloc()) == NULL ) {
-        ber_free( ber, 1 );
-        checked_unlock( &client->c_io_mutex );
-        return -1;
-    }
-    client->c_pendingber = output;
-
-    ber_printf( output, "t{titOtO}", LDAP_TAG_MESSAGE,
-            LDAP_TAG_MSGID, msgid,
-            response_tag, &response,
-            LDAP_TAG_CONTROLS, BER_BV_OPTIONAL( &controls ) );
-
+    rc = connection_forward_pdu(
+            client, msgid, response_tag, &response, &controls );
     checked_unlock( &client->c_io_mutex );
 
     ber_free( ber, 1 );
-    connection_write_cb( -1, 0, client );
+    if ( rc < 0 ) {
+        return -1;
+    }
+    if ( rc > 0 ) {
+        connection_write_cb( -1, 0, client );
+    }
     return 0;
 }
 
@@ -628,7 +624,7 @@ upstream_finish( LloadConnection *c )
             b->b_active && b->b_numbindconns ) {
         if ( !b->b_bindavail ) {
             is_bindconn = 1;
-        } else if ( b->b_active >= b->b_numconns &&
+        } else if ( b->b_active >= b->b_target_numconns &&
                 b->b_bindavail < b->b_numbindconns ) {
             is_bindconn = 1;
         }
@@ -829,7 +829,7 @@ dynacl_aci_mask(
 	ACL_INIT(tdeny);
 
 	/* get the aci attribute */
-	at = attr_find( e->e_attrs, ad );
+	at = entry_attr_find( e, ad );
 	if ( at != NULL ) {
 		int		i;
 
@@ -230,7 +230,10 @@ slap_access_allowed(
 			state->as_fe_done--;
 		ACL_PRIV_ASSIGN( mask, state->as_vd_mask );
 	} else {
+		AclDnCache *dc = state->as_dncache;
+
 		*state = state_init;
+		state->as_dncache = dc;
 
 		a = NULL;
 		count = 0;
@@ -489,6 +492,446 @@ done:
 }
 
 
+/* The suffixes of an entry DN, by number of RDNs */
+#define ACL_DN_MAXDEPTH	32
+typedef struct AclDnSuffix {
+	int		ds_n;	/* RDNs in the DN, ACL_DN_TOODEEP if too many */
+	ber_len_t	ds_len[ACL_DN_MAXDEPTH + 1];
+	unsigned	ds_hash[ACL_DN_MAXDEPTH + 1];
+} AclDnSuffix;
+
+#define ACL_DN_TOODEEP	(-2)
+
+static unsigned
+acl_dn_hashstr( const char *s, ber_len_t len )
+{
+	unsigned h = 2166136261U;	/* FNV-1a */
+
+	while ( len-- ) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static int
+acl_dn_suffixes( struct berval *ndn, ber_len_t *len, unsigned *hash )
+{
+	struct berval dn = *ndn, sfx[ACL_DN_MAXDEPTH + 1];
+	int i, n = 0;
+
+	while ( !BER_BVISEMPTY( &dn ) ) {
+		if ( n == ACL_DN_MAXDEPTH )
+			return ACL_DN_TOODEEP;
+		sfx[n++] = dn;
+		dnParent( &dn, &dn );
+	}
+	if ( len ) {
+		len[0] = 0;
+		hash[0] = acl_dn_hashstr( "", 0 );
+		for ( i = 1; i <= n; i++ ) {
+			len[i] = sfx[n - i].bv_len;
+			hash[i] = acl_dn_hashstr( sfx[n - i].bv_val, len[i] );
+		}
+	}
+	return n;
+}
+
+/*
+ * acl_dn_prepare - precompute what's needed to reject entries
+ * without a full match of the "to dn" part of acl a:
+ * - the number of RDNs and a hash of a non-regex pattern, compared
+ *   against the suffix of the entry DN with that many RDNs;
+ * - the literal characters a regex anchored with $ must end with.
+ */
+void
+acl_dn_prepare( AccessControl *a )
+{
+	char *p;
+
+	a->acl_dn_nrdns = -1;
+	BER_BVZERO( &a->acl_dn_tail );
+
+	if ( a->acl_dn_style != ACL_STYLE_REGEX ) {
+		a->acl_dn_nrdns = acl_dn_suffixes( &a->acl_dn_pat, NULL, NULL );
+		if ( a->acl_dn_nrdns >= 0 )
+			a->acl_dn_hash = acl_dn_hashstr( a->acl_dn_pat.bv_val,
+				a->acl_dn_pat.bv_len );
+		else
+			a->acl_dn_nrdns = -1;
+		return;
+	}
+
+	if ( a->acl_dn_pat.bv_len < 2 ||
+		a->acl_dn_pat.bv_val[a->acl_dn_pat.bv_len - 1] != '$' ||
+		a->acl_dn_pat.bv_val[a->acl_dn_pat.bv_len - 2] == '\\' ||
+		strchr( a->acl_dn_pat.bv_val, '|' ) != NULL )
+		return;
+
+	for ( p = &a->acl_dn_pat.bv_val[a->acl_dn_pat.bv_len - 2];
+		p >= a->acl_dn_pat.bv_val; p-- )
+	{
+		if ( strchr( "\\.[]()*+?{}^$", *p ) != NULL ) {
+			/* the character after a backslash may be special */
+			if ( *p == '\\' )
+				p++;
+			break;
+		}
+	}
+	p++;
+	if ( p < &a->acl_dn_pat.bv_val[a->acl_dn_pat.bv_len - 1] ) {
+		a->acl_dn_tail.bv_val = p;
+		a->acl_dn_tail.bv_len = &a->acl_dn_pat.bv_val[a->acl_dn_pat.bv_len - 1] - p;
+	}
+}
+
+/*
+ * ACL index
+ *
+ * The ACLs of a list whose "to dn" clause is a DN, rather than a
+ * regex, are hashed by that DN.  The ACLs that can select an entry
+ * are then those hashed under one of the suffixes of its DN, plus
+ * those that may select any entry.  slap_acl_get() merges their
+ * positions in ascending order and skips everything else, so the
+ * first matching ACL is the same as with a full walk of the list.
+ *
+ * The index hangs off the first ACL of a list.  It's built again
+ * whenever the list changes, which only happens at startup or with
+ * the server paused, so readers never see it change or go away.
+ */
+typedef struct AclIndexSlot {
+	AccessControl	*is_acl;	/* first ACL with this DN, NULL if free */
+	int		is_n;
+	int		*is_pos;
+} AclIndexSlot;
+
+typedef struct AclIndex {
+	int		ai_nacl;
+	AccessControl	**ai_acls;	/* by position */
+	int		*ai_any;	/* positions of the ACLs without a DN */
+	unsigned	ai_mask;
+	AclIndexSlot	*ai_slots;
+} AclIndex;
+
+/* Position lists are ascending and end with ai_nacl */
+typedef struct AclIndexCursor {
+	int		ic_n;
+	const int	*ic_pos[ACL_DN_MAXDEPTH + 2];
+} AclIndexCursor;
+
+#define ACL_INDEXED(a)	( (a)->acl_dn_style != ACL_STYLE_REGEX && \
+	(a)->acl_dn_nrdns >= 0 )
+
+static AclIndexSlot *
+acl_index_slot( AclIndex *ai, unsigned hash, const char *dn, ber_len_t len )
+{
+	unsigned h = hash & ai->ai_mask;
+
+	while ( ai->ai_slots[h].is_acl ) {
+		AccessControl *a = ai->ai_slots[h].is_acl;
+
+		if ( a->acl_dn_hash == hash && a->acl_dn_pat.bv_len == len &&
+			memcmp( a->acl_dn_pat.bv_val, dn, len ) == 0 )
+			break;
+		h = ( h + 1 ) & ai->ai_mask;
+	}
+	return &ai->ai_slots[h];
+}
+
+static AclIndex *
+acl_index_build( AccessControl *head )
+{
+	AclIndex *ai;
+	AccessControl *a;
+	AclIndexSlot *slot;
+	unsigned size;
+	int i, n, nindexed, nany, *pos;
+
+	for ( n = 0, nindexed = 0, a = head; a; a = a->acl_next, n++ ) {
+		if ( ACL_INDEXED( a ))
+			nindexed++;
+	}
+
+	/* keep the table at most half full */
+	for ( size = 16; size < 2U * nindexed; size <<= 1 )
+		;
+
+	/* each list needs room for its terminator, there are at most
+	 * nindexed lists of DNs plus the list of other ACLs */
+	ai = ch_calloc( 1, sizeof(AclIndex) + size * sizeof(AclIndexSlot)
+		+ n * sizeof(AccessControl *)
+		+ ( n + nindexed + 1 ) * sizeof(int) );
+	ai->ai_nacl = n;
+	ai->ai_mask = size - 1;
+	ai->ai_slots = (AclIndexSlot *)(ai+1);
+	ai->ai_acls = (AccessControl **)(ai->ai_slots + size);
+	pos = (int *)(ai->ai_acls + n);
+
+	/* count the ACLs under each DN */
+	for ( i = 0, nany = 0, a = head; a; a = a->acl_next, i++ ) {
+		a->acl_pos = i;
+		ai->ai_acls[i] = a;
+		if ( ACL_INDEXED( a )) {
+			slot = acl_index_slot( ai, a->acl_dn_hash,
+				a->acl_dn_pat.bv_val, a->acl_dn_pat.bv_len );
+			if ( !slot->is_acl )
+				slot->is_acl = a;
+			slot->is_n++;
+		} else {
+			nany++;
+		}
+	}
+
+	/* carve the position lists */
+	ai->ai_any = pos;
+	pos += nany + 1;
+	for ( i = 0; i < size; i++ ) {
+		slot = &ai->ai_slots[i];
+		if ( slot->is_acl ) {
+			slot->is_pos = pos;
+			pos += slot->is_n + 1;
+			slot->is_n = 0;
+		}
+	}
+
+	/* fill them in list order */
+	for ( i = 0, nany = 0; i < n; i++ ) {
+		a = ai->ai_acls[i];
+		if ( ACL_INDEXED( a )) {
+			slot = acl_index_slot( ai, a->acl_dn_hash,
+				a->acl_dn_pat.bv_val, a->acl_dn_pat.bv_len );
+			slot->is_pos[slot->is_n++] = i;
+		} else {
+			ai->ai_any[nany++] = i;
+		}
+	}
+	ai->ai_any[nany] = n;
+	for ( i = 0; i < size; i++ ) {
+		slot = &ai->ai_slots[i];
+		if ( slot->is_acl )
+			slot->is_pos[slot->is_n] = n;
+	}
+
+	return ai;
+}
+
+/*
+ * Must be called whenever the list starting at head changes, before
+ * the server starts or with it paused.  An ACL that used to be first
+ * may still hold an index, drop them all.
+ */
+void
+acl_index_rebuild( AccessControl *head )
+{
+	AccessControl *a;
+
+	for ( a = head; a; a = a->acl_next ) {
+		if ( a->acl_index ) {
+			ch_free( a->acl_index );
+			a->acl_index = NULL;
+		}
+	}
+	if ( head )
+		head->acl_index = acl_index_build( head );
+}
+
+/*
+ * Set up ic to walk the ACLs of the list starting with head that can
+ * select the entry whose DN suffixes are in sfx, from ACL a on.
+ * Returns NULL if the list must be walked in full.
+ */
+static AclIndex *
+acl_index_open(
+	AclIndexCursor	*ic,
+	AccessControl	*head,
+	AccessControl	*a,
+	Entry		*e,
+	AclDnSuffix	*sfx )
+{
+	AclIndex *ai;
+	AclIndexSlot *slot;
+	int k;
+
+	ic->ic_n = 0;
+	if ( a == NULL || sfx->ds_n < 0 )
+		return NULL;
+
+	ai = head->acl_index;
+	/* a must be on the list the index was built from */
+	if ( ai == NULL || a->acl_pos < 0 || a->acl_pos >= ai->ai_nacl ||
+		ai->ai_acls[a->acl_pos] != a )
+		return NULL;
+
+	ic->ic_pos[ic->ic_n++] = ai->ai_any;
+	for ( k = 0; k <= sfx->ds_n; k++ ) {
+		slot = acl_index_slot( ai, sfx->ds_hash[k], e->e_ndn +
+			e->e_nname.bv_len - sfx->ds_len[k], sfx->ds_len[k] );
+		if ( slot->is_acl )
+			ic->ic_pos[ic->ic_n++] = slot->is_pos;
+	}
+
+	return ai;
+}
+
+/* The position of the first ACL at or after pos that can select the entry */
+static int
+acl_index_next( AclIndexCursor *ic, int pos, int nacl )
+{
+	int i, next = nacl;
+
+	for ( i = 0; i < ic->ic_n; i++ ) {
+		while ( *ic->ic_pos[i] < pos )
+			ic->ic_pos[i]++;
+		if ( *ic->ic_pos[i] < next )
+			next = *ic->ic_pos[i];
+	}
+	return next;
+}
+
+/*
+ * acl_dn_match - does the "to dn" part of acl a select entry e?
+ */
+static int
+acl_dn_match(
+	AccessControl	*a,
+	Entry		*e,
+	AclDnSuffix	*sfx,
+	AclRegexMatches	*matches,
+	int		count )
+{
+	ber_len_t dnlen = e->e_nname.bv_len;
+
+	if ( a->acl_dn_style == ACL_STYLE_REGEX ) {
+		Debug( LDAP_DEBUG_ACL, "=> dnpat: [%d] %s nsub: %d\n", 
+			count, a->acl_dn_pat.bv_val, (int) a->acl_dn_re.re_nsub );
+		if ( a->acl_dn_tail.bv_len && ( dnlen < a->acl_dn_tail.bv_len ||
+			strncasecmp( e->e_ndn + dnlen - a->acl_dn_tail.bv_len,
+				a->acl_dn_tail.bv_val, a->acl_dn_tail.bv_len )))
+			return 0;
+		if ( regexec ( &a->acl_dn_re, 
+			       e->e_ndn, 
+		 	       matches->dn_count, 
+			       matches->dn_data, 0 ) )
+			return 0;
+
+	} else {
+		ber_len_t patlen;
+
+		Debug( LDAP_DEBUG_ACL, "=> dn: [%d] %s\n", 
+			count, a->acl_dn_pat.bv_val );
+		patlen = a->acl_dn_pat.bv_len;
+		if ( dnlen < patlen )
+			return 0;
+
+		if ( sfx->ds_n >= 0 && a->acl_dn_nrdns >= 0 ) {
+			int k = a->acl_dn_nrdns;
+
+			if ( k > sfx->ds_n || sfx->ds_len[k] != patlen ||
+				sfx->ds_hash[k] != a->acl_dn_hash )
+				return 0;
+
+			switch ( a->acl_dn_style ) {
+			case ACL_STYLE_BASE:
+				if ( k != sfx->ds_n )
+					return 0;
+				break;
+			case ACL_STYLE_ONE:
+				if ( k != sfx->ds_n - 1 )
+					return 0;
+				break;
+			case ACL_STYLE_CHILDREN:
+				if ( k == sfx->ds_n )
+					return 0;
+				break;
+			default:
+				break;
+			}
+			/* rule out hash collisions */
+			return memcmp( a->acl_dn_pat.bv_val,
+				e->e_ndn + dnlen - patlen, patlen ) == 0;
+		}
+
+		if ( a->acl_dn_style == ACL_STYLE_BASE ) {
+			/* base dn -- entire object DN must match */
+			if ( dnlen != patlen )
+				return 0;
+
+		} else if ( a->acl_dn_style == ACL_STYLE_ONE ) {
+			ber_len_t	rdnlen = 0;
+			ber_len_t	sep = 0;
+
+			if ( dnlen <= patlen )
+				return 0;
+
+			if ( patlen > 0 ) {
+				if ( !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
+					return 0;
+				sep = 1;
+			}
+
+			rdnlen = dn_rdnlen( NULL, &e->e_nname );
+			if ( rdnlen + patlen + sep != dnlen )
+				return 0;
+
+		} else if ( a->acl_dn_style == ACL_STYLE_SUBTREE ) {
+			if ( dnlen > patlen && !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
+				return 0;
+
+		} else if ( a->acl_dn_style == ACL_STYLE_CHILDREN ) {
+			if ( dnlen <= patlen )
+				return 0;
+			if ( !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
+				return 0;
+		}
+
+		if ( strcmp( a->acl_dn_pat.bv_val, e->e_ndn + dnlen - patlen ) != 0 )
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * acl_dncache_matches - keep (store != 0) or get back the submatches
+ * of the dn.regex clause of acl a, the bit-th ACL of the list.
+ * Returns 0 if they couldn't be kept or weren't.
+ */
+static int
+acl_dncache_matches(
+	AclDnCache	*dc,
+	int		bit,
+	AccessControl	*a,
+	AclRegexMatches	*matches,
+	int		store )
+{
+	int i, n = a->acl_dn_re.re_nsub + 1;
+
+	if ( n > matches->dn_count )
+		n = matches->dn_count;
+
+	if ( store ) {
+		dc->dc_moff[bit] = 0;
+		if ( dc->dc_mused + n > ACL_DNCACHE_NMATCH )
+			return 0;
+		AC_MEMCPY( &dc->dc_match[dc->dc_mused], matches->dn_data,
+			n * sizeof(regmatch_t) );
+		dc->dc_moff[bit] = dc->dc_mused + 1;
+		dc->dc_mused += n;
+		return 1;
+	}
+
+	if ( !dc->dc_moff[bit] )
+		return 0;
+	AC_MEMCPY( matches->dn_data, &dc->dc_match[dc->dc_moff[bit] - 1],
+		n * sizeof(regmatch_t) );
+	/* as regexec() leaves them */
+	for ( i = n; i < matches->dn_count; i++ ) {
+		matches->dn_data[i].rm_so = -1;
+		matches->dn_data[i].rm_eo = -1;
+	}
+	return 1;
+}
+
 /*
  * slap_acl_get - return the acl applicable to entry e, attribute
  * attr.  the acl returned is suitable for use in subsequent calls to
@@ -508,8 +951,11 @@ slap_acl_get(
 	AccessControlState *state )
 {
 	const char *attr;
-	ber_len_t dnlen;
-	AccessControl *prev;
+	AccessControl *prev, *head;
+	AclDnCache *dc = state->as_dncache;
+	AclDnSuffix sfx;
+	AclIndex *ai;
+	AclIndexCursor ic;
 
 	assert( e != NULL );
 	assert( count != NULL );
@@ -527,79 +973,85 @@ slap_acl_get(
 			a = op->o_bd->be_acl;
 		}
 		prev = NULL;
+		head = a;
 
 		assert( a != NULL );
 		if ( a == frontendDB->be_acl )
 			state->as_fe_done = 1;
+
+		/* ACLs are numbered from a different list */
+		if ( dc && dc->dc_acl != a ) {
+			memset( dc->dc_tested, 0, sizeof( dc->dc_tested ));
+			memset( dc->dc_matched, 0, sizeof( dc->dc_matched ));
+			dc->dc_mused = 0;
+			dc->dc_acl = a;
+		}
 	} else {
 		prev = a;
 		a = a->acl_next;
+		/* restarting, the same list as in the previous call */
+		if ( state->as_fe_done || op->o_bd == NULL ||
+			op->o_bd->be_acl == NULL )
+			head = frontendDB->be_acl;
+		else
+			head = op->o_bd->be_acl;
 	}
-
-	dnlen = e->e_nname.bv_len;
+	sfx.ds_n = acl_dn_suffixes( &e->e_nname, sfx.ds_len, sfx.ds_hash );
 
  retry:
+	ai = acl_index_open( &ic, head, a, e, &sfx );
 	for ( ; a != NULL; prev = a, a = a->acl_next ) {
+		if ( ai ) {
+			int pos = a->acl_pos,
+				next = acl_index_next( &ic, pos, ai->ai_nacl );
+
+			if ( next > pos ) {
+				/* account for the ACLs that can't select e */
+				*count += next - pos;
+				if ( state->as_fe_done ) {
+					state->as_fe_done += next - pos;
+					if ( pos == 0 && head == frontendDB->be_acl )
+						state->as_fe_done--;
+				}
+				prev = ai->ai_acls[next - 1];
+				if ( next == ai->ai_nacl ) {
+					a = NULL;
+					break;
+				}
+				a = ai->ai_acls[next];
+			}
+		}
+
 		(*count) ++;
 
 		if ( a != frontendDB->be_acl && state->as_fe_done )
 			state->as_fe_done++;
 
 		if ( a->acl_dn_pat.bv_len || ( a->acl_dn_style != ACL_STYLE_REGEX )) {
-			if ( a->acl_dn_style == ACL_STYLE_REGEX ) {
-				Debug( LDAP_DEBUG_ACL, "=> dnpat: [%d] %s nsub: %d\n", 
-					*count, a->acl_dn_pat.bv_val, (int) a->acl_dn_re.re_nsub );
-				if ( regexec ( &a->acl_dn_re, 
-					       e->e_ndn, 
-				 	       matches->dn_count, 
-					       matches->dn_data, 0 ) )
-					continue;
+			int bit = *count - 1, match;
 
-			} else {
-				ber_len_t patlen;
-
-				Debug( LDAP_DEBUG_ACL, "=> dn: [%d] %s\n", 
-					*count, a->acl_dn_pat.bv_val );
-				patlen = a->acl_dn_pat.bv_len;
-				if ( dnlen < patlen )
-					continue;
-
-				if ( a->acl_dn_style == ACL_STYLE_BASE ) {
-					/* base dn -- entire object DN must match */
-					if ( dnlen != patlen )
-						continue;
-
-				} else if ( a->acl_dn_style == ACL_STYLE_ONE ) {
-					ber_len_t	rdnlen = 0;
-					ber_len_t	sep = 0;
-
-					if ( dnlen <= patlen )
-						continue;
+			if ( dc && bit < ACL_DNCACHE_MAX &&
+				( dc->dc_tested[bit >> 3] & ( 1 << ( bit & 7 ))))
+			{
+				match = ( dc->dc_matched[bit >> 3] & ( 1 << ( bit & 7 ))) != 0;
+				/* regex submatches are needed by slap_acl_mask() */
+				if ( match && a->acl_dn_style == ACL_STYLE_REGEX &&
+					!acl_dncache_matches( dc, bit, a, matches, 0 ))
+					match = acl_dn_match( a, e, &sfx, matches, *count );
 
-					if ( patlen > 0 ) {
-						if ( !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
-							continue;
-						sep = 1;
+			} else {
+				match = acl_dn_match( a, e, &sfx, matches, *count );
+				if ( dc && bit < ACL_DNCACHE_MAX ) {
+					dc->dc_tested[bit >> 3] |= 1 << ( bit & 7 );
+					if ( match ) {
+						dc->dc_matched[bit >> 3] |= 1 << ( bit & 7 );
+						if ( a->acl_dn_style == ACL_STYLE_REGEX )
+							acl_dncache_matches( dc, bit, a, matches, 1 );
 					}
-
-					rdnlen = dn_rdnlen( NULL, &e->e_nname );
-					if ( rdnlen + patlen + sep != dnlen )
-						continue;
-
-				} else if ( a->acl_dn_style == ACL_STYLE_SUBTREE ) {
-					if ( dnlen > patlen && !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
-						continue;
-
-				} else if ( a->acl_dn_style == ACL_STYLE_CHILDREN ) {
-					if ( dnlen <= patlen )
-						continue;
-					if ( !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
-						continue;
 				}
-
-				if ( strcmp( a->acl_dn_pat.bv_val, e->e_ndn + dnlen - patlen ) != 0 )
-					continue;
 			}
+			if ( !match )
+				continue;
 
 			Debug( LDAP_DEBUG_ACL, "=> acl_get: [%d] matched\n",
 				*count );
@@ -708,6 +1160,7 @@ slap_acl_get(
 	if ( !state->as_fe_done ) {
 		state->as_fe_done = 1;
 		a = frontendDB->be_acl;
+		head = a;
 		goto retry;
 	}
 
@@ -1037,9 +1490,9 @@ acl_mask_dnattr(
 	bv = *opndn;
 
 	/* see if asker is listed in dnattr */
-	for ( at = attrs_find( e->e_attrs, bdn->a_at );
+	for ( at = entry_attrs_find( e, bdn->a_at );
 		at != NULL;
-		at = attrs_find( at->a_next, bdn->a_at ) )
+		at = entry_attrs_next( e, at, bdn->a_at ) )
 	{
 		if ( attr_valfind( at,
 			SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH |
@@ -2130,7 +2583,7 @@ acl_set_cb_gather( Operation *op, SlapReply *rs )
 			} else {
 				Attribute	*a;
 
-				a = attr_find( rs->sr_entry->e_attrs, desc );
+				a = entry_attr_find( rs->sr_entry, desc );
 				if ( a != NULL ) {
 					bvalsp = a->a_nvals;
 				}
@@ -345,6 +345,7 @@ parse_acl(
 			}
 			a = (AccessControl *) ch_calloc( 1, sizeof(AccessControl) );
 			a->acl_attrval_style = ACL_STYLE_NONE;
+			a->acl_dn_nrdns = -1;
 			for ( ++i; i < argc; i++ ) {
 				if ( strcasecmp( argv[i], "by" ) == 0 ) {
 					i--;
@@ -662,6 +663,7 @@ parse_acl(
 					}
 					free( a->acl_dn_pat.bv_val );
 					a->acl_dn_pat = bv;
+					acl_dn_prepare( a );
 
 				} else {
 					int e = regcomp( &a->acl_dn_re, a->acl_dn_pat.bv_val,
@@ -675,6 +677,7 @@ parse_acl(
 						      fname, lineno, right, err );
 						goto fail;
 					}
+					acl_dn_prepare( a );
 				}
 			}
 
@@ -2298,6 +2301,7 @@ access_append( Access **l, Access *a )
 void
 acl_append( AccessControl **l, AccessControl *a, int pos )
 {
+	AccessControl **head = l;
 	int i;
 
 	for (i=0 ; i != pos && *l != NULL; l = &(*l)->acl_next, i++ ) {
@@ -2306,6 +2310,7 @@ acl_append( AccessControl **l, AccessControl *a, int pos )
 	if ( *l && a )
 		a->acl_next = *l;
 	*l = a;
+	acl_index_rebuild( *head );
 }
 
 static void
@@ -2387,6 +2392,9 @@ acl_free( AccessControl *a )
 		n = a->acl_access->a_next;
 		access_free( a->acl_access );
 	}
+	if ( a->acl_index ) {
+		ch_free( a->acl_index );
+	}
 	free( a );
 }
 
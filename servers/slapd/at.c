@@ -258,6 +258,8 @@ at_delete( AttributeType *at )
 	LDAP_STAILQ_REMOVE(&attr_list, at, AttributeType, sat_next);
 
 	at_delete_names( at );
+	filter_cache_flush();
+	dn_cache_flush();
 }
 
 static void
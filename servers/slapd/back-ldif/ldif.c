@@ -1993,7 +1993,8 @@ ldif_back_initialize( BackendInfo *bi )
 
 	bi->bi_flags |=
 		SLAP_BFLAG_INCREMENT |
-		SLAP_BFLAG_REFERRALS;
+		SLAP_BFLAG_REFERRALS |
+		SLAP_BFLAG_GRADUATE;
 
 	bi->bi_controls = controls;
 
@@ -822,3 +822,231 @@ void mdb_ad_unwind( struct mdb_info *mdb, int prev_ads )
 	}
 	mdb->mi_numads = i;
 }
+
+/* The hash used for index keys is recorded in the ad2i DB under
+ * key 0, which no AttributeDescription uses. It is followed by one
+ * "<attr>=<mask>" string per attribute, giving the index types known
+ * to be complete for it, so a copy of the database can be checked
+ * against the indexes configured where it is loaded. Every string is
+ * NUL terminated.
+ */
+
+/* Look up an attribute's mask in a record, 0 if it has none */
+static slap_mask_t
+mdb_ix_rec_mask( MDB_val *rec, struct berval *name )
+{
+	char *ptr = rec->mv_data, *end = ptr + rec->mv_size;
+	char *next;
+
+	/* skip the hash name */
+	ptr = memchr( ptr, '\0', end - ptr );
+	while ( ptr && ++ptr < end ) {
+		next = memchr( ptr, '\0', end - ptr );
+		if ( !next )
+			break;
+		if ( next - ptr > name->bv_len && ptr[name->bv_len] == '=' &&
+			!strncasecmp( ptr, name->bv_val, name->bv_len ))
+			return strtoul( ptr + name->bv_len + 1, NULL, 16 );
+		ptr = next;
+	}
+	return 0;
+}
+
+/* Write the record. With no previous record, every configured index
+ * is taken to be complete. Otherwise only what both the previous
+ * record and the configuration agree on is kept, except for ai, which
+ * has just been built.
+ */
+static int
+mdb_ix_rec_put( struct mdb_info *mdb, MDB_txn *txn, MDB_val *old,
+	AttrInfo *only )
+{
+	int i = 0, rc;
+	MDB_val key, data;
+	struct berval *name = slap_index_hash_name( slap_index_hash( -1 ));
+	slap_mask_t *masks;
+	ber_len_t len;
+	char *ptr;
+
+	masks = ch_calloc( mdb->mi_nattrs + 1, sizeof(slap_mask_t) );
+	len = name->bv_len + 1;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+
+		if ( ai->ai_indexmask & MDB_INDEX_DELETING )
+			continue;
+		masks[i] = ai->ai_indexmask;
+		if ( old && ai != only )
+			masks[i] &= mdb_ix_rec_mask( old, &ai->ai_desc->ad_cname );
+		if ( masks[i] )
+			len += ai->ai_desc->ad_cname.bv_len + STRLENOF("=ffffffff") + 1;
+	}
+
+	data.mv_data = ptr = ch_malloc( len );
+	ptr = lutil_strcopy( ptr, name->bv_val ) + 1;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		if ( masks[i] ) {
+			ptr += sprintf( ptr, "%s=%lx",
+				mdb->mi_attrs[i]->ai_desc->ad_cname.bv_val,
+				(unsigned long)( masks[i] & 0xffffffffUL )) + 1;
+		}
+	}
+	data.mv_size = ptr - (char *)data.mv_data;
+	ch_free( masks );
+
+	i = 0;
+	key.mv_size = sizeof(int);
+	key.mv_data = &i;
+
+	rc = mdb_put( txn, mdb->mi_ad2id, &key, &data, 0 );
+	ch_free( data.mv_data );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_ix_hash_put: mdb_put failed %s(%d)\n",
+			mdb_strerror(rc), rc );
+	}
+	return rc;
+}
+
+/* All indexes have just been built */
+int mdb_ix_hash_put( struct mdb_info *mdb, MDB_txn *txn )
+{
+	return mdb_ix_rec_put( mdb, txn, NULL, NULL );
+}
+
+/* ai has been indexed online, or with ai NULL, drop whatever is no
+ * longer configured.
+ */
+int mdb_ix_hash_update( struct mdb_info *mdb, MDB_txn *txn, AttrInfo *ai )
+{
+	int i = 0, rc;
+	MDB_val key, data;
+
+	key.mv_size = sizeof(int);
+	key.mv_data = &i;
+
+	rc = mdb_get( txn, mdb->mi_ad2id, &key, &data );
+	if ( rc == MDB_NOTFOUND )
+		return 0;
+	if ( rc == MDB_SUCCESS ) {
+		/* mdb_put may reuse the page data points into */
+		MDB_val old;
+
+		old.mv_size = data.mv_size;
+		old.mv_data = ch_malloc( data.mv_size );
+		AC_MEMCPY( old.mv_data, data.mv_data, data.mv_size );
+		rc = mdb_ix_rec_put( mdb, txn, &old, ai );
+		ch_free( old.mv_data );
+	}
+	return rc;
+}
+
+/* Make sure a copy of a database, opened in txn, was indexed with our
+ * hash and has every index we are configured with.
+ */
+int mdb_ix_hash_match( BackendDB *be, MDB_txn *txn, MDB_dbi ad2i )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	int i = 0, rc;
+	MDB_val key, data;
+	struct berval rec;
+
+	key.mv_size = sizeof(int);
+	key.mv_data = &i;
+
+	rc = mdb_get( txn, ad2i, &key, &data );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_ix_hash_match: database \"%s\": "
+			"copy does not record its indexes.\n",
+			be->be_suffix[0].bv_val );
+		return rc == MDB_NOTFOUND ? LDAP_OTHER : rc;
+	}
+
+	rec.bv_val = data.mv_data;
+	rec.bv_len = data.mv_size;
+	if ( memchr( rec.bv_val, '\0', rec.bv_len ))
+		rec.bv_len = strlen( rec.bv_val );
+	if ( slap_index_hash_find( &rec ) != slap_index_hash( -1 )) {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_ix_hash_match: database \"%s\": "
+			"copy was indexed with %.*s hashing.\n",
+			be->be_suffix[0].bv_val, (int)rec.bv_len, rec.bv_val );
+		return LDAP_OTHER;
+	}
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+		slap_mask_t want = ai->ai_indexmask | ai->ai_newmask;
+
+		want &= ~MDB_INDEX_DELETING & 0xffffffffUL;
+		if ( want & ~mdb_ix_rec_mask( &data, &ai->ai_desc->ad_cname )) {
+			Debug( LDAP_DEBUG_ANY,
+				"mdb_ix_hash_match: database \"%s\": "
+				"copy is not fully indexed for %s.\n",
+				be->be_suffix[0].bv_val, ai->ai_desc->ad_cname.bv_val );
+			return LDAP_OTHER;
+		}
+	}
+	return 0;
+}
+
+/* Make sure the indexes were built with the configured hash. New
+ * databases get the current hash recorded; a mismatch must be fixed
+ * by rebuilding all indexes with slapindex.
+ */
+int mdb_ix_hash_check( BackendDB *be, MDB_txn *txn, ConfigReply *cr )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	int i = 0, rc, alg = -1;
+	MDB_val key, data;
+	MDB_stat st;
+	struct berval rec = BER_BVNULL;
+
+	key.mv_size = sizeof(int);
+	key.mv_data = &i;
+
+	rc = mdb_get( txn, mdb->mi_ad2id, &key, &data );
+	if ( rc == MDB_SUCCESS ) {
+		rec.bv_len = data.mv_size;
+		rec.bv_val = data.mv_data;
+		if ( memchr( rec.bv_val, '\0', rec.bv_len ))
+			rec.bv_len = strlen( rec.bv_val );
+		alg = slap_index_hash_find( &rec );
+	} else if ( rc != MDB_NOTFOUND ) {
+		return rc;
+	}
+
+	rc = mdb_stat( txn, mdb->mi_id2entry, &st );
+	if ( rc )
+		return rc;
+
+	if ( !st.ms_entries )
+		return mdb_ix_hash_put( mdb, txn );
+
+	if ( alg == slap_index_hash( -1 ))
+		return mdb_ix_hash_update( mdb, txn, NULL );
+
+	/* Databases that don't record it were indexed with FNV,
+	 * we can't tell which size so trust the config.
+	 */
+	if ( BER_BVISNULL( &rec ) &&
+		slap_index_hash( -1 ) != SLAP_INDEX_HASH_XXH64 )
+		return mdb_ix_hash_put( mdb, txn );
+
+	if ( BER_BVISNULL( &rec ))
+		ber_str2bv( "fnv", STRLENOF("fnv"), 0, &rec );
+
+	snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+		"indexes were built with %.*s hashing but index_hash is %s, "
+		"run \"slapindex\".",
+		be->be_suffix[0].bv_val, (int)rec.bv_len, rec.bv_val,
+		slap_index_hash_name( slap_index_hash( -1 ))->bv_val );
+	Debug( LDAP_DEBUG_ANY,
+		LDAP_XSTRING(mdb_db_open) ": %s\n",
+		cr->msg );
+	mdb->mi_flags |= MDB_NEED_REHASH;
+	if ( !(slapMode & SLAP_TOOL_READMAIN ))
+		return LDAP_OTHER;
+	return 0;
+}
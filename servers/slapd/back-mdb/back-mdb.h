@@ -103,6 +103,7 @@ struct mdb_info {
 #define	MDB_DEL_INDEX	0x08
 #define	MDB_RE_OPEN		0x10
 #define	MDB_NEED_UPGRADE	0x20
+#define	MDB_NEED_REHASH	0x40
 
 	int mi_numads;
 
@@ -127,6 +128,7 @@ typedef struct mdb_op_info {
 	OpExtra		moi_oe;
 	MDB_txn*	moi_txn;
 	int			moi_ref;
+	int			moi_numads;	/* AttributeDescriptions known before a txn */
 	char		moi_flag;
 } mdb_op_info;
 #define MOI_READER	0x01
@@ -208,7 +208,7 @@ mdb_online_index( void *ctx, void *arg )
 	MDB_txn *txn;
 	ID id;
 	Entry *e;
-	int rc, getnext = 1;
+	int rc = 0, getnext = 1;
 	int i;
 
 	connection_fake_init( &conn, &opbuf, ctx );
@@ -275,6 +275,12 @@ mdb_online_index( void *ctx, void *arg )
 		getnext = 1;
 	}
 
+	/* only record indexes that were actually finished */
+	txn = NULL;
+	if ( !rc && !slapd_shutdown &&
+		mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn ))
+		txn = NULL;
+
 	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
 		if ( mdb->mi_attrs[ i ]->ai_indexmask & MDB_INDEX_DELETING
 			|| mdb->mi_attrs[ i ]->ai_newmask == 0 )
@@ -283,6 +289,16 @@ mdb_online_index( void *ctx, void *arg )
 		}
 		mdb->mi_attrs[ i ]->ai_indexmask = mdb->mi_attrs[ i ]->ai_newmask;
 		mdb->mi_attrs[ i ]->ai_newmask = 0;
+		if ( txn && mdb_ix_hash_update( mdb, txn, mdb->mi_attrs[ i ] )) {
+			mdb_txn_abort( txn );
+			txn = NULL;
+		}
+	}
+	if ( txn && ( rc = mdb_txn_commit( txn ))) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_online_index) ": database %s: "
+			"recording new indexes failed: %s (%d)\n",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
 	}
 
 	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
@@ -357,6 +357,9 @@ mdb_delete( Operation *op, SlapReply *rs )
 				goto return_results;
 			}
 			parent_is_leaf = 1;
+		} else {
+			/* not an error, and checked below when the txn isn't ours */
+			rs->sr_err = 0;
 		}
 		mdb_entry_return( op, p );
 		p = NULL;
@@ -526,6 +526,7 @@ int mdb_entry_return(
 	if ( !e )
 		return 0;
 	if ( e->e_private ) {
+		entry_attr_unindex( e );
 		if ( op->o_hdr && op->o_tmpmfuncs ) {
 			op->o_tmpfree( e->e_nname.bv_val, op->o_tmpmemctx );
 			op->o_tmpfree( e->e_name.bv_val, op->o_tmpmemctx );
@@ -823,16 +824,20 @@ int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 		if ( !rc ) {
 			moi = *moip;
 			moi->moi_flag |= MOI_KEEPER;
+			/* the txn may span several ops, remember which
+			 * AttributeDescriptions to forget if it fails */
+			mdb_ad_read( mdb, moi->moi_txn );
+			moi->moi_numads = mdb->mi_numads;
 		}
 		return rc;
 	case SLAP_TXN_COMMIT:
 		rc = mdb_txn_commit( moi->moi_txn );
 		if ( rc )
-			mdb->mi_numads = 0;
+			mdb_ad_unwind( mdb, moi->moi_numads );
 		op->o_tmpfree( moi, op->o_tmpmemctx );
 		return rc;
 	case SLAP_TXN_ABORT:
-		mdb->mi_numads = 0;
+		mdb_ad_unwind( mdb, moi->moi_numads );
 		mdb_txn_abort( moi->moi_txn );
 		op->o_tmpfree( moi, op->o_tmpmemctx );
 		return 0;
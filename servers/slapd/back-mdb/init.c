@@ -22,6 +22,7 @@
 #include <ac/stdlib.h>
 #include <ac/errno.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include "back-mdb.h"
 #include <lutil.h>
 #include <ldap_rq.h>
@@ -281,6 +282,12 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			mdb_txn_abort( txn );
 			goto fail;
 		}
+
+		rc = mdb_ix_hash_check( be, txn, cr );
+		if ( rc ) {
+			mdb_txn_abort( txn );
+			goto fail;
+		}
 	}
 
 	rc = mdb_txn_commit(txn);
@@ -380,6 +387,157 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 	return 0;
 }
 
+/* A snapshot is a compacted copy of the whole environment. A consumer
+ * stages an incoming copy next to its own data file; it is swapped in
+ * while the server is paused, by closing and reopening the database.
+ */
+#define MDB_SNAPSHOT_FILE	"seed.mdb"
+
+static int
+mdb_db_isempty( struct mdb_info *mdb )
+{
+	MDB_txn *txn;
+	MDB_stat ms;
+	int rc;
+
+	rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &txn );
+	if ( rc == 0 ) {
+		rc = mdb_stat( txn, mdb->mi_id2entry, &ms );
+		mdb_txn_abort( txn );
+	}
+	if ( rc == 0 && ms.ms_entries > 0 )
+		rc = LDAP_ALREADY_EXISTS;
+	return rc;
+}
+
+static int
+mdb_db_snapshot( BackendDB *be, int snapop, int *fd )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	char path[MAXPATHLEN], lpath[MAXPATHLEN + sizeof("-lock")];
+	ConfigReply cr = { 0 };
+	MDB_env *env;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	int i, rc;
+
+	snprintf( path, sizeof(path), "%s" LDAP_DIRSEP MDB_SNAPSHOT_FILE,
+		mdb->mi_dbenv_home );
+
+	switch ( snapop ) {
+	case SLAP_SNAPSHOT_SAVE:
+		rc = mdb_env_copyfd2( mdb->mi_dbenv, *fd, MDB_CP_COMPACT );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_db_snapshot) ": database \"%s\": "
+				"mdb_env_copyfd2 failed: %s (%d).\n",
+				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+		}
+		return rc;
+
+	case SLAP_SNAPSHOT_OPEN:
+		/* only an empty database may be replaced */
+		rc = mdb_db_isempty( mdb );
+		if ( rc )
+			return rc;
+		*fd = open( path, O_WRONLY|O_CREAT|O_TRUNC, mdb->mi_dbenv_mode );
+		if ( *fd < 0 )
+			return errno;
+		return 0;
+
+	case SLAP_SNAPSHOT_LOAD:
+		rc = fsync( *fd );
+		close( *fd );
+		*fd = -1;
+		if ( rc ) {
+			rc = errno;
+			break;
+		}
+
+		/* something may have been written while we were receiving */
+		rc = mdb_db_isempty( mdb );
+		if ( rc )
+			break;
+
+		/* make sure the copy carries every index we are configured with,
+		 * built with our hash, otherwise they would silently be wrong.
+		 */
+		rc = mdb_env_create( &env );
+		if ( rc )
+			break;
+		mdb_env_set_maxdbs( env, MDB_INDICES );
+		rc = mdb_env_open( env, path, MDB_NOSUBDIR|MDB_RDONLY,
+			mdb->mi_dbenv_mode );
+		if ( rc == 0 )
+			rc = mdb_txn_begin( env, NULL, MDB_RDONLY, &txn );
+		if ( rc == 0 ) {
+			for ( i = 0; rc == 0 && mdmi_databases[i].bv_val; i++ )
+				rc = mdb_dbi_open( txn, mdmi_databases[i].bv_val, 0, &dbi );
+			for ( i = 0; rc == 0 && i < mdb->mi_nattrs; i++ ) {
+				rc = mdb_dbi_open( txn,
+					mdb->mi_attrs[i]->ai_desc->ad_type->sat_cname.bv_val,
+					0, &dbi );
+				if ( rc ) {
+					Debug( LDAP_DEBUG_ANY,
+						LDAP_XSTRING(mdb_db_snapshot) ": database \"%s\": "
+						"snapshot has no index for %s.\n",
+						be->be_suffix[0].bv_val,
+						mdb->mi_attrs[i]->ai_desc->ad_cname.bv_val );
+				}
+			}
+			if ( rc == 0 )
+				rc = mdb_dbi_open( txn, mdmi_databases[MDB_AD2ID].bv_val,
+					0, &dbi );
+			if ( rc == 0 )
+				rc = mdb_ix_hash_match( be, txn, dbi );
+			mdb_txn_abort( txn );
+		}
+		mdb_env_close( env );
+		snprintf( lpath, sizeof(lpath), "%s-lock", path );
+		unlink( lpath );
+		if ( rc )
+			break;
+
+		/* the caller has paused the server, drop every thread's reader */
+		ldap_pvt_thread_pool_purgekey( mdb->mi_dbenv );
+		mdb_db_close( be, NULL );
+		snprintf( lpath, sizeof(lpath), "%s" LDAP_DIRSEP "data.mdb",
+			mdb->mi_dbenv_home );
+		if ( rename( path, lpath ) )
+			rc = errno;
+		if ( mdb_db_open( be, &cr ) ) {
+			/* If this fails, we need to restart */
+			slapd_shutdown = 2;
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_db_snapshot) ": database \"%s\": "
+				"failed to reopen database.\n",
+				be->be_suffix[0].bv_val );
+			return LDAP_OTHER;
+		}
+		if ( rc )
+			break;
+		return 0;
+
+	case SLAP_SNAPSHOT_DISCARD:
+		if ( *fd >= 0 ) {
+			close( *fd );
+			*fd = -1;
+		}
+		unlink( path );
+		return 0;
+
+	default:
+		return LDAP_OTHER;
+	}
+
+	Debug( LDAP_DEBUG_ANY,
+		LDAP_XSTRING(mdb_db_snapshot) ": database \"%s\": "
+		"unable to load snapshot: %s (%d).\n",
+		be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+	unlink( path );
+	return rc;
+}
+
 int
 mdb_back_initialize(
 	BackendInfo	*bi )
@@ -408,7 +566,8 @@ mdb_back_initialize(
 		SLAP_BFLAG_INCREMENT |
 		SLAP_BFLAG_SUBENTRIES |
 		SLAP_BFLAG_ALIASES |
-		SLAP_BFLAG_REFERRALS;
+		SLAP_BFLAG_REFERRALS |
+		SLAP_BFLAG_GRADUATE;
 
 	bi->bi_controls = controls;
 
@@ -451,6 +610,7 @@ mdb_back_initialize(
 	bi->bi_db_open = mdb_db_open;
 	bi->bi_db_close = mdb_db_close;
 	bi->bi_db_destroy = mdb_db_destroy;
+	bi->bi_db_snapshot = mdb_db_snapshot;
 
 	bi->bi_op_add = mdb_add;
 	bi->bi_op_bind = mdb_bind;
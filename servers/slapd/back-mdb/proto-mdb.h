@@ -59,6 +59,11 @@ int mdb_ad_read( struct mdb_info *mdb, MDB_txn *txn );
 int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad );
 void mdb_ad_unwind( struct mdb_info *mdb, int prev_ads );
 
+int mdb_ix_hash_put( struct mdb_info *mdb, MDB_txn *txn );
+int mdb_ix_hash_update( struct mdb_info *mdb, MDB_txn *txn, AttrInfo *ai );
+int mdb_ix_hash_match( BackendDB *be, MDB_txn *txn, MDB_dbi ad2i );
+int mdb_ix_hash_check( BackendDB *be, MDB_txn *txn, ConfigReply *cr );
+
 /*
  * config.c
  */
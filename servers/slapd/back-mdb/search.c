@@ -428,6 +428,7 @@ mdb_search( Operation *op, SlapReply *rs )
 	Entry		*e = NULL, *base = NULL;
 	Entry		*matched = NULL;
 	AttributeName	*attrs;
+	FilterProg	*fprog = NULL;
 	slap_mask_t	mask;
 	time_t		stoptime;
 	int		manageDSAit;
@@ -796,6 +797,8 @@ adminlimit:
 		id = mdb_idl_first( candidates, &cursor );
 	}
 
+	fprog = filter_compile( op, op->oq_search.rs_filter );
+
 	while (id != NOID)
 	{
 		int scopeok;
@@ -1072,8 +1075,13 @@ notfound:
 			goto loop_continue;
 		}
 
+		/* the entry stays as is until it's returned, let filter
+		 * and ACL lookups use an attribute index
+		 */
+		entry_attr_index( e );
+
 		/* if it matches the filter and scope, send it */
-		rs->sr_err = test_filter( op, e, op->oq_search.rs_filter );
+		rs->sr_err = test_filter_prog( op, e, fprog );
 
 		if ( rs->sr_err == LDAP_COMPARE_TRUE ) {
 			/* check size limit */
@@ -1231,6 +1239,8 @@ done:
 	}
 	if (base)
 		mdb_entry_return( op, base );
+	if ( fprog )
+		filter_prog_free( op, fprog );
 	scope_chunk_ret( op, scopes );
 	if ( candidates != c0 ) {
 		ch_free( candidates );
@@ -87,6 +87,9 @@ static void * mdb_tool_index_task( void *ctx, void *ptr );
 
 static int	mdb_writes, mdb_writes_per_commit;
 
+/* set while all indexes are being rebuilt, -1 if that failed */
+static int	mdb_tool_ix_all;
+
 /* Number of ops per commit in Quick mode.
  * Batching speeds writes overall, but too large a
  * batch will fail with MDB_TXN_FULL.
@@ -229,6 +232,32 @@ int mdb_tool_entry_close(
 		txi = NULL;
 	}
 
+	/* Indexes were rebuilt, they now match the configured hash */
+	if ( mdb_tool_ix_all ) {
+		struct mdb_info *mdb = be->be_private;
+		int rc = 0;
+
+		if ( mdb_tool_ix_all > 0 ) {
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txi );
+			if ( rc == 0 ) {
+				rc = mdb_ix_hash_put( mdb, txi );
+				if ( rc == 0 )
+					rc = mdb_txn_commit( txi );
+				else
+					mdb_txn_abort( txi );
+				txi = NULL;
+			}
+		}
+		mdb_tool_ix_all = 0;
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_tool_entry_close) ": database %s: "
+				"recording index hash failed: %s (%d)\n",
+				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+			return -1;
+		}
+	}
+
 	if( nholes ) {
 		unsigned i;
 		fprintf( stderr, "Error, entries missing!\n");
@@ -821,6 +850,16 @@ int mdb_tool_entry_reindex(
 		return mdb_dn2id_upgrade( be );
 	}
 
+	if ( !adv ) {
+		if ( !mdb_tool_ix_all )
+			mdb_tool_ix_all = 1;
+	} else if ( mi->mi_flags & MDB_NEED_REHASH ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_tool_entry_reindex)
+			": index_hash changed, all indexes must be rebuilt\n" );
+		return -1;
+	}
+
 	/* No indexes configured, nothing to do. Could return an
 	 * error here to shortcut things.
 	 */
@@ -890,7 +929,10 @@ int mdb_tool_entry_reindex(
 		}
 	}
 
-	if ( slapMode & SLAP_TRUNCATE_MODE ) {
+	/* Keys from the old hash would linger, start over */
+	if (( slapMode & SLAP_TRUNCATE_MODE ) ||
+		( mi->mi_flags & MDB_NEED_REHASH ))
+	{
 		int i;
 		for ( i=0; i < mi->mi_nattrs; i++ ) {
 			rc = mdb_drop( txi, mi->mi_attrs[i]->ai_dbi, 0 );
@@ -903,7 +945,8 @@ int mdb_tool_entry_reindex(
 				return -1;
 			}
 		}
-		slapMode ^= SLAP_TRUNCATE_MODE;
+		slapMode &= ~SLAP_TRUNCATE_MODE;
+		mi->mi_flags &= ~MDB_NEED_REHASH;
 	}
 
 	/*
@@ -954,6 +997,8 @@ done:
 
 	} else {
 		unsigned i;
+		if ( mdb_tool_ix_all )
+			mdb_tool_ix_all = -1;
 		mdb_writes = 0;
 		mdb_cursor_close( cursor );
 		cursor = NULL;
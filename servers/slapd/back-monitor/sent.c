@@ -43,6 +43,10 @@ enum {
 	MONITOR_SENT_PDU,
 	MONITOR_SENT_ENTRIES,
 	MONITOR_SENT_REFERRALS,
+	MONITOR_SENT_GROUP_HITS,
+	MONITOR_SENT_GROUP_MISSES,
+	MONITOR_SENT_GROUP_ENTRIES,
+	MONITOR_SENT_GROUP_BYTES,
 
 	MONITOR_SENT_LAST
 };
@@ -55,6 +59,10 @@ struct monitor_sent_t {
 	{ BER_BVC("cn=PDU"),		BER_BVNULL },
 	{ BER_BVC("cn=Entries"),	BER_BVNULL },
 	{ BER_BVC("cn=Referrals"),	BER_BVNULL },
+	{ BER_BVC("cn=Group Cache Hits"),	BER_BVNULL },
+	{ BER_BVC("cn=Group Cache Misses"),	BER_BVNULL },
+	{ BER_BVC("cn=Group Cache Entries"),	BER_BVNULL },
+	{ BER_BVC("cn=Group Cache Bytes"),	BER_BVNULL },
 	{ BER_BVNULL,			BER_BVNULL }
 };
 
@@ -184,6 +192,14 @@ monitor_subsys_sent_update(
 		return SLAP_CB_CONTINUE;
 	}
 
+	if ( i >= MONITOR_SENT_GROUP_HITS ) {
+		unsigned long gc[4];
+
+		group_cache_stats( &gc[0], &gc[1], &gc[2], &gc[3] );
+		ldap_pvt_mp_init_set( n, gc[i - MONITOR_SENT_GROUP_HITS] );
+		goto update;
+	}
+
 	ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
 	switch ( i ) {
 	case MONITOR_SENT_ENTRIES:
@@ -226,7 +242,8 @@ monitor_subsys_sent_update(
 		assert(0);
 	}
 	ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
-	
+
+update:
 	a = attr_find( e->e_attrs, mi->mi_ad_monitorCounter );
 	assert( a != NULL );
 
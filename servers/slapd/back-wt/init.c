@@ -238,7 +238,8 @@ wt_back_initialize( BackendInfo *bi )
 		SLAP_BFLAG_INCREMENT |
 		SLAP_BFLAG_SUBENTRIES |
 		SLAP_BFLAG_ALIASES |
-		SLAP_BFLAG_REFERRALS;
+		SLAP_BFLAG_REFERRALS |
+		SLAP_BFLAG_GRADUATE;
 
 	bi->bi_controls = controls;
 /* version check */
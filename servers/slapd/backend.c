@@ -458,6 +458,7 @@ void backend_destroy_one( BackendDB *bd, int dynamic )
 	}
 
 	backend_stopdown_one( bd );
+	group_cache_flush( bd );
 
 	ber_bvarray_free( bd->be_suffix );
 	ber_bvarray_free( bd->be_nsuffix );
@@ -1456,6 +1457,8 @@ fe_acl_group(
 	GroupAssertion *g;
 	Backend *be = op->o_bd;
 	OpExtra		*oex;
+	unsigned long gen = 0;
+	int cacheable;
 
 	LDAP_SLIST_FOREACH(oex, &op->o_extra, oe_next) {
 		if ( oex->oe_key == (void *)backend_group )
@@ -1484,10 +1487,24 @@ fe_acl_group(
 		goto done;
 	}
 
+	cacheable = group_cache_usable( op->o_bd, group_at, op_ndn );
+
 	if ( target && dn_match( &target->e_nname, gr_ndn ) ) {
 		e = target;
 		rc = 0;
 
+		if ( cacheable ) {
+			a = entry_attr_find( e, slap_schema.si_ad_entryCSN );
+			if ( a ) {
+				group_cache_invalidate( gr_ndn, &a->a_nvals[0] );
+			}
+		}
+
+	} else if ( cacheable && ( rc = group_cache_check( op->o_bd, gr_ndn,
+		group_oc, group_at, op_ndn, &gen )) != -1 )
+	{
+		goto cache;
+
 	} else {
 		op->o_private = NULL;
 		rc = be_entry_get_rw( op, gr_ndn, group_oc, group_at, 0, &e );
@@ -1496,7 +1513,7 @@ fe_acl_group(
 	}
 
 	if ( e ) {
-		a = attr_find( e->e_attrs, group_at );
+		a = entry_attr_find( e, group_at );
 		if ( a ) {
 			/* If the attribute is a subtype of labeledURI,
 			 * treat this as a dynamic group ala groupOfURLs
@@ -1634,6 +1651,11 @@ loopit:
 			rc = LDAP_NO_SUCH_ATTRIBUTE;
 		}
 
+		if ( cacheable && e != target ) {
+			group_cache_add( op->o_bd, e, group_oc, group_at, a, gen,
+				op->o_time );
+		}
+
 		if ( e != target ) {
 			op->o_private = e_priv;
 			be_entry_release_r( op, e );
@@ -1644,6 +1666,7 @@ loopit:
 		rc = LDAP_NO_SUCH_OBJECT;
 	}
 
+cache:
 	if ( op->o_tag != LDAP_REQ_BIND && !op->o_do_not_cache ) {
 		g = op->o_tmpalloc( sizeof( GroupAssertion ) + gr_ndn->bv_len,
 			op->o_tmpmemctx );
@@ -1745,7 +1768,7 @@ fe_acl_attribute(
 			goto freeit;
 		}
 
-		a = attr_find( e->e_attrs, entry_at );
+		a = entry_attr_find( e, entry_at );
 		if ( a == NULL ) {
 			SlapReply	rs = { REP_SEARCH };
 			AttributeName	anlist[ 2 ];
@@ -1912,7 +1935,7 @@ backend_access(
 			}
 
 		} else {
-			a = attr_find( e->e_attrs, entry_at );
+			a = entry_attr_find( e, entry_at );
 			if ( a == NULL ) {
 				SlapReply	rs = { REP_SEARCH };
 				AttributeName	anlist[ 2 ];
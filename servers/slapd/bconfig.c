@@ -195,6 +195,7 @@ enum {
 	CFG_SYNC_SUBENTRY,
 	CFG_LTHREADS,
 	CFG_IX_HASH64,
+	CFG_IX_HASH,
 	CFG_DISABLED,
 	CFG_THREADQS,
 	CFG_TLS_ECNAME,
@@ -385,10 +386,18 @@ static ConfigTable config_back_cf_table[] = {
 			"SUBSTR caseIgnoreSubstringsMatch "
 			"SYNTAX OMsDirectoryString X-ORDERED 'VALUES' )",
 			NULL, NULL },
+	{ "dncache-size", "entries", 2, 2, 0, ARG_UINT,
+		&dn_cache_max, "( OLcfgGlAt:103 NAME 'olcDNCacheSize' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "extra_attrs", "attrlist", 2, 2, 0, ARG_DB|ARG_MAGIC,
 		&config_extra_attrs, "( OLcfgDbAt:0.20 NAME 'olcExtraAttrs' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "filtercache-size", "entries", 2, 2, 0, ARG_UINT,
+		&filter_cache_max, "( OLcfgGlAt:102 NAME 'olcFilterCacheSize' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "gentlehup", "on|off", 2, 2, 0,
 #ifdef SIGHUP
 		ARG_ON_OFF, &global_gentlehup,
@@ -398,6 +407,10 @@ static ConfigTable config_back_cf_table[] = {
 		"( OLcfgGlAt:17 NAME 'olcGentleHUP' "
 			"EQUALITY booleanMatch "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "groupcache-size", "bytes", 2, 2, 0, ARG_ULONG,
+		&group_cache_max, "( OLcfgGlAt:101 NAME 'olcGroupCacheSize' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "hidden", "on|off", 2, 2, 0, ARG_DB|ARG_ON_OFF|ARG_MAGIC|CFG_HIDDEN,
 		&config_generic, "( OLcfgDbAt:0.17 NAME 'olcHidden' "
 			"EQUALITY booleanMatch "
@@ -409,6 +422,10 @@ static ConfigTable config_back_cf_table[] = {
 	{ "include", "file", 2, 2, 0, ARG_MAGIC,
 		&config_include, "( OLcfgGlAt:19 NAME 'olcInclude' "
 			"SUP labeledURI )", NULL, NULL },
+	{ "index_hash", "fnv32|fnv64|xxh64", 2, 2, 0, ARG_MAGIC|CFG_IX_HASH,
+		&config_generic, "( OLcfgGlAt:104 NAME 'olcIndexHash' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "index_hash64", "on|off", 2, 2, 0, ARG_ON_OFF|ARG_MAGIC|CFG_IX_HASH64,
 		&config_generic, "( OLcfgGlAt:94 NAME 'olcIndexHash64' "
 			"EQUALITY booleanMatch "
@@ -939,9 +956,9 @@ static ConfigOCs cf_ocs[] = {
 		 "olcAttributeOptions $ olcAuthIDRewrite $ "
 		 "olcAuthzPolicy $ olcAuthzRegexp $ olcConcurrency $ "
 		 "olcConnMaxPending $ olcConnMaxPendingAuth $ "
-		 "olcDisallows $ olcGentleHUP $ olcIdleTimeout $ "
+		 "olcDisallows $ olcDNCacheSize $ olcFilterCacheSize $ olcGentleHUP $ olcGroupCacheSize $ olcIdleTimeout $ "
 		 "olcIndexSubstrIfMaxLen $ olcIndexSubstrIfMinLen $ "
-		 "olcIndexSubstrAnyLen $ olcIndexSubstrAnyStep $ olcIndexHash64 $ "
+		 "olcIndexSubstrAnyLen $ olcIndexSubstrAnyStep $ olcIndexHash $ olcIndexHash64 $ "
 		 "olcIndexIntLen $ "
 		 "olcListenerThreads $ olcLocalSSF $ olcLogFile $ olcLogLevel $ "
 		 "olcPasswordCryptSaltFormat $ olcPasswordHash $ olcPidFile $ "
@@ -1350,7 +1367,18 @@ config_generic(ConfigArgs *c) {
 			c->value_uint = index_substr_if_minlen;
 			break;
 		case CFG_IX_HASH64:
-			c->value_int = slap_hash64( -1 );
+			/* olcIndexHash takes over for hashes other than FNV */
+			if ( slap_index_hash( -1 ) == SLAP_INDEX_HASH_XXH64 )
+				rc = 1;
+			else
+				c->value_int = slap_hash64( -1 );
+			break;
+		case CFG_IX_HASH:
+			if ( slap_index_hash( -1 ) == SLAP_INDEX_HASH_XXH64 )
+				value_add_one( &c->rvalue_vals,
+					slap_index_hash_name( slap_index_hash( -1 )));
+			else
+				rc = 1;
 			break;
 		case CFG_IX_INTLEN:
 			c->value_int = index_intlen;
@@ -1537,7 +1565,14 @@ config_generic(ConfigArgs *c) {
 			break;
 
 		case CFG_IX_HASH64:
-			slap_hash64( 0 );
+		case CFG_IX_HASH:
+			/* open databases already hold keys made with it */
+			if ( slap_index_hash( -1 ) != SLAP_INDEX_HASH_FNV32 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"<%s> cannot be changed while slapd is running",
+					c->argv[0] );
+				rc = 1;
+			}
 			break;
 
 		case CFG_IX_INTLEN:
@@ -1562,6 +1597,7 @@ config_generic(ConfigArgs *c) {
 				a = *prev;
 				*prev = a->acl_next;
 				acl_free( a );
+				acl_index_rebuild( c->be->be_acl );
 			}
 			if ( SLAP_CONFIG( c->be ) && !c->be->be_acl ) {
 				Debug( LDAP_DEBUG_CONFIG, "config_generic (CFG_ACL): "
@@ -2075,9 +2111,45 @@ config_generic(ConfigArgs *c) {
 			break;
 
 		case CFG_IX_HASH64:
-			if ( slap_hash64( c->value_int != 0 ))
+		case CFG_IX_HASH: {
+			struct berval bv;
+
+			if ( c->type == CFG_IX_HASH64 ) {
+				i = c->value_int ? SLAP_INDEX_HASH_FNV64 :
+					SLAP_INDEX_HASH_FNV32;
+			} else {
+				ber_str2bv( c->argv[1], 0, 0, &bv );
+				i = slap_index_hash_find( &bv );
+				if ( i < 0 ) {
+					snprintf( c->cr_msg, sizeof( c->cr_msg ),
+						"<%s> unsupported hash \"%s\"",
+						c->argv[0], c->argv[1] );
+					Debug( LDAP_DEBUG_ANY, "%s: %s\n",
+						c->log, c->cr_msg );
+					return 1;
+				}
+			}
+			/* Databases record the hash their index keys were made
+			 * with when they are opened, switching it under them
+			 * would mix keys of both kinds.
+			 */
+			if ( i != slap_index_hash( -1 ) && CONFIG_ONLINE_ADD( c )) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"<%s> cannot be changed while slapd is running",
+					c->argv[0] );
+				Debug( LDAP_DEBUG_ANY, "%s: %s\n",
+					c->log, c->cr_msg );
 				return 1;
-			break;
+			}
+			if ( slap_index_hash( i )) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"<%s> unsupported hash \"%s\"",
+					c->argv[0], c->argv[1] );
+				Debug( LDAP_DEBUG_ANY, "%s: %s\n",
+					c->log, c->cr_msg );
+				return 1;
+			}
+			} break;
 
 		case CFG_IX_INTLEN:
 			if ( c->value_int < SLAP_INDEX_INTLEN_DEFAULT )
@@ -113,6 +113,11 @@ slap_graduate_commit_csn( Operation *op )
 	if ( op->o_bd == NULL ) return;
 	be = op->o_bd->bd_self;
 
+	/* every write ends here, successful or not */
+	group_cache_written( &op->o_req_ndn, &op->o_csn,
+		op->o_tag == LDAP_REQ_MODRDN ||
+		( op->o_tag == LDAP_REQ_DELETE && get_treeDelete( op )));
+
 	ldap_pvt_thread_mutex_lock( &be->be_pcl_mutex );
 
 	LDAP_TAILQ_FOREACH( csne, be->be_pending_csn_list, ce_csn_link ) {
@@ -413,6 +413,432 @@ LDAPDN_rewrite( LDAPDN dn, unsigned flags, void *ctx )
 	return LDAP_SUCCESS;
 }
 
+/*
+ * Most DNs that come in are plain "type=value,type=value" strings made
+ * of ASCII characters that never need escaping.  Those are rewritten
+ * here in a single pass, without building the LDAPDN structure: each
+ * value still goes through the syntax's own validate/pretty/normalize
+ * routines, and the result is written straight into the output buffer.
+ * Anything out of the ordinary (escapes, quotes, multi-valued RDNs,
+ * options, OIDs, unknown types, values that would need escaping on
+ * output) returns DN_FAST_NO and is left to the general code.
+ */
+#define DN_FAST_NO	(-1)
+#define DN_FAST_MAXRDN	32
+#define DN_FAST_MAXLEN	1024
+
+typedef struct dn_fast_rdn {
+	AttributeDescription	*fr_ad;
+	struct berval		fr_value;	/* as found in the input */
+	struct berval		fr_pretty;
+	struct berval		fr_normal;
+} dn_fast_rdn;
+
+/* characters that may appear unescaped in an input value */
+#define DN_FAST_VALCHAR(c) \
+	( (c) >= ' ' && (c) <= '~' && (c) != '\\' && (c) != '"' && \
+	  (c) != '+' && (c) != ';' && (c) != '<' && (c) != '>' && \
+	  (c) != '#' && (c) != '=' && (c) != ',' )
+
+/* a rewritten value that ldap_dn2bv would copy as is */
+static int
+dn_fast_safe( struct berval *bv )
+{
+	ber_len_t i;
+
+	if ( bv->bv_len == 0 || bv->bv_val[0] == ' ' ||
+		bv->bv_val[bv->bv_len - 1] == ' ' )
+	{
+		return 0;
+	}
+	for ( i = 0; i < bv->bv_len; i++ ) {
+		if ( !DN_FAST_VALCHAR( (unsigned char)bv->bv_val[i] ) )
+			return 0;
+	}
+	return 1;
+}
+
+static int
+dn_fast_value(
+	AttributeDescription *ad,
+	struct berval *in,
+	struct berval *out,
+	unsigned flags,
+	void *ctx )
+{
+	Syntax *syn = ad->ad_type->sat_syntax;
+	MatchingRule *mr;
+
+	BER_BVZERO( out );
+	if ( flags & SLAP_LDAPDN_PRETTY ) {
+		if ( syn->ssyn_pretty ) {
+			return syn->ssyn_pretty( syn, in, out, ctx );
+		}
+		return syn->ssyn_validate( syn, in );
+	}
+
+	if ( syn->ssyn_validate( syn, in ) != LDAP_SUCCESS ) {
+		return LDAP_INVALID_SYNTAX;
+	}
+	mr = ad->ad_type->sat_equality;
+	if ( mr && !( mr->smr_usage & SLAP_MR_MUTATION_NORMALIZER ) &&
+		mr->smr_normalize )
+	{
+		return mr->smr_normalize( SLAP_MR_VALUE_OF_ASSERTION_SYNTAX,
+			syn, mr, in, out, ctx );
+	}
+	return LDAP_SUCCESS;
+}
+
+static void
+dn_fast_build( dn_fast_rdn *rdns, int nrdns, int normal,
+	struct berval *out, void *ctx )
+{
+	ber_len_t len = nrdns - 1;
+	struct berval *v;
+	char *p;
+	int i;
+
+	for ( i = 0; i < nrdns; i++ ) {
+		v = normal ? &rdns[i].fr_normal : &rdns[i].fr_pretty;
+		len += rdns[i].fr_ad->ad_cname.bv_len + 1 + v->bv_len;
+	}
+
+	out->bv_len = len;
+	out->bv_val = p = ber_memalloc_x( len + 1, ctx );
+	for ( i = 0; i < nrdns; i++ ) {
+		v = normal ? &rdns[i].fr_normal : &rdns[i].fr_pretty;
+		if ( i ) *p++ = ',';
+		AC_MEMCPY( p, rdns[i].fr_ad->ad_cname.bv_val,
+			rdns[i].fr_ad->ad_cname.bv_len );
+		p += rdns[i].fr_ad->ad_cname.bv_len;
+		*p++ = '=';
+		AC_MEMCPY( p, v->bv_val, v->bv_len );
+		p += v->bv_len;
+	}
+	*p = '\0';
+}
+
+static int
+dn_fast_rewrite(
+	struct berval *val,
+	struct berval *pretty,
+	struct berval *normal,
+	void *ctx )
+{
+	dn_fast_rdn rdns[DN_FAST_MAXRDN];
+	char buf[DN_FAST_MAXLEN + 1];
+	char *p = buf, *end = buf + val->bv_len;
+	int i, nrdns = 0, rc = DN_FAST_NO;
+
+	if ( val->bv_len > DN_FAST_MAXLEN )
+		return DN_FAST_NO;
+
+	/* work on a copy so that each value can be terminated in place */
+	AC_MEMCPY( buf, val->bv_val, val->bv_len );
+	*end = '\0';
+
+	for (;;) {
+		struct berval type;
+		AttributeType *at;
+		dn_fast_rdn *fr;
+
+		if ( nrdns == DN_FAST_MAXRDN )
+			goto done;
+		fr = &rdns[nrdns];
+
+		while ( p < end && *p == ' ' ) p++;
+		type.bv_val = p;
+		if ( p == end || !LDAP_ALPHA( *p ) )
+			goto done;
+		while ( p < end && LDAP_LDH( *p ) ) p++;
+		type.bv_len = p - type.bv_val;
+		while ( p < end && *p == ' ' ) p++;
+		if ( p == end || *p++ != '=' )
+			goto done;
+		while ( p < end && *p == ' ' ) p++;
+
+		fr->fr_value.bv_val = p;
+		while ( p < end && DN_FAST_VALCHAR( (unsigned char)*p ) ) p++;
+		if ( p < end && *p != ',' )
+			goto done;
+		fr->fr_value.bv_len = p - fr->fr_value.bv_val;
+		while ( fr->fr_value.bv_len &&
+			fr->fr_value.bv_val[fr->fr_value.bv_len - 1] == ' ' )
+		{
+			fr->fr_value.bv_len--;
+		}
+		if ( fr->fr_value.bv_len == 0 )
+			goto done;
+		fr->fr_value.bv_val[fr->fr_value.bv_len] = '\0';
+
+		at = at_bvfind( &type );
+		if ( at == NULL || at->sat_ad == NULL ||
+			( at->sat_flags & SLAP_AT_ORDERED_VAL ) )
+		{
+			goto done;
+		}
+		fr->fr_ad = at->sat_ad;
+		BER_BVZERO( &fr->fr_pretty );
+		BER_BVZERO( &fr->fr_normal );
+		nrdns++;
+
+		if ( pretty ) {
+			if ( dn_fast_value( fr->fr_ad, &fr->fr_value, &fr->fr_pretty,
+					SLAP_LDAPDN_PRETTY, ctx ) != LDAP_SUCCESS )
+				goto done;
+			if ( BER_BVISNULL( &fr->fr_pretty ) )
+				fr->fr_pretty = fr->fr_value;
+			if ( !dn_fast_safe( &fr->fr_pretty ) )
+				goto done;
+		}
+		if ( normal ) {
+			if ( dn_fast_value( fr->fr_ad, &fr->fr_value, &fr->fr_normal,
+					0, ctx ) != LDAP_SUCCESS )
+				goto done;
+			if ( BER_BVISNULL( &fr->fr_normal ) )
+				fr->fr_normal = fr->fr_value;
+			if ( !dn_fast_safe( &fr->fr_normal ) )
+				goto done;
+		}
+
+		if ( p == end )
+			break;
+		p++;	/* ',' */
+	}
+
+	if ( pretty )
+		dn_fast_build( rdns, nrdns, 0, pretty, ctx );
+	if ( normal )
+		dn_fast_build( rdns, nrdns, 1, normal, ctx );
+	rc = LDAP_SUCCESS;
+
+done:
+	for ( i = 0; i < nrdns; i++ ) {
+		if ( rdns[i].fr_pretty.bv_val &&
+			rdns[i].fr_pretty.bv_val != rdns[i].fr_value.bv_val )
+			ber_memfree_x( rdns[i].fr_pretty.bv_val, ctx );
+		if ( rdns[i].fr_normal.bv_val &&
+			rdns[i].fr_normal.bv_val != rdns[i].fr_value.bv_val )
+			ber_memfree_x( rdns[i].fr_normal.bv_val, ctx );
+	}
+	return rc;
+}
+
+/*
+ * The DNs handled above are also remembered, keyed by their input
+ * string, so that the same DN coming in again (bind DNs, search bases,
+ * group members...) costs a hash lookup.  Only DNs made entirely of
+ * known attribute types end up here, so schema additions cannot change
+ * the result; the cache is flushed when schema elements are deleted.
+ */
+unsigned int dn_cache_max = SLAP_DN_CACHE_DEFAULT;
+
+#define DC_BUCKETS	4096
+
+typedef struct DNCacheEntry {
+	struct DNCacheEntry *dc_next;	/* hash chain */
+	struct DNCacheEntry *dc_lru_prev;
+	struct DNCacheEntry *dc_lru_next;
+	unsigned dc_hash;
+	struct berval dc_raw;
+	struct berval dc_pretty;	/* NULL if not known */
+	struct berval dc_normal;	/* NULL if not known */
+} DNCacheEntry;
+
+static struct {
+	ldap_pvt_thread_mutex_t dc_mutex;
+	DNCacheEntry *dc_buckets[DC_BUCKETS];
+	DNCacheEntry *dc_lru_head;		/* most recently used */
+	DNCacheEntry *dc_lru_tail;
+	unsigned dc_count;
+} dn_cache;
+
+static unsigned
+dc_hashstr( const char *s, ber_len_t len )
+{
+	unsigned h = 2166136261U;	/* FNV-1a */
+
+	while ( len-- ) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void
+dc_unlink( DNCacheEntry *dc )
+{
+	DNCacheEntry **dp;
+
+	for ( dp = &dn_cache.dc_buckets[dc->dc_hash % DC_BUCKETS];
+		*dp != dc; dp = &(*dp)->dc_next )
+		;
+	*dp = dc->dc_next;
+
+	if ( dc->dc_lru_prev )
+		dc->dc_lru_prev->dc_lru_next = dc->dc_lru_next;
+	else
+		dn_cache.dc_lru_head = dc->dc_lru_next;
+	if ( dc->dc_lru_next )
+		dc->dc_lru_next->dc_lru_prev = dc->dc_lru_prev;
+	else
+		dn_cache.dc_lru_tail = dc->dc_lru_prev;
+
+	dn_cache.dc_count--;
+	ch_free( dc );
+}
+
+static DNCacheEntry *
+dc_find( struct berval *val, unsigned hash )
+{
+	DNCacheEntry *dc;
+
+	for ( dc = dn_cache.dc_buckets[hash % DC_BUCKETS]; dc; dc = dc->dc_next ) {
+		if ( dc->dc_hash == hash && dc->dc_raw.bv_len == val->bv_len &&
+			memcmp( dc->dc_raw.bv_val, val->bv_val, val->bv_len ) == 0 )
+		{
+			break;
+		}
+	}
+	return dc;
+}
+
+static void
+dc_insert( struct berval *val, unsigned hash,
+	struct berval *pretty, struct berval *normal )
+{
+	DNCacheEntry *dc;
+	ber_len_t len = val->bv_len + 1;
+	char *p;
+
+	if ( pretty ) len += pretty->bv_len + 1;
+	if ( normal ) len += normal->bv_len + 1;
+
+	dc = ch_malloc( sizeof( DNCacheEntry ) + len );
+	dc->dc_hash = hash;
+	p = (char *)( dc + 1 );
+	dc->dc_raw.bv_val = p;
+	dc->dc_raw.bv_len = val->bv_len;
+	AC_MEMCPY( p, val->bv_val, val->bv_len + 1 );
+	p += val->bv_len + 1;
+	BER_BVZERO( &dc->dc_pretty );
+	BER_BVZERO( &dc->dc_normal );
+	if ( pretty ) {
+		dc->dc_pretty.bv_val = p;
+		dc->dc_pretty.bv_len = pretty->bv_len;
+		AC_MEMCPY( p, pretty->bv_val, pretty->bv_len + 1 );
+		p += pretty->bv_len + 1;
+	}
+	if ( normal ) {
+		dc->dc_normal.bv_val = p;
+		dc->dc_normal.bv_len = normal->bv_len;
+		AC_MEMCPY( p, normal->bv_val, normal->bv_len + 1 );
+	}
+
+	ldap_pvt_thread_mutex_lock( &dn_cache.dc_mutex );
+	while ( dn_cache.dc_lru_tail && dn_cache.dc_count >= dn_cache_max ) {
+		dc_unlink( dn_cache.dc_lru_tail );
+	}
+	/* replaces an entry that knew fewer forms, or a concurrent insert */
+	{
+		DNCacheEntry *old = dc_find( val, hash );
+		if ( old )
+			dc_unlink( old );
+	}
+	dc->dc_next = dn_cache.dc_buckets[hash % DC_BUCKETS];
+	dn_cache.dc_buckets[hash % DC_BUCKETS] = dc;
+	dc->dc_lru_prev = NULL;
+	dc->dc_lru_next = dn_cache.dc_lru_head;
+	if ( dn_cache.dc_lru_head )
+		dn_cache.dc_lru_head->dc_lru_prev = dc;
+	else
+		dn_cache.dc_lru_tail = dc;
+	dn_cache.dc_lru_head = dc;
+	dn_cache.dc_count++;
+	ldap_pvt_thread_mutex_unlock( &dn_cache.dc_mutex );
+}
+
+/*
+ * Look the DN up in the cache, then try the single pass rewrite.
+ * Returns DN_FAST_NO if the DN must go through ldap_bv2dn().
+ */
+static int
+dn_fast(
+	struct berval *val,
+	struct berval *pretty,
+	struct berval *normal,
+	void *ctx )
+{
+	DNCacheEntry *dc;
+	unsigned hash = 0;
+	int cache = dn_cache_max && val->bv_len <= DN_FAST_MAXLEN;
+
+	if ( cache ) {
+		hash = dc_hashstr( val->bv_val, val->bv_len );
+
+		ldap_pvt_thread_mutex_lock( &dn_cache.dc_mutex );
+		dc = dc_find( val, hash );
+		if ( dc && ( !pretty || !BER_BVISNULL( &dc->dc_pretty ) ) &&
+			( !normal || !BER_BVISNULL( &dc->dc_normal ) ) )
+		{
+			if ( dc != dn_cache.dc_lru_head ) {
+				dc->dc_lru_prev->dc_lru_next = dc->dc_lru_next;
+				if ( dc->dc_lru_next )
+					dc->dc_lru_next->dc_lru_prev = dc->dc_lru_prev;
+				else
+					dn_cache.dc_lru_tail = dc->dc_lru_prev;
+				dc->dc_lru_prev = NULL;
+				dc->dc_lru_next = dn_cache.dc_lru_head;
+				dn_cache.dc_lru_head->dc_lru_prev = dc;
+				dn_cache.dc_lru_head = dc;
+			}
+			if ( pretty )
+				ber_dupbv_x( pretty, &dc->dc_pretty, ctx );
+			if ( normal )
+				ber_dupbv_x( normal, &dc->dc_normal, ctx );
+			ldap_pvt_thread_mutex_unlock( &dn_cache.dc_mutex );
+			return LDAP_SUCCESS;
+		}
+		ldap_pvt_thread_mutex_unlock( &dn_cache.dc_mutex );
+	}
+
+	if ( dn_fast_rewrite( val, pretty, normal, ctx ) != LDAP_SUCCESS )
+		return DN_FAST_NO;
+
+	if ( cache )
+		dc_insert( val, hash, pretty, normal );
+
+	return LDAP_SUCCESS;
+}
+
+void
+dn_cache_init( void )
+{
+	ldap_pvt_thread_mutex_init( &dn_cache.dc_mutex );
+}
+
+/*
+ * Called when schema elements go away, the cached DNs may have
+ * been rewritten with their syntaxes.
+ */
+void
+dn_cache_flush( void )
+{
+	ldap_pvt_thread_mutex_lock( &dn_cache.dc_mutex );
+	while ( dn_cache.dc_lru_tail ) {
+		dc_unlink( dn_cache.dc_lru_tail );
+	}
+	ldap_pvt_thread_mutex_unlock( &dn_cache.dc_mutex );
+}
+
+void
+dn_cache_destroy( void )
+{
+	dn_cache_flush();
+	ldap_pvt_thread_mutex_destroy( &dn_cache.dc_mutex );
+}
+
 int
 dnNormalize(
     slap_mask_t use,
@@ -427,7 +853,10 @@ dnNormalize(
 
 	Debug( LDAP_DEBUG_TRACE, ">>> dnNormalize: <%s>\n", val->bv_val ? val->bv_val : "" );
 
-	if ( val->bv_len != 0 ) {
+	if ( val->bv_len == 0 ) {
+		ber_dupbv_x( out, val, ctx );
+
+	} else if ( dn_fast( val, NULL, out, ctx ) != LDAP_SUCCESS ) {
 		LDAPDN		dn = NULL;
 		int		rc;
 
@@ -460,8 +889,6 @@ dnNormalize(
 		if ( rc != LDAP_SUCCESS ) {
 			return LDAP_INVALID_SYNTAX;
 		}
-	} else {
-		ber_dupbv_x( out, val, ctx );
 	}
 
 	Debug( LDAP_DEBUG_TRACE, "<<< dnNormalize: <%s>\n", out->bv_val ? out->bv_val : "" );
@@ -545,7 +972,7 @@ dnPretty(
 	} else if ( val->bv_len > SLAP_LDAPDN_MAXLEN ) {
 		return LDAP_INVALID_SYNTAX;
 
-	} else {
+	} else if ( dn_fast( val, out, NULL, ctx ) != LDAP_SUCCESS ) {
 		LDAPDN		dn = NULL;
 		int		rc;
 
@@ -716,7 +1143,7 @@ dnPrettyNormal(
 		/* too big */
 		return LDAP_INVALID_SYNTAX;
 
-	} else {
+	} else if ( dn_fast( val, pretty, normal, ctx ) != LDAP_SUCCESS ) {
 		LDAPDN		dn = NULL;
 		int		rc;
 
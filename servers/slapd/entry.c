@@ -44,7 +44,7 @@ static int		emaxsize;/* max size of ebuf			 */
  * Empty root entry
  */
 const Entry slap_entry_root = {
-	NOID, { 0, "" }, { 0, "" }, NULL, 0, { 0, "" }, NULL
+	NOID, { 0, "" }, { 0, "" }, NULL, 0, { 0, "" }, NULL, NULL
 };
 
 /*
@@ -449,6 +449,8 @@ entry_clean( Entry *e )
 	/* e_private must be freed by the caller */
 	assert( e->e_private == NULL );
 
+	entry_attr_unindex( e );
+
 	e->e_id = 0;
 
 	/* free DNs */
@@ -548,6 +550,211 @@ entry_alloc( void )
 	return e;
 }
 
+/*
+ * Attribute index
+ *
+ * An entry whose attribute list is known not to change for a while,
+ * e.g. a candidate being evaluated and returned by a search, may be
+ * marked with entry_attr_index().  The second lookup through
+ * entry_attr_find() or entry_attrs_find() then builds a small hash of
+ * the attribute types, so later lookups don't walk the whole list.
+ * Entries only looked at once, e.g. by a single term filter that
+ * doesn't match, never pay for the table.
+ * entry_attr_unindex() must be called before the list is modified;
+ * entry_clean() does it too.
+ */
+
+/* Entries with fewer attributes are searched linearly */
+#define	AINDEX_MIN	12
+
+typedef struct AttrSlot {
+	AttributeType	*as_type;
+	int		as_first;	/* position of first attr of this type */
+} AttrSlot;
+
+typedef struct AttrIndex {
+	Attribute	*ai_head;	/* e_attrs the index was built from */
+	unsigned	ai_mask;
+	AttrSlot	*ai_slots;
+	Attribute	**ai_attrs;	/* attrs in list order */
+	int		*ai_next;	/* next position with the same type, or -1 */
+} AttrIndex;
+
+/* Marks an entry that was too small to bother indexing */
+static AttrIndex ai_none;
+
+/* Marks an entry that was looked up once */
+static AttrIndex ai_once;
+
+#define	AI_HASH(ai,t)	((unsigned)((unsigned long)(t) >> 4) & (ai)->ai_mask)
+
+static AttrIndex *
+attr_index_build( Attribute *head )
+{
+	AttrIndex *ai;
+	Attribute *a;
+	unsigned size;
+	int i, n;
+
+	for ( n = 0, a = head; a; a = a->a_next )
+		n++;
+	if ( n < AINDEX_MIN )
+		return &ai_none;
+
+	/* keep the table at most half full */
+	for ( size = 32; size < 2U * n; size <<= 1 )
+		;
+
+	ai = ch_malloc( sizeof(AttrIndex) + size * sizeof(AttrSlot)
+		+ n * ( sizeof(Attribute *) + sizeof(int) ));
+	ai->ai_head = head;
+	ai->ai_mask = size - 1;
+	ai->ai_slots = (AttrSlot *)(ai+1);
+	ai->ai_attrs = (Attribute **)(ai->ai_slots + size);
+	ai->ai_next = (int *)(ai->ai_attrs + n);
+	memset( ai->ai_slots, 0, size * sizeof(AttrSlot) );
+
+	for ( i = 0, a = head; a; a = a->a_next )
+		ai->ai_attrs[i++] = a;
+
+	/* insert backwards so that each chain ends up in list order */
+	for ( i = n-1; i >= 0; i-- ) {
+		AttributeType *t = ai->ai_attrs[i]->a_desc->ad_type;
+		unsigned h = AI_HASH( ai, t );
+
+		while ( ai->ai_slots[h].as_type && ai->ai_slots[h].as_type != t )
+			h = ( h + 1 ) & ai->ai_mask;
+		if ( ai->ai_slots[h].as_type ) {
+			ai->ai_next[i] = ai->ai_slots[h].as_first;
+		} else {
+			ai->ai_slots[h].as_type = t;
+			ai->ai_next[i] = -1;
+		}
+		ai->ai_slots[h].as_first = i;
+	}
+
+	return ai;
+}
+
+/* Returns the index of e, or NULL if lookups must walk the list */
+static AttrIndex *
+entry_aindex( Entry *e )
+{
+	AttrIndex *ai;
+
+	if ( !( e->e_ocflags & SLAP_OC__INDEX ))
+		return NULL;
+
+	ai = e->e_aindex;
+	if ( ai == NULL ) {
+		/* a single lookup is cheaper without the table */
+		e->e_aindex = &ai_once;
+		return NULL;
+	} else if ( ai == &ai_once ) {
+		ai = attr_index_build( e->e_attrs );
+		e->e_aindex = ai;
+	} else if ( ai != &ai_none && ai->ai_head != e->e_attrs ) {
+		/* the list was replaced, don't trust the index any more */
+		entry_attr_unindex( e );
+		return NULL;
+	}
+
+	return ai == &ai_none ? NULL : ai;
+}
+
+static int
+attr_index_first( AttrIndex *ai, AttributeType *t )
+{
+	unsigned h = AI_HASH( ai, t );
+
+	while ( ai->ai_slots[h].as_type ) {
+		if ( ai->ai_slots[h].as_type == t )
+			return ai->ai_slots[h].as_first;
+		h = ( h + 1 ) & ai->ai_mask;
+	}
+	return -1;
+}
+
+void
+entry_attr_index( Entry *e )
+{
+	if ( e->e_ocflags & SLAP_OC__INDEX )
+		return;
+	e->e_aindex = NULL;
+	e->e_ocflags |= SLAP_OC__INDEX;
+}
+
+void
+entry_attr_unindex( Entry *e )
+{
+	if ( !( e->e_ocflags & SLAP_OC__INDEX ))
+		return;
+	if ( e->e_aindex != &ai_none && e->e_aindex != &ai_once )
+		ch_free( e->e_aindex );
+	e->e_aindex = NULL;
+	e->e_ocflags &= ~SLAP_OC__INDEX;
+}
+
+/* Same as attr_find( e->e_attrs, desc ) */
+Attribute *
+entry_attr_find( Entry *e, AttributeDescription *desc )
+{
+	AttrIndex *ai = entry_aindex( e );
+	int i;
+
+	if ( ai == NULL )
+		return attr_find( e->e_attrs, desc );
+
+	for ( i = attr_index_first( ai, desc->ad_type ); i >= 0; i = ai->ai_next[i] ) {
+		if ( ai->ai_attrs[i]->a_desc == desc )
+			return ai->ai_attrs[i];
+	}
+	return NULL;
+}
+
+/* Same as attrs_find( e->e_attrs, desc ) */
+Attribute *
+entry_attrs_find( Entry *e, AttributeDescription *desc )
+{
+	AttrIndex *ai = entry_aindex( e );
+	int i;
+
+	/* subtypes live in other chains */
+	if ( ai == NULL || desc->ad_type->sat_subtypes )
+		return attrs_find( e->e_attrs, desc );
+
+	for ( i = attr_index_first( ai, desc->ad_type ); i >= 0; i = ai->ai_next[i] ) {
+		if ( is_ad_subtype( ai->ai_attrs[i]->a_desc, desc ))
+			return ai->ai_attrs[i];
+	}
+	return NULL;
+}
+
+/* Same as attrs_find( a->a_next, desc ), a being a previous match */
+Attribute *
+entry_attrs_next( Entry *e, Attribute *a, AttributeDescription *desc )
+{
+	AttrIndex *ai = entry_aindex( e );
+	int i;
+
+	if ( ai == NULL || desc->ad_type->sat_subtypes
+		|| a->a_desc->ad_type != desc->ad_type )
+		return attrs_find( a->a_next, desc );
+
+	for ( i = attr_index_first( ai, desc->ad_type ); i >= 0; i = ai->ai_next[i] ) {
+		if ( ai->ai_attrs[i] == a )
+			break;
+	}
+	if ( i < 0 )
+		return attrs_find( a->a_next, desc );
+
+	for ( i = ai->ai_next[i]; i >= 0; i = ai->ai_next[i] ) {
+		if ( is_ad_subtype( ai->ai_attrs[i]->a_desc, desc ))
+			return ai->ai_attrs[i];
+	}
+	return NULL;
+}
+
 
 /*
  * These routines are used only by Backend.
@@ -937,7 +1144,7 @@ entry_dup2( Entry *dest, Entry *source )
 	ber_dupbv( &dest->e_name, &source->e_name );
 	ber_dupbv( &dest->e_nname, &source->e_nname );
 	dest->e_attrs = attrs_dup( source->e_attrs );
-	dest->e_ocflags = source->e_ocflags;
+	dest->e_ocflags = source->e_ocflags & ~SLAP_OC__INDEX;
 
 	return dest;
 }
@@ -969,7 +1176,7 @@ Entry *entry_dup_bv( Entry *e )
 	entry_partsize(e, &len, &nattrs, &nvals, 1);
 	ret->e_id = e->e_id;
 	ret->e_attrs = attrs_alloc( nattrs );
-	ret->e_ocflags = e->e_ocflags;
+	ret->e_ocflags = e->e_ocflags & ~SLAP_OC__INDEX;
 	ret->e_bv.bv_len = len + nvals * sizeof(struct berval);
 	ret->e_bv.bv_val = ch_malloc( ret->e_bv.bv_len );
 
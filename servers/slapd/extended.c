@@ -60,6 +60,7 @@ static struct {
 } builtin_extops[] = {
 	{ &slap_EXOP_TXN_START, 0, txn_start_extop },
 	{ &slap_EXOP_TXN_END, 0, txn_end_extop },
+	{ &slap_EXOP_SNAPSHOT, 0, snapshot_extop },
 	{ &slap_EXOP_CANCEL, 0, cancel_extop },
 	{ &slap_EXOP_WHOAMI, 0, whoami_extop },
 	{ &slap_EXOP_MODIFY_PASSWD, SLAP_EXOP_WRITES, passwd_extop },
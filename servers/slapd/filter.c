@@ -37,6 +37,35 @@
 const Filter *slap_filter_objectClass_pres;
 const struct berval *slap_filterstr_objectClass_pres;
 
+/*
+ * Search filters are remembered by their BER encoding, along with
+ * their normalized form and string representation, so that clients
+ * sending the same filters over and over do not have every assertion
+ * value normalized again.
+ */
+unsigned int filter_cache_max = SLAP_FILTER_CACHE_DEFAULT;
+
+#define FC_BUCKETS	4096
+#define FC_MAXRAW	1024	/* don't bother with larger filters */
+
+typedef struct FilterCacheEntry {
+	struct FilterCacheEntry *fc_next;	/* hash chain */
+	struct FilterCacheEntry *fc_lru_prev;
+	struct FilterCacheEntry *fc_lru_next;
+	unsigned fc_hash;
+	struct berval fc_raw;
+	struct berval fc_str;
+	Filter *fc_filter;
+} FilterCacheEntry;
+
+static struct {
+	ldap_pvt_thread_mutex_t fc_mutex;
+	FilterCacheEntry *fc_buckets[FC_BUCKETS];
+	FilterCacheEntry *fc_lru_head;		/* most recently used */
+	FilterCacheEntry *fc_lru_tail;
+	unsigned fc_count;
+} filter_cache;
+
 #ifndef SLAPD_MAX_FILTER_DEPTH
 #define SLAPD_MAX_FILTER_DEPTH	5000
 #endif
@@ -76,13 +105,16 @@ filter_init( void )
 	slap_filter_objectClass_pres = &filter_objectClass_pres;
 	slap_filterstr_objectClass_pres = &filterstr_objectClass_pres;
 
+	ldap_pvt_thread_mutex_init( &filter_cache.fc_mutex );
+
 	return 0;
 }
 
 void
 filter_destroy( void )
 {
-	return;
+	filter_cache_flush();
+	ldap_pvt_thread_mutex_destroy( &filter_cache.fc_mutex );
 }
 
 static int
@@ -332,6 +364,226 @@ get_filter(
 	return get_filter0( op, ber, filt, text, 0 );
 }
 
+static unsigned
+fc_hashstr( const char *s, ber_len_t len )
+{
+	unsigned h = 2166136261U;	/* FNV-1a */
+
+	while ( len-- ) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void
+fc_unlink( FilterCacheEntry *fc )
+{
+	FilterCacheEntry **fp;
+
+	for ( fp = &filter_cache.fc_buckets[fc->fc_hash % FC_BUCKETS];
+		*fp != fc; fp = &(*fp)->fc_next )
+		;
+	*fp = fc->fc_next;
+
+	if ( fc->fc_lru_prev )
+		fc->fc_lru_prev->fc_lru_next = fc->fc_lru_next;
+	else
+		filter_cache.fc_lru_head = fc->fc_lru_next;
+	if ( fc->fc_lru_next )
+		fc->fc_lru_next->fc_lru_prev = fc->fc_lru_prev;
+	else
+		filter_cache.fc_lru_tail = fc->fc_lru_prev;
+
+	filter_cache.fc_count--;
+	filter_free( fc->fc_filter );
+	ch_free( fc );
+}
+
+/*
+ * Only filters that came out the same regardless of the schema
+ * additions that may follow are kept: no undefined attributes and
+ * no assertions that could not be parsed or normalized.
+ */
+static int
+fc_cacheable( Filter *f )
+{
+	for ( ; f; f = f->f_next ) {
+		if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+			return 0;
+
+		switch ( f->f_choice ) {
+		case LDAP_FILTER_AND:
+		case LDAP_FILTER_OR:
+		case LDAP_FILTER_NOT:
+			if ( !fc_cacheable( f->f_list ) )
+				return 0;
+			break;
+
+		case LDAP_FILTER_EXT:
+#ifdef LDAP_COMP_MATCH
+			if ( f->f_mra->ma_cf )
+				return 0;
+#endif
+			/* FALLTHRU */
+		case LDAP_FILTER_PRESENT:
+		case LDAP_FILTER_EQUALITY:
+		case LDAP_FILTER_GE:
+		case LDAP_FILTER_LE:
+		case LDAP_FILTER_APPROX:
+		case LDAP_FILTER_SUBSTRINGS:
+#ifdef LDAP_COMP_MATCH
+			if ( f->f_choice != LDAP_FILTER_PRESENT &&
+				f->f_choice != LDAP_FILTER_SUBSTRINGS &&
+				f->f_choice != LDAP_FILTER_EXT && f->f_ava->aa_cf )
+				return 0;
+#endif
+			break;
+
+		default:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Parse a search filter and its string representation, reusing
+ * the result of an earlier search that sent the same filter.
+ */
+int
+get_filter_cached(
+	Operation *op,
+	BerElement *ber,
+	Filter **filt,
+	struct berval *fstr,
+	const char **text )
+{
+	BerElementBuffer berbuf;
+	BerElement *fber = (BerElement *)&berbuf;
+	FilterCacheEntry *fc;
+	struct berval raw;
+	unsigned hash;
+	int rc;
+
+	if ( !filter_cache_max ) {
+		goto nocache;
+	}
+
+	if ( ber_skip_raw( ber, &raw ) == LBER_DEFAULT ) {
+		*text = "error decoding filter";
+		return SLAPD_DISCONNECT;
+	}
+
+	hash = fc_hashstr( raw.bv_val, raw.bv_len );
+
+	ldap_pvt_thread_mutex_lock( &filter_cache.fc_mutex );
+	for ( fc = filter_cache.fc_buckets[hash % FC_BUCKETS]; fc; fc = fc->fc_next ) {
+		if ( fc->fc_hash == hash && fc->fc_raw.bv_len == raw.bv_len &&
+			memcmp( fc->fc_raw.bv_val, raw.bv_val, raw.bv_len ) == 0 )
+		{
+			break;
+		}
+	}
+	if ( fc ) {
+		if ( fc != filter_cache.fc_lru_head ) {
+			fc->fc_lru_prev->fc_lru_next = fc->fc_lru_next;
+			if ( fc->fc_lru_next )
+				fc->fc_lru_next->fc_lru_prev = fc->fc_lru_prev;
+			else
+				filter_cache.fc_lru_tail = fc->fc_lru_prev;
+			fc->fc_lru_prev = NULL;
+			fc->fc_lru_next = filter_cache.fc_lru_head;
+			filter_cache.fc_lru_head->fc_lru_prev = fc;
+			filter_cache.fc_lru_head = fc;
+		}
+		*filt = filter_dup( fc->fc_filter, op->o_tmpmemctx );
+		ber_dupbv_x( fstr, &fc->fc_str, op->o_tmpmemctx );
+		ldap_pvt_thread_mutex_unlock( &filter_cache.fc_mutex );
+		return LDAP_SUCCESS;
+	}
+	ldap_pvt_thread_mutex_unlock( &filter_cache.fc_mutex );
+
+	if ( raw.bv_len > FC_MAXRAW ) {
+		ber_init2( fber, &raw, 0 );
+		rc = get_filter( op, fber, filt, text );
+		if ( rc == LDAP_SUCCESS ) {
+			filter2bv_x( op, *filt, fstr );
+		}
+		return rc;
+	}
+
+	/* decoding terminates strings in place, take the key first */
+	fc = ch_malloc( sizeof( FilterCacheEntry ) + FC_MAXRAW );
+	fc->fc_hash = hash;
+	fc->fc_raw.bv_val = (char *)( fc + 1 );
+	fc->fc_raw.bv_len = raw.bv_len;
+	AC_MEMCPY( fc->fc_raw.bv_val, raw.bv_val, raw.bv_len );
+
+	ber_init2( fber, &raw, 0 );
+	rc = get_filter( op, fber, filt, text );
+	if ( rc != LDAP_SUCCESS ) {
+		ch_free( fc );
+		return rc;
+	}
+	filter2bv_x( op, *filt, fstr );
+
+	if ( !fc_cacheable( *filt ) ) {
+		ch_free( fc );
+		return rc;
+	}
+
+	fc = ch_realloc( fc, sizeof( FilterCacheEntry ) + raw.bv_len +
+		fstr->bv_len + 1 );
+	fc->fc_raw.bv_val = (char *)( fc + 1 );
+	fc->fc_str.bv_val = fc->fc_raw.bv_val + raw.bv_len;
+	fc->fc_str.bv_len = fstr->bv_len;
+	AC_MEMCPY( fc->fc_str.bv_val, fstr->bv_val, fstr->bv_len + 1 );
+	fc->fc_filter = filter_dup( *filt, NULL );
+
+	ldap_pvt_thread_mutex_lock( &filter_cache.fc_mutex );
+	while ( filter_cache.fc_lru_tail &&
+		filter_cache.fc_count >= filter_cache_max )
+	{
+		fc_unlink( filter_cache.fc_lru_tail );
+	}
+	/* a concurrent search may have added it too, that's harmless */
+	fc->fc_next = filter_cache.fc_buckets[hash % FC_BUCKETS];
+	filter_cache.fc_buckets[hash % FC_BUCKETS] = fc;
+	fc->fc_lru_prev = NULL;
+	fc->fc_lru_next = filter_cache.fc_lru_head;
+	if ( filter_cache.fc_lru_head )
+		filter_cache.fc_lru_head->fc_lru_prev = fc;
+	else
+		filter_cache.fc_lru_tail = fc;
+	filter_cache.fc_lru_head = fc;
+	filter_cache.fc_count++;
+	ldap_pvt_thread_mutex_unlock( &filter_cache.fc_mutex );
+
+	return rc;
+
+nocache:
+	rc = get_filter( op, ber, filt, text );
+	if ( rc == LDAP_SUCCESS ) {
+		filter2bv_x( op, *filt, fstr );
+	}
+	return rc;
+}
+
+/*
+ * Called when schema elements go away, since cached filters
+ * point to their descriptions.
+ */
+void
+filter_cache_flush( void )
+{
+	ldap_pvt_thread_mutex_lock( &filter_cache.fc_mutex );
+	while ( filter_cache.fc_lru_tail ) {
+		fc_unlink( filter_cache.fc_lru_tail );
+	}
+	ldap_pvt_thread_mutex_unlock( &filter_cache.fc_mutex );
+}
+
 
 static int
 get_filter_list( Operation *op, BerElement *ber,
@@ -200,9 +200,9 @@ static int test_mra_filter(
 			return LDAP_COMPARE_FALSE;
 		}
 
-		for ( a = attrs_find( e->e_attrs, mra->ma_desc );
+		for ( a = entry_attrs_find( e, mra->ma_desc );
 			a != NULL;
-			a = attrs_find( a->a_next, mra->ma_desc ) )
+			a = entry_attrs_next( e, a, mra->ma_desc ) )
 		{
 			struct berval	*bv;
 			int		normalize_attribute = 0;
@@ -612,9 +612,9 @@ test_ava_filter(
 	}
 #endif
 
-	for(a = attrs_find( e->e_attrs, ava->aa_desc );
+	for(a = entry_attrs_find( e, ava->aa_desc );
 		a != NULL;
-		a = attrs_find( a->a_next, ava->aa_desc ) )
+		a = entry_attrs_next( e, a, ava->aa_desc ) )
 	{
 		int use;
 		MatchingRule *mr;
@@ -845,9 +845,9 @@ test_presence_filter(
 
 	rc = LDAP_COMPARE_FALSE;
 
-	for(a = attrs_find( e->e_attrs, desc );
+	for(a = entry_attrs_find( e, desc );
 		a != NULL;
-		a = attrs_find( a->a_next, desc ) )
+		a = entry_attrs_next( e, a, desc ) )
 	{
 		if (( desc != a->a_desc ) && !access_allowed( op,
 			e, a->a_desc, NULL, ACL_SEARCH, NULL ))
@@ -945,9 +945,9 @@ test_substrings_filter(
 
 	rc = LDAP_COMPARE_FALSE;
 
-	for(a = attrs_find( e->e_attrs, f->f_sub_desc );
+	for(a = entry_attrs_find( e, f->f_sub_desc );
 		a != NULL;
-		a = attrs_find( a->a_next, f->f_sub_desc ) )
+		a = entry_attrs_next( e, a, f->f_sub_desc ) )
 	{
 		MatchingRule *mr;
 		struct berval *bv;
@@ -984,3 +984,275 @@ test_substrings_filter(
 		rc );
 	return rc;
 }
+
+/*
+ * Compiled filters.  A search that tests its filter against many
+ * candidates can compile it once into a flat array of nodes in
+ * evaluation order: each node is followed by its children and knows
+ * the size of its subtree, so AND/OR/NOT walk the array instead of
+ * following the Filter lists, and leaves go straight to the test
+ * routines.  The children of AND and OR are ordered by estimated cost
+ * so that the cheap tests get a chance to decide the result first;
+ * constant (COMPUTED or UNDEFINED) children cost nothing and go first.
+ *
+ * Reordering only changes which non-TRUE/FALSE result is returned
+ * when several children are undefined, never whether the filter
+ * matches.
+ */
+typedef struct FilterInsn {
+	ber_tag_t	fi_choice;	/* f_choice without the UNDEFINED bit */
+	int		fi_len;		/* number of nodes in this subtree */
+	int		fi_result;	/* for SLAPD_FILTER_COMPUTED */
+	Filter		*fi_filter;
+} FilterInsn;
+
+struct FilterProg {
+	int		fp_len;
+	FilterInsn	fp_insns[1];
+};
+
+/* estimated relative cost of testing a filter against an entry */
+static int
+filter_cost( Filter *f )
+{
+	int cost;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+		return 0;
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		return 0;
+
+	case LDAP_FILTER_PRESENT:
+		cost = 1;
+		if ( f->f_desc == slap_schema.si_ad_hasSubordinates )
+			cost += 8;
+		return cost;
+
+	case LDAP_FILTER_EQUALITY:
+	case LDAP_FILTER_APPROX:
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+		cost = f->f_choice == LDAP_FILTER_EQUALITY ? 2 : 3;
+		if ( f->f_av_desc == slap_schema.si_ad_hasSubordinates )
+			cost += 8;
+		return cost;
+
+	case LDAP_FILTER_SUBSTRINGS:
+		cost = 4;
+		if ( f->f_sub_any ) {
+			int i;
+			for ( i = 0; !BER_BVISNULL( &f->f_sub_any[i] ); i++ )
+				cost++;
+		}
+		return cost;
+
+	case LDAP_FILTER_EXT:
+		return 8;
+
+	case LDAP_FILTER_NOT:
+		return filter_cost( f->f_not );
+
+	case LDAP_FILTER_AND:
+	case LDAP_FILTER_OR:
+		cost = 0;
+		for ( f = f->f_and; f; f = f->f_next )
+			cost += filter_cost( f );
+		return cost;
+	}
+
+	return 8;
+}
+
+static int
+filter_nodes( Filter *f )
+{
+	int n = 1;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+		return n;
+
+	switch ( f->f_choice ) {
+	case LDAP_FILTER_NOT:
+		n += filter_nodes( f->f_not );
+		break;
+
+	case LDAP_FILTER_AND:
+	case LDAP_FILTER_OR:
+		for ( f = f->f_and; f; f = f->f_next )
+			n += filter_nodes( f );
+		break;
+	}
+
+	return n;
+}
+
+static int
+filter_emit( Operation *op, FilterInsn *fi, Filter *f )
+{
+	fi->fi_filter = f;
+	fi->fi_len = 1;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED ) {
+		fi->fi_choice = SLAPD_FILTER_COMPUTED;
+		fi->fi_result = SLAPD_COMPARE_UNDEFINED;
+		return fi->fi_len;
+	}
+
+	fi->fi_choice = f->f_choice;
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		fi->fi_result = f->f_result;
+		break;
+
+	case LDAP_FILTER_NOT:
+		fi->fi_len += filter_emit( op, fi + 1, f->f_not );
+		break;
+
+	case LDAP_FILTER_AND:
+	case LDAP_FILTER_OR: {
+		Filter *sub, **kids;
+		int *costs, n = 0, i, j;
+
+		for ( sub = f->f_and; sub; sub = sub->f_next )
+			n++;
+		if ( n == 0 )
+			break;
+		kids = op->o_tmpalloc( n * ( sizeof( Filter * ) + sizeof( int ) ),
+			op->o_tmpmemctx );
+		costs = (int *)( kids + n );
+
+		/* stable insertion sort on cost */
+		for ( i = 0, sub = f->f_and; sub; sub = sub->f_next, i++ ) {
+			int c = filter_cost( sub );
+
+			for ( j = i; j > 0 && costs[j - 1] > c; j-- ) {
+				kids[j] = kids[j - 1];
+				costs[j] = costs[j - 1];
+			}
+			kids[j] = sub;
+			costs[j] = c;
+		}
+
+		for ( i = 0; i < n; i++ )
+			fi->fi_len += filter_emit( op, fi + fi->fi_len, kids[i] );
+		op->o_tmpfree( kids, op->o_tmpmemctx );
+		} break;
+	}
+
+	return fi->fi_len;
+}
+
+/*
+ * filter_compile - compile a filter for repeated use by test_filter_prog,
+ * the result is allocated on the operation's memory context and refers
+ * to the filter, which must outlive it.
+ */
+FilterProg *
+filter_compile( Operation *op, Filter *f )
+{
+	FilterProg *fp;
+	int n = filter_nodes( f );
+
+	fp = op->o_tmpalloc( sizeof( FilterProg ) +
+		( n - 1 ) * sizeof( FilterInsn ), op->o_tmpmemctx );
+	fp->fp_len = filter_emit( op, fp->fp_insns, f );
+	assert( fp->fp_len == n );
+
+	return fp;
+}
+
+void
+filter_prog_free( Operation *op, FilterProg *fp )
+{
+	op->o_tmpfree( fp, op->o_tmpmemctx );
+}
+
+static int
+test_filter_insn(
+	Operation	*op,
+	Entry		*e,
+	FilterInsn	*fi )
+{
+	FilterInsn *end = fi + fi->fi_len, *sub;
+	Filter *f = fi->fi_filter;
+	int rc;
+
+	switch ( fi->fi_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		return fi->fi_result;
+
+	case LDAP_FILTER_EQUALITY:
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+	case LDAP_FILTER_APPROX:
+		return test_ava_filter( op, e, f->f_ava, fi->fi_choice );
+
+	case LDAP_FILTER_PRESENT:
+		return test_presence_filter( op, e, f->f_desc );
+
+	case LDAP_FILTER_SUBSTRINGS:
+		return test_substrings_filter( op, e, f );
+
+	case LDAP_FILTER_EXT:
+		return test_mra_filter( op, e, f->f_mra );
+
+	case LDAP_FILTER_NOT:
+		rc = test_filter_insn( op, e, fi + 1 );
+		switch ( rc ) {
+		case LDAP_COMPARE_TRUE:
+			return LDAP_COMPARE_FALSE;
+		case LDAP_COMPARE_FALSE:
+			return LDAP_COMPARE_TRUE;
+		}
+		return rc;
+
+	case LDAP_FILTER_AND:
+		rc = LDAP_COMPARE_TRUE;
+		for ( sub = fi + 1; sub < end; sub += sub->fi_len ) {
+			int rc2 = test_filter_insn( op, e, sub );
+
+			if ( rc2 == LDAP_COMPARE_FALSE )
+				return rc2;
+			if ( rc2 != LDAP_COMPARE_TRUE )
+				rc = rc2;
+		}
+		return rc;
+
+	case LDAP_FILTER_OR:
+		rc = LDAP_COMPARE_FALSE;
+		for ( sub = fi + 1; sub < end; sub += sub->fi_len ) {
+			int rc2 = test_filter_insn( op, e, sub );
+
+			if ( rc2 == LDAP_COMPARE_TRUE )
+				return rc2;
+			if ( rc2 != LDAP_COMPARE_FALSE )
+				rc = rc2;
+		}
+		return rc;
+	}
+
+	Debug( LDAP_DEBUG_ANY, "    unknown filter type %lu\n",
+		fi->fi_choice );
+	return LDAP_PROTOCOL_ERROR;
+}
+
+/*
+ * test_filter_prog - test a compiled filter against a single entry,
+ * returns the same as test_filter.
+ */
+int
+test_filter_prog(
+	Operation	*op,
+	Entry		*e,
+	FilterProg	*fp )
+{
+	int	rc;
+
+	Debug( LDAP_DEBUG_FILTER, "=> test_filter_prog\n" );
+	rc = test_filter_insn( op, e, fp->fp_insns );
+	Debug( LDAP_DEBUG_FILTER, "<= test_filter_prog %d\n", rc );
+
+	return rc;
+}
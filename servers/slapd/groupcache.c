@@ -0,0 +1,487 @@
+/* groupcache.c - server-wide cache of static group memberships */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1998-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/*
+ * The op->o_groups list only remembers group checks for the lifetime
+ * of a single operation, so every search evaluating "group=" ACL
+ * clauses fetches and decodes the same group entries again. This cache
+ * keeps the normalized member values of static groups in a hash table,
+ * keyed by the database, group DN, objectClass and member attribute.
+ *
+ * Only groups read from backends that graduate every write through
+ * slap_graduate_commit_csn(), and that carry an entryCSN, are cached.
+ * Entries are dropped when the group is written, again after the
+ * commit when that comes later (transactions, syncrepl batches), when
+ * the group entry is found with a different entryCSN, and the whole
+ * cache is dropped by a modrdn or a subtree delete.
+ *
+ * A check that raced with a write must not cache what it read before
+ * the write: a generation counter per hash slot catches writes that
+ * graduate between the check and the add. A reader may also still be
+ * looking at a snapshot older than a write that graduated before its
+ * check, so each slot remembers when it was last written and the
+ * newest CSN written; an operation that started before that write
+ * only caches an entry at least as new as that CSN.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+
+#include <ac/string.h>
+
+#include "slap.h"
+#include "lutil.h"
+
+unsigned long group_cache_max = SLAP_GROUP_CACHE_DEFAULT;
+
+#define GC_BUCKETS	4096
+
+typedef struct GroupCacheEntry {
+	struct GroupCacheEntry *gc_next;	/* hash chain */
+	struct GroupCacheEntry *gc_lru_prev;
+	struct GroupCacheEntry *gc_lru_next;
+	BackendDB *gc_be;
+	ObjectClass *gc_oc;
+	AttributeDescription *gc_at;
+	unsigned gc_hash;
+	struct berval gc_ndn;
+	struct berval gc_csn;
+	int gc_noattr;
+	unsigned gc_mask;		/* member slots - 1 */
+	struct berval *gc_members;
+	ber_len_t gc_size;
+} GroupCacheEntry;
+
+static struct {
+	ldap_pvt_thread_mutex_t gc_mutex;
+	GroupCacheEntry *gc_buckets[GC_BUCKETS];
+	unsigned long gc_gen[GC_BUCKETS];
+	time_t gc_written[GC_BUCKETS];
+	char gc_wcsn[GC_BUCKETS][LDAP_PVT_CSNSTR_BUFSIZE];	/* "" if unknown */
+	time_t gc_flushed;
+	GroupCacheEntry *gc_lru_head;		/* most recently used */
+	GroupCacheEntry *gc_lru_tail;
+	unsigned long gc_count;
+	unsigned long gc_bytes;
+	unsigned long gc_hits;
+	unsigned long gc_misses;
+} group_cache;
+
+static unsigned
+gc_hashstr( const char *s, ber_len_t len )
+{
+	unsigned h = 2166136261U;	/* FNV-1a */
+
+	while ( len-- ) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+void
+group_cache_init( void )
+{
+	ldap_pvt_thread_mutex_init( &group_cache.gc_mutex );
+}
+
+static void
+gc_unlink( GroupCacheEntry *gc )
+{
+	GroupCacheEntry **gp;
+
+	for ( gp = &group_cache.gc_buckets[gc->gc_hash % GC_BUCKETS];
+		*gp != gc; gp = &(*gp)->gc_next )
+		;
+	*gp = gc->gc_next;
+
+	if ( gc->gc_lru_prev )
+		gc->gc_lru_prev->gc_lru_next = gc->gc_lru_next;
+	else
+		group_cache.gc_lru_head = gc->gc_lru_next;
+	if ( gc->gc_lru_next )
+		gc->gc_lru_next->gc_lru_prev = gc->gc_lru_prev;
+	else
+		group_cache.gc_lru_tail = gc->gc_lru_prev;
+
+	group_cache.gc_count--;
+	group_cache.gc_bytes -= gc->gc_size;
+	ch_free( gc );
+}
+
+static void
+gc_touch( GroupCacheEntry *gc )
+{
+	if ( gc == group_cache.gc_lru_head )
+		return;
+
+	gc->gc_lru_prev->gc_lru_next = gc->gc_lru_next;
+	if ( gc->gc_lru_next )
+		gc->gc_lru_next->gc_lru_prev = gc->gc_lru_prev;
+	else
+		group_cache.gc_lru_tail = gc->gc_lru_prev;
+
+	gc->gc_lru_prev = NULL;
+	gc->gc_lru_next = group_cache.gc_lru_head;
+	group_cache.gc_lru_head->gc_lru_prev = gc;
+	group_cache.gc_lru_head = gc;
+}
+
+static GroupCacheEntry *
+gc_find( BackendDB *be, struct berval *gr_ndn, unsigned hash,
+	ObjectClass *group_oc, AttributeDescription *group_at )
+{
+	GroupCacheEntry *gc;
+
+	for ( gc = group_cache.gc_buckets[hash % GC_BUCKETS]; gc; gc = gc->gc_next ) {
+		if ( gc->gc_hash == hash && gc->gc_be == be &&
+			gc->gc_oc == group_oc && gc->gc_at == group_at &&
+			gc->gc_ndn.bv_len == gr_ndn->bv_len &&
+			memcmp( gc->gc_ndn.bv_val, gr_ndn->bv_val, gr_ndn->bv_len ) == 0 )
+		{
+			break;
+		}
+	}
+	return gc;
+}
+
+/*
+ * The member set is only consulted when an exact comparison of the
+ * normalized values gives the same answer as attr_valfind(): for
+ * distinguishedNameMatch, and for uniqueMemberMatch as long as the
+ * asserted DN cannot be taken for one carrying an optional UID.
+ * Databases that rewrite DNs are skipped, since writes would be
+ * seen under a different name than the one the group was read by,
+ * and so are backends such as proxies that do not graduate their
+ * writes, as the cache would never hear of them.
+ */
+int
+group_cache_usable(
+	BackendDB *be,
+	AttributeDescription *group_at,
+	struct berval *op_ndn )
+{
+	MatchingRule *mr;
+
+	if ( !group_cache_max || be == NULL || !SLAP_GRADUATE( be ) )
+		return 0;
+
+	if ( overlay_is_inst( be, "rwm" ) )
+		return 0;
+
+	if ( is_at_subtype( group_at->ad_type,
+		slap_schema.si_ad_labeledURI->ad_type ) )
+		return 0;
+
+	mr = group_at->ad_type->sat_equality;
+	if ( mr == NULL )
+		return 0;
+
+	if ( strcmp( mr->smr_oid, "2.5.13.1" ) == 0 )
+		return 1;
+
+	if ( strcmp( mr->smr_oid, "2.5.13.23" ) == 0 )
+		return memchr( op_ndn->bv_val, '#', op_ndn->bv_len ) == NULL;
+
+	return 0;
+}
+
+/*
+ * Look up op_ndn in the cached member set of gr_ndn. Returns -1 if
+ * the group is not cached, after storing the generation to pass to
+ * group_cache_add(). Otherwise returns the result backend_group()
+ * would have returned.
+ */
+int
+group_cache_check(
+	BackendDB *be,
+	struct berval *gr_ndn,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	struct berval *op_ndn,
+	unsigned long *gen )
+{
+	GroupCacheEntry *gc;
+	unsigned hash, h, i;
+	int rc = -1;
+
+	hash = gc_hashstr( gr_ndn->bv_val, gr_ndn->bv_len );
+
+	ldap_pvt_thread_mutex_lock( &group_cache.gc_mutex );
+	gc = gc_find( be, gr_ndn, hash, group_oc, group_at );
+	if ( gc == NULL ) {
+		group_cache.gc_misses++;
+		*gen = group_cache.gc_gen[hash % GC_BUCKETS];
+
+	} else {
+		group_cache.gc_hits++;
+		gc_touch( gc );
+
+		if ( gc->gc_noattr ) {
+			rc = LDAP_NO_SUCH_ATTRIBUTE;
+
+		} else {
+			rc = LDAP_COMPARE_FALSE;
+			h = gc_hashstr( op_ndn->bv_val, op_ndn->bv_len );
+			for ( i = h & gc->gc_mask; !BER_BVISNULL( &gc->gc_members[i] );
+				i = ( i + 1 ) & gc->gc_mask )
+			{
+				if ( gc->gc_members[i].bv_len == op_ndn->bv_len &&
+					memcmp( gc->gc_members[i].bv_val, op_ndn->bv_val,
+						op_ndn->bv_len ) == 0 )
+				{
+					rc = 0;
+					break;
+				}
+			}
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &group_cache.gc_mutex );
+
+	return rc;
+}
+
+/*
+ * Cache the member values of group entry e, as read after
+ * group_cache_check() returned gen by an operation that started
+ * at started. a is the group_at attribute of e, if any.
+ */
+void
+group_cache_add(
+	BackendDB *be,
+	Entry *e,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	Attribute *a,
+	unsigned long gen,
+	time_t started )
+{
+	GroupCacheEntry *gc, *old;
+	Attribute *csn;
+	unsigned hash, h, i, nslots, slot;
+	ber_len_t size;
+	char *ptr;
+
+	csn = attr_find( e->e_attrs, slap_schema.si_ad_entryCSN );
+	if ( csn == NULL )
+		return;
+
+	/* keep the member table at most half full */
+	nslots = 1;
+	if ( a ) {
+		while ( nslots < 2 * a->a_numvals + 1 )
+			nslots <<= 1;
+	}
+
+	size = sizeof( GroupCacheEntry ) + nslots * sizeof( struct berval ) +
+		e->e_nname.bv_len + 1 + csn->a_nvals[0].bv_len + 1;
+	if ( a ) {
+		for ( i = 0; i < a->a_numvals; i++ )
+			size += a->a_nvals[i].bv_len + 1;
+	}
+	if ( size > group_cache_max )
+		return;
+
+	gc = ch_calloc( 1, size );
+	gc->gc_be = be;
+	gc->gc_oc = group_oc;
+	gc->gc_at = group_at;
+	gc->gc_size = size;
+	gc->gc_noattr = ( a == NULL );
+	gc->gc_mask = nslots - 1;
+	gc->gc_members = (struct berval *)( gc + 1 );
+
+	ptr = (char *)( gc->gc_members + nslots );
+	gc->gc_ndn.bv_val = ptr;
+	gc->gc_ndn.bv_len = e->e_nname.bv_len;
+	ptr = lutil_strncopy( ptr, e->e_nname.bv_val, e->e_nname.bv_len ) + 1;
+	gc->gc_csn.bv_val = ptr;
+	gc->gc_csn.bv_len = csn->a_nvals[0].bv_len;
+	ptr = lutil_strncopy( ptr, csn->a_nvals[0].bv_val,
+		csn->a_nvals[0].bv_len ) + 1;
+
+	if ( a ) {
+		for ( i = 0; i < a->a_numvals; i++ ) {
+			struct berval *bv = &a->a_nvals[i];
+
+			h = gc_hashstr( bv->bv_val, bv->bv_len );
+			for ( h &= gc->gc_mask; !BER_BVISNULL( &gc->gc_members[h] );
+				h = ( h + 1 ) & gc->gc_mask )
+				;
+			gc->gc_members[h].bv_val = ptr;
+			gc->gc_members[h].bv_len = bv->bv_len;
+			ptr = lutil_strncopy( ptr, bv->bv_val, bv->bv_len ) + 1;
+		}
+	}
+
+	hash = gc_hashstr( gc->gc_ndn.bv_val, gc->gc_ndn.bv_len );
+	gc->gc_hash = hash;
+	slot = hash % GC_BUCKETS;
+
+	ldap_pvt_thread_mutex_lock( &group_cache.gc_mutex );
+	if ( group_cache.gc_gen[slot] != gen ||
+		started <= group_cache.gc_flushed ||
+		( started <= group_cache.gc_written[slot] &&
+			( !group_cache.gc_wcsn[slot][0] ||
+			strcmp( gc->gc_csn.bv_val, group_cache.gc_wcsn[slot] ) < 0 )))
+	{
+		/* a write may have happened since we read the entry */
+		ldap_pvt_thread_mutex_unlock( &group_cache.gc_mutex );
+		ch_free( gc );
+		return;
+	}
+
+	old = gc_find( be, &gc->gc_ndn, hash, group_oc, group_at );
+	if ( old )
+		gc_unlink( old );
+
+	while ( group_cache.gc_lru_tail &&
+		group_cache.gc_bytes + size > group_cache_max )
+	{
+		gc_unlink( group_cache.gc_lru_tail );
+	}
+
+	gc->gc_next = group_cache.gc_buckets[hash % GC_BUCKETS];
+	group_cache.gc_buckets[hash % GC_BUCKETS] = gc;
+	gc->gc_lru_next = group_cache.gc_lru_head;
+	if ( group_cache.gc_lru_head )
+		group_cache.gc_lru_head->gc_lru_prev = gc;
+	else
+		group_cache.gc_lru_tail = gc;
+	group_cache.gc_lru_head = gc;
+	group_cache.gc_count++;
+	group_cache.gc_bytes += size;
+	ldap_pvt_thread_mutex_unlock( &group_cache.gc_mutex );
+}
+
+/*
+ * Drop any cached copy of ndn whose entryCSN differs from csn,
+ * or any copy at all if csn is NULL.
+ */
+void
+group_cache_invalidate(
+	struct berval *ndn,
+	struct berval *csn )
+{
+	GroupCacheEntry *gc, *next;
+	unsigned hash;
+
+	if ( BER_BVISEMPTY( ndn ) )
+		return;
+
+	hash = gc_hashstr( ndn->bv_val, ndn->bv_len );
+
+	ldap_pvt_thread_mutex_lock( &group_cache.gc_mutex );
+	if ( csn == NULL )
+		group_cache.gc_gen[hash % GC_BUCKETS]++;
+
+	for ( gc = group_cache.gc_buckets[hash % GC_BUCKETS]; gc; gc = next ) {
+		next = gc->gc_next;
+		if ( gc->gc_hash == hash && dn_match( &gc->gc_ndn, ndn ) &&
+			( csn == NULL || !bvmatch( &gc->gc_csn, csn ) ) )
+		{
+			gc_unlink( gc );
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &group_cache.gc_mutex );
+}
+
+/*
+ * Account for a write to ndn that stored csn; csn is empty if the
+ * write's CSN is not known, and NULL when the write was already
+ * accounted for and has just been committed. A subtree write, that
+ * renames or deletes the entries below ndn, drops the whole cache.
+ */
+void
+group_cache_written(
+	struct berval *ndn,
+	struct berval *csn,
+	int subtree )
+{
+	unsigned hash, slot;
+
+	if ( subtree ) {
+		group_cache_flush( NULL );
+		return;
+	}
+
+	group_cache_invalidate( ndn, NULL );
+
+	hash = gc_hashstr( ndn->bv_val, ndn->bv_len );
+	slot = hash % GC_BUCKETS;
+
+	ldap_pvt_thread_mutex_lock( &group_cache.gc_mutex );
+	if ( csn == NULL ) {
+		/* keep the CSN recorded when the write graduated */
+	} else if ( BER_BVISEMPTY( csn ) ||
+		csn->bv_len >= sizeof( group_cache.gc_wcsn[slot] ) )
+	{
+		/* nothing tells a stale copy from a fresh one now */
+		group_cache.gc_wcsn[slot][0] = '\0';
+	} else if ( !group_cache.gc_written[slot] ||
+		( group_cache.gc_wcsn[slot][0] &&
+		strcmp( csn->bv_val, group_cache.gc_wcsn[slot] ) > 0 ))
+	{
+		AC_MEMCPY( group_cache.gc_wcsn[slot], csn->bv_val, csn->bv_len );
+		group_cache.gc_wcsn[slot][csn->bv_len] = '\0';
+	}
+	group_cache.gc_written[slot] = slap_get_time();
+	ldap_pvt_thread_mutex_unlock( &group_cache.gc_mutex );
+}
+
+/*
+ * Drop all the groups cached from be, or everything if be is NULL.
+ */
+void
+group_cache_flush( BackendDB *be )
+{
+	GroupCacheEntry *gc, *next;
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &group_cache.gc_mutex );
+	for ( gc = group_cache.gc_lru_head; gc; gc = next ) {
+		next = gc->gc_lru_next;
+		if ( be == NULL || gc->gc_be == be )
+			gc_unlink( gc );
+	}
+	for ( i = 0; i < GC_BUCKETS; i++ )
+		group_cache.gc_gen[i]++;
+	group_cache.gc_flushed = slap_get_time();
+	ldap_pvt_thread_mutex_unlock( &group_cache.gc_mutex );
+}
+
+void
+group_cache_stats(
+	unsigned long *hits,
+	unsigned long *misses,
+	unsigned long *count,
+	unsigned long *bytes )
+{
+	ldap_pvt_thread_mutex_lock( &group_cache.gc_mutex );
+	*hits = group_cache.gc_hits;
+	*misses = group_cache.gc_misses;
+	*count = group_cache.gc_count;
+	*bytes = group_cache.gc_bytes;
+	ldap_pvt_thread_mutex_unlock( &group_cache.gc_mutex );
+}
+
+void
+group_cache_destroy( void )
+{
+	group_cache_flush( NULL );
+	ldap_pvt_thread_mutex_destroy( &group_cache.gc_mutex );
+}
@@ -88,6 +88,8 @@ slap_init( int mode, const char *name )
 	slapMode = mode;
 
 	slap_op_init();
+	group_cache_init();
+	dn_cache_init();
 
 #ifdef SLAPD_MODULES
 	if ( module_init() != 0 ) {
@@ -276,6 +278,8 @@ int slap_destroy(void)
 
 	}
 
+	dn_cache_destroy();
+	group_cache_destroy();
 	slap_op_destroy();
 
 	ldap_pvt_thread_destroy();
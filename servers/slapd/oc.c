@@ -84,7 +84,7 @@ int is_entry_objectclass(
 	/*
 	 * find objectClass attribute
 	 */
-	attr = attr_find( e->e_attrs, slap_schema.si_ad_objectClass );
+	attr = entry_attr_find( e, slap_schema.si_ad_objectClass );
 	if ( attr == NULL ) {
 		/* no objectClass attribute */
 		Debug( LDAP_DEBUG_ANY, "is_entry_objectclass(\"%s\", \"%s\") "
@@ -426,6 +426,8 @@ oc_delete( ObjectClass *oc )
 	LDAP_STAILQ_REMOVE(&oc_list, oc, ObjectClass, soc_next);
 
 	oc_delete_names( oc );
+	filter_cache_flush();
+	dn_cache_flush();
 }
 
 static void
@@ -63,6 +63,14 @@ typedef struct log_base {
 	struct berval lb_line;
 } log_base;
 
+/* A log entry waiting to be written to the log DB */
+typedef struct log_pending {
+	struct log_pending *lp_next;
+	Entry *lp_e;
+	struct berval lp_csn;
+	int lp_queue;	/* lp_csn must be queued on the log DB */
+} log_pending;
+
 typedef struct log_info {
 	BackendDB *li_db;
 	struct berval li_db_suffix;
@@ -80,6 +88,8 @@ typedef struct log_info {
 	int *li_sids, li_numcsns;
 	ldap_pvt_thread_mutex_t li_op_rmutex;
 	ldap_pvt_thread_mutex_t li_log_mutex;
+	log_pending *li_pending, **li_pendtail;
+	ldap_pvt_thread_mutex_t li_flush_mutex;
 } log_info;
 
 static ConfigDriver log_cf_gen;
@@ -599,6 +609,7 @@ log_age_unparse( int age, struct berval *agebv, size_t size )
 static slap_callback nullsc;
 
 #define PURGE_INCREMENT	100
+#define PURGE_BATCH	100
 
 typedef struct purge_data {
 	struct log_info *li;
@@ -657,6 +668,42 @@ log_old_lookup( Operation *op, SlapReply *rs )
 	return 0;
 }
 
+/* Delete the entries pd->dn[i] to pd->dn[n-1] in one transaction on the
+ * log DB. Any failure rolls the whole batch back and is returned, the
+ * caller then deletes the entries one at a time.
+ */
+static int
+log_purge_batch( Operation *op, purge_data *pd, int i, int n )
+{
+	BackendInfo *bi = op->o_bd->bd_info;
+	SlapReply rs = {REP_RESULT};
+	OpExtra *txn = NULL;
+	int rc;
+
+	if ( bi->bi_op_txn == NULL || bi->bi_op_txn( op, SLAP_TXN_BEGIN, &txn ))
+		return LDAP_OTHER;
+
+	for ( rc = LDAP_SUCCESS; i < n && rc == LDAP_SUCCESS; i++ ) {
+		op->o_req_dn = pd->dn[i];
+		op->o_req_ndn = pd->ndn[i];
+		rs_reinit( &rs, REP_RESULT );
+		op->o_bd->be_delete( op, &rs );
+		rc = rs.sr_err;
+	}
+
+	LDAP_SLIST_REMOVE( &op->o_extra, txn, OpExtra, oe_next );
+	if ( rc == LDAP_SUCCESS ) {
+		rc = bi->bi_op_txn( op, SLAP_TXN_COMMIT, &txn );
+	} else {
+		bi->bi_op_txn( op, SLAP_TXN_ABORT, &txn );
+	}
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "accesslog_purge: "
+			"batched delete failed (%d), retrying one at a time\n", rc );
+	}
+	return rc;
+}
+
 /* Periodically search for old entries in the log database and delete them */
 static void *
 accesslog_purge( void *ctx, void *arg )
@@ -712,7 +759,7 @@ accesslog_purge( void *ctx, void *arg )
 	op->o_tmpfree( op->ors_filterstr.bv_val, op->o_tmpmemctx );
 
 	if ( pd.used ) {
-		int i;
+		int i, j, n;
 
 		op->o_callback = &nullsc;
 		op->o_dont_replicate = 1;
@@ -744,17 +791,24 @@ accesslog_purge( void *ctx, void *arg )
 			}
 		}
 
-		/* delete the expired entries */
+		/* delete the expired entries, PURGE_BATCH per transaction */
 		op->o_tag = LDAP_REQ_DELETE;
-		for (i=0; i<pd.used; i++) {
-			op->o_req_dn = pd.dn[i];
-			op->o_req_ndn = pd.ndn[i];
-			if ( !slapd_shutdown ) {
-				rs_reinit( &rs, REP_RESULT );
-				op->o_bd->be_delete( op, &rs );
+		for (i=0; i<pd.used; i=n) {
+			n = i + PURGE_BATCH;
+			if ( n > pd.used )
+				n = pd.used;
+			if ( !slapd_shutdown && log_purge_batch( op, &pd, i, n )) {
+				for (j=i; j<n && !slapd_shutdown; j++) {
+					op->o_req_dn = pd.dn[j];
+					op->o_req_ndn = pd.ndn[j];
+					rs_reinit( &rs, REP_RESULT );
+					op->o_bd->be_delete( op, &rs );
+				}
+			}
+			for (j=i; j<n; j++) {
+				ch_free( pd.ndn[j].bv_val );
+				ch_free( pd.dn[j].bv_val );
 			}
-			ch_free( pd.ndn[i].bv_val );
-			ch_free( pd.dn[i].bv_val );
 			ldap_pvt_thread_pool_pausecheck( &connection_pool );
 		}
 		ch_free( pd.ndn );
@@ -1475,6 +1529,107 @@ accesslog_op2logop( Operation *op )
 	return LOG_EN_UNKNOWN;
 }
 
+/* Write the queued log entries. Entries are queued in log order under
+ * li_log_mutex, and whoever gets li_flush_mutex first writes all of
+ * them in a single transaction on the log DB, so concurrent writers
+ * share one commit. Once a caller holds li_flush_mutex its own entry
+ * is either in the list it takes or was committed by a previous
+ * holder. If the batch fails it is rolled back and every entry is
+ * retried in a transaction of its own.
+ */
+static void
+accesslog_flush( Operation *op, log_info *li )
+{
+	Operation op2 = {0};
+	SlapReply rs2 = {REP_RESULT};
+	BackendInfo *bi = li->li_db->bd_info;
+	OpExtra *txn = NULL;
+	log_pending *list, *lp;
+	int n = 0, rc = LDAP_SUCCESS;
+
+	ldap_pvt_thread_mutex_lock( &li->li_flush_mutex );
+	ldap_pvt_thread_mutex_lock( &li->li_log_mutex );
+	list = li->li_pending;
+	li->li_pending = NULL;
+	li->li_pendtail = &li->li_pending;
+	ldap_pvt_thread_mutex_unlock( &li->li_log_mutex );
+
+	if ( list == NULL ) {
+		ldap_pvt_thread_mutex_unlock( &li->li_flush_mutex );
+		return;
+	}
+
+	op2.o_hdr = op->o_hdr;
+	op2.o_tag = LDAP_REQ_ADD;
+	op2.o_bd = li->li_db;
+	op2.o_dn = li->li_db->be_rootdn;
+	op2.o_ndn = li->li_db->be_rootndn;
+	op2.o_callback = &nullsc;
+
+	if ( list->lp_next && bi->bi_op_txn &&
+		bi->bi_op_txn( &op2, SLAP_TXN_BEGIN, &txn ))
+		txn = NULL;
+
+retry:
+	for ( lp = list; lp; lp = lp->lp_next ) {
+		op2.o_req_dn = lp->lp_e->e_name;
+		op2.o_req_ndn = lp->lp_e->e_nname;
+		op2.ora_e = lp->lp_e;
+		if ( lp->lp_queue ) {
+			BER_BVZERO( &op2.o_csn );
+			slap_queue_csn( &op2, &lp->lp_csn );
+		} else {
+			op2.o_csn = lp->lp_csn;
+		}
+		rs_reinit( &rs2, REP_RESULT );
+		op2.o_bd->be_add( &op2, &rs2 );
+		if ( lp->lp_queue && !BER_BVISNULL( &op2.o_csn ))
+			op->o_tmpfree( op2.o_csn.bv_val, op->o_tmpmemctx );
+		BER_BVZERO( &op2.o_csn );
+		if ( rs2.sr_err != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_SYNC,
+				"accesslog_flush: got result 0x%x adding log entry %s\n",
+				rs2.sr_err, op2.o_req_dn.bv_val );
+			if ( txn ) {
+				rc = rs2.sr_err;
+				break;
+			}
+		}
+		n++;
+	}
+
+	if ( txn ) {
+		LDAP_SLIST_REMOVE( &op2.o_extra, txn, OpExtra, oe_next );
+		if ( rc == LDAP_SUCCESS ) {
+			rc = bi->bi_op_txn( &op2, SLAP_TXN_COMMIT, &txn );
+		} else {
+			bi->bi_op_txn( &op2, SLAP_TXN_ABORT, &txn );
+		}
+		txn = NULL;
+		if ( rc == LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_SYNC,
+				"accesslog_flush: committed %d log entries\n", n );
+		} else {
+			Debug( LDAP_DEBUG_ANY,
+				"accesslog_flush: batch of log entries failed (%d), "
+				"retrying one at a time\n", rc );
+			n = 0;
+			rc = LDAP_SUCCESS;
+			goto retry;
+		}
+	}
+
+	ldap_pvt_thread_mutex_unlock( &li->li_flush_mutex );
+
+	for ( lp = list; lp; lp = list ) {
+		list = lp->lp_next;
+		entry_free( lp->lp_e );
+		if ( !BER_BVISNULL( &lp->lp_csn ))
+			ch_free( lp->lp_csn.bv_val );
+		ch_free( lp );
+	}
+}
+
 static int accesslog_response(Operation *op, SlapReply *rs) {
 	slap_overinst *on = (slap_overinst *)op->o_callback->sc_private;
 	log_info *li = on->on_bi.bi_private;
@@ -1491,6 +1646,8 @@ static int accesslog_response(Operation *op, SlapReply *rs) {
 	BerVarray vals;
 	Operation op2 = {0};
 	SlapReply rs2 = {REP_RESULT};
+	struct berval csn = BER_BVNULL;
+	log_pending *lp = NULL;
 
 	{
 		slap_callback *sc = op->o_callback;
@@ -1892,20 +2049,36 @@ static int accesslog_response(Operation *op, SlapReply *rs) {
 		 */
 		slap_get_commit_csn( op, &maxcsn, &foundit );
 		if ( !BER_BVISEMPTY( &maxcsn ) ) {
-			slap_queue_csn( &op2, &op->o_csn );
+			csn = op->o_csn;
 		} else {
 			attr_merge_normalize_one( e, slap_schema.si_ad_entryCSN,
 				&op->o_csn, op->o_tmpmemctx );
 		}
 	}
 
-	op2.o_bd->be_add( &op2, &rs2 );
-	if ( rs2.sr_err != LDAP_SUCCESS ) {
-		Debug( LDAP_DEBUG_SYNC,
-			"accesslog_response: got result 0x%x adding log entry %s\n",
-			rs2.sr_err, op2.o_req_dn.bv_val );
+	if ( lo->mask & LOG_OP_WRITES ) {
+		/* Written by accesslog_flush once li_log_mutex is released,
+		 * together with any other entry queued in the meantime.
+		 */
+		lp = ch_malloc( sizeof( log_pending ));
+		lp->lp_next = NULL;
+		lp->lp_e = e;
+		lp->lp_queue = !BER_BVISNULL( &csn );
+		if ( !BER_BVISEMPTY( &op->o_csn ))
+			ber_dupbv( &lp->lp_csn, &op->o_csn );
+		else
+			BER_BVZERO( &lp->lp_csn );
+		*li->li_pendtail = lp;
+		li->li_pendtail = &lp->lp_next;
+	} else {
+		op2.o_bd->be_add( &op2, &rs2 );
+		if ( rs2.sr_err != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_SYNC,
+				"accesslog_response: got result 0x%x adding log entry %s\n",
+				rs2.sr_err, op2.o_req_dn.bv_val );
+		}
+		if ( e == op2.ora_e ) entry_free( e );
 	}
-	if ( e == op2.ora_e ) entry_free( e );
 	e = NULL;
 
 	/* TODO: What to do about minCSN when we have an op without a CSN? */
@@ -1962,8 +2135,11 @@ static int accesslog_response(Operation *op, SlapReply *rs) {
 	}
 
 done:
-	if ( lo->mask & LOG_OP_WRITES )
+	if ( lo->mask & LOG_OP_WRITES ) {
 		ldap_pvt_thread_mutex_unlock( &li->li_log_mutex );
+		if ( lp )
+			accesslog_flush( op, li );
+	}
 	if ( old ) entry_free( old );
 	return SLAP_CB_CONTINUE;
 }
@@ -2212,6 +2388,8 @@ accesslog_db_init(
 	on->on_bi.bi_private = li;
 	ldap_pvt_thread_mutex_recursive_init( &li->li_op_rmutex );
 	ldap_pvt_thread_mutex_init( &li->li_log_mutex );
+	ldap_pvt_thread_mutex_init( &li->li_flush_mutex );
+	li->li_pendtail = &li->li_pending;
 	return 0;
 }
 
@@ -2231,6 +2409,7 @@ accesslog_db_destroy(
 		li->li_oldattrs = la->next;
 		ch_free( la );
 	}
+	ldap_pvt_thread_mutex_destroy( &li->li_flush_mutex );
 	ldap_pvt_thread_mutex_destroy( &li->li_log_mutex );
 	ldap_pvt_thread_mutex_destroy( &li->li_op_rmutex );
 	free( li );
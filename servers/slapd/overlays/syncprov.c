@@ -27,6 +27,13 @@
 #include "slap.h"
 #include "config.h"
 #include "ldap_rq.h"
+#include "../back-monitor/back-monitor.h"
+
+/* The on-disk session log needs LMDB, borrow back-mdb's copy */
+#if defined(SLAPD_MDB) && SLAPD_MDB == SLAPD_MOD_STATIC
+#define	SYNCPROV_DISKLOG	1
+#include "lmdb.h"
+#endif
 
 #ifdef LDAP_DEVEL
 #define	CHECK_CSN	1
@@ -45,6 +52,16 @@ typedef struct modtarget {
 	ldap_pvt_thread_mutex_t mt_mutex;
 } modtarget;
 
+/* A psearch response encoded once for all the psearches with
+ * the same share key, see syncprov_sharekey()
+ */
+typedef struct resenc {
+	struct resenc *re_next;
+	struct berval re_key;
+	struct berval re_body;	/* protocolOp and controls, no messageID */
+	int re_mode;
+} resenc;
+
 /* All the info of a psearch result that's shared between
  * multiple queues
  */
@@ -56,6 +73,8 @@ typedef struct resinfo {
 	struct berval ri_uuid;
 	struct berval ri_csn;
 	struct berval ri_cookie;
+	ber_len_t ri_size;	/* approximate memory held */
+	resenc *ri_enc;	/* encoded responses, protected by ri_mutex */
 	char ri_isref;
 	ldap_pvt_thread_mutex_t ri_mutex;
 } resinfo;
@@ -68,6 +87,15 @@ typedef struct syncres {
 	char s_mode;
 } syncres;
 
+/* An equality or presence assertion that any entry matching a
+ * persistent search must satisfy. Used to rule out psearches
+ * cheaply before evaluating their full filter.
+ */
+typedef struct synckey {
+	AttributeDescription *sk_ad;
+	struct berval	sk_val;		/* normalized value, NULL for presence */
+} synckey;
+
 /* Record of a persistent search */
 typedef struct syncops {
 	struct syncops *s_next;
@@ -78,6 +106,9 @@ typedef struct syncops {
 	int		s_rid;
 	int		s_sid;
 	struct berval s_filterstr;
+	struct berval s_sharekey;	/* psearches sent identical responses */
+	synckey	*s_keys;	/* required terms of s_filterstr */
+	int		s_nkeys;
 	int		s_flags;	/* search status */
 #define	PS_IS_REFRESHING	0x01
 #define	PS_IS_DETACHED		0x02
@@ -85,12 +116,22 @@ typedef struct syncops {
 #define	PS_FIND_BASE		0x08
 #define	PS_FIX_FILTER		0x10
 #define	PS_TASK_QUEUED		0x20
+#define	PS_OVERFLOW		0x40
 
 	int		s_inuse;	/* reference count */
 	struct syncres *s_res;
 	struct syncres *s_restail;
 	void *s_pool_cookie;
 	ldap_pvt_thread_mutex_t	s_mutex;
+
+	/* statistics shown in the monitor entry, protected by s_mutex */
+	int		s_qlen;		/* number of queued responses */
+	ber_len_t	s_qbytes;	/* memory held by queued responses */
+	unsigned long	s_nsent;	/* responses sent from the queue */
+	struct timeval	s_sendtime;	/* time spent sending them */
+	time_t		s_start;
+	char		s_lastcsn[LDAP_PVT_CSNSTR_BUFSIZE];
+	struct berval	s_monitor_ndn;
 } syncops;
 
 /* A received sync control */
@@ -133,8 +174,21 @@ typedef struct sessionlog {
 	int		sl_playing;
 	TAvlnode *sl_entries;
 	ldap_pvt_thread_rdwr_t sl_mutex;
+
+	/* optional on-disk log, outliving both restarts and sl_size */
+	char	*sl_path;
+	unsigned long	sl_maxsize;
+	int		sl_maxage;
+#ifdef SYNCPROV_DISKLOG
+	MDB_env	*sl_env;
+	MDB_dbi	sl_dbi;		/* logged changes */
+	MDB_dbi	sl_meta;	/* minCSN, contextCSN, clean shutdown marker */
+	struct sync_cookie sl_dmin;	/* oldest CSNs the disk log covers */
+#endif
 } sessionlog;
 
+#define SLOG_DEFAULT_MAXSIZE	(256UL * 1048576UL)
+
 /* Accesslog callback data */
 typedef struct syncprov_accesslog_deletes {
 	Operation *op;
@@ -161,6 +215,7 @@ typedef struct syncprov_info_t {
 	int		si_numops;	/* number of ops since last checkpoint */
 	int		si_nopres;	/* Skip present phase */
 	int		si_usehint;	/* use reload hint */
+	int		si_maxqueue;	/* max queued responses per psearch */
 	int		si_active;	/* True if there are active mods */
 	int		si_dirty;	/* True if the context is dirty, i.e changes
 						 * have been made without updating the csn. */
@@ -860,13 +915,521 @@ static void free_resinfo( syncres *sr )
 			entry_free( sr->s_info->ri_e );
 		if ( !BER_BVISNULL( &sr->s_info->ri_cookie ))
 			ch_free( sr->s_info->ri_cookie.bv_val );
+		while ( sr->s_info->ri_enc ) {
+			resenc *re = sr->s_info->ri_enc;
+			sr->s_info->ri_enc = re->re_next;
+			ch_free( re );
+		}
 		ch_free( sr->s_info );
 	}
 }
 
+static int
+syncprov_key_ok( AttributeDescription *ad )
+{
+	/* Operational attributes may be computed on the fly (entryDN,
+	 * hasSubordinates...) so only index plain user attributes.
+	 */
+	return !is_at_operational( ad->ad_type ) &&
+		ad->ad_type->sat_equality != NULL;
+}
+
+static int
+syncprov_key_add( Filter *f, synckey *sk )
+{
+	switch ( f->f_choice ) {
+	case LDAP_FILTER_EQUALITY:
+#ifdef LDAP_COMP_MATCH
+		if ( f->f_ava->aa_cf )
+			return 0;
+#endif
+		if ( !syncprov_key_ok( f->f_av_desc ))
+			return 0;
+		if ( sk ) {
+			sk->sk_ad = f->f_av_desc;
+			ber_dupbv( &sk->sk_val, &f->f_av_value );
+		}
+		return 1;
+	case LDAP_FILTER_PRESENT:
+		if ( !syncprov_key_ok( f->f_desc ))
+			return 0;
+		if ( sk ) {
+			sk->sk_ad = f->f_desc;
+			BER_BVZERO( &sk->sk_val );
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Collect the equality and presence terms an entry has to satisfy
+ * to match this filter: the filter itself or the immediate children
+ * of a top level AND.
+ */
+static void
+syncprov_keys_build( syncops *so, Filter *f )
+{
+	Filter *fl;
+	int n = 0;
+
+	so->s_keys = NULL;
+	so->s_nkeys = 0;
+
+	if ( f->f_choice != LDAP_FILTER_AND ) {
+		if ( syncprov_key_add( f, NULL )) {
+			so->s_keys = ch_malloc( sizeof( synckey ));
+			so->s_nkeys = syncprov_key_add( f, so->s_keys );
+		}
+		return;
+	}
+
+	for ( fl = f->f_and; fl; fl = fl->f_next )
+		n += syncprov_key_add( fl, NULL );
+	if ( !n )
+		return;
+
+	so->s_keys = ch_malloc( n * sizeof( synckey ));
+	for ( fl = f->f_and; fl; fl = fl->f_next )
+		so->s_nkeys += syncprov_key_add( fl, &so->s_keys[so->s_nkeys] );
+}
+
+static void
+syncprov_keys_free( syncops *so )
+{
+	int i;
+
+	for ( i = 0; i < so->s_nkeys; i++ )
+		ch_free( so->s_keys[i].sk_val.bv_val );
+	ch_free( so->s_keys );
+	so->s_keys = NULL;
+	so->s_nkeys = 0;
+}
+
+/* Outcome of testing a key against the entry being written. Many
+ * psearches share the same terms (objectClass=..., etc.), each one
+ * is only checked once per write.
+ */
+typedef struct synckeyres {
+	struct synckeyres *kr_next;
+	synckey kr_key;
+	int kr_match;
+} synckeyres;
+
+typedef struct synckeycache {
+	Avlnode *kc_tree;
+	synckeyres *kc_list;
+} synckeycache;
+
+static int
+syncprov_keyres_cmp( const void *v1, const void *v2 )
+{
+	const synckey *k1 = &((const synckeyres *)v1)->kr_key;
+	const synckey *k2 = &((const synckeyres *)v2)->kr_key;
+
+	if ( k1->sk_ad != k2->sk_ad )
+		return k1->sk_ad < k2->sk_ad ? -1 : 1;
+	if ( BER_BVISNULL( &k1->sk_val ) || BER_BVISNULL( &k2->sk_val ))
+		return BER_BVISNULL( &k2->sk_val ) - BER_BVISNULL( &k1->sk_val );
+	return ber_bvcmp( &k1->sk_val, &k2->sk_val );
+}
+
+static int
+syncprov_key_test( Entry *e, synckey *sk )
+{
+	Attribute *a;
+	unsigned slot;
+
+	for ( a = attrs_find( e->e_attrs, sk->sk_ad ); a;
+		a = attrs_find( a->a_next, sk->sk_ad ))
+	{
+		if ( BER_BVISNULL( &sk->sk_val ) ||
+			!a->a_desc->ad_type->sat_equality )
+			return 1;
+		if ( attr_valfind( a, SLAP_MR_EQUALITY |
+				SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH |
+				SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH,
+				&sk->sk_val, &slot, NULL ) != LDAP_NO_SUCH_ATTRIBUTE )
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns 0 if the entry cannot possibly match the psearch's filter.
+ * Never evaluates ACLs, a key match only means test_filter() has to
+ * be consulted. Results are kept in kc for the duration of the write,
+ * the psearch itself may be freed before that.
+ */
+static int
+syncprov_keys_match( Operation *op, Entry *e, syncops *so, synckeycache *kc )
+{
+	synckeyres kr, *res;
+	int i;
+
+	for ( i = 0; i < so->s_nkeys; i++ ) {
+		kr.kr_key = so->s_keys[i];
+		res = avl_find( kc->kc_tree, &kr, syncprov_keyres_cmp );
+		if ( !res ) {
+			res = op->o_tmpalloc( sizeof( synckeyres ), op->o_tmpmemctx );
+			res->kr_key.sk_ad = kr.kr_key.sk_ad;
+			if ( BER_BVISNULL( &kr.kr_key.sk_val ))
+				BER_BVZERO( &res->kr_key.sk_val );
+			else
+				ber_dupbv_x( &res->kr_key.sk_val, &kr.kr_key.sk_val,
+					op->o_tmpmemctx );
+			res->kr_match = syncprov_key_test( e, &kr.kr_key );
+			res->kr_next = kc->kc_list;
+			kc->kc_list = res;
+			avl_insert( &kc->kc_tree, res, syncprov_keyres_cmp, avl_dup_error );
+		}
+		if ( !res->kr_match )
+			return 0;
+	}
+	return 1;
+}
+
+static void
+syncprov_keycache_free( Operation *op, synckeycache *kc )
+{
+	synckeyres *res, *next;
+
+	avl_free( kc->kc_tree, NULL );
+	for ( res = kc->kc_list; res; res = next ) {
+		next = res->kr_next;
+		if ( !BER_BVISNULL( &res->kr_key.sk_val ))
+			op->o_tmpfree( res->kr_key.sk_val.bv_val, op->o_tmpmemctx );
+		op->o_tmpfree( res, op->o_tmpmemctx );
+	}
+}
+
 #define FS_UNLINK	1
 #define FS_LOCK		2
 
+/* Each persistent search gets a monitor entry below its database's,
+ * showing how far behind the consumer is on the provider side.
+ */
+static ObjectClass	*oc_olmSyncProvSession;
+static AttributeDescription	*ad_olmSPPeer, *ad_olmSPAuthzDN,
+	*ad_olmSPSyncPhase, *ad_olmSPQueueDepth, *ad_olmSPQueueBytes,
+	*ad_olmSPLastCSNSent, *ad_olmSPChangesSent, *ad_olmSPSendRate,
+	*ad_olmSPSendTime;
+
+static struct {
+	char *name;
+	char *oid;
+} sp_oid[] = {
+	{ "olmSyncProvAttributes",	"olmOverlayAttributes:2" },
+	{ "olmSyncProvObjectClasses", "olmOverlayObjectClasses:2" },
+	{ NULL }
+};
+
+static struct {
+	char *desc;
+	AttributeDescription **ad;
+} sp_at[] = {
+	{ "( olmSyncProvAttributes:1 "
+		"NAME ( 'olmSPPeer' ) "
+		"DESC 'Address of the consumer' "
+		"SUP monitoredInfo "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPPeer },
+	{ "( olmSyncProvAttributes:2 "
+		"NAME ( 'olmSPAuthzDN' ) "
+		"DESC 'Identity the consumer is bound as' "
+		"SUP monitoredInfo "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPAuthzDN },
+	{ "( olmSyncProvAttributes:3 "
+		"NAME ( 'olmSPSyncPhase' ) "
+		"DESC 'Current phase of the session' "
+		"SUP monitoredInfo "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPSyncPhase },
+	{ "( olmSyncProvAttributes:4 "
+		"NAME ( 'olmSPQueueDepth' ) "
+		"DESC 'Changes queued for the consumer' "
+		"SUP monitorCounter "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPQueueDepth },
+	{ "( olmSyncProvAttributes:5 "
+		"NAME ( 'olmSPQueueBytes' ) "
+		"DESC 'Approximate memory held by the queued changes' "
+		"SUP monitorCounter "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPQueueBytes },
+	{ "( olmSyncProvAttributes:6 "
+		"NAME ( 'olmSPLastCSNSent' ) "
+		"DESC 'CSN of the last change sent to the consumer' "
+		"SUP monitoredInfo "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPLastCSNSent },
+	{ "( olmSyncProvAttributes:7 "
+		"NAME ( 'olmSPChangesSent' ) "
+		"DESC 'Queued changes sent to the consumer' "
+		"SUP monitorCounter "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPChangesSent },
+	{ "( olmSyncProvAttributes:8 "
+		"NAME ( 'olmSPSendRate' ) "
+		"DESC 'Queued changes sent per second since the session started' "
+		"SUP monitorCounter "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPSendRate },
+	{ "( olmSyncProvAttributes:9 "
+		"NAME ( 'olmSPSendTime' ) "
+		"DESC 'Milliseconds spent writing queued changes to the consumer' "
+		"SUP monitorCounter "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmSPSendTime },
+	{ NULL }
+};
+
+static struct {
+	char *desc;
+	ObjectClass **oc;
+} sp_oc[] = {
+	{ "( olmSyncProvObjectClasses:1 "
+		"NAME ( 'olmSyncProvSession' ) "
+		"SUP monitoredObject STRUCTURAL "
+		"MAY ( "
+			"olmSPPeer "
+			"$ olmSPAuthzDN "
+			"$ olmSPSyncPhase "
+			"$ olmSPQueueDepth "
+			"$ olmSPQueueBytes "
+			"$ olmSPLastCSNSent "
+			"$ olmSPChangesSent "
+			"$ olmSPSendRate "
+			"$ olmSPSendTime "
+			") )",
+		&oc_olmSyncProvSession },
+	{ NULL }
+};
+
+static int
+syncprov_monitor_initialized;
+
+static int
+syncprov_monitor_init( void )
+{
+	int i, code;
+
+	if ( syncprov_monitor_initialized )
+		return 0;
+
+	if ( backend_info( "monitor" ) == NULL )
+		return -1;
+
+	{
+		ConfigArgs c;
+		char *argv[3];
+
+		argv[ 0 ] = "syncprov monitor";
+		c.argv = argv;
+		c.argc = 2;
+		c.fname = argv[0];
+		for ( i=0; sp_oid[i].name; i++ ) {
+			argv[1] = sp_oid[i].name;
+			argv[2] = sp_oid[i].oid;
+			if ( parse_oidm( &c, 0, NULL )) {
+				Debug( LDAP_DEBUG_ANY,
+					"syncprov_monitor_init: unable to add "
+					"objectIdentifier \"%s=%s\"\n",
+					sp_oid[i].name, sp_oid[i].oid );
+				return 2;
+			}
+		}
+	}
+
+	for ( i=0; sp_at[i].desc != NULL; i++ ) {
+		code = register_at( sp_at[i].desc, sp_at[i].ad, 1 );
+		if ( code != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_ANY,
+				"syncprov_monitor_init: register_at failed for attributeType (%s)\n",
+				sp_at[i].desc );
+			return 3;
+		}
+		(*sp_at[i].ad)->ad_type->sat_flags |= SLAP_AT_HIDE;
+	}
+
+	for ( i=0; sp_oc[i].desc != NULL; i++ ) {
+		code = register_oc( sp_oc[i].desc, sp_oc[i].oc, 1 );
+		if ( code != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_ANY,
+				"syncprov_monitor_init: register_oc failed for objectClass (%s)\n",
+				sp_oc[i].desc );
+			return 4;
+		}
+		(*sp_oc[i].oc)->soc_flags |= SLAP_OC_HIDE;
+	}
+	syncprov_monitor_initialized = 1;
+
+	return 0;
+}
+
+static void
+syncprov_monitor_set( Entry *e, AttributeDescription *ad, struct berval *bv )
+{
+	Attribute *a = attr_find( e->e_attrs, ad );
+
+	if ( !a )
+		return;
+	if ( a->a_nvals != a->a_vals )
+		ber_bvreplace( &a->a_nvals[0], bv );
+	ber_bvreplace( &a->a_vals[0], bv );
+}
+
+static int
+syncprov_monitor_update(
+	Operation *op,
+	SlapReply *rs,
+	Entry *e,
+	void *priv )
+{
+	syncops *so = priv;
+	char buf[ LDAP_PVT_INTTYPE_CHARS(unsigned long) ];
+	char csnbuf[ LDAP_PVT_CSNSTR_BUFSIZE ];
+	struct berval bv;
+	unsigned long qbytes, nsent, sendms;
+	int qlen, refreshing;
+	time_t elapsed;
+
+	/* only take s_mutex, the entry may be updated while
+	 * syncprov_free_syncop waits to unregister it */
+	ldap_pvt_thread_mutex_lock( &so->s_mutex );
+	refreshing = so->s_flags & PS_IS_REFRESHING;
+	qlen = so->s_qlen;
+	qbytes = so->s_qbytes;
+	nsent = so->s_nsent;
+	sendms = so->s_sendtime.tv_sec * 1000 + so->s_sendtime.tv_usec / 1000;
+	strcpy( csnbuf, so->s_lastcsn );
+	elapsed = slap_get_time() - so->s_start;
+	ldap_pvt_thread_mutex_unlock( &so->s_mutex );
+
+	if ( refreshing ) {
+		BER_BVSTR( &bv, "Refresh" );
+	} else {
+		BER_BVSTR( &bv, "Persist" );
+	}
+	syncprov_monitor_set( e, ad_olmSPSyncPhase, &bv );
+
+	bv.bv_val = buf;
+	bv.bv_len = sprintf( buf, "%d", qlen );
+	syncprov_monitor_set( e, ad_olmSPQueueDepth, &bv );
+	bv.bv_len = sprintf( buf, "%lu", qbytes );
+	syncprov_monitor_set( e, ad_olmSPQueueBytes, &bv );
+	bv.bv_len = sprintf( buf, "%lu", nsent );
+	syncprov_monitor_set( e, ad_olmSPChangesSent, &bv );
+	bv.bv_len = sprintf( buf, "%lu", elapsed > 0 ? nsent / elapsed : nsent );
+	syncprov_monitor_set( e, ad_olmSPSendRate, &bv );
+	bv.bv_len = sprintf( buf, "%lu", sendms );
+	syncprov_monitor_set( e, ad_olmSPSendTime, &bv );
+
+	ber_str2bv( csnbuf, 0, 0, &bv );
+	syncprov_monitor_set( e, ad_olmSPLastCSNSent, &bv );
+
+	return SLAP_CB_CONTINUE;
+}
+
+static void
+syncprov_monitor_add( Operation *op, syncops *so )
+{
+	BackendInfo *mi;
+	monitor_extra_t *mbe;
+	struct berval pndn, pdn, rdn, bv;
+	char rdnbuf[sizeof("cn=Sync Session ") + 2*LDAP_PVT_INTTYPE_CHARS(unsigned long)];
+	monitor_callback_t *cb;
+	Entry *e, *p;
+
+	if ( !syncprov_monitor_initialized )
+		return;
+
+	mi = backend_info( "monitor" );
+	if ( !mi || !mi->bi_extra )
+		return;
+	mbe = mi->bi_extra;
+	if ( !mbe->is_configured() )
+		return;
+
+	if ( mbe->register_database( op->o_bd->bd_self, &pndn ))
+		return;
+	p = mbe->entry_get_unlocked( &pndn );
+	if ( p ) {
+		pdn = p->e_name;
+	} else {
+		pdn = pndn;
+	}
+
+	rdn.bv_val = rdnbuf;
+	rdn.bv_len = sprintf( rdnbuf, "cn=Sync Session %lu.%d",
+		op->o_connid, op->o_msgid );
+	e = mbe->entry_stub( &pdn, &pndn, &rdn,
+		oc_olmSyncProvSession, NULL, NULL );
+	if ( e == NULL ) {
+		Debug( LDAP_DEBUG_ANY, "syncprov_monitor_add: "
+			"unable to create entry \"%s,%s\"\n",
+			rdn.bv_val, pndn.bv_val );
+		return;
+	}
+
+	if ( op->o_conn && !BER_BVISEMPTY( &op->o_conn->c_peer_name ))
+		attr_merge_normalize_one( e, ad_olmSPPeer,
+			&op->o_conn->c_peer_name, NULL );
+	if ( !BER_BVISEMPTY( &op->o_ndn ))
+		attr_merge_normalize_one( e, ad_olmSPAuthzDN, &op->o_ndn, NULL );
+
+	BER_BVSTR( &bv, "Refresh" );
+	attr_merge_normalize_one( e, ad_olmSPSyncPhase, &bv, NULL );
+	BER_BVSTR( &bv, "0" );
+	attr_merge_normalize_one( e, ad_olmSPQueueDepth, &bv, NULL );
+	attr_merge_normalize_one( e, ad_olmSPQueueBytes, &bv, NULL );
+	attr_merge_normalize_one( e, ad_olmSPChangesSent, &bv, NULL );
+	attr_merge_normalize_one( e, ad_olmSPSendRate, &bv, NULL );
+	attr_merge_normalize_one( e, ad_olmSPSendTime, &bv, NULL );
+	BER_BVSTR( &bv, "" );
+	attr_merge_normalize_one( e, ad_olmSPLastCSNSent, &bv, NULL );
+
+	cb = ch_calloc( sizeof( monitor_callback_t ), 1 );
+	cb->mc_update = syncprov_monitor_update;
+	cb->mc_private = so;
+	if ( mbe->register_entry( e, cb, NULL, 0 ) == 0 ) {
+		so->s_monitor_ndn = e->e_nname;
+		BER_BVZERO( &e->e_nname );
+	}
+	entry_free( e );
+}
+
+static void
+syncprov_monitor_del( syncops *so )
+{
+	BackendInfo *mi;
+
+	mi = backend_info( "monitor" );
+	if ( mi && mi->bi_extra ) {
+		monitor_extra_t *mbe = mi->bi_extra;
+		mbe->unregister_entry( &so->s_monitor_ndn );
+	}
+	ch_free( so->s_monitor_ndn.bv_val );
+	BER_BVZERO( &so->s_monitor_ndn );
+}
+
 static int
 syncprov_free_syncop( syncops *so, int flags )
 {
@@ -893,6 +1456,8 @@ syncprov_free_syncop( syncops *so, int flags )
 		}
 		ldap_pvt_thread_mutex_unlock( &so->s_si->si_ops_mutex );
 	}
+	if ( !BER_BVISNULL( &so->s_monitor_ndn ))
+		syncprov_monitor_del( so );
 	if ( so->s_flags & PS_IS_DETACHED ) {
 		filter_free( so->s_op->ors_filter );
 		for ( ga = so->s_op->o_groups; ga; ga=gnext ) {
@@ -902,6 +1467,9 @@ syncprov_free_syncop( syncops *so, int flags )
 		ch_free( so->s_op );
 	}
 	ch_free( so->s_base.bv_val );
+	if ( !BER_BVISNULL( &so->s_sharekey ))
+		ch_free( so->s_sharekey.bv_val );
+	syncprov_keys_free( so );
 	for ( sr=so->s_res; sr; sr=srnext ) {
 		srnext = sr->s_next;
 		free_resinfo( sr );
@@ -912,6 +1480,157 @@ syncprov_free_syncop( syncops *so, int flags )
 	return 1;
 }
 
+/* Persistent searches made by the same identity with the same
+ * security factors, attribute selection and replica ID get identical
+ * responses, so a change only needs to be encoded once for all of them.
+ * Build the key that identifies such a group. Searches with a values
+ * return filter are left out.
+ */
+static void
+syncprov_sharekey( Operation *op, syncops *so )
+{
+	AttributeName *an;
+	char buf[128], *ptr;
+	int len, nattrs = 0;
+
+	if ( op->o_vrFilter )
+		return;
+
+	for ( an = op->ors_attrs; an && !BER_BVISNULL( &an->an_name ); an++ )
+		nattrs++;
+	len = snprintf( buf, sizeof( buf ), "%d %d %d %u %u %u %u %d\n",
+		so->s_rid, op->o_protocol, op->ors_attrsonly,
+		op->o_ssf, op->o_transport_ssf, op->o_tls_ssf, op->o_sasl_ssf,
+		nattrs );
+
+	so->s_sharekey.bv_len = len + op->o_ndn.bv_len;
+	for ( an = op->ors_attrs; an && !BER_BVISNULL( &an->an_name ); an++ )
+		so->s_sharekey.bv_len += an->an_name.bv_len + 1;
+	so->s_sharekey.bv_val = ch_malloc( so->s_sharekey.bv_len + 1 );
+	ptr = lutil_strcopy( so->s_sharekey.bv_val, buf );
+	for ( an = op->ors_attrs; an && !BER_BVISNULL( &an->an_name ); an++ ) {
+		ptr = lutil_strncopy( ptr, an->an_name.bv_val, an->an_name.bv_len );
+		*ptr++ = '\n';
+	}
+	/* the DN goes last, so it can't be mistaken for an attribute */
+	ptr = lutil_strncopy( ptr, op->o_ndn.bv_val, op->o_ndn.bv_len );
+	*ptr = '\0';
+}
+
+/* Returns nonzero if access may depend on where the client
+ * connected from, which the share key doesn't capture
+ */
+static int
+syncprov_acl_peerdep( AccessControl *acl )
+{
+	Access *b;
+
+	for ( ; acl; acl = acl->acl_next ) {
+		for ( b = acl->acl_access; b; b = b->a_next ) {
+			if ( !BER_BVISEMPTY( &b->a_peername_pat ) ||
+				!BER_BVISEMPTY( &b->a_sockname_pat ) ||
+				!BER_BVISEMPTY( &b->a_domain_pat ) ||
+				!BER_BVISEMPTY( &b->a_sockurl_pat ))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/* Can this response be shared with other psearches? */
+static int
+syncprov_canshare( Operation *op, resinfo *ri, syncops *so, int mode )
+{
+	if ( BER_BVISNULL( &so->s_sharekey ))
+		return 0;
+	if ( ri->ri_isref && so->s_op->o_managedsait <= SLAP_CONTROL_IGNORED )
+		return 0;
+	if ( mode == LDAP_SYNC_ADD || mode == LDAP_SYNC_MODIFY ) {
+		if ( !ri->ri_e )
+			return 0;
+	} else if ( mode != LDAP_SYNC_DELETE ) {
+		return 0;
+	}
+	/* must be going out on a plain client connection */
+	if ( op->o_conn->c_send_search_entry != slap_send_search_entry )
+		return 0;
+	if ( syncprov_acl_peerdep( op->o_bd->be_acl ) ||
+		syncprov_acl_peerdep( frontendDB->be_acl ))
+		return 0;
+	return 1;
+}
+
+/* Send a response that another psearch of the group already encoded */
+static int
+syncprov_sendshared( Operation *op, resinfo *ri, syncops *so, int mode,
+	int *rc )
+{
+	SlapReply rs = { REP_SEARCH };
+	resenc *re;
+
+	ldap_pvt_thread_mutex_lock( &ri->ri_mutex );
+	for ( re = ri->ri_enc; re; re = re->re_next ) {
+		if ( re->re_mode == mode && bvmatch( &re->re_key, &so->s_sharekey ))
+			break;
+	}
+	ldap_pvt_thread_mutex_unlock( &ri->ri_mutex );
+	if ( !re )
+		return 0;
+
+	/* entries are never removed from ri_enc while ri is queued */
+	Debug( LDAP_DEBUG_SYNC, "%s syncprov_sendresp: "
+		"sending shared response, dn=%s\n",
+		op->o_log_prefix, ri->ri_dn.bv_val );
+	*rc = slap_send_search_entry_encoded( op, &rs, &re->re_body );
+	return 1;
+}
+
+/* Encode a response into ri for the other psearches of the group,
+ * then send it
+ */
+static int
+syncprov_sendenc( Operation *op, SlapReply *rs, resinfo *ri, syncops *so,
+	int mode )
+{
+	resenc *re;
+	struct berval bv;
+	int rc;
+
+	op->o_res_ber = ber_alloc_t( LBER_USE_DER );
+	if ( op->o_res_ber == NULL )
+		return send_search_entry( op, rs );
+
+	rc = send_search_entry( op, rs );
+	if ( rc == LDAP_SUCCESS ) {
+		if ( ber_flatten2( op->o_res_ber, &bv, 0 ) == 0 ) {
+			re = ch_malloc( sizeof( resenc ) + so->s_sharekey.bv_len + 1 +
+				bv.bv_len );
+			re->re_mode = mode;
+			re->re_key.bv_val = (char *)(re + 1);
+			re->re_key.bv_len = so->s_sharekey.bv_len;
+			AC_MEMCPY( re->re_key.bv_val, so->s_sharekey.bv_val,
+				so->s_sharekey.bv_len + 1 );
+			re->re_body.bv_val = re->re_key.bv_val + re->re_key.bv_len + 1;
+			re->re_body.bv_len = bv.bv_len;
+			AC_MEMCPY( re->re_body.bv_val, bv.bv_val, bv.bv_len );
+
+			/* if another psearch of the group raced us here, its
+			 * copy is just never found */
+			ldap_pvt_thread_mutex_lock( &ri->ri_mutex );
+			re->re_next = ri->ri_enc;
+			ri->ri_enc = re;
+			ldap_pvt_thread_mutex_unlock( &ri->ri_mutex );
+
+			rc = slap_send_search_entry_encoded( op, rs, &re->re_body );
+		} else {
+			rc = LDAP_OTHER;
+		}
+	}
+	ber_free( op->o_res_ber, 1 );
+	op->o_res_ber = NULL;
+	return rc;
+}
+
 /* Send a persistent search response */
 static int
 syncprov_sendresp( Operation *op, resinfo *ri, syncops *so, int mode )
@@ -920,10 +1639,15 @@ syncprov_sendresp( Operation *op, resinfo *ri, syncops *so, int mode )
 	struct berval cookie, csns[2];
 	Entry e_uuid = {0};
 	Attribute a_uuid = {0};
+	int share, rc;
 
 	if ( so->s_op->o_abandon )
 		return SLAPD_ABANDON;
 
+	share = syncprov_canshare( op, ri, so, mode );
+	if ( share && syncprov_sendshared( op, ri, so, mode, &rc ))
+		return rc;
+
 	rs.sr_ctrls = op->o_tmpalloc( sizeof(LDAPControl *)*2, op->o_tmpmemctx );
 	rs.sr_ctrls[1] = NULL;
 	rs.sr_flags = REP_CTRLS_MUSTBEFREED;
@@ -970,7 +1694,10 @@ syncprov_sendresp( Operation *op, resinfo *ri, syncops *so, int mode )
 			mode == LDAP_SYNC_ADD ? "LDAP_SYNC_ADD" : "LDAP_SYNC_MODIFY",
 			e_uuid.e_nname.bv_val );
 		rs.sr_attrs = op->ors_attrs;
-		rs.sr_err = send_search_entry( op, &rs );
+		if ( share )
+			rs.sr_err = syncprov_sendenc( op, &rs, ri, so, mode );
+		else
+			rs.sr_err = send_search_entry( op, &rs );
 		break;
 	case LDAP_SYNC_DELETE:
 		Debug( LDAP_DEBUG_SYNC, "%s syncprov_sendresp: "
@@ -983,6 +1710,8 @@ syncprov_sendresp( Operation *op, resinfo *ri, syncops *so, int mode )
 			struct berval bv = BER_BVNULL;
 			rs.sr_ref = &bv;
 			rs.sr_err = send_search_reference( op, &rs );
+		} else if ( share ) {
+			rs.sr_err = syncprov_sendenc( op, &rs, ri, so, mode );
 		} else {
 			rs.sr_err = send_search_entry( op, &rs );
 		}
@@ -996,6 +1725,65 @@ syncprov_sendresp( Operation *op, resinfo *ri, syncops *so, int mode )
 static void
 syncprov_qstart( syncops *so );
 
+static int
+syncprov_drop_psearch( syncops *so, int lock );
+
+/* The queue of a psearch grew past syncprov-maxqueue. Drop it and let
+ * the playback task end the search with e-syncRefreshRequired, so that
+ * the consumer catches up with a new refresh instead of slapd holding
+ * an unbounded backlog in memory. Called with s_mutex held.
+ */
+static void
+syncprov_qoverflow( syncops *so )
+{
+	syncres *sr, *srnext;
+
+	Debug( LDAP_DEBUG_ANY, "%s syncprov_qresp: "
+		"%d responses queued, consumer must refresh\n",
+		so->s_op->o_log_prefix, so->s_qlen );
+
+	so->s_flags |= PS_OVERFLOW;
+	for ( sr = so->s_res; sr; sr = srnext ) {
+		srnext = sr->s_next;
+		free_resinfo( sr );
+		ch_free( sr );
+	}
+	so->s_res = NULL;
+	so->s_restail = NULL;
+	so->s_qlen = 0;
+	so->s_qbytes = 0;
+	if ( !( so->s_flags & PS_TASK_QUEUED ))
+		syncprov_qstart( so );
+}
+
+/* End an overflowed psearch, unless it's already going away */
+static void
+syncprov_qend( Operation *op, syncops *so )
+{
+	syncprov_info_t *si = so->s_si;
+	SlapReply rs = { REP_RESULT };
+	syncops **sop;
+	int found = 0;
+
+	if ( !si )
+		return;
+	ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
+	for ( sop = &si->si_ops; *sop; sop = &(*sop)->s_next ) {
+		if ( *sop == so ) {
+			*sop = so->s_next;
+			found = 1;
+			break;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
+	if ( !found )
+		return;
+
+	send_ldap_error( op, &rs, LDAP_SYNC_REFRESH_REQUIRED,
+		"too many changes queued" );
+	syncprov_drop_psearch( so, 1 );
+}
+
 /* Play back queued responses */
 static int
 syncprov_qplay( Operation *op, syncops *so )
@@ -1005,6 +1793,13 @@ syncprov_qplay( Operation *op, syncops *so )
 
 	do {
 		ldap_pvt_thread_mutex_lock( &so->s_mutex );
+		if ( so->s_flags & PS_OVERFLOW ) {
+			ldap_pvt_thread_mutex_unlock( &so->s_mutex );
+			syncprov_qend( op, so );
+			/* Exit with mutex held */
+			ldap_pvt_thread_mutex_lock( &so->s_mutex );
+			return SLAPD_ABANDON;
+		}
 		sr = so->s_res;
 		/* Exit loop with mutex held */
 		if ( !sr )
@@ -1012,10 +1807,14 @@ syncprov_qplay( Operation *op, syncops *so )
 		so->s_res = sr->s_next;
 		if ( !so->s_res )
 			so->s_restail = NULL;
+		so->s_qlen--;
+		so->s_qbytes -= sr->s_info->ri_size;
 		ldap_pvt_thread_mutex_unlock( &so->s_mutex );
 
 		if ( !so->s_op->o_abandon ) {
+			struct timeval start, end;
 
+			gettimeofday( &start, NULL );
 			if ( sr->s_mode == LDAP_SYNC_NEW_COOKIE ) {
 				SlapReply rs = { REP_INTERMEDIATE };
 
@@ -1024,6 +1823,23 @@ syncprov_qplay( Operation *op, syncops *so )
 			} else {
 				rc = syncprov_sendresp( op, sr->s_info, so, sr->s_mode );
 			}
+			gettimeofday( &end, NULL );
+
+			ldap_pvt_thread_mutex_lock( &so->s_mutex );
+			so->s_nsent++;
+			so->s_sendtime.tv_sec += end.tv_sec - start.tv_sec;
+			so->s_sendtime.tv_usec += end.tv_usec - start.tv_usec;
+			if ( so->s_sendtime.tv_usec < 0 ) {
+				so->s_sendtime.tv_usec += 1000000;
+				so->s_sendtime.tv_sec--;
+			} else if ( so->s_sendtime.tv_usec >= 1000000 ) {
+				so->s_sendtime.tv_usec -= 1000000;
+				so->s_sendtime.tv_sec++;
+			}
+			if ( sr->s_info->ri_csn.bv_len &&
+				sr->s_info->ri_csn.bv_len < sizeof( so->s_lastcsn ))
+				strcpy( so->s_lastcsn, sr->s_info->ri_csn.bv_val );
+			ldap_pvt_thread_mutex_unlock( &so->s_mutex );
 		}
 
 		free_resinfo( sr );
@@ -1043,7 +1859,7 @@ syncprov_qplay( Operation *op, syncops *so )
 	 * there are more responses queued and no errors occurred.
 	 */
 
-	if ( rc == 0 && so->s_res ) {
+	if ( rc == 0 && ( so->s_res || ( so->s_flags & PS_OVERFLOW ))) {
 		syncprov_qstart( so );
 	}
 
@@ -1111,6 +1927,7 @@ syncprov_qstart( syncops *so )
 static int
 syncprov_qresp( opcookie *opc, syncops *so, int mode )
 {
+	syncprov_info_t	*si = opc->son->on_bi.bi_private;
 	syncres *sr;
 	resinfo *ri;
 	int srsize;
@@ -1166,8 +1983,12 @@ syncprov_qresp( opcookie *opc, syncops *so, int mode )
 		}
 		ri->ri_list = &opc->ssres;
 		ri->ri_e = opc->se;
+		ri->ri_size = srsize;
+		if ( opc->se )
+			ri->ri_size += entry_flatsize( opc->se, 0 );
 		ri->ri_csn.bv_len = csn.bv_len;
 		ri->ri_isref = opc->sreference;
+		ri->ri_enc = NULL;
 		BER_BVZERO( &ri->ri_cookie );
 		ldap_pvt_thread_mutex_init( &ri->ri_mutex );
 		opc->se = NULL;
@@ -1179,8 +2000,6 @@ syncprov_qresp( opcookie *opc, syncops *so, int mode )
 	sr->s_rilist = ri->ri_list;
 	ri->ri_list = sr;
 	if ( mode == LDAP_SYNC_NEW_COOKIE && BER_BVISNULL( &ri->ri_cookie )) {
-		syncprov_info_t	*si = opc->son->on_bi.bi_private;
-
 		slap_compose_sync_cookie( NULL, &ri->ri_cookie, si->si_ctxcsn,
 			so->s_rid, slap_serverID ? slap_serverID : -1, NULL );
 	}
@@ -1190,12 +2009,23 @@ syncprov_qresp( opcookie *opc, syncops *so, int mode )
 	ldap_pvt_thread_mutex_unlock( &ri->ri_mutex );
 
 	ldap_pvt_thread_mutex_lock( &so->s_mutex );
+	if ( !( so->s_flags & PS_OVERFLOW ) && si->si_maxqueue &&
+		so->s_qlen >= si->si_maxqueue && ( so->s_flags & PS_IS_DETACHED ))
+		syncprov_qoverflow( so );
+	if ( so->s_flags & PS_OVERFLOW ) {
+		ldap_pvt_thread_mutex_unlock( &so->s_mutex );
+		free_resinfo( sr );
+		ch_free( sr );
+		return LDAP_SUCCESS;
+	}
 	if ( !so->s_res ) {
 		so->s_res = sr;
 	} else {
 		so->s_restail->s_next = sr;
 	}
 	so->s_restail = sr;
+	so->s_qlen++;
+	so->s_qbytes += ri->ri_size;
 
 	/* If the base of the psearch was modified, check it next time round */
 	if ( so->s_flags & PS_WROTE_BASE ) {
@@ -1281,6 +2111,7 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 	syncprov_info_t		*si = on->on_bi.bi_private;
 
 	fbase_cookie fc;
+	synckeycache kc = { NULL, NULL };
 	syncops **pss;
 	Entry *e = NULL;
 	Attribute *a;
@@ -1345,6 +2176,12 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 		ber_dupbv_x( &opc->sndn, &e->e_nname, op->o_tmpmemctx );
 	}
 
+	/* Every psearch is visited, there is no index by base DN: on the
+	 * final pass each one that doesn't match still gets a new cookie,
+	 * and a psearch whose base is gone has to be dropped. Out of scope
+	 * psearches cost a DN compare, in scope ones are ruled out by their
+	 * synckeys before test_filter() and its ACL checks.
+	 */
 	ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
 	for (pss = &si->si_ops; *pss; pss = gonext ? &(*pss)->s_next : pss)
 	{
@@ -1414,7 +2251,12 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			}
 		}
 
-		if ( fc.fscope ) {
+		/* Skip filter evaluation if the entry lacks a required term */
+		if ( fc.fscope && ss->s_nkeys &&
+			!syncprov_keys_match( op, e, ss, &kc ) )
+		{
+			rc = LDAP_COMPARE_FALSE;
+		} else if ( fc.fscope ) {
 			ldap_pvt_thread_mutex_lock( &ss->s_mutex );
 			op2 = *ss->s_op;
 			oh = *op->o_hdr;
@@ -1471,6 +2313,7 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 		}
 	}
 	ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
+	syncprov_keycache_free( op, &kc );
 
 	if ( op->o_tag != LDAP_REQ_ADD && e ) {
 		if ( !SLAP_ISOVERLAY( op->o_bd )) {
@@ -1627,6 +2470,450 @@ syncprov_checkpoint( Operation *op, slap_overinst *on )
 #endif
 }
 
+#ifdef SYNCPROV_DISKLOG
+/* The on-disk session log lives in its own LMDB environment. Each
+ * record is keyed by CSN, entryUUID and (inverted) tag so that records
+ * sort the same way syncprov_sessionlog_cmp orders the in-memory log;
+ * the data is the tag itself. A separate DB holds the minCSN of the
+ * log, and, while the server is down, the contextCSN at shutdown and a
+ * clean shutdown marker: unless both check out on startup, the log
+ * is discarded.
+ */
+#define SLOG_KEY_MAX	(LDAP_PVT_CSNSTR_BUFSIZE + UUID_LEN + 1)
+
+static struct berval slog_meta_mincsn = BER_BVC("minCSN");
+static struct berval slog_meta_ctxcsn = BER_BVC("contextCSN");
+static struct berval slog_meta_clean = BER_BVC("clean");
+
+static int
+syncprov_disklog_key( MDB_val *key, char *buf, struct berval *csn,
+	struct berval *uuid, ber_tag_t tag )
+{
+	char *ptr;
+
+	if ( csn->bv_len >= LDAP_PVT_CSNSTR_BUFSIZE || uuid->bv_len != UUID_LEN )
+		return -1;
+
+	ptr = lutil_strncopy( buf, csn->bv_val, csn->bv_len );
+	*ptr++ = '\0';
+	ptr = lutil_memcopy( ptr, uuid->bv_val, UUID_LEN );
+	*ptr++ = 0xff - ( tag & 0xff );
+
+	key->mv_data = buf;
+	key->mv_size = ptr - buf;
+	return 0;
+}
+
+static int
+syncprov_disklog_parse( MDB_val *key, MDB_val *data, struct berval *csn,
+	struct berval *uuid, ber_tag_t *tag )
+{
+	char *end;
+
+	end = memchr( key->mv_data, '\0', key->mv_size );
+	if ( !end || key->mv_size != ( end - (char *)key->mv_data ) + 2 + UUID_LEN ||
+			data->mv_size != 1 )
+		return -1;
+
+	csn->bv_val = key->mv_data;
+	csn->bv_len = end - csn->bv_val;
+	uuid->bv_val = end + 1;
+	uuid->bv_len = UUID_LEN;
+	*tag = *(unsigned char *)data->mv_data;
+	return 0;
+}
+
+/* CSN sets are stored as a space separated list */
+static int
+syncprov_disklog_putcsns( sessionlog *sl, MDB_txn *txn, struct berval *name,
+	BerVarray csns, int numcsns )
+{
+	MDB_val key, data;
+	char *ptr;
+	int i, rc;
+
+	key.mv_data = name->bv_val;
+	key.mv_size = name->bv_len;
+	data.mv_size = 0;
+	for ( i=0; i<numcsns; i++ )
+		data.mv_size += csns[i].bv_len + 1;
+
+	rc = mdb_put( txn, sl->sl_meta, &key, &data, MDB_RESERVE );
+	if ( rc || !numcsns )
+		return rc;
+
+	ptr = data.mv_data;
+	for ( i=0; i<numcsns; i++ ) {
+		if ( i ) *ptr++ = ' ';
+		ptr = lutil_strncopy( ptr, csns[i].bv_val, csns[i].bv_len );
+	}
+	*ptr = '\0';
+	return 0;
+}
+
+static int
+syncprov_disklog_getcsns( sessionlog *sl, MDB_txn *txn, struct berval *name,
+	struct sync_cookie *ck )
+{
+	MDB_val key, data;
+	struct berval bv;
+	char *ptr, *end, *next;
+	int rc;
+
+	key.mv_data = name->bv_val;
+	key.mv_size = name->bv_len;
+	rc = mdb_get( txn, sl->sl_meta, &key, &data );
+	if ( rc )
+		return rc;
+
+	ptr = data.mv_data;
+	end = ptr + data.mv_size;
+	for ( ; ptr < end && *ptr; ptr = next ) {
+		next = memchr( ptr, ' ', end - ptr );
+		if ( !next )
+			next = end - 1;
+		bv.bv_val = ptr;
+		bv.bv_len = next - ptr;
+		next++;
+		if ( !bv.bv_len )
+			continue;
+		slap_insert_csn_sids( ck, ck->numcsns, slap_parse_csn_sid( &bv ), &bv );
+	}
+	if ( ck->numcsns )
+		slap_sort_csn_sids( ck->ctxcsn, ck->sids, ck->numcsns, NULL );
+	return 0;
+}
+
+static void
+syncprov_disklog_setmin( struct sync_cookie *ck, BerVarray csns, int numcsns )
+{
+	int i;
+
+	if ( ck->ctxcsn ) {
+		ber_bvarray_free( ck->ctxcsn );
+		ck->ctxcsn = NULL;
+	}
+	ch_free( ck->sids );
+	ck->sids = NULL;
+	ck->numcsns = 0;
+	for ( i=0; i<numcsns; i++ )
+		slap_insert_csn_sids( ck, i, slap_parse_csn_sid( &csns[i] ), &csns[i] );
+}
+
+/* Forget about the change at csn, the log can no longer serve
+ * consumers older than that.
+ */
+static void
+syncprov_disklog_expire( struct sync_cookie *ck, struct berval *csn )
+{
+	int i, sid = slap_parse_csn_sid( csn );
+
+	for ( i=0; i<ck->numcsns; i++ )
+		if ( ck->sids[i] >= sid )
+			break;
+	if ( i == ck->numcsns || ck->sids[i] != sid ) {
+		slap_insert_csn_sids( ck, i, sid, csn );
+	} else if ( ber_bvcmp( csn, &ck->ctxcsn[i] ) > 0 ) {
+		ber_bvreplace( &ck->ctxcsn[i], csn );
+	}
+}
+
+/* Drop records older than maxage, and the oldest eighth of the log
+ * once it takes up more than 3/4 of its map (the rest is kept as
+ * headroom for LMDB's copy-on-write).
+ */
+static int
+syncprov_disklog_trim( Operation *op, sessionlog *sl, MDB_txn *txn )
+{
+	MDB_cursor *mc;
+	MDB_val key, data;
+	MDB_stat st;
+	struct berval csn, uuid, cutoff = BER_BVNULL;
+	char timebuf[ LDAP_LUTIL_GENTIME_BUFSIZE ];
+	ber_tag_t tag;
+	size_t count = 0;
+	int rc, trimmed = 0;
+
+	if ( sl->sl_maxage ) {
+		time_t old = op->o_time - sl->sl_maxage;
+
+		cutoff.bv_val = timebuf;
+		cutoff.bv_len = sizeof(timebuf);
+		slap_timestamp( &old, &cutoff );
+		/* Compare the date and time only, without the 'Z' */
+		cutoff.bv_len--;
+	}
+
+	rc = mdb_stat( txn, sl->sl_dbi, &st );
+	if ( rc )
+		return rc;
+	if ( ( st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages ) *
+			st.ms_psize > sl->sl_maxsize / 4 * 3 )
+		count = st.ms_entries / 8 + 1;
+
+	if ( !count && BER_BVISNULL( &cutoff ))
+		return 0;
+
+	rc = mdb_cursor_open( txn, sl->sl_dbi, &mc );
+	if ( rc )
+		return rc;
+
+	while ( ( rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST )) == 0 ) {
+		if ( syncprov_disklog_parse( &key, &data, &csn, &uuid, &tag ) ) {
+			rc = MDB_CORRUPTED;
+			break;
+		}
+		if ( !count && ( csn.bv_len < cutoff.bv_len ||
+				strncmp( csn.bv_val, cutoff.bv_val, cutoff.bv_len ) >= 0 ))
+			break;
+
+		Debug( LDAP_DEBUG_SYNC, "%s syncprov_disklog_trim: "
+			"expiring csn=%s from disk sessionlog\n",
+			op->o_log_prefix, csn.bv_val );
+		syncprov_disklog_expire( &sl->sl_dmin, &csn );
+		rc = mdb_cursor_del( mc, 0 );
+		if ( rc )
+			break;
+		trimmed++;
+		if ( count )
+			count--;
+	}
+	mdb_cursor_close( mc );
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+
+	if ( !rc && trimmed )
+		rc = syncprov_disklog_putcsns( sl, txn, &slog_meta_mincsn,
+			sl->sl_dmin.ctxcsn, sl->sl_dmin.numcsns );
+	return rc;
+}
+
+/* Append a record to the disk log, called with sl_mutex write locked */
+static void
+syncprov_disklog_add( Operation *op, sessionlog *sl, slog_entry *se )
+{
+	MDB_txn *txn;
+	MDB_val key, data;
+	char keybuf[SLOG_KEY_MAX];
+	unsigned char tag = se->se_tag;
+	int rc;
+
+	/* Adds are never replayed, and their UUID isn't always known */
+	if ( se->se_tag == LDAP_REQ_ADD )
+		return;
+
+	if ( syncprov_disklog_key( &key, keybuf, &se->se_csn, &se->se_uuid,
+			se->se_tag ) ) {
+		/* Can't log it, so nothing older can be replayed any more */
+		syncprov_disklog_expire( &sl->sl_dmin, &se->se_csn );
+		return;
+	}
+	data.mv_data = &tag;
+	data.mv_size = 1;
+
+	rc = mdb_txn_begin( sl->sl_env, NULL, 0, &txn );
+	if ( rc == 0 ) {
+		rc = syncprov_disklog_trim( op, sl, txn );
+		if ( rc == 0 )
+			rc = mdb_put( txn, sl->sl_dbi, &key, &data, 0 );
+		if ( rc == 0 || rc == MDB_KEYEXIST ) {
+			rc = mdb_txn_commit( txn );
+		} else {
+			mdb_txn_abort( txn );
+		}
+	}
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "%s syncprov_disklog_add: "
+			"failed to log csn=%s: %s\n",
+			op->o_log_prefix, se->se_csn.bv_val, mdb_strerror( rc ) );
+		syncprov_disklog_expire( &sl->sl_dmin, &se->se_csn );
+	}
+}
+
+/* A change without a CSN went by, start afresh. Takes sl_mutex itself
+ * as it needs si_csn_rwlock first.
+ */
+static void
+syncprov_disklog_wipe( Operation *op, syncprov_info_t *si, sessionlog *sl )
+{
+	MDB_txn *txn;
+	BerVarray ctxcsn;
+	int numcsns, rc;
+
+	ldap_pvt_thread_rdwr_rlock( &si->si_csn_rwlock );
+	ber_bvarray_dup_x( &ctxcsn, si->si_ctxcsn, NULL );
+	numcsns = si->si_numcsns;
+	ldap_pvt_thread_rdwr_runlock( &si->si_csn_rwlock );
+
+	ldap_pvt_thread_rdwr_wlock( &sl->sl_mutex );
+	syncprov_disklog_setmin( &sl->sl_dmin, ctxcsn, numcsns );
+	rc = mdb_txn_begin( sl->sl_env, NULL, 0, &txn );
+	if ( rc == 0 ) {
+		rc = mdb_drop( txn, sl->sl_dbi, 0 );
+		if ( rc == 0 )
+			rc = syncprov_disklog_putcsns( sl, txn, &slog_meta_mincsn,
+				sl->sl_dmin.ctxcsn, sl->sl_dmin.numcsns );
+		if ( rc == 0 ) {
+			rc = mdb_txn_commit( txn );
+		} else {
+			mdb_txn_abort( txn );
+		}
+	}
+	ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
+	if ( ctxcsn )
+		ber_bvarray_free( ctxcsn );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "%s syncprov_disklog_wipe: "
+			"failed to reset disk sessionlog: %s\n",
+			op->o_log_prefix, mdb_strerror( rc ) );
+	}
+}
+
+static int
+syncprov_disklog_open( syncprov_info_t *si )
+{
+	sessionlog *sl = si->si_logs;
+	struct sync_cookie ck = {0};
+	MDB_txn *txn;
+	MDB_val key, data;
+	int i, rc, valid = 0;
+
+	rc = mdb_env_create( &sl->sl_env );
+	if ( rc == 0 )
+		rc = mdb_env_set_maxdbs( sl->sl_env, 2 );
+	if ( rc == 0 )
+		rc = mdb_env_set_mapsize( sl->sl_env, sl->sl_maxsize );
+	/* The log is discarded after an unclean shutdown anyway */
+	if ( rc == 0 )
+		rc = mdb_env_open( sl->sl_env, sl->sl_path,
+			MDB_NOSYNC|MDB_NOMETASYNC, SLAPD_DEFAULT_DB_MODE );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "syncprov_db_open: "
+			"cannot open disk sessionlog at %s: %s\n",
+			sl->sl_path, mdb_strerror( rc ) );
+		goto fail;
+	}
+
+	rc = mdb_txn_begin( sl->sl_env, NULL, 0, &txn );
+	if ( rc == 0 )
+		rc = mdb_dbi_open( txn, "log", MDB_CREATE, &sl->sl_dbi );
+	if ( rc == 0 )
+		rc = mdb_dbi_open( txn, "meta", MDB_CREATE, &sl->sl_meta );
+	if ( rc )
+		goto abort;
+
+	/* Only reuse the log if it was closed cleanly and the database
+	 * hasn't moved on without us since.
+	 */
+	key.mv_data = slog_meta_clean.bv_val;
+	key.mv_size = slog_meta_clean.bv_len;
+	if ( mdb_get( txn, sl->sl_meta, &key, &data ) == 0 &&
+		syncprov_disklog_getcsns( sl, txn, &slog_meta_ctxcsn, &ck ) == 0 &&
+		ck.numcsns == si->si_numcsns )
+	{
+		for ( i=0; i<ck.numcsns; i++ ) {
+			if ( ck.sids[i] != si->si_sids[i] ||
+				!bvmatch( &ck.ctxcsn[i], &si->si_ctxcsn[i] ))
+				break;
+		}
+		if ( i == ck.numcsns &&
+				syncprov_disklog_getcsns( sl, txn, &slog_meta_mincsn,
+					&sl->sl_dmin ) == 0 )
+			valid = 1;
+	}
+	if ( ck.ctxcsn )
+		ber_bvarray_free( ck.ctxcsn );
+	ch_free( ck.sids );
+
+	if ( valid ) {
+		Debug( LDAP_DEBUG_SYNC, "syncprov_db_open: "
+			"reusing disk sessionlog at %s\n", sl->sl_path );
+	} else {
+		Debug( LDAP_DEBUG_SYNC, "syncprov_db_open: "
+			"disk sessionlog at %s is stale, discarding\n", sl->sl_path );
+		syncprov_disklog_setmin( &sl->sl_dmin, si->si_ctxcsn, si->si_numcsns );
+		rc = mdb_drop( txn, sl->sl_dbi, 0 );
+		if ( rc == 0 )
+			rc = syncprov_disklog_putcsns( sl, txn, &slog_meta_mincsn,
+				sl->sl_dmin.ctxcsn, sl->sl_dmin.numcsns );
+		if ( rc )
+			goto abort;
+	}
+
+	/* We're live now, any contextCSN stored is going to be outdated */
+	rc = mdb_del( txn, sl->sl_meta, &key, NULL );
+	if ( rc && rc != MDB_NOTFOUND )
+		goto abort;
+	rc = mdb_txn_commit( txn );
+	if ( rc == 0 )
+		rc = mdb_env_sync( sl->sl_env, 1 );
+	if ( rc == 0 )
+		return 0;
+	goto fail;
+
+abort:
+	mdb_txn_abort( txn );
+	Debug( LDAP_DEBUG_ANY, "syncprov_db_open: "
+		"cannot set up disk sessionlog at %s: %s\n",
+		sl->sl_path, mdb_strerror( rc ) );
+fail:
+	if ( sl->sl_env ) {
+		mdb_env_close( sl->sl_env );
+		sl->sl_env = NULL;
+	}
+	return -1;
+}
+
+static void
+syncprov_disklog_close( syncprov_info_t *si )
+{
+	sessionlog *sl = si->si_logs;
+	MDB_txn *txn;
+	MDB_val key, data;
+	int rc;
+
+	ldap_pvt_thread_rdwr_wlock( &sl->sl_mutex );
+	rc = mdb_txn_begin( sl->sl_env, NULL, 0, &txn );
+	if ( rc == 0 ) {
+		rc = syncprov_disklog_putcsns( sl, txn, &slog_meta_mincsn,
+			sl->sl_dmin.ctxcsn, sl->sl_dmin.numcsns );
+		if ( rc == 0 )
+			rc = syncprov_disklog_putcsns( sl, txn, &slog_meta_ctxcsn,
+				si->si_ctxcsn, si->si_numcsns );
+		if ( rc == 0 ) {
+			key.mv_data = slog_meta_clean.bv_val;
+			key.mv_size = slog_meta_clean.bv_len;
+			data.mv_data = "";
+			data.mv_size = 0;
+			rc = mdb_put( txn, sl->sl_meta, &key, &data, 0 );
+		}
+		if ( rc == 0 ) {
+			rc = mdb_txn_commit( txn );
+		} else {
+			mdb_txn_abort( txn );
+		}
+	}
+	if ( rc == 0 )
+		rc = mdb_env_sync( sl->sl_env, 1 );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "syncprov_db_close: "
+			"failed to save disk sessionlog at %s, "
+			"it will be discarded on next startup: %s\n",
+			sl->sl_path, mdb_strerror( rc ) );
+	}
+	mdb_env_close( sl->sl_env );
+	sl->sl_env = NULL;
+	if ( sl->sl_dmin.ctxcsn ) {
+		ber_bvarray_free( sl->sl_dmin.ctxcsn );
+		sl->sl_dmin.ctxcsn = NULL;
+	}
+	ch_free( sl->sl_dmin.sids );
+	sl->sl_dmin.sids = NULL;
+	sl->sl_dmin.numcsns = 0;
+	ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
+}
+#endif /* SYNCPROV_DISKLOG */
+
 static void
 syncprov_add_slog( Operation *op )
 {
@@ -1646,6 +2933,10 @@ syncprov_add_slog( Operation *op )
 			 * state with respect to such operations, so we ignore them and
 			 * wipe out anything in the log if we see them.
 			 */
+#ifdef SYNCPROV_DISKLOG
+			if ( sl->sl_env )
+				syncprov_disklog_wipe( op, si, sl );
+#endif
 			ldap_pvt_thread_rdwr_wlock( &sl->sl_mutex );
 			/* can only do this if no one else is reading the log at the moment */
 			if ( !sl->sl_playing ) {
@@ -1702,6 +2993,10 @@ syncprov_add_slog( Operation *op )
 			goto leave;
 		}
 		sl->sl_num++;
+#ifdef SYNCPROV_DISKLOG
+		if ( sl->sl_env )
+			syncprov_disklog_add( op, sl, se );
+#endif
 		if ( !sl->sl_playing && sl->sl_num > sl->sl_size ) {
 			TAvlnode *edge = tavl_end( sl->sl_entries, TAVL_DIR_LEFT );
 			while ( sl->sl_num > sl->sl_size ) {
@@ -1953,156 +3248,104 @@ syncprov_accesslog_uuid_cb( Operation *op, SlapReply *rs )
 	return rs->sr_err;
 }
 
-static int
-syncprov_play_sessionlog( Operation *op, SlapReply *rs, sync_control *srs,
-		BerVarray ctxcsn, int numcsns, int *sids,
-		struct berval *mincsn, int minsid )
-{
-	slap_overinst		*on = (slap_overinst *)op->o_bd->bd_info;
-	syncprov_info_t *si = (syncprov_info_t *)on->on_bi.bi_private;
-	sessionlog *sl = si->si_logs;
-	int i, j, ndel, num, nmods, mmods, do_play = 0, rc = -1;
-	BerVarray uuids, csns;
-	struct berval uuid[2] = {}, csn[2] = {};
-	slog_entry *se;
-	TAvlnode *entry;
-	char cbuf[LDAP_PVT_CSNSTR_BUFSIZE];
-	struct berval delcsn[2];
-
-	ldap_pvt_thread_rdwr_wlock( &sl->sl_mutex );
-	/* Are there any log entries, and is the consumer state
-	 * present in the session log?
-	 */
-	if ( !sl->sl_num ) {
-		ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
-		return rc;
-	}
-	assert( sl->sl_num > 0 );
+/* Is the consumer state described by mincsn/minsid recent enough
+ * for a log whose oldest retained CSNs are mincsns?
+ */
+static int
+syncprov_slog_covers( BerVarray mincsns, int *minsids, int numcsns,
+		struct berval *mincsn, int minsid )
+{
+	int i;
 
-	for ( i=0; i<sl->sl_numcsns; i++ ) {
+	for ( i=0; i<numcsns; i++ ) {
 		/* SID not present == new enough */
-		if ( minsid < sl->sl_sids[i] ) {
-			do_play = 1;
-			break;
-		}
+		if ( minsid < minsids[i] )
+			return 1;
 		/* SID present */
-		if ( minsid == sl->sl_sids[i] ) {
+		if ( minsid == minsids[i] ) {
 			/* new enough? */
-			if ( ber_bvcmp( mincsn, &sl->sl_mincsn[i] ) >= 0 )
-				do_play = 1;
-			break;
+			return ber_bvcmp( mincsn, &mincsns[i] ) >= 0;
 		}
 	}
 	/* SID not present == new enough */
-	if ( i == sl->sl_numcsns )
-		do_play = 1;
-
-	if ( !do_play ) {
-		ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
-		return rc;
-	}
-
-	num = sl->sl_num;
-	i = 0;
-	nmods = 0;
-	sl->sl_playing++;
-	ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
-
-	uuids = op->o_tmpalloc( (num) * sizeof( struct berval ) +
-			num * UUID_LEN, op->o_tmpmemctx );
-	uuids[0].bv_val = (char *)(uuids + num);
-	csns = op->o_tmpalloc( (num) * sizeof( struct berval ) +
-			num * LDAP_PVT_CSNSTR_BUFSIZE, op->o_tmpmemctx );
-	csns[0].bv_val = (char *)(csns + num);
+	return 1;
+}
 
-	ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
-	/* Make a copy of the relevant UUIDs. Put the Deletes up front
-	 * and everything else at the end. Do this first so we can
-	 * let the write side manage the sessionlog again.
-	 */
-	assert( sl->sl_entries );
+/* Whether a logged change needs replaying to this consumer: -1 if the
+ * consumer has already seen it, 0 if it is newer than the state we are
+ * refreshing to (and so is everything after it), 1 otherwise.
+ */
+static int
+syncprov_slog_want( sync_control *srs, BerVarray ctxcsn, int numcsns,
+		int *sids, int sid, struct berval *csn )
+{
+	int k, cmp = 1;
 
-	/* Find first relevant log entry. If greater than mincsn, backtrack one entry */
-	{
-		slog_entry te = {0};
-		te.se_csn = *mincsn;
-		entry = tavl_find3( sl->sl_entries, &te, syncprov_sessionlog_cmp, &ndel );
+	for ( k=0; k<srs->sr_state.numcsns; k++ ) {
+		if ( sid == srs->sr_state.sids[k] ) {
+			cmp = ber_bvcmp( csn, &srs->sr_state.ctxcsn[k] );
+			break;
+		}
 	}
-	if ( ndel > 0 && entry )
-		entry = tavl_next( entry, TAVL_DIR_LEFT );
-	/* if none, just start at beginning */
-	if ( !entry )
-		entry = tavl_end( sl->sl_entries, TAVL_DIR_LEFT );
-
-	do {
-		char uuidstr[40] = {};
-		slog_entry *se = entry->avl_data;
-		int k;
+	if ( cmp <= 0 )
+		return -1;
 
-		/* Make sure writes can still make progress */
-		ldap_pvt_thread_rdwr_runlock( &sl->sl_mutex );
-		ndel = 1;
-		for ( k=0; k<srs->sr_state.numcsns; k++ ) {
-			if ( se->se_sid == srs->sr_state.sids[k] ) {
-				ndel = ber_bvcmp( &se->se_csn, &srs->sr_state.ctxcsn[k] );
-				break;
-			}
-		}
-		if ( ndel <= 0 ) {
-			ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
-			continue;
-		}
-		ndel = 0;
-		for ( k=0; k<numcsns; k++ ) {
-			if ( se->se_sid == sids[k] ) {
-				ndel = ber_bvcmp( &se->se_csn, &ctxcsn[k] );
-				break;
-			}
-		}
-		if ( ndel > 0 ) {
-			Debug( LDAP_DEBUG_SYNC, "%s syncprov_play_sessionlog: "
-				"cmp %d, csn %s too new, we're finished\n",
-				op->o_log_prefix, ndel, se->se_csn.bv_val );
-			ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
+	cmp = 0;
+	for ( k=0; k<numcsns; k++ ) {
+		if ( sid == sids[k] ) {
+			cmp = ber_bvcmp( csn, &ctxcsn[k] );
 			break;
 		}
-		if ( se->se_tag == LDAP_REQ_DELETE ) {
-			j = i;
-			i++;
-		} else {
-			if ( se->se_tag == LDAP_REQ_ADD ) {
-				ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
-				continue;
-			}
-			nmods++;
-			j = num - nmods;
-		}
-		uuids[j].bv_val = uuids[0].bv_val + (j * UUID_LEN);
-		AC_MEMCPY(uuids[j].bv_val, se->se_uuid.bv_val, UUID_LEN);
-		uuids[j].bv_len = UUID_LEN;
+	}
+	return cmp > 0 ? 0 : 1;
+}
 
-		csns[j].bv_val = csns[0].bv_val + (j * LDAP_PVT_CSNSTR_BUFSIZE);
-		AC_MEMCPY(csns[j].bv_val, se->se_csn.bv_val, se->se_csn.bv_len);
-		csns[j].bv_len = se->se_csn.bv_len;
-		/* We're printing it */
-		csns[j].bv_val[csns[j].bv_len] = '\0';
+/* Record a change picked from the log. Put the Deletes up front
+ * and everything else at the end.
+ */
+static void
+syncprov_slog_pick( Operation *op, BerVarray uuids, BerVarray csns,
+		int num, int *ndel, int *nmods,
+		struct berval *uuid, struct berval *csn, ber_tag_t tag )
+{
+	char uuidstr[40] = {};
+	int j;
 
-		if ( LogTest( LDAP_DEBUG_SYNC ) ) {
-			lutil_uuidstr_from_normalized( uuids[j].bv_val, uuids[j].bv_len,
-					uuidstr, 40 );
-			Debug( LDAP_DEBUG_SYNC, "%s syncprov_play_sessionlog: "
-				"picking a %s entry uuid=%s cookie=%s\n",
-				op->o_log_prefix, se->se_tag == LDAP_REQ_DELETE ? "deleted" : "modified",
-				uuidstr, csns[j].bv_val );
-		}
-		ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
-	} while ( (entry = tavl_next( entry, TAVL_DIR_RIGHT )) != NULL );
-	ldap_pvt_thread_rdwr_runlock( &sl->sl_mutex );
-	ldap_pvt_thread_rdwr_wlock( &sl->sl_mutex );
-	sl->sl_playing--;
-	ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
+	if ( tag == LDAP_REQ_DELETE ) {
+		j = (*ndel)++;
+	} else {
+		(*nmods)++;
+		j = num - *nmods;
+	}
+	uuids[j].bv_val = uuids[0].bv_val + (j * UUID_LEN);
+	AC_MEMCPY(uuids[j].bv_val, uuid->bv_val, UUID_LEN);
+	uuids[j].bv_len = UUID_LEN;
+
+	csns[j].bv_val = csns[0].bv_val + (j * LDAP_PVT_CSNSTR_BUFSIZE);
+	AC_MEMCPY(csns[j].bv_val, csn->bv_val, csn->bv_len);
+	csns[j].bv_len = csn->bv_len;
+	/* We're printing it */
+	csns[j].bv_val[csns[j].bv_len] = '\0';
+
+	if ( LogTest( LDAP_DEBUG_SYNC ) ) {
+		lutil_uuidstr_from_normalized( uuids[j].bv_val, uuids[j].bv_len,
+				uuidstr, 40 );
+		Debug( LDAP_DEBUG_SYNC, "%s syncprov_play_sessionlog: "
+			"picking a %s entry uuid=%s cookie=%s\n",
+			op->o_log_prefix, tag == LDAP_REQ_DELETE ? "deleted" : "modified",
+			uuidstr, csns[j].bv_val );
+	}
+}
 
-	ndel = i;
+/* Send the deletes collected from a log and any modified entries
+ * that no longer match the search.
+ */
+static void
+syncprov_slog_send( Operation *op, SlapReply *rs, sync_control *srs,
+		BerVarray uuids, BerVarray csns, int num, int ndel, int nmods )
+{
+	struct berval uuid[2] = {}, csn[2] = {};
+	int i, j, mmods;
 
 	/* Zero out unused slots */
 	for ( i=ndel; i < num - nmods; i++ )
@@ -2178,6 +3421,202 @@ syncprov_play_sessionlog( Operation *op, SlapReply *rs, sync_control *srs,
 		 * phase), but would have to limit how many we send out at once */
 		syncprov_sendinfo( op, rs, LDAP_TAG_SYNC_ID_SET, &cookie, 0, uuid, 1 );
 	}
+}
+
+#ifdef SYNCPROV_DISKLOG
+/* Same as syncprov_play_sessionlog, from the on-disk log. The read txn
+ * gives us a stable snapshot, so the log is walked twice: once to size
+ * the UUID list, then to fill it in.
+ */
+static int
+syncprov_play_disklog( Operation *op, SlapReply *rs, sync_control *srs,
+		BerVarray ctxcsn, int numcsns, int *sids,
+		struct berval *mincsn, int minsid )
+{
+	slap_overinst		*on = (slap_overinst *)op->o_bd->bd_info;
+	syncprov_info_t *si = (syncprov_info_t *)on->on_bi.bi_private;
+	sessionlog *sl = si->si_logs;
+	MDB_txn *txn;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	BerVarray uuids = NULL, csns = NULL;
+	struct berval csn, uuid;
+	ber_tag_t tag;
+	int pass, want, num = 0, ndel = 0, nmods = 0, rc;
+
+	ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
+	if ( !sl->sl_env || !syncprov_slog_covers( sl->sl_dmin.ctxcsn,
+			sl->sl_dmin.sids, sl->sl_dmin.numcsns, mincsn, minsid ) ) {
+		ldap_pvt_thread_rdwr_runlock( &sl->sl_mutex );
+		return -1;
+	}
+	/* Writers hold the lock while committing, so the snapshot agrees
+	 * with the minCSN we just checked */
+	rc = mdb_txn_begin( sl->sl_env, NULL, MDB_RDONLY, &txn );
+	ldap_pvt_thread_rdwr_runlock( &sl->sl_mutex );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "%s syncprov_play_disklog: "
+			"cannot read disk sessionlog: %s\n",
+			op->o_log_prefix, mdb_strerror( rc ) );
+		return -1;
+	}
+	rc = mdb_cursor_open( txn, sl->sl_dbi, &mc );
+	if ( rc ) {
+		mdb_txn_abort( txn );
+		return -1;
+	}
+
+	Debug( LDAP_DEBUG_SYNC, "%s syncprov_play_disklog: "
+		"replaying disk sessionlog from csn=%s\n",
+		op->o_log_prefix, mincsn->bv_val );
+
+	for ( pass = 0; pass < 2; pass++ ) {
+		ndel = nmods = 0;
+		/* CSN alone sorts before any record with that CSN */
+		key.mv_data = mincsn->bv_val;
+		key.mv_size = mincsn->bv_len;
+		for ( rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE ); rc == 0;
+				rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT ) ) {
+			if ( syncprov_disklog_parse( &key, &data, &csn, &uuid, &tag ) )
+				continue;
+			want = syncprov_slog_want( srs, ctxcsn, numcsns, sids,
+				slap_parse_csn_sid( &csn ), &csn );
+			if ( !want )
+				break;
+			if ( want < 0 || tag == LDAP_REQ_ADD )
+				continue;
+			if ( pass ) {
+				syncprov_slog_pick( op, uuids, csns, num, &ndel, &nmods,
+					&uuid, &csn, tag );
+			} else if ( tag == LDAP_REQ_DELETE ) {
+				ndel++;
+			} else {
+				nmods++;
+			}
+		}
+		if ( rc && rc != MDB_NOTFOUND )
+			break;
+		rc = 0;
+
+		if ( !pass ) {
+			num = ndel + nmods;
+			if ( !num )
+				break;
+			uuids = op->o_tmpalloc( (num) * sizeof( struct berval ) +
+					num * UUID_LEN, op->o_tmpmemctx );
+			uuids[0].bv_val = (char *)(uuids + num);
+			csns = op->o_tmpalloc( (num) * sizeof( struct berval ) +
+					num * LDAP_PVT_CSNSTR_BUFSIZE, op->o_tmpmemctx );
+			csns[0].bv_val = (char *)(csns + num);
+		}
+	}
+	mdb_cursor_close( mc );
+	mdb_txn_abort( txn );
+
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "%s syncprov_play_disklog: "
+			"error reading disk sessionlog: %s\n",
+			op->o_log_prefix, mdb_strerror( rc ) );
+	} else if ( num ) {
+		syncprov_slog_send( op, rs, srs, uuids, csns, num, ndel, nmods );
+	}
+	if ( uuids ) {
+		op->o_tmpfree( uuids, op->o_tmpmemctx );
+		op->o_tmpfree( csns, op->o_tmpmemctx );
+	}
+
+	return rc ? -1 : LDAP_SUCCESS;
+}
+#endif /* SYNCPROV_DISKLOG */
+
+static int
+syncprov_play_sessionlog( Operation *op, SlapReply *rs, sync_control *srs,
+		BerVarray ctxcsn, int numcsns, int *sids,
+		struct berval *mincsn, int minsid )
+{
+	slap_overinst		*on = (slap_overinst *)op->o_bd->bd_info;
+	syncprov_info_t *si = (syncprov_info_t *)on->on_bi.bi_private;
+	sessionlog *sl = si->si_logs;
+	int ndel, num, nmods, want, rc = -1;
+	BerVarray uuids, csns;
+	TAvlnode *entry;
+
+	ldap_pvt_thread_rdwr_wlock( &sl->sl_mutex );
+	/* Are there any log entries, and is the consumer state
+	 * present in the session log?
+	 */
+	if ( !sl->sl_num || !syncprov_slog_covers( sl->sl_mincsn, sl->sl_sids,
+			sl->sl_numcsns, mincsn, minsid ) ) {
+		ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
+#ifdef SYNCPROV_DISKLOG
+		/* The in-memory log has been outrun, try the one on disk */
+		if ( sl->sl_env )
+			rc = syncprov_play_disklog( op, rs, srs, ctxcsn, numcsns, sids,
+				mincsn, minsid );
+#endif
+		return rc;
+	}
+	assert( sl->sl_num > 0 );
+
+	num = sl->sl_num;
+	ndel = 0;
+	nmods = 0;
+	sl->sl_playing++;
+	ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
+
+	uuids = op->o_tmpalloc( (num) * sizeof( struct berval ) +
+			num * UUID_LEN, op->o_tmpmemctx );
+	uuids[0].bv_val = (char *)(uuids + num);
+	csns = op->o_tmpalloc( (num) * sizeof( struct berval ) +
+			num * LDAP_PVT_CSNSTR_BUFSIZE, op->o_tmpmemctx );
+	csns[0].bv_val = (char *)(csns + num);
+
+	ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
+	/* Make a copy of the relevant UUIDs. Do this first so we can
+	 * let the write side manage the sessionlog again.
+	 */
+	assert( sl->sl_entries );
+
+	/* Find first relevant log entry. If greater than mincsn, backtrack one entry */
+	{
+		slog_entry te = {0};
+		int cmp;
+		te.se_csn = *mincsn;
+		entry = tavl_find3( sl->sl_entries, &te, syncprov_sessionlog_cmp, &cmp );
+		if ( cmp > 0 && entry )
+			entry = tavl_next( entry, TAVL_DIR_LEFT );
+	}
+	/* if none, just start at beginning */
+	if ( !entry )
+		entry = tavl_end( sl->sl_entries, TAVL_DIR_LEFT );
+
+	do {
+		slog_entry *se = entry->avl_data;
+
+		/* Make sure writes can still make progress */
+		ldap_pvt_thread_rdwr_runlock( &sl->sl_mutex );
+		want = syncprov_slog_want( srs, ctxcsn, numcsns, sids,
+			se->se_sid, &se->se_csn );
+		if ( !want ) {
+			Debug( LDAP_DEBUG_SYNC, "%s syncprov_play_sessionlog: "
+				"csn %s too new, we're finished\n",
+				op->o_log_prefix, se->se_csn.bv_val );
+			ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
+			break;
+		}
+		if ( want > 0 && se->se_tag != LDAP_REQ_ADD ) {
+			syncprov_slog_pick( op, uuids, csns, num, &ndel, &nmods,
+				&se->se_uuid, &se->se_csn, se->se_tag );
+		}
+		ldap_pvt_thread_rdwr_rlock( &sl->sl_mutex );
+	} while ( (entry = tavl_next( entry, TAVL_DIR_RIGHT )) != NULL );
+	ldap_pvt_thread_rdwr_runlock( &sl->sl_mutex );
+	ldap_pvt_thread_rdwr_wlock( &sl->sl_mutex );
+	sl->sl_playing--;
+	ldap_pvt_thread_rdwr_wunlock( &sl->sl_mutex );
+
+	syncprov_slog_send( op, rs, srs, uuids, csns, num, ndel, nmods );
+
 	op->o_tmpfree( uuids, op->o_tmpmemctx );
 	op->o_tmpfree( csns, op->o_tmpmemctx );
 
@@ -3016,7 +4455,7 @@ syncprov_op_search( Operation *op, SlapReply *rs )
 	BerVarray ctxcsn;
 	int i, *sids, numcsns;
 	struct berval mincsn, maxcsn;
-	int minsid, maxsid;
+	int minsid = -1, maxsid = -1;
 	int dirty = 0;
 
 	if ( !(op->o_sync_mode & SLAP_SYNC_REFRESH) ) return SLAP_CB_CONTINUE;
@@ -3061,8 +4500,10 @@ syncprov_op_search( Operation *op, SlapReply *rs )
 		}
 		sop = ch_malloc( sizeof( syncops ));
 		*sop = so;
+		syncprov_keys_build( sop, op->ors_filter );
 		sop->s_rid = srs->sr_state.rid;
 		sop->s_sid = srs->sr_state.sid;
+		syncprov_sharekey( op, sop );
 		/* set refcount=2 to prevent being freed out from under us
 		 * by abandons that occur while we're running here
 		 */
@@ -3078,6 +4519,8 @@ syncprov_op_search( Operation *op, SlapReply *rs )
 			 */
 			ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 			if ( slapd_shutdown ) {
+				syncprov_keys_free( sop );
+				ch_free( sop->s_sharekey.bv_val );
 				ch_free( sop );
 				return SLAPD_ABANDON;
 			}
@@ -3087,6 +4530,8 @@ syncprov_op_search( Operation *op, SlapReply *rs )
 		}
 		if ( op->o_abandon ) {
 			ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
+			syncprov_keys_free( sop );
+			ch_free( sop->s_sharekey.bv_val );
 			ch_free( sop );
 			return SLAPD_ABANDON;
 		}
@@ -3097,6 +4542,8 @@ syncprov_op_search( Operation *op, SlapReply *rs )
 		ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 		Debug( LDAP_DEBUG_SYNC, "%s syncprov_op_search: "
 			"registered persistent search\n", op->o_log_prefix );
+		sop->s_start = slap_get_time();
+		syncprov_monitor_add( op, sop );
 	}
 
 	/* snapshot the ctxcsn
@@ -3210,6 +4657,7 @@ bailout:
 						sp = &(*sp)->s_next;
 					*sp = sop->s_next;
 					ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
+					syncprov_keys_free( sop );
 					ch_free( sop );
 				}
 				rs->sr_ctrls = NULL;
@@ -3498,7 +4946,11 @@ enum {
 	SP_SESSL,
 	SP_NOPRES,
 	SP_USEHINT,
-	SP_LOGDB
+	SP_LOGDB,
+	SP_SLPATH,
+	SP_SLMAXSIZE,
+	SP_SLMAXAGE,
+	SP_MAXQUEUE
 };
 
 static ConfigDriver sp_cf_gen;
@@ -3528,6 +4980,26 @@ static ConfigTable spcfg[] = {
 		sp_cf_gen, "( OLcfgOvAt:1.5 NAME 'olcSpSessionlogSource' "
 			"DESC 'On startup, try loading sessionlog from this subtree' "
 			"SYNTAX OMsDN SINGLE-VALUE )", NULL, NULL },
+	{ "syncprov-sessionlog-path", "directory", 2, 2, 0, ARG_STRING|ARG_MAGIC|SP_SLPATH,
+		sp_cf_gen, "( OLcfgOvAt:1.6 NAME 'olcSpSessionlogPath' "
+			"DESC 'Directory holding the on-disk session log' "
+			"EQUALITY caseExactMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "syncprov-sessionlog-maxsize", "size", 2, 2, 0, ARG_ULONG|ARG_MAGIC|SP_SLMAXSIZE,
+		sp_cf_gen, "( OLcfgOvAt:1.7 NAME 'olcSpSessionlogMaxSize' "
+			"DESC 'Maximum size of the on-disk session log in bytes' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "syncprov-sessionlog-maxage", "seconds", 2, 2, 0, ARG_INT|ARG_MAGIC|SP_SLMAXAGE,
+		sp_cf_gen, "( OLcfgOvAt:1.8 NAME 'olcSpSessionlogMaxAge' "
+			"DESC 'Maximum age of on-disk session log records in seconds' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "syncprov-maxqueue", "changes", 2, 2, 0, ARG_INT|ARG_MAGIC|SP_MAXQUEUE,
+		sp_cf_gen, "( OLcfgOvAt:1.9 NAME 'olcSpMaxQueue' "
+			"DESC 'Maximum number of changes queued for a persistent search' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED }
 };
 
@@ -3541,11 +5013,27 @@ static ConfigOCs spocs[] = {
 			"$ olcSpNoPresent "
 			"$ olcSpReloadHint "
 			"$ olcSpSessionlogSource "
+			"$ olcSpSessionlogPath "
+			"$ olcSpSessionlogMaxSize "
+			"$ olcSpSessionlogMaxAge "
+			"$ olcSpMaxQueue "
 		") )",
 			Cft_Overlay, spcfg },
 	{ NULL, 0, NULL }
 };
 
+static sessionlog *
+syncprov_sessionlog_alloc( syncprov_info_t *si )
+{
+	sessionlog *sl;
+
+	sl = ch_calloc( 1, sizeof( sessionlog ));
+	sl->sl_maxsize = SLOG_DEFAULT_MAXSIZE;
+	ldap_pvt_thread_rdwr_init( &sl->sl_mutex );
+	si->si_logs = sl;
+	return sl;
+}
+
 static int
 sp_cf_gen(ConfigArgs *c)
 {
@@ -3602,6 +5090,34 @@ sp_cf_gen(ConfigArgs *c)
 				value_add_one( &c->rvalue_nvals, &si->si_logbase );
 			}
 			break;
+		case SP_SLPATH:
+			if ( si->si_logs && si->si_logs->sl_path ) {
+				c->value_string = ch_strdup( si->si_logs->sl_path );
+			} else {
+				rc = 1;
+			}
+			break;
+		case SP_SLMAXSIZE:
+			if ( si->si_logs && si->si_logs->sl_maxsize != SLOG_DEFAULT_MAXSIZE ) {
+				c->value_ulong = si->si_logs->sl_maxsize;
+			} else {
+				rc = 1;
+			}
+			break;
+		case SP_SLMAXAGE:
+			if ( si->si_logs && si->si_logs->sl_maxage ) {
+				c->value_int = si->si_logs->sl_maxage;
+			} else {
+				rc = 1;
+			}
+			break;
+		case SP_MAXQUEUE:
+			if ( si->si_maxqueue ) {
+				c->value_int = si->si_maxqueue;
+			} else {
+				rc = 1;
+			}
+			break;
 		}
 		return rc;
 	} else if ( c->op == LDAP_MOD_DELETE ) {
@@ -3625,6 +5141,23 @@ sp_cf_gen(ConfigArgs *c)
 				BER_BVZERO( &si->si_logbase );
 			}
 			break;
+		case SP_SLPATH:
+			if ( si->si_logs ) {
+				ch_free( si->si_logs->sl_path );
+				si->si_logs->sl_path = NULL;
+			}
+			break;
+		case SP_SLMAXSIZE:
+			if ( si->si_logs )
+				si->si_logs->sl_maxsize = SLOG_DEFAULT_MAXSIZE;
+			break;
+		case SP_SLMAXAGE:
+			if ( si->si_logs )
+				si->si_logs->sl_maxage = 0;
+			break;
+		case SP_MAXQUEUE:
+			si->si_maxqueue = 0;
+			break;
 		}
 		return rc;
 	}
@@ -3679,13 +5212,68 @@ sp_cf_gen(ConfigArgs *c)
 		sl = si->si_logs;
 		if ( !sl ) {
 			if ( !size ) break;
-			sl = ch_calloc( 1, sizeof( sessionlog ));
-			ldap_pvt_thread_rdwr_init( &sl->sl_mutex );
-			si->si_logs = sl;
+			sl = syncprov_sessionlog_alloc( si );
 		}
 		sl->sl_size = size;
 		}
 		break;
+	case SP_SLPATH:
+#ifndef SYNCPROV_DISKLOG
+		snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s requires back-mdb "
+			"to be built into slapd", c->argv[0] );
+		Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+			"%s: %s\n", c->log, c->cr_msg );
+		ch_free( c->value_string );
+		return ARG_BAD_CONF;
+#else
+		if ( si->si_logs && si->si_logs->sl_env ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s cannot be changed "
+				"while the session log is open", c->argv[0] );
+			Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+				"%s: %s\n", c->log, c->cr_msg );
+			ch_free( c->value_string );
+			return ARG_BAD_CONF;
+		}
+		if ( !si->si_logs )
+			syncprov_sessionlog_alloc( si );
+		ch_free( si->si_logs->sl_path );
+		si->si_logs->sl_path = c->value_string;
+		break;
+#endif
+	case SP_SLMAXSIZE:
+		if ( c->value_ulong < 1048576UL ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s size %lu is too small",
+				c->argv[0], c->value_ulong );
+			Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+				"%s: %s\n", c->log, c->cr_msg );
+			return ARG_BAD_CONF;
+		}
+		if ( !si->si_logs )
+			syncprov_sessionlog_alloc( si );
+		si->si_logs->sl_maxsize = c->value_ulong;
+		break;
+	case SP_SLMAXAGE:
+		if ( c->value_int < 0 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s age %d is negative",
+				c->argv[0], c->value_int );
+			Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+				"%s: %s\n", c->log, c->cr_msg );
+			return ARG_BAD_CONF;
+		}
+		if ( !si->si_logs )
+			syncprov_sessionlog_alloc( si );
+		si->si_logs->sl_maxage = c->value_int;
+		break;
+	case SP_MAXQUEUE:
+		if ( c->value_int < 0 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s %d is negative",
+				c->argv[0], c->value_int );
+			Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+				"%s: %s\n", c->log, c->cr_msg );
+			return ARG_BAD_CONF;
+		}
+		si->si_maxqueue = c->value_int;
+		break;
 	case SP_NOPRES:
 		si->si_nopres = c->value_int;
 		break;
@@ -3917,6 +5505,27 @@ syncprov_db_open(
 
 out:
 	op->o_bd->bd_info = (BackendInfo *)on;
+#ifdef SYNCPROV_DISKLOG
+	/* The disk log is only an optimisation, never fail the db over it */
+	if ( si->si_logs && si->si_logs->sl_path &&
+			syncprov_disklog_open( si ) ) {
+		char path[MAXPATHLEN];
+
+		Debug( LDAP_DEBUG_ANY, "syncprov_db_open: "
+			"recreating disk sessionlog at %s\n", si->si_logs->sl_path );
+		snprintf( path, sizeof(path), "%s" LDAP_DIRSEP "data.mdb",
+			si->si_logs->sl_path );
+		unlink( path );
+		snprintf( path, sizeof(path), "%s" LDAP_DIRSEP "lock.mdb",
+			si->si_logs->sl_path );
+		unlink( path );
+		if ( syncprov_disklog_open( si ) ) {
+			Debug( LDAP_DEBUG_ANY, "syncprov_db_open: "
+				"disk sessionlog at %s unusable, continuing without it\n",
+				si->si_logs->sl_path );
+		}
+	}
+#endif
 	return 0;
 }
 
@@ -3951,6 +5560,11 @@ syncprov_db_close(
 		op->o_ndn = be->be_rootndn;
 		syncprov_checkpoint( op, on );
 	}
+#ifdef SYNCPROV_DISKLOG
+	if ( si->si_logs && si->si_logs->sl_env ) {
+		syncprov_disklog_close( si );
+	}
+#endif
 
 #ifdef SLAP_CONFIG_DELETE
 	if ( !slapd_shutdown ) {
@@ -3991,6 +5605,7 @@ syncprov_db_init(
 
 	si = ch_calloc(1, sizeof(syncprov_info_t));
 	on->on_bi.bi_private = si;
+	syncprov_monitor_init();
 	ldap_pvt_thread_rdwr_init( &si->si_csn_rwlock );
 	ldap_pvt_thread_mutex_init( &si->si_ops_mutex );
 	ldap_pvt_thread_mutex_init( &si->si_mods_mutex );
@@ -4025,6 +5640,7 @@ syncprov_db_destroy(
 				ber_bvarray_free( sl->sl_mincsn );
 			if ( sl->sl_sids )
 				ch_free( sl->sl_sids );
+			ch_free( sl->sl_path );
 
 			ldap_pvt_thread_rdwr_destroy(&si->si_logs->sl_mutex);
 			ch_free( si->si_logs );
@@ -74,6 +74,8 @@ LDAP_SLAPD_F (int) acl_check_modlist LDAP_P((
 	Operation *op, Entry *e, Modifications *ml ));
 
 LDAP_SLAPD_F (void) acl_append( AccessControl **l, AccessControl *a, int pos );
+LDAP_SLAPD_F (void) acl_dn_prepare LDAP_P(( AccessControl *a ));
+LDAP_SLAPD_F (void) acl_index_rebuild LDAP_P(( AccessControl *head ));
 
 #ifdef SLAP_DYNACL
 LDAP_SLAPD_F (int) slap_dynacl_register LDAP_P(( slap_dynacl_t *da ));
@@ -958,6 +960,11 @@ LDAP_SLAPD_F (int) dnPrettyNormal LDAP_P((
 	struct berval *normal,
 	void *ctx ));
 
+LDAP_SLAPD_F (void) dn_cache_init LDAP_P(( void ));
+LDAP_SLAPD_F (void) dn_cache_flush LDAP_P(( void ));
+LDAP_SLAPD_F (void) dn_cache_destroy LDAP_P(( void ));
+LDAP_SLAPD_V (unsigned int) dn_cache_max;
+
 LDAP_SLAPD_F (int) dnMatch LDAP_P(( 
 	int *matchp, 
 	slap_mask_t flags, 
@@ -1062,6 +1069,14 @@ LDAP_SLAPD_F (Entry *) entry_dup2 LDAP_P(( Entry *dest, Entry *src ));
 LDAP_SLAPD_F (Entry *) entry_dup_bv LDAP_P(( Entry *e ));
 LDAP_SLAPD_F (Entry *) entry_alloc LDAP_P((void));
 LDAP_SLAPD_F (int) entry_prealloc LDAP_P((int num));
+LDAP_SLAPD_F (void) entry_attr_index LDAP_P(( Entry *e ));
+LDAP_SLAPD_F (void) entry_attr_unindex LDAP_P(( Entry *e ));
+LDAP_SLAPD_F (Attribute *) entry_attr_find LDAP_P((
+	Entry *e, AttributeDescription *desc ));
+LDAP_SLAPD_F (Attribute *) entry_attrs_find LDAP_P((
+	Entry *e, AttributeDescription *desc ));
+LDAP_SLAPD_F (Attribute *) entry_attrs_next LDAP_P((
+	Entry *e, Attribute *a, AttributeDescription *desc ));
 
 /*
  * extended.c
@@ -1076,6 +1091,7 @@ LDAP_SLAPD_V( const struct berval ) slap_EXOP_MODIFY_PASSWD;
 LDAP_SLAPD_V( const struct berval ) slap_EXOP_START_TLS;
 LDAP_SLAPD_V( const struct berval ) slap_EXOP_TXN_START;
 LDAP_SLAPD_V( const struct berval ) slap_EXOP_TXN_END;
+LDAP_SLAPD_V( const struct berval ) slap_EXOP_SNAPSHOT;
 
 typedef int (SLAP_EXTOP_MAIN_FN) LDAP_P(( Operation *op, SlapReply *rs ));
 
@@ -1108,6 +1124,50 @@ LDAP_SLAPD_F ( SLAP_EXTOP_MAIN_FN ) txn_start_extop;
 LDAP_SLAPD_F ( SLAP_EXTOP_MAIN_FN ) txn_end_extop;
 LDAP_SLAPD_F ( int ) txn_preop LDAP_P(( Operation *op, SlapReply *rs ));
 
+/*
+ * groupcache.c
+ */
+LDAP_SLAPD_V (unsigned long) group_cache_max;
+LDAP_SLAPD_F (void) group_cache_init LDAP_P(( void ));
+LDAP_SLAPD_F (void) group_cache_destroy LDAP_P(( void ));
+LDAP_SLAPD_F (int) group_cache_usable LDAP_P((
+	BackendDB *be,
+	AttributeDescription *group_at,
+	struct berval *op_ndn ));
+LDAP_SLAPD_F (int) group_cache_check LDAP_P((
+	BackendDB *be,
+	struct berval *gr_ndn,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	struct berval *op_ndn,
+	unsigned long *gen ));
+LDAP_SLAPD_F (void) group_cache_add LDAP_P((
+	BackendDB *be,
+	Entry *e,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	Attribute *a,
+	unsigned long gen,
+	time_t started ));
+LDAP_SLAPD_F (void) group_cache_invalidate LDAP_P((
+	struct berval *ndn,
+	struct berval *csn ));
+LDAP_SLAPD_F (void) group_cache_written LDAP_P((
+	struct berval *ndn,
+	struct berval *csn,
+	int subtree ));
+LDAP_SLAPD_F (void) group_cache_flush LDAP_P(( BackendDB *be ));
+LDAP_SLAPD_F (void) group_cache_stats LDAP_P((
+	unsigned long *hits,
+	unsigned long *misses,
+	unsigned long *count,
+	unsigned long *bytes ));
+
+/*
+ * snapshot.c
+ */
+LDAP_SLAPD_F ( SLAP_EXTOP_MAIN_FN ) snapshot_extop;
+
 /*
  * cancel.c
  */
@@ -1121,6 +1181,14 @@ LDAP_SLAPD_F (int) get_filter LDAP_P((
 	BerElement *ber,
 	Filter **filt,
 	const char **text ));
+LDAP_SLAPD_F (int) get_filter_cached LDAP_P((
+	Operation *op,
+	BerElement *ber,
+	Filter **filt,
+	struct berval *fstr,
+	const char **text ));
+LDAP_SLAPD_F (void) filter_cache_flush LDAP_P(( void ));
+LDAP_SLAPD_V (unsigned int) filter_cache_max;
 
 LDAP_SLAPD_F (void) filter_free LDAP_P(( Filter *f ));
 LDAP_SLAPD_F (void) filter_free_x LDAP_P(( Operation *op, Filter *f, int freeme ));
@@ -1151,6 +1219,10 @@ LDAP_SLAPD_F (void) filter_destroy LDAP_P(( void ));
  */
 
 LDAP_SLAPD_F (int) test_filter LDAP_P(( Operation *op, Entry *e, Filter *f ));
+LDAP_SLAPD_F (FilterProg *) filter_compile LDAP_P(( Operation *op, Filter *f ));
+LDAP_SLAPD_F (void) filter_prog_free LDAP_P(( Operation *op, FilterProg *fp ));
+LDAP_SLAPD_F (int) test_filter_prog LDAP_P((
+	Operation *op, Entry *e, FilterProg *fp ));
 
 /*
  * frontend.c
@@ -1628,6 +1700,8 @@ LDAP_SLAPD_F (void) slap_send_ldap_intermediate LDAP_P(( Operation *op, SlapRepl
 LDAP_SLAPD_F (void) slap_send_search_result LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_send_search_reference LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_send_search_entry LDAP_P(( Operation *op, SlapReply *rs ));
+LDAP_SLAPD_F (int) slap_send_search_entry_encoded LDAP_P(( Operation *op,
+	SlapReply *rs, struct berval *body ));
 LDAP_SLAPD_F (int) slap_null_cb LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_freeself_cb LDAP_P(( Operation *op, SlapReply *rs ));
 
@@ -1800,6 +1874,9 @@ LDAP_SLAPD_F (int) slap_schema_init LDAP_P((void));
 LDAP_SLAPD_F (void) schema_destroy LDAP_P(( void ));
 
 LDAP_SLAPD_F (int) slap_hash64 LDAP_P((int));
+LDAP_SLAPD_F (int) slap_index_hash LDAP_P((int));
+LDAP_SLAPD_F (struct berval *) slap_index_hash_name LDAP_P((int));
+LDAP_SLAPD_F (int) slap_index_hash_find LDAP_P((struct berval *));
 
 LDAP_SLAPD_F( slap_mr_indexer_func ) octetStringIndexer;
 LDAP_SLAPD_F( slap_mr_filter_func ) octetStringFilter;
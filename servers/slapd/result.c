@@ -1028,6 +1028,7 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 	int		i, j, rc = LDAP_UNAVAILABLE, bytes;
 	int		userattrs;
 	AccessControlState acl_state = ACL_STATE_INIT;
+	AclDnCache	acl_dncache;
 	int			 attrsonly;
 	AttributeDescription *ad_entry = slap_schema.si_ad_entry;
 
@@ -1081,6 +1082,10 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 
 	attrsonly = op->ors_attrsonly;
 
+	/* rs->sr_entry doesn't change from here on */
+	acl_dncache.dc_acl = NULL;
+	acl_state.as_dncache = &acl_dncache;
+
 	if ( !access_allowed( op, rs->sr_entry, ad_entry, NULL, ACL_READ, NULL )) {
 		Debug( LDAP_DEBUG_ACL,
 			"send_search_entry: conn %lu access to entry (%s) not allowed\n", 
@@ -1545,6 +1550,60 @@ error_return:;
 	return( rc );
 }
 
+/* Send a search entry whose protocolOp and controls were already
+ * encoded by send_search_entry() into op->o_res_ber, e.g. when the
+ * same response goes to several operations. Only the messageID is
+ * added here; access control must have been checked by the caller.
+ */
+int
+slap_send_search_entry_encoded( Operation *op, SlapReply *rs,
+	struct berval *body )
+{
+	BerElementBuffer berbuf;
+	BerElement	*ber = (BerElement *) &berbuf;
+	long		bytes;
+	int		rc;
+
+	rs->sr_type = REP_SEARCH;
+
+	ber_init_w_nullc( ber, LBER_USE_DER );
+	ber_set_option( ber, LBER_OPT_BER_MEMCTX, &op->o_tmpmemctx );
+
+	rc = ber_printf( ber, "{i" /*}*/, op->o_msgid );
+	if ( rc != -1 && ber_write( ber, body->bv_val, body->bv_len, 0 )
+		!= (ber_slen_t)body->bv_len )
+	{
+		rc = -1;
+	}
+	if ( rc != -1 ) {
+		rc = ber_printf( ber, /*{*/ "N}" );
+	}
+	if ( rc == -1 ) {
+		Debug( LDAP_DEBUG_ANY, "ber_printf failed\n" );
+		ber_free_buf( ber );
+		return LDAP_OTHER;
+	}
+
+	bytes = send_ldap_ber( op, ber );
+	ber_free_buf( ber );
+
+	if ( bytes < 0 ) {
+		Debug( LDAP_DEBUG_ANY,
+			"send_search_entry_encoded: conn %lu  ber write failed.\n",
+			op->o_connid );
+		return LDAP_UNAVAILABLE;
+	}
+	rs->sr_nentries++;
+
+	ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
+	ldap_pvt_mp_add_ulong( op->o_counters->sc_bytes, (unsigned long)bytes );
+	ldap_pvt_mp_add_ulong( op->o_counters->sc_entries, 1 );
+	ldap_pvt_mp_add_ulong( op->o_counters->sc_pdu, 1 );
+	ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
+
+	return LDAP_SUCCESS;
+}
+
 int
 slap_send_search_reference( Operation *op, SlapReply *rs )
 {
@@ -112,29 +112,54 @@
 static void (*hashinit)(lutil_HASH_CTX *ctx) = lutil_HASHInit;
 static void (*hashupdate)(lutil_HASH_CTX *ctx,unsigned char const *buf, ber_len_t len) = lutil_HASHUpdate;
 static void (*hashfinal)(unsigned char digest[HASH_BYTES], lutil_HASH_CTX *ctx) = lutil_HASHFinal;
+static void (*hashwindows)(lutil_HASH_CTX *ctx, unsigned char const *buf,
+	ber_len_t wlen, ber_len_t step, ber_len_t n, unsigned char *digests) = lutil_HASHWindows;
+static void (*hashseal)(lutil_HASH_CTX *ctx) = NULL;
 static int hashlen = LUTIL_HASH_BYTES;
 #define HASH_Init(c)			hashinit(c)
 #define HASH_Update(c,buf,len)	hashupdate(c,buf,len)
 #define HASH_Final(d,c)			hashfinal(d,c)
+#define HASH_Windows(c,buf,wlen,step,n,d)	hashwindows(c,buf,wlen,step,n,d)
+#define HASH_Seal(c)			do { if ( hashseal ) hashseal(c); } while (0)
 
-/* Toggle between 32 and 64 bit hashing, default to 32 for compatibility
-   -1 to query, returns 1 if 64 bit, 0 if 32.
-   0/1 to set 32/64, returns 0 on success, -1 on failure */
-int slap_hash64( int onoff )
+static int hashalg = SLAP_INDEX_HASH_FNV32;
+
+/* Select the hash used for index keys, default to 32 bit FNV for
+   compatibility. -1 to query, returns the current SLAP_INDEX_HASH_*.
+   Otherwise returns 0 on success, -1 on failure */
+int slap_index_hash( int alg )
 {
-	if ( onoff < 0 ) {
-		return hashlen == LUTIL_HASH64_BYTES;
-	} else if ( onoff ) {
-		hashinit = lutil_HASH64Init;
-		hashupdate = lutil_HASH64Update;
-		hashfinal = lutil_HASH64Final;
-		hashlen = LUTIL_HASH64_BYTES;
-	} else {
+	switch ( alg ) {
+	case -1:
+		return hashalg;
+	case SLAP_INDEX_HASH_FNV32:
 		hashinit = lutil_HASHInit;
 		hashupdate = lutil_HASHUpdate;
 		hashfinal = lutil_HASHFinal;
+		hashwindows = lutil_HASHWindows;
+		hashseal = NULL;
 		hashlen = LUTIL_HASH_BYTES;
+		break;
+	case SLAP_INDEX_HASH_FNV64:
+		hashinit = lutil_HASH64Init;
+		hashupdate = lutil_HASH64Update;
+		hashfinal = lutil_HASH64Final;
+		hashwindows = lutil_HASH64Windows;
+		hashseal = NULL;
+		hashlen = LUTIL_HASH64_BYTES;
+		break;
+	case SLAP_INDEX_HASH_XXH64:
+		hashinit = lutil_XXH64Init;
+		hashupdate = lutil_XXH64Update;
+		hashfinal = lutil_XXH64Final;
+		hashwindows = lutil_XXH64Windows;
+		hashseal = lutil_XXH64Seal;
+		hashlen = LUTIL_HASH64_BYTES;
+		break;
+	default:
+		return -1;
 	}
+	hashalg = alg;
 	return 0;
 }
 
@@ -144,18 +169,60 @@ int slap_hash64( int onoff )
 #define HASH_Init(c)			lutil_HASHInit(c)
 #define HASH_Update(c,buf,len)	lutil_HASHUpdate(c,buf,len)
 #define HASH_Final(d,c)			lutil_HASHFinal(d,c)
+#define HASH_Windows(c,buf,wlen,step,n,d)	lutil_HASHWindows(c,buf,wlen,step,n,d)
+#define HASH_Seal(c)
 
-int slap_has64( int onoff )
+int slap_index_hash( int alg )
 {
-	if ( onoff < 0 )
-		return 0;
+	if ( alg < 0 )
+		return SLAP_INDEX_HASH_FNV32;
 	else
-		return onoff ? -1 : 0;
+		return alg == SLAP_INDEX_HASH_FNV32 ? 0 : -1;
 }
 
 #endif
 #define HASH_CONTEXT			lutil_HASH_CTX
 
+static struct berval index_hash_names[] = {
+	BER_BVC("fnv32"),
+	BER_BVC("fnv64"),
+	BER_BVC("xxh64"),
+	BER_BVNULL
+};
+
+/* Name of an index hash, as used in the config and recorded by backends */
+struct berval *
+slap_index_hash_name( int alg )
+{
+	if ( alg < 0 || alg > SLAP_INDEX_HASH_XXH64 )
+		return NULL;
+	return &index_hash_names[alg];
+}
+
+/* Look up an index hash by name, returns -1 if unknown */
+int
+slap_index_hash_find( struct berval *name )
+{
+	int i;
+
+	for ( i = 0; !BER_BVISNULL( &index_hash_names[i] ); i++ ) {
+		if ( ber_bvstrcasecmp( name, &index_hash_names[i] ) == 0 )
+			return i;
+	}
+	return -1;
+}
+
+/* Toggle between 32 and 64 bit FNV hashing.
+   -1 to query, returns 1 if keys are 64 bit, 0 if 32.
+   0/1 to set 32/64, returns 0 on success, -1 on failure */
+int slap_hash64( int onoff )
+{
+	if ( onoff < 0 )
+		return slap_index_hash( -1 ) != SLAP_INDEX_HASH_FNV32;
+	return slap_index_hash( onoff ? SLAP_INDEX_HASH_FNV64 :
+		SLAP_INDEX_HASH_FNV32 );
+}
+
 /* approx matching rules */
 #define directoryStringApproxMatchOID	"1.3.6.1.4.1.4203.666.4.4"
 #define directoryStringApproxMatch		approxMatch
@@ -705,6 +772,7 @@ hashPreset(
 	if(pre) HASH_Update(HASHcontext, (unsigned char*)&pre, sizeof(pre));
 	HASH_Update(HASHcontext, (unsigned char*)syntax->ssyn_oid, syntax->ssyn_oidlen);
 	HASH_Update(HASHcontext, (unsigned char*)mr->smr_oid, mr->smr_oidlen);
+	HASH_Seal(HASHcontext);
 	return;
 }
 
@@ -721,6 +789,38 @@ hashIter(
 	HASH_Final( HASHdigest, &ctx );
 }
 
+#define HASH_WINDOWS	16
+
+/* Append to keys the hashes of n windows of wlen bytes of value,
+ * spaced step bytes apart, as hashIter would compute them one by one */
+static void
+hashWindows(
+	HASH_CONTEXT *HASHcontext,
+	unsigned char *value,
+	ber_len_t wlen,
+	ber_len_t step,
+	ber_len_t n,
+	BerVarray keys,
+	void *ctx )
+{
+	unsigned char HASHdigests[HASH_WINDOWS * HASH_BYTES];
+	struct berval digest;
+	ber_len_t i, k;
+
+	digest.bv_len = HASH_LEN;
+	for ( i = 0; i < n; i += k ) {
+		k = n - i < HASH_WINDOWS ? n - i : HASH_WINDOWS;
+		HASH_Windows( HASHcontext, &value[i * step], wlen, step, k,
+			HASHdigests );
+		for ( digest.bv_val = (char *)HASHdigests;
+			digest.bv_val < (char *)&HASHdigests[k * HASH_LEN];
+			digest.bv_val += HASH_LEN )
+		{
+			ber_dupbv_x( keys++, &digest, ctx );
+		}
+	}
+}
+
 /* Index generation function: Attribute values -> index hash keys */
 int octetStringIndexer(
 	slap_mask_t use,
@@ -796,6 +896,66 @@ int octetStringFilter(
 	return LDAP_SUCCESS;
 }
 
+#define	SS_WORD		unsigned long
+#define	SS_ONES		((SS_WORD)-1 / 0xff)
+#define	SS_LOW7		(SS_ONES * 0x7f)
+
+/* high bit set in each byte of w that is zero */
+#define	SS_ZERO(w)	(~((((w) & SS_LOW7) + SS_LOW7) | (w) | SS_LOW7))
+
+/* Find the first occurrence of sub in val, or NULL. A word at a time,
+ * candidate positions are those where both the first and the last byte
+ * of sub line up; only these get compared in full.
+ */
+static char *
+substrFind(
+	struct berval *val,
+	struct berval *sub )
+{
+	unsigned char *v = (unsigned char *)val->bv_val;
+	unsigned char *s = (unsigned char *)sub->bv_val;
+	ber_len_t i, k, last, n = sub->bv_len - 1;
+	SS_WORD first, tail, w0, w1, z;
+
+	if ( sub->bv_len > val->bv_len ) {
+		return NULL;
+	}
+	if ( n == 0 ) {
+		return memchr( val->bv_val, s[0], val->bv_len );
+	}
+
+	/* candidates are v[0] .. v[last] */
+	last = val->bv_len - sub->bv_len;
+	first = SS_ONES * s[0];
+	tail = SS_ONES * s[n];
+
+	for ( i = 0; i + sizeof(SS_WORD) <= last + 1; i += sizeof(SS_WORD) ) {
+		AC_MEMCPY( &w0, v + i, sizeof(w0) );
+		AC_MEMCPY( &w1, v + i + n, sizeof(w1) );
+		z = SS_ZERO( ( w0 ^ first ) | ( w1 ^ tail ) );
+		if ( z == 0 ) {
+			continue;
+		}
+		for ( k = i; k < i + sizeof(SS_WORD); k++ ) {
+			if ( v[k] == s[0] && v[k + n] == s[n] &&
+				memcmp( v + k + 1, s + 1, n - 1 ) == 0 )
+			{
+				return (char *)v + k;
+			}
+		}
+	}
+
+	for ( ; i <= last; i++ ) {
+		if ( v[i] == s[0] && v[i + n] == s[n] &&
+			memcmp( v + i + 1, s + 1, n - 1 ) == 0 )
+		{
+			return (char *)v + i;
+		}
+	}
+
+	return NULL;
+}
+
 static int
 octetStringSubstringsMatch(
 	int *matchp,
@@ -865,7 +1025,6 @@ octetStringSubstringsMatch(
 			ber_len_t idx;
 			char *p;
 
-retry:
 			if ( inlen > left.bv_len ) {
 				/* not enough length */
 				match = 1;
@@ -876,7 +1035,7 @@ retry:
 				continue;
 			}
 
-			p = memchr( left.bv_val, *sub->sa_any[i].bv_val, left.bv_len );
+			p = substrFind( &left, &sub->sa_any[i] );
 
 			if( p == NULL ) {
 				match = 1;
@@ -884,31 +1043,9 @@ retry:
 			}
 
 			idx = p - left.bv_val;
-
-			if ( idx >= left.bv_len ) {
-				/* this shouldn't happen */
-				return LDAP_OTHER;
-			}
-
 			left.bv_val = p;
 			left.bv_len -= idx;
 
-			if ( sub->sa_any[i].bv_len > left.bv_len ) {
-				/* not enough left */
-				match = 1;
-				goto done;
-			}
-
-			match = memcmp( left.bv_val,
-				sub->sa_any[i].bv_val,
-				sub->sa_any[i].bv_len );
-
-			if ( match != 0 ) {
-				left.bv_val++;
-				left.bv_len--;
-				goto retry;
-			}
-
 			left.bv_val += sub->sa_any[i].bv_len;
 			left.bv_len -= sub->sa_any[i].bv_len;
 			inlen -= sub->sa_any[i].bv_len;
@@ -935,7 +1072,7 @@ octetStringSubstringsIndexer(
 	ber_len_t i, nkeys;
 	BerVarray keys;
 
-	HASH_CONTEXT HCany, HCini, HCfin;
+	HASH_CONTEXT HCany, HCini, HCfin, HCpre;
 	unsigned char HASHdigest[HASH_BYTES];
 	struct berval digest;
 	digest.bv_val = (char *)HASHdigest;
@@ -994,12 +1131,9 @@ octetStringSubstringsIndexer(
 		{
 			max = values[i].bv_len - (index_substr_any_len - 1);
 
-			for( j=0; j<max; j++ ) {
-				hashIter( &HCany, HASHdigest,
-					(unsigned char *)&values[i].bv_val[j],
-					index_substr_any_len );
-				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
-			}
+			hashWindows( &HCany, (unsigned char *)values[i].bv_val,
+				index_substr_any_len, 1, max, &keys[nkeys], ctx );
+			nkeys += max;
 		}
 
 		/* skip if too short */ 
@@ -1008,11 +1142,20 @@ octetStringSubstringsIndexer(
 		max = index_substr_if_maxlen < values[i].bv_len
 			? index_substr_if_maxlen : values[i].bv_len;
 
+		/* initial keys extend each other, hash the common prefix once */
+		if( flags & SLAP_INDEX_SUBSTR_INITIAL ) {
+			HCpre = HCini;
+			HASH_Update( &HCpre, (unsigned char *)values[i].bv_val,
+				index_substr_if_minlen - 1 );
+		}
+
 		for( j=index_substr_if_minlen; j<=max; j++ ) {
 
 			if( flags & SLAP_INDEX_SUBSTR_INITIAL ) {
-				hashIter( &HCini, HASHdigest,
-					(unsigned char *)values[i].bv_val, j );
+				HASH_Update( &HCpre,
+					(unsigned char *)&values[i].bv_val[j-1], 1 );
+				hashIter( &HCpre, HASHdigest,
+					(unsigned char *)values[i].bv_val, 0 );
 				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
 			}
 
@@ -1151,14 +1294,11 @@ octetStringSubstringsFilter (
 			value = &sa->sa_any[i];
 
 			hashPreset( &HASHcontext, prefix, pre, syntax, mr);
-			for(j=0;
-				j <= value->bv_len - index_substr_any_len;
-				j += index_substr_any_step )
-			{
-				hashIter( &HASHcontext, HASHdigest,
-					(unsigned char *)&value->bv_val[j], klen ); 
-				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
-			}
+			j = ( value->bv_len - index_substr_any_len ) /
+				index_substr_any_step + 1;
+			hashWindows( &HASHcontext, (unsigned char *)value->bv_val,
+				klen, index_substr_any_step, j, &keys[nkeys], ctx );
+			nkeys += j;
 		}
 	}
 
@@ -1990,18 +2130,11 @@ directoryStringSubstringsMatch(
 			}
 			priorspace=0;
 
-retry:
 			if ( BER_BVISEMPTY( &sub->sa_any[i] ) ) {
 				continue;
 			}
 
-			if ( sub->sa_any[i].bv_len > left.bv_len ) {
-				/* not enough left */
-				match = 1;
-				goto done;
-			}
-
-			p = memchr( left.bv_val, *sub->sa_any[i].bv_val, left.bv_len );
+			p = substrFind( &left, &sub->sa_any[i] );
 
 			if( p == NULL ) {
 				match = 1;
@@ -2009,31 +2142,9 @@ retry:
 			}
 
 			idx = p - left.bv_val;
-
-			if ( idx >= left.bv_len ) {
-				/* this shouldn't happen */
-				return LDAP_OTHER;
-			}
-
 			left.bv_val = p;
 			left.bv_len -= idx;
 
-			if ( sub->sa_any[i].bv_len > left.bv_len ) {
-				/* not enough left */
-				match = 1;
-				goto done;
-			}
-
-			match = memcmp( left.bv_val,
-				sub->sa_any[i].bv_val,
-				sub->sa_any[i].bv_len );
-
-			if ( match != 0 ) {
-				left.bv_val++;
-				left.bv_len--;
-				goto retry;
-			}
-
 			left.bv_val += sub->sa_any[i].bv_len;
 			left.bv_len -= sub->sa_any[i].bv_len;
 
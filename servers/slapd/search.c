@@ -124,7 +124,8 @@ do_search(
 		op->ors_slimit, op->ors_tlimit, op->ors_attrsonly);
 
 	/* filter - returns a "normalized" version */
-	rs->sr_err = get_filter( op, op->o_ber, &op->ors_filter, &rs->sr_text );
+	rs->sr_err = get_filter_cached( op, op->o_ber, &op->ors_filter,
+		&op->ors_filterstr, &rs->sr_text );
 	if( rs->sr_err != LDAP_SUCCESS ) {
 		if( rs->sr_err == SLAPD_DISCONNECT ) {
 			rs->sr_err = LDAP_PROTOCOL_ERROR;
@@ -135,7 +136,6 @@ do_search(
 		}
 		goto return_results;
 	}
-	filter2bv_x( op, op->ors_filter, &op->ors_filterstr );
 	
 	Debug( LDAP_DEBUG_ARGS, "    filter: %s\n",
 		!BER_BVISEMPTY( &op->ors_filterstr ) ? op->ors_filterstr.bv_val : "empty" );
@@ -142,6 +142,10 @@ LDAP_BEGIN_DECL
 #define SLAP_CONN_MAX_PENDING_DEFAULT	100
 #define SLAP_CONN_MAX_PENDING_AUTH	1000
 
+#define SLAP_GROUP_CACHE_DEFAULT	(16 * 1024 * 1024)
+#define SLAP_FILTER_CACHE_DEFAULT	4096
+#define SLAP_DN_CACHE_DEFAULT	4096
+
 #define SLAP_TEXT_BUFLEN (256)
 
 /* pseudo error code indicating abandoned operation */
@@ -277,6 +281,11 @@ typedef struct slap_ssf_set {
 /* default for ordered integer index keys */
 #define SLAP_INDEX_INTLEN_DEFAULT	4
 
+/* hash functions for index keys, see slap_index_hash() */
+#define SLAP_INDEX_HASH_FNV32	0
+#define SLAP_INDEX_HASH_FNV64	1
+#define SLAP_INDEX_HASH_XXH64	2
+
 #define SLAP_INDEX_FLAGS         0xF000UL
 #define SLAP_INDEX_NOSUBTYPES    0x1000UL /* don't use index w/ subtypes */
 #define SLAP_INDEX_NOTAGS        0x2000UL /* don't use index w/ tags */
@@ -350,6 +359,7 @@ typedef struct ContentRule ContentRule;
 typedef struct AttributeAssertion AttributeAssertion;
 typedef struct SubstringsAssertion SubstringsAssertion;
 typedef struct Filter Filter;
+typedef struct FilterProg FilterProg;
 typedef struct ValuesReturnFilter ValuesReturnFilter;
 typedef struct Attribute Attribute;
 #ifdef LDAP_COMP_MATCH
@@ -809,6 +819,7 @@ struct ObjectClass {
 #define SLAP_OC_SYNCCONSUMERSUBENTRY		0x0080
 #define	SLAP_OC__MASK		0x00FF
 #define	SLAP_OC__END		0x0100
+#define	SLAP_OC__INDEX		0x0200	/* e_aindex is valid */
 #define SLAP_OC_OPERATIONAL	0x4000
 #ifdef SLAP_SCHEMA_EXPOSE
 #define SLAP_OC_HIDE		0x0000
@@ -1226,6 +1237,9 @@ struct Entry {
 
 	/* for use by the backend for any purpose */
 	void*	e_private;
+
+	/* attribute index, see entry_attr_index() */
+	struct AttrIndex	*e_aindex;
 };
 
 /*
@@ -1547,6 +1561,12 @@ typedef struct AccessControl {
 	slap_style_t acl_dn_style;
 	regex_t		acl_dn_re;
 	struct berval	acl_dn_pat;
+	/* precomputed by acl_dn_prepare() to rule out entries quickly */
+	int		acl_dn_nrdns;	/* RDNs in a non-regex pattern */
+	unsigned	acl_dn_hash;	/* hash of a non-regex pattern */
+	struct berval	acl_dn_tail;	/* literal end of a regex, in acl_dn_pat */
+	int		acl_pos;	/* position in its list, set with the index */
+	struct AclIndex	*acl_index;	/* on the first ACL of a list */
 	AttributeName	*acl_attrs;
 	MatchingRule	*acl_attrval_mr;
 	slap_style_t	acl_attrval_style;
@@ -1559,6 +1579,23 @@ typedef struct AccessControl {
 	struct AccessControl	*acl_next;
 } AccessControl;
 
+/* Which ACLs select an entry by its DN, so that the "to dn" clauses
+ * aren't evaluated again for every attribute of the entry. Only the
+ * first ACL_DNCACHE_MAX ACLs are remembered. The submatches of the
+ * dn.regex clauses that matched are kept too, as long as they fit in
+ * dc_match; the others are run again.
+ */
+#define ACL_DNCACHE_MAX	256
+#define ACL_DNCACHE_NMATCH	64
+typedef struct AclDnCache {
+	struct AccessControl *dc_acl;	/* first ACL of the list, NULL if unused */
+	unsigned char	dc_tested[ACL_DNCACHE_MAX / 8];
+	unsigned char	dc_matched[ACL_DNCACHE_MAX / 8];
+	unsigned char	dc_moff[ACL_DNCACHE_MAX];	/* 1 + offset in dc_match, 0 if not kept */
+	int		dc_mused;
+	regmatch_t	dc_match[ACL_DNCACHE_NMATCH];
+} AclDnCache;
+
 typedef struct AccessControlState {
 	/* Access state */
 
@@ -1579,8 +1616,11 @@ typedef struct AccessControlState {
 
 	/* True if started to process frontend ACLs */
 	int as_fe_done;
+
+	/* Optional; only set when all checks are on the same entry */
+	AclDnCache *as_dncache;
 } AccessControlState;
-#define ACL_STATE_INIT { NULL, ACL_NONE, NULL, 0, 0, ACL_PRIV_NONE, -1, 0 }
+#define ACL_STATE_INIT { NULL, ACL_NONE, NULL, 0, 0, ACL_PRIV_NONE, -1, 0, NULL }
 
 typedef struct AclRegexMatches {        
 	int dn_count;
@@ -2209,6 +2249,11 @@ typedef int (BI_op_txn) LDAP_P(( Operation *op, int txnop, struct OpExtra **ptr
 #define SLAP_TXN_BEGIN	1
 #define SLAP_TXN_COMMIT	2
 #define SLAP_TXN_ABORT	3
+typedef int (BI_db_snapshot) LDAP_P(( BackendDB *be, int snapop, int *fd ));
+#define SLAP_SNAPSHOT_SAVE		1	/* write a consistent copy to *fd */
+#define SLAP_SNAPSHOT_OPEN		2	/* return a staging file in *fd */
+#define SLAP_SNAPSHOT_LOAD		3	/* install the staged copy, server paused */
+#define SLAP_SNAPSHOT_DISCARD	4	/* drop the staged copy */
 
 typedef int (BI_conn_func) LDAP_P(( BackendDB *bd, Connection *c ));
 typedef BI_conn_func BI_connection_init;
@@ -2308,6 +2353,7 @@ struct BackendInfo {
 	BI_chk_referrals	*bi_chk_referrals;
 	BI_chk_controls		*bi_chk_controls;
 	BI_op_txn			*bi_op_txn;
+	BI_db_snapshot		*bi_db_snapshot;
 	BI_entry_get_rw		*bi_entry_get_rw;
 	BI_entry_release_rw	*bi_entry_release_rw;
 
@@ -2341,6 +2387,7 @@ struct BackendInfo {
 #define SLAP_BFLAG_CONFIG			0x0002U /* a config backend */
 #define SLAP_BFLAG_FRONTEND			0x0004U /* the frontendDB */
 #define SLAP_BFLAG_NOLASTMODCMD		0x0010U
+#define SLAP_BFLAG_GRADUATE			0x0020U /* all writes call slap_graduate_commit_csn() */
 #define SLAP_BFLAG_INCREMENT		0x0100U
 #define SLAP_BFLAG_ALIASES			0x1000U
 #define SLAP_BFLAG_REFERRALS		0x2000U
@@ -2365,6 +2412,7 @@ struct BackendInfo {
 #define SLAP_SUBENTRIES(be)	(SLAP_BFLAGS(be) & SLAP_BFLAG_SUBENTRIES)
 #define SLAP_DYNAMIC(be)	((SLAP_BFLAGS(be) & SLAP_BFLAG_DYNAMIC) || (SLAP_DBFLAGS(be) & SLAP_DBFLAG_DYNAMIC))
 #define SLAP_NOLASTMODCMD(be)	(SLAP_BFLAGS(be) & SLAP_BFLAG_NOLASTMODCMD)
+#define SLAP_GRADUATE(be)	(SLAP_BFLAGS(be) & SLAP_BFLAG_GRADUATE)
 #define SLAP_LASTMODCMD(be)	(!SLAP_NOLASTMODCMD(be))
 
 /* overlay specific */
@@ -0,0 +1,160 @@
+/* snapshot.c - database snapshot extended operation */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1998-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/*
+ * The request value is the suffix of a database. The database is
+ * copied by its backend's bi_db_snapshot hook into a pipe on a separate
+ * thread, and the copy is returned to the client as a sequence of
+ * intermediate responses carrying raw chunks, followed by the final
+ * extended response. Since the copy is taken from a single read
+ * transaction, it includes the contextCSN matching its contents, which
+ * lets a syncrepl consumer install it and resume from there.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+
+#include <ac/string.h>
+#include <ac/unistd.h>
+
+#include "slap.h"
+
+#include <lber_pvt.h>
+
+const struct berval slap_EXOP_SNAPSHOT = BER_BVC(LDAP_EXOP_X_SNAPSHOT);
+
+#define SNAPSHOT_CHUNK	(256 * 1024)
+
+typedef struct snapshot_writer {
+	BackendDB	*sw_be;
+	int			sw_fd;
+	int			sw_rc;
+} snapshot_writer;
+
+static void *
+snapshot_write_task( void *arg )
+{
+	snapshot_writer *sw = arg;
+
+	sw->sw_rc = sw->sw_be->bd_info->bi_db_snapshot( sw->sw_be,
+		SLAP_SNAPSHOT_SAVE, &sw->sw_fd );
+	close( sw->sw_fd );
+	return NULL;
+}
+
+int snapshot_extop(
+	Operation *op, SlapReply *rs )
+{
+	BackendDB *be;
+	struct berval ndn, chunk;
+	snapshot_writer sw;
+	ldap_pvt_thread_t tid;
+	ber_len_t len;
+	ssize_t n;
+	int fds[2], rc;
+
+	if ( op->ore_reqdata == NULL || BER_BVISEMPTY( op->ore_reqdata ) ) {
+		rs->sr_text = "no database suffix specified";
+		return LDAP_PROTOCOL_ERROR;
+	}
+
+	rc = dnNormalize( 0, NULL, NULL, op->ore_reqdata, &ndn, op->o_tmpmemctx );
+	if ( rc != LDAP_SUCCESS ) {
+		rs->sr_text = "invalid database suffix";
+		return LDAP_INVALID_DN_SYNTAX;
+	}
+
+	Debug( LDAP_DEBUG_STATS, "%s SNAPSHOT base=\"%s\"\n",
+		op->o_log_prefix, ndn.bv_val );
+
+	be = select_backend( &ndn, 0 );
+	if ( be == NULL || !be_issuffix( be, &ndn ) ) {
+		op->o_tmpfree( ndn.bv_val, op->o_tmpmemctx );
+		rs->sr_text = "no database with that suffix";
+		return LDAP_NO_SUCH_OBJECT;
+	}
+	op->o_tmpfree( ndn.bv_val, op->o_tmpmemctx );
+
+	if ( be->bd_info->bi_db_snapshot == NULL ) {
+		rs->sr_text = "database does not support snapshots";
+		return LDAP_UNWILLING_TO_PERFORM;
+	}
+
+	/* the copy includes every attribute of every entry */
+	op->o_bd = be;
+	if ( !be_isroot( op ) ) {
+		rs->sr_text = "only the rootdn may take a snapshot";
+		return LDAP_INSUFFICIENT_ACCESS;
+	}
+
+	if ( pipe( fds ) ) {
+		rs->sr_text = "unable to create pipe";
+		return LDAP_OTHER;
+	}
+
+	sw.sw_be = be;
+	sw.sw_fd = fds[1];
+	sw.sw_rc = 0;
+	if ( ldap_pvt_thread_create( &tid, 0, snapshot_write_task, &sw ) ) {
+		close( fds[0] );
+		close( fds[1] );
+		rs->sr_text = "unable to start snapshot thread";
+		return LDAP_OTHER;
+	}
+
+	chunk.bv_val = ch_malloc( SNAPSHOT_CHUNK );
+	rc = LDAP_SUCCESS;
+	do {
+		/* fill a whole chunk, pipes hand out much smaller pieces */
+		for ( len = 0; len < SNAPSHOT_CHUNK; len += n ) {
+			n = read( fds[0], chunk.bv_val + len, SNAPSHOT_CHUNK - len );
+			if ( n <= 0 )
+				break;
+		}
+		if ( n < 0 ) {
+			rs->sr_text = "snapshot read failed";
+			rc = LDAP_OTHER;
+			break;
+		}
+		if ( op->o_abandon || slapd_shutdown ) {
+			rc = SLAPD_ABANDON;
+			break;
+		}
+		if ( len ) {
+			chunk.bv_len = len;
+			rs->sr_rspoid = LDAP_EXOP_X_SNAPSHOT;
+			rs->sr_rspdata = &chunk;
+			send_ldap_intermediate( op, rs );
+		}
+	} while ( n > 0 );
+	rs->sr_rspoid = NULL;
+	rs->sr_rspdata = NULL;
+
+	/* an early close makes the writer fail with EPIPE */
+	close( fds[0] );
+	ldap_pvt_thread_join( tid, NULL );
+	ch_free( chunk.bv_val );
+
+	if ( rc == LDAP_SUCCESS && sw.sw_rc != 0 ) {
+		Debug( LDAP_DEBUG_ANY, "%s SNAPSHOT failed (%d)\n",
+			op->o_log_prefix, sw.sw_rc );
+		rs->sr_text = "snapshot failed";
+		rc = LDAP_OTHER;
+	}
+
+	return rc;
+}
@@ -25,6 +25,7 @@
 
 #include "lutil.h"
 #include "slap.h"
+#include "../../libraries/liblber/lber-int.h" /* get ber_pvt_ber_total() */
 #include "lutil_ldap.h"
 
 #include "config.h"
@@ -58,6 +59,8 @@ static AttributeDescription *sy_ad_dseeLastChange;
 
 #define	UUIDLEN	16
 
+typedef struct presentbucket presentbucket;
+
 struct nonpresent_entry {
 	struct berval *npe_name;
 	struct berval *npe_nname;
@@ -79,6 +82,7 @@ typedef struct cookie_state {
 	int cs_age;
 	int cs_ref;
 	int cs_updating;
+	int cs_batching;	/* a batch is being applied */
 
 	/* pending changes, not yet committed */
 	ldap_pvt_thread_mutex_t	cs_pmutex;
@@ -142,12 +146,23 @@ typedef struct syncinfo_s {
 	int			si_syncdata;
 	int			si_logstate;
 	int			si_lazyCommit;
+	int			si_refreshBatch;	/* refresh entries per backend txn */
+	int			si_snapshotSeed;	/* seed an empty db from a snapshot */
+	int			si_logBatch;		/* delta-sync changes per backend txn */
+	int			si_batchnum;
+	int			si_batchsize;
+	int			si_batchmax;
+	int			si_batchlog;
+	int			si_batchrename;
+	LDAPMessage		**si_batchmsgs;
+	Avlnode			*si_batchdns;
+	struct sync_cookie	si_batchcookie;
 	int			si_got;
 	int			si_strict_refresh;	/* stop listening during fallback refresh */
 	int			si_too_old;
 	int			si_is_configdb;
 	ber_int_t	si_msgid;
-	Avlnode			*si_presentlist;
+	presentbucket		*si_presentlist;
 	LDAP			*si_ld;
 	Connection		*si_conn;
 	LDAP_LIST_HEAD(np, nonpresent_entry)	si_nonpresentlist;
@@ -166,6 +181,10 @@ typedef struct syncinfo_s {
 	struct berval	si_connaddr;
 	struct berval	si_lastCookieRcvd;
 	struct berval	si_lastCookieSent;
+	struct berval	si_lastCSNApplied;
+	char	si_lastCSNbuf[LDAP_PVT_CSNSTR_BUFSIZE];
+	unsigned long	si_lagChanges;
+	int		si_caughtUp;
 	struct berval	si_monitor_ndn;
 	char	si_connaddrbuf[SLAP_ADDRLEN];
 
@@ -175,9 +194,9 @@ typedef struct syncinfo_s {
 
 static int syncuuid_cmp( const void *, const void * );
 static int presentlist_insert( syncinfo_t* si, struct berval *syncUUID );
-static void presentlist_delete( Avlnode **av, struct berval *syncUUID );
-static char *presentlist_find( Avlnode *av, struct berval *syncUUID );
-static int presentlist_free( Avlnode *av );
+static void presentlist_delete( presentbucket *pl, struct berval *syncUUID );
+static int presentlist_find( presentbucket *pl, struct berval *syncUUID );
+static int presentlist_free( presentbucket *pl );
 static void syncrepl_del_nonpresent( Operation *, syncinfo_t *, BerVarray, struct sync_cookie *, int );
 static int syncrepl_message_to_op(
 					syncinfo_t *, Operation *, LDAPMessage *, int );
@@ -206,8 +225,14 @@ static int syncrepl_dirsync_cookie(
 
 static int syncrepl_dsee_update( syncinfo_t *si, Operation *op ) ;
 
-/* delta-mpr overlay handler */
+/* delta-mpr overlay handlers */
 static int syncrepl_op_modify( Operation *op, SlapReply *rs );
+static int syncrepl_op_add( Operation *op, SlapReply *rs );
+static int syncrepl_op_delete( Operation *op, SlapReply *rs );
+static int syncrepl_op_modrdn( Operation *op, SlapReply *rs );
+static int syncrepl_ov_db_init( BackendDB *be, ConfigReply *cr );
+static int syncrepl_ov_db_destroy( BackendDB *be, ConfigReply *cr );
+static void syncrepl_csn_forget( BackendDB *be, struct berval *ndn );
 
 /* callback functions */
 static int dn_callback( Operation *, SlapReply * );
@@ -290,7 +315,12 @@ init_syncrepl(syncinfo_t *si)
 
 	if ( !syncrepl_ov.on_bi.bi_type ) {
 		syncrepl_ov.on_bi.bi_type = "syncrepl";
+		syncrepl_ov.on_bi.bi_db_init = syncrepl_ov_db_init;
+		syncrepl_ov.on_bi.bi_db_destroy = syncrepl_ov_db_destroy;
 		syncrepl_ov.on_bi.bi_op_modify = syncrepl_op_modify;
+		syncrepl_ov.on_bi.bi_op_add = syncrepl_op_add;
+		syncrepl_ov.on_bi.bi_op_delete = syncrepl_op_delete;
+		syncrepl_ov.on_bi.bi_op_modrdn = syncrepl_op_modrdn;
 		overlay_register( &syncrepl_ov );
 	}
 
@@ -858,7 +888,12 @@ check_syncprov(
 	op->o_req_ndn = e.e_nname;
 
 	ldap_pvt_thread_mutex_lock( &si->si_cookieState->cs_mutex );
-	i = backend_operational( op, &rs );
+	/* syncprov sees the changes of a batch before they are committed,
+	 * they can't be taken as applied until the batch is */
+	if ( si->si_cookieState->cs_batching )
+		i = LDAP_BUSY;
+	else
+		i = backend_operational( op, &rs );
 	if ( i == LDAP_SUCCESS && a.a_nvals ) {
 		int num = a.a_numvals;
 		/* check for differences */
@@ -915,6 +950,121 @@ check_syncprov(
 	return changed;
 }
 
+/*
+ * Install a copy of the provider's database in place of our empty one,
+ * so the refresh that follows only has to catch up from the contextCSN
+ * recorded in the copy. Any failure leaves the database untouched and
+ * the refresh proceeds as usual.
+ */
+static void
+syncrepl_seed(
+	Operation *op,
+	syncinfo_t *si )
+{
+	BackendDB *be = si->si_be;
+	BackendInfo *bi = be->bd_info;
+	LDAPMessage *res = NULL;
+	struct berval *data;
+	unsigned long bytes = 0;
+	int rc, msgid, fd = -1;
+
+	if ( overlay_is_over( be ) )
+		bi = ((slap_overinfo *)bi->bi_private)->oi_orig;
+
+	/* the copy must match exactly what this consumer would replicate */
+	if ( !bi->bi_db_snapshot || SLAP_MULTIPROVIDER( be ) || si->si_be != si->si_wbe ||
+		si->si_syncdata || si->si_scope != LDAP_SCOPE_SUBTREE ||
+		!si->si_allattrs || !si->si_allopattrs || si->si_exattrs ||
+		!dn_match( &si->si_base, &be->be_nsuffix[0] ) ||
+		strcasecmp( si->si_filterstr.bv_val, generic_filterstr.bv_val ) )
+	{
+		Debug( LDAP_DEBUG_ANY, "syncrepl_seed: %s "
+			"snapshot seeding needs a full copy of the database, skipped\n",
+			si->si_ridtxt );
+		return;
+	}
+
+	rc = bi->bi_db_snapshot( be, SLAP_SNAPSHOT_OPEN, &fd );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_SYNC, "syncrepl_seed: %s "
+			"database is not empty (%d), skipped\n",
+			si->si_ridtxt, rc );
+		return;
+	}
+
+	rc = ldap_extended_operation( si->si_ld, LDAP_EXOP_X_SNAPSHOT,
+		&si->si_base, NULL, NULL, &msgid );
+	while ( rc == LDAP_SUCCESS ) {
+		rc = ldap_result( si->si_ld, msgid, LDAP_MSG_ONE, NULL, &res );
+		if ( rc == LDAP_RES_INTERMEDIATE ) {
+			data = NULL;
+			rc = ldap_parse_intermediate( si->si_ld, res, NULL, &data, NULL, 0 );
+			if ( rc == LDAP_SUCCESS && data ) {
+				if ( write( fd, data->bv_val, data->bv_len ) != (ssize_t)data->bv_len )
+					rc = LDAP_OTHER;
+				bytes += data->bv_len;
+				ber_bvfree( data );
+			}
+			ldap_msgfree( res );
+		} else if ( rc == LDAP_RES_EXTENDED ) {
+			ldap_parse_result( si->si_ld, res, &rc, NULL, NULL, NULL, NULL, 1 );
+			break;
+		} else {
+			if ( res )
+				ldap_msgfree( res );
+			rc = LDAP_OTHER;
+		}
+	}
+
+	/* the copy can't be swapped in under running operations */
+	if ( rc == LDAP_SUCCESS && slap_pause_server() < 0 )
+		rc = LDAP_BUSY;
+
+	if ( rc == LDAP_SUCCESS ) {
+		rc = bi->bi_db_snapshot( be, SLAP_SNAPSHOT_LOAD, &fd );
+		group_cache_flush( be );
+		slap_unpause_server();
+	} else {
+		bi->bi_db_snapshot( be, SLAP_SNAPSHOT_DISCARD, &fd );
+	}
+
+	if ( rc == LDAP_SUCCESS ) {
+		/* Overlays such as syncprov read the contextCSN when the
+		 * database was opened, and it was empty then. Store the
+		 * copy's contextCSN through a cookie update so they pick
+		 * it up the same way they see our other updates.
+		 */
+		struct sync_cookie sc = { 0 };
+		BerVarray csn = NULL;
+		void *ctx = op->o_tmpmemctx;
+		slap_callback *cb = op->o_callback;
+		ber_tag_t tag = op->o_tag;
+
+		op->o_req_ndn = si->si_contextdn;
+		op->o_req_dn = op->o_req_ndn;
+		op->o_tmpmemctx = NULL;
+		backend_attribute( op, NULL, &op->o_req_ndn,
+			slap_schema.si_ad_contextCSN, &csn, ACL_READ );
+		op->o_tmpmemctx = ctx;
+		if ( csn ) {
+			sc.ctxcsn = csn;
+			for ( sc.numcsns = 0; !BER_BVISNULL( &csn[sc.numcsns] ); sc.numcsns++ );
+			sc.sids = slap_parse_csn_sids( csn, sc.numcsns, NULL );
+			slap_sort_csn_sids( csn, sc.sids, sc.numcsns, NULL );
+			syncrepl_updateCookie( si, op, &sc, 0 );
+			ber_bvarray_free( csn );
+			ch_free( sc.sids );
+			/* do_syncrep1 rebuilds it from the cookie state */
+			slap_sync_cookie_free( &si->si_syncCookie, 0 );
+		}
+		op->o_callback = cb;
+		op->o_tag = tag;
+	}
+
+	Debug( LDAP_DEBUG_SYNC, "syncrepl_seed: %s %s snapshot of %lu bytes (%d)\n",
+		si->si_ridtxt, rc ? "failed to load" : "loaded", bytes, rc );
+}
+
 static int
 do_syncrep1(
 	Operation *op,
@@ -1030,6 +1180,9 @@ do_syncrep1(
 				/* ctxcsn wasn't parsed yet, do it now */
 				slap_parse_sync_cookie( &si->si_syncCookie, NULL );
 			} else {
+				if ( si->si_snapshotSeed && !si->si_cookieState->cs_num )
+					syncrepl_seed( op, si );
+
 				ldap_pvt_thread_mutex_lock( &si->si_cookieState->cs_mutex );
 				if ( !si->si_cookieState->cs_num ) {
 					/* get contextCSN shadow replica from database */
@@ -1210,6 +1363,453 @@ get_pmutex(
 	return 0;
 }
 
+/*
+ * Refresh batching: while the provider streams plain refresh adds that
+ * carry no cookie, collect up to si_refreshBatch of them and apply them
+ * inside a single backend transaction instead of committing each one.
+ * cs_pmutex is only taken, and the transaction only opened, once the
+ * batch is complete, so neither is held while waiting for the provider.
+ * The messages are kept until the commit so that a failed entry can
+ * abort the batch and have it replayed one entry at a time with the
+ * normal error handling.
+ *
+ * In delta-sync the same is done for up to si_logBatch consecutive log
+ * records, in either phase, as long as they target distinct entries;
+ * their CSNs are checked against the pending ones as they are applied,
+ * and the newest CSN of each SID is stored once the batch is committed.
+ * A batch is applied when it is full, when any other message arrives,
+ * or when the provider has sent nothing more for SYNC_BATCH_WAIT
+ * microseconds.
+ */
+#define SYNC_BATCH_WAIT	10000
+
+static int
+syncrepl_batch_ok( syncinfo_t *si, int syncstate, int cookie )
+{
+	if ( si->si_is_configdb || si->si_wbe->bd_info->bi_op_txn == NULL )
+		return 0;
+	if ( si->si_syncdata && si->si_logstate == SYNCLOG_LOGGING )
+		return si->si_logBatch > 1;
+	return si->si_refreshBatch > 1 && !si->si_refreshDone &&
+		syncstate == LDAP_SYNC_ADD && !cookie;
+}
+
+static int
+syncrepl_batch_dncmp( const void *v1, const void *v2 )
+{
+	return ber_bvcmp( (const struct berval *)v1,
+		(const struct berval *)v2 );
+}
+
+static int
+syncrepl_batch_dnfind( syncinfo_t *si, struct berval *dn, int add )
+{
+	struct berval ndn, *bv;
+	int rc;
+
+	/* an unparsable DN can't be compared, keep it on its own */
+	if ( dnNormalize( 0, NULL, NULL, dn, &ndn, NULL ) != LDAP_SUCCESS )
+		return 1;
+	rc = avl_find( si->si_batchdns, &ndn, syncrepl_batch_dncmp ) != NULL;
+	if ( !rc && add ) {
+		bv = ch_malloc( sizeof( struct berval ) );
+		*bv = ndn;
+		avl_insert( &si->si_batchdns, bv, syncrepl_batch_dncmp, avl_dup_error );
+	} else {
+		ch_free( ndn.bv_val );
+	}
+	return rc;
+}
+
+/* Returns nonzero if the target of a log record, or for a modrdn the
+ * entry's new DN, is already part of the current batch; otherwise they
+ * are recorded when add is set.
+ */
+static int
+syncrepl_batch_dn( syncinfo_t *si, LDAPMessage *msg, int add )
+{
+	struct berval **vals, **rdn, **sup, pdn, newdn;
+	int rc;
+
+	if ( !si->si_batchlog )
+		return 0;
+	vals = ldap_get_values_len( si->si_ld, msg, accesslog_sc.ls_dn.bv_val );
+	if ( vals == NULL )
+		return 0;
+	rc = syncrepl_batch_dnfind( si, vals[0], add );
+
+	rdn = ldap_get_values_len( si->si_ld, msg, accesslog_sc.ls_newRdn.bv_val );
+	if ( rdn != NULL ) {
+		sup = ldap_get_values_len( si->si_ld, msg, accesslog_sc.ls_newSup.bv_val );
+		if ( sup != NULL )
+			pdn = *sup[0];
+		else
+			dnParent( vals[0], &pdn );
+		build_new_dn( &newdn, &pdn, rdn[0], NULL );
+		rc |= syncrepl_batch_dnfind( si, &newdn, add );
+		if ( add )
+			si->si_batchrename = 1;
+		ch_free( newdn.bv_val );
+		if ( sup != NULL )
+			ldap_value_free_len( sup );
+		ldap_value_free_len( rdn );
+	}
+	ldap_value_free_len( vals );
+	return rc;
+}
+
+static void
+syncrepl_batch_begin( syncinfo_t *si )
+{
+	si->si_batchlog = si->si_syncdata && si->si_logstate == SYNCLOG_LOGGING;
+	si->si_batchsize = si->si_batchlog ? si->si_logBatch : si->si_refreshBatch;
+	if ( si->si_batchmax < si->si_batchsize ) {
+		si->si_batchmsgs = ch_realloc( si->si_batchmsgs,
+			si->si_batchsize * sizeof(LDAPMessage *) );
+		si->si_batchmax = si->si_batchsize;
+	}
+	si->si_batchnum = 0;
+}
+
+static void
+syncrepl_batch_free( syncinfo_t *si )
+{
+	int i;
+
+	for ( i = 0; i < si->si_batchnum; i++ )
+		ldap_msgfree( si->si_batchmsgs[i] );
+	si->si_batchnum = 0;
+	slap_sync_cookie_free( &si->si_batchcookie, 0 );
+	avl_free( si->si_batchdns, (AVL_FREE)ber_bvfree );
+	si->si_batchdns = NULL;
+	si->si_batchrename = 0;
+}
+
+static int
+syncrepl_batch_written( void *v, void *arg )
+{
+	group_cache_written( (struct berval *)v, NULL, 0 );
+	return 0;
+}
+
+/* The changes in a batch graduated before they were committed, tell
+ * the group cache again now that they are visible.
+ */
+static void
+syncrepl_batch_uncache( syncinfo_t *si, Operation *op )
+{
+	struct berval dn, ndn;
+	int i;
+
+	if ( !group_cache_max )
+		return;
+
+	if ( si->si_batchlog ) {
+		if ( si->si_batchrename )
+			group_cache_written( NULL, NULL, 1 );
+		else
+			avl_apply( si->si_batchdns, syncrepl_batch_written, NULL,
+				-1, AVL_INORDER );
+		return;
+	}
+
+	for ( i = 0; i < si->si_batchnum; i++ ) {
+		ldap_get_dn_ber( si->si_ld, si->si_batchmsgs[i], NULL, &dn );
+		if ( dnNormalize( 0, NULL, NULL, &dn, &ndn, op->o_tmpmemctx ) == LDAP_SUCCESS ) {
+			group_cache_written( &ndn, NULL, 0 );
+			op->o_tmpfree( ndn.bv_val, op->o_tmpmemctx );
+		}
+	}
+}
+
+static int
+syncrepl_batch_forgetdn( void *v, void *arg )
+{
+	syncrepl_csn_forget( (BackendDB *)arg, (struct berval *)v );
+	return 0;
+}
+
+/* The batch was rolled back after the CSN cache saw its changes
+ * succeed, drop them from the cache before they are replayed or
+ * they would be taken for changes that were already applied.
+ */
+static void
+syncrepl_batch_forget( syncinfo_t *si, Operation *op )
+{
+	struct berval dn, ndn;
+	int i;
+
+	if ( si->si_batchlog ) {
+		if ( si->si_batchrename )
+			syncrepl_csn_forget( si->si_be, NULL );
+		else
+			avl_apply( si->si_batchdns, syncrepl_batch_forgetdn, si->si_be,
+				-1, AVL_INORDER );
+		return;
+	}
+
+	for ( i = 0; i < si->si_batchnum; i++ ) {
+		ldap_get_dn_ber( si->si_ld, si->si_batchmsgs[i], NULL, &dn );
+		if ( dnNormalize( 0, NULL, NULL, &dn, &ndn, op->o_tmpmemctx ) == LDAP_SUCCESS ) {
+			syncrepl_csn_forget( si->si_be, &ndn );
+			op->o_tmpfree( ndn.bv_val, op->o_tmpmemctx );
+		}
+	}
+}
+
+/* Keep the newest CSN of each SID in the batch, a log record's cookie
+ * only carries its own, and store them all after the commit.
+ */
+static void
+syncrepl_batch_cookie( syncinfo_t *si, struct sync_cookie *sc )
+{
+	struct sync_cookie *bc = &si->si_batchcookie;
+	int i, j;
+
+	for ( i = 0; i < sc->numcsns; i++ ) {
+		for ( j = 0; j < bc->numcsns && bc->sids[j] < sc->sids[i]; j++ )
+			;
+		if ( j < bc->numcsns && bc->sids[j] == sc->sids[i] ) {
+			if ( ber_bvcmp( &sc->ctxcsn[i], &bc->ctxcsn[j] ) > 0 )
+				ber_bvreplace( &bc->ctxcsn[j], &sc->ctxcsn[i] );
+		} else {
+			slap_insert_csn_sids( bc, j, sc->sids[i], &sc->ctxcsn[i] );
+		}
+	}
+}
+
+/* Drop the pending CSN in slot, as its change was not committed */
+static void
+syncrepl_pending_revert( syncinfo_t *si, int slot )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &si->si_cookieState->cs_mutex );
+	for ( i = 0; i<si->si_cookieState->cs_num; i++ ) {
+		if ( si->si_cookieState->cs_sids[i] == si->si_cookieState->cs_psids[slot] ) {
+			ber_bvreplace( &si->si_cookieState->cs_pvals[slot],
+				&si->si_cookieState->cs_vals[i] );
+			break;
+		}
+	}
+	if ( i == si->si_cookieState->cs_num )
+		si->si_cookieState->cs_pvals[slot].bv_val[0] = '\0';
+	ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_mutex );
+}
+
+/* A log record could not be replayed, fall back to a full refresh */
+static int
+syncrepl_delta_lost( syncinfo_t *si, int rc, struct berval *bdn )
+{
+	switch ( rc ) {
+	case LDAP_ALREADY_EXISTS:
+	case LDAP_NO_SUCH_OBJECT:
+	case LDAP_NO_SUCH_ATTRIBUTE:
+	case LDAP_TYPE_OR_VALUE_EXISTS:
+	case LDAP_NOT_ALLOWED_ON_NONLEAF:
+		rc = LDAP_SYNC_REFRESH_REQUIRED;
+		si->si_logstate = SYNCLOG_FALLBACK;
+		ldap_abandon_ext( si->si_ld, si->si_msgid, NULL, NULL );
+		bdn->bv_val[bdn->bv_len] = '\0';
+		Debug( LDAP_DEBUG_SYNC, "do_syncrep2: %s delta-sync lost sync on (%s), switching to REFRESH\n",
+			si->si_ridtxt, bdn->bv_val );
+		if (si->si_strict_refresh) {
+			slap_suspend_listeners();
+			connections_drop();
+		}
+		break;
+	default:
+		break;
+	}
+	return rc;
+}
+
+static int
+syncrepl_batch_apply( syncinfo_t *si, Operation *op, LDAPMessage *msg, int batched )
+{
+	BerElementBuffer berbuf;
+	BerElement	*ber = (BerElement *)&berbuf;
+	LDAPControl	**rctrls = NULL, *rctrlp;
+	Modifications	*modlist = NULL;
+	struct berval	syncUUID[2], cookie, bdn;
+	struct sync_cookie	sc = { NULL };
+	Entry		*entry = NULL;
+	ber_len_t	len;
+	int		syncstate, rc, sid, slot = -1;
+
+	/* the control was already validated when the entry was received */
+	ldap_get_entry_controls( si->si_ld, msg, &rctrls );
+	rctrlp = ldap_control_find( LDAP_CONTROL_SYNC_STATE, rctrls, NULL );
+	ber_init2( ber, &rctrlp->ldctl_value, LBER_USE_DER );
+	ber_scanf( ber, "{em" /*"}"*/, &syncstate, &syncUUID[0] );
+
+	if ( si->si_batchlog ) {
+		ldap_get_dn_ber( si->si_ld, msg, NULL, &bdn );
+		if ( ber_peek_tag( ber, &len ) == LDAP_TAG_SYNC_COOKIE &&
+			ber_scanf( ber, /*"{"*/ "m}", &cookie ) != LBER_ERROR &&
+			!BER_BVISNULL( &cookie ) )
+		{
+			ber_dupbv( &sc.octet_str, &cookie );
+			slap_parse_sync_cookie( &sc, NULL );
+		}
+		if ( sc.ctxcsn ) {
+			/* skip changes another consumer has already applied */
+			sid = slap_parse_csn_sid( sc.ctxcsn );
+			rc = check_csn_age( si, &bdn, sc.ctxcsn, sid,
+				(cookie_vals *)&si->si_cookieState->cs_pvals, &slot );
+			if ( rc == CV_CSN_OLD ) {
+				slap_sync_cookie_free( &sc, 0 );
+				ldap_controls_free( rctrls );
+				return LDAP_SUCCESS;
+			} else if ( rc == CV_CSN_OK ) {
+				ber_bvreplace( &si->si_cookieState->cs_pvals[slot],
+					sc.ctxcsn );
+			} else {
+				slap_insert_csn_sids(
+					(struct sync_cookie *)&si->si_cookieState->cs_pvals,
+					slot, sid, sc.ctxcsn );
+			}
+		}
+		rc = syncrepl_message_to_op( si, op, msg, 0 );
+		if ( rc == LDAP_SUCCESS && sc.ctxcsn ) {
+			if ( batched )
+				syncrepl_batch_cookie( si, &sc );
+			else
+				rc = syncrepl_updateCookie( si, op, &sc, 0 );
+		}
+		slap_sync_cookie_free( &sc, 0 );
+		if ( rc && !batched ) {
+			if ( slot >= 0 )
+				syncrepl_pending_revert( si, slot );
+			rc = syncrepl_delta_lost( si, rc, &bdn );
+		}
+		ldap_controls_free( rctrls );
+		return rc;
+	}
+
+	rc = syncrepl_message_to_entry( si, op, msg, &modlist, &entry,
+		syncstate, syncUUID );
+	if ( rc == LDAP_SUCCESS )
+		rc = syncrepl_entry( si, op, entry, &modlist, syncstate,
+			syncUUID, NULL );
+	if ( modlist )
+		slap_mods_free( modlist, 1 );
+	ldap_controls_free( rctrls );
+	return rc;
+}
+
+/* Parsing a message NUL-terminates its values in place, so keep a
+ * copy of the encoding of each one for when the batch is replayed.
+ */
+static struct berval *
+syncrepl_batch_save( syncinfo_t *si )
+{
+	struct berval *saved;
+	BerElement *ber;
+	int i;
+
+	saved = ch_malloc( si->si_batchnum * sizeof( struct berval ));
+	for ( i = 0; i < si->si_batchnum; i++ ) {
+		ber = ldap_get_message_ber( si->si_batchmsgs[i] );
+		saved[i].bv_len = ber_pvt_ber_total( ber );
+		saved[i].bv_val = ch_malloc( saved[i].bv_len );
+		AC_MEMCPY( saved[i].bv_val, ber->ber_buf, saved[i].bv_len );
+	}
+	return saved;
+}
+
+static void
+syncrepl_batch_restore( syncinfo_t *si, struct berval *saved )
+{
+	BerElement *ber;
+	int i;
+
+	for ( i = 0; i < si->si_batchnum; i++ ) {
+		ber = ldap_get_message_ber( si->si_batchmsgs[i] );
+		AC_MEMCPY( ber->ber_buf, saved[i].bv_val, saved[i].bv_len );
+	}
+}
+
+/* Apply the collected messages in a single transaction */
+static int
+syncrepl_batch_end( syncinfo_t *si, Operation *op )
+{
+	BackendDB *be = op->o_bd;
+	OpExtra *txn = NULL;
+	struct berval *saved;
+	int i, rc;
+
+	if ( !si->si_batchnum )
+		return LDAP_SUCCESS;
+
+	if (( rc = get_pmutex( si ))) {
+		syncrepl_batch_free( si );
+		return rc;
+	}
+
+	ldap_pvt_thread_mutex_lock( &si->si_cookieState->cs_mutex );
+	si->si_cookieState->cs_batching = 1;
+	ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_mutex );
+
+	saved = syncrepl_batch_save( si );
+
+	op->o_bd = si->si_wbe;
+	rc = op->o_bd->bd_info->bi_op_txn( op, SLAP_TXN_BEGIN, &txn );
+	op->o_bd = be;
+	if ( rc ) {
+		txn = NULL;
+		rc = LDAP_OTHER;
+	}
+	for ( i = 0; rc == LDAP_SUCCESS && i < si->si_batchnum; i++ )
+		rc = syncrepl_batch_apply( si, op, si->si_batchmsgs[i], 1 );
+
+	if ( txn ) {
+		op->o_bd = si->si_wbe;
+		LDAP_SLIST_REMOVE( &op->o_extra, txn, OpExtra, oe_next );
+		if ( rc == LDAP_SUCCESS ) {
+			rc = op->o_bd->bd_info->bi_op_txn( op, SLAP_TXN_COMMIT, &txn );
+		} else {
+			op->o_bd->bd_info->bi_op_txn( op, SLAP_TXN_ABORT, &txn );
+		}
+		op->o_bd = be;
+	}
+
+	if ( rc == LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_SYNC, "syncrepl_batch_end: %s "
+			"committed %d %s\n",
+			si->si_ridtxt, si->si_batchnum,
+			si->si_batchlog ? "log changes" : "refresh entries" );
+		syncrepl_batch_uncache( si, op );
+		if ( si->si_batchcookie.ctxcsn )
+			rc = syncrepl_updateCookie( si, op, &si->si_batchcookie, 0 );
+	} else {
+		Debug( LDAP_DEBUG_SYNC, "syncrepl_batch_end: %s "
+			"replaying %d %s\n",
+			si->si_ridtxt, si->si_batchnum,
+			si->si_batchlog ? "log changes" : "refresh entries" );
+		syncrepl_batch_forget( si, op );
+		syncrepl_batch_restore( si, saved );
+		if ( si->si_batchlog ) {
+			for ( i = 0; i < si->si_cookieState->cs_pnum; i++ )
+				syncrepl_pending_revert( si, i );
+		}
+		rc = LDAP_SUCCESS;
+		for ( i = 0; rc == LDAP_SUCCESS && i < si->si_batchnum; i++ )
+			rc = syncrepl_batch_apply( si, op, si->si_batchmsgs[i], 0 );
+	}
+
+	for ( i = 0; i < si->si_batchnum; i++ )
+		ch_free( saved[i].bv_val );
+	ch_free( saved );
+	syncrepl_batch_free( si );
+	ldap_pvt_thread_mutex_lock( &si->si_cookieState->cs_mutex );
+	si->si_cookieState->cs_batching = 0;
+	ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_mutex );
+	ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_pmutex );
+
+	return rc;
+}
+
 static int
 do_syncrep2(
 	Operation *op,
@@ -1231,6 +1831,7 @@ do_syncrep2(
 	int				m;
 
 	struct timeval tout = { 0, 0 };
+	struct timeval batchwait = { 0, SYNC_BATCH_WAIT };
 
 	int		refreshDeletes = 0;
 	char empty[6] = "empty";
@@ -1248,9 +1849,9 @@ do_syncrep2(
 	slap_dup_sync_cookie( &syncCookie_req, &si->si_syncCookie );
 
 	while ( ( rc = ldap_result( si->si_ld, si->si_msgid, LDAP_MSG_ONE,
-		&tout, &msg ) ) > 0 )
+		si->si_batchnum ? &batchwait : &tout, &msg ) ) > 0 )
 	{
-		int				match, punlock, syncstate;
+		int				match, punlock, syncstate, batched = 0;
 		struct berval	*retdata, syncUUID[2], cookie = BER_BVNULL;
 		char			*retoid;
 		LDAPControl		**rctrls = NULL, *rctrlp = NULL;
@@ -1265,8 +1866,16 @@ do_syncrep2(
 			goto done;
 		}
 		si->si_lastcontact = slap_get_time();
+		if ( si->si_batchnum && ldap_msgtype( msg ) != LDAP_RES_SEARCH_ENTRY ) {
+			if (( rc = syncrepl_batch_end( si, op )))
+				goto done;
+		}
 		switch( ldap_msgtype( msg ) ) {
 		case LDAP_RES_SEARCH_ENTRY:
+			ldap_pvt_thread_mutex_lock( &si->si_monitor_mutex );
+			si->si_caughtUp = 0;
+			si->si_lagChanges++;
+			ldap_pvt_thread_mutex_unlock( &si->si_monitor_mutex );
 #ifdef LDAP_CONTROL_X_DIRSYNC
 			if ( si->si_ctype == MSAD_DIRSYNC ) {
 				BER_BVZERO( &syncUUID[0] );
@@ -1370,6 +1979,22 @@ do_syncrep2(
 				rc = -1;
 				goto done;
 			}
+			batched = syncrepl_batch_ok( si, syncstate,
+				ber_peek_tag( ber, &len ) == LDAP_TAG_SYNC_COOKIE );
+			if ( si->si_batchnum && ( !batched ||
+				syncrepl_batch_dn( si, msg, 0 )))
+			{
+				/* changes to the same entry go into separate batches */
+				if (( rc = syncrepl_batch_end( si, op ))) {
+					ldap_controls_free( rctrls );
+					goto done;
+				}
+			}
+			if ( batched ) {
+				if ( !si->si_batchnum )
+					syncrepl_batch_begin( si );
+				syncrepl_batch_dn( si, msg, 1 );
+			}
 			punlock = -1;
 			if ( ber_peek_tag( ber, &len ) == LDAP_TAG_SYNC_COOKIE ) {
 				if ( ber_scanf( ber, /*"{"*/ "m}", &cookie ) != LBER_ERROR ) {
@@ -1403,27 +2028,29 @@ do_syncrep2(
 						}
 						si->si_too_old = 0;
 
-						/* check pending CSNs too */
-						if (( rc = get_pmutex( si )))
-							goto done;
-
-						i = check_csn_age( si, &bdn, syncCookie.ctxcsn, sid, (cookie_vals *)&si->si_cookieState->cs_pvals, &slot );
-						if ( i == CV_CSN_OK ) {
-							ber_bvreplace( &si->si_cookieState->cs_pvals[slot],
-								syncCookie.ctxcsn );
-						} else if ( i == CV_CSN_OLD ) {
-							ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_pmutex );
-							ldap_controls_free( rctrls );
-							rc = 0;
-							goto done;
-						} else {
-						/* new SID, add it */
-							slap_insert_csn_sids(
-								(struct sync_cookie *)&si->si_cookieState->cs_pvals,
-								slot, sid, syncCookie.ctxcsn );
+						/* check pending CSNs too, a batch does so when it is applied */
+						if ( !batched ) {
+							if (( rc = get_pmutex( si )))
+								goto done;
+
+							i = check_csn_age( si, &bdn, syncCookie.ctxcsn, sid, (cookie_vals *)&si->si_cookieState->cs_pvals, &slot );
+							if ( i == CV_CSN_OK ) {
+								ber_bvreplace( &si->si_cookieState->cs_pvals[slot],
+									syncCookie.ctxcsn );
+							} else if ( i == CV_CSN_OLD ) {
+								ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_pmutex );
+								ldap_controls_free( rctrls );
+								rc = 0;
+								goto done;
+							} else {
+							/* new SID, add it */
+								slap_insert_csn_sids(
+									(struct sync_cookie *)&si->si_cookieState->cs_pvals,
+									slot, sid, syncCookie.ctxcsn );
+							}
+							assert( punlock < 0 );
+							punlock = slot;
 						}
-						assert( punlock < 0 );
-						punlock = slot;
 					} else if (si->si_too_old) {
 						bdn.bv_val[bdn.bv_len] = '\0';
 						Debug( LDAP_DEBUG_SYNC, "do_syncrep2: %s CSN too old, ignoring (%s)\n",
@@ -1436,35 +2063,28 @@ do_syncrep2(
 				}
 				}
 			}
+			if ( batched ) {
+				/* the batch owns the message until it is applied */
+				ldap_controls_free( rctrls );
+				si->si_batchmsgs[si->si_batchnum++] = msg;
+				msg = NULL;
+				if ( si->si_batchnum >= si->si_batchsize &&
+					( rc = syncrepl_batch_end( si, op )))
+					goto done;
+				break;
+			}
 			rc = 0;
 			if ( si->si_syncdata && si->si_logstate == SYNCLOG_LOGGING ) {
 				modlist = NULL;
-				if ( ( rc = syncrepl_message_to_op( si, op, msg, punlock < 0 ) ) == LDAP_SUCCESS &&
+				if ( ( rc = syncrepl_message_to_op( si, op, msg,
+					punlock < 0 ) ) == LDAP_SUCCESS &&
 					syncCookie.ctxcsn )
 				{
 					rc = syncrepl_updateCookie( si, op, &syncCookie, 0 );
-				} else
+				} else {
 logerr:
-					switch ( rc ) {
-					case LDAP_ALREADY_EXISTS:
-					case LDAP_NO_SUCH_OBJECT:
-					case LDAP_NO_SUCH_ATTRIBUTE:
-					case LDAP_TYPE_OR_VALUE_EXISTS:
-					case LDAP_NOT_ALLOWED_ON_NONLEAF:
-						rc = LDAP_SYNC_REFRESH_REQUIRED;
-						si->si_logstate = SYNCLOG_FALLBACK;
-						ldap_abandon_ext( si->si_ld, si->si_msgid, NULL, NULL );
-						bdn.bv_val[bdn.bv_len] = '\0';
-						Debug( LDAP_DEBUG_SYNC, "do_syncrep2: %s delta-sync lost sync on (%s), switching to REFRESH\n",
-							si->si_ridtxt, bdn.bv_val );
-						if (si->si_strict_refresh) {
-							slap_suspend_listeners();
-							connections_drop();
-						}
-						break;
-					default:
-						break;
-					}
+					rc = syncrepl_delta_lost( si, rc, &bdn );
+				}
 			} else if ( ( rc = syncrepl_message_to_entry( si, op, msg,
 				&modlist, &entry, syncstate, syncUUID ) ) == LDAP_SUCCESS )
 			{
@@ -1483,20 +2103,8 @@ logerr:
 			}
 			if ( punlock >= 0 ) {
 				/* on failure, revert pending CSN */
-				if ( rc != LDAP_SUCCESS ) {
-					int i;
-					ldap_pvt_thread_mutex_lock( &si->si_cookieState->cs_mutex );
-					for ( i = 0; i<si->si_cookieState->cs_num; i++ ) {
-						if ( si->si_cookieState->cs_sids[i] == si->si_cookieState->cs_psids[punlock] ) {
-							ber_bvreplace( &si->si_cookieState->cs_pvals[punlock],
-								&si->si_cookieState->cs_vals[i] );
-							break;
-						}
-					}
-					if ( i == si->si_cookieState->cs_num )
-						si->si_cookieState->cs_pvals[punlock].bv_val[0] = '\0';
-					ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_mutex );
-				}
+				if ( rc != LDAP_SUCCESS )
+					syncrepl_pending_revert( si, punlock );
 				ldap_pvt_thread_mutex_unlock( &si->si_cookieState->cs_pmutex );
 			}
 			ldap_controls_free( rctrls );
@@ -1875,6 +2483,8 @@ logerr:
 		ldap_msgfree( msg );
 		msg = NULL;
 		if ( ldap_pvt_thread_pool_pausing( &connection_pool )) {
+			if (( rc = syncrepl_batch_end( si, op )))
+				goto done;
 			slap_sync_cookie_free( &syncCookie, 0 );
 			slap_sync_cookie_free( &syncCookie_req, 0 );
 			return SYNC_PAUSED;
@@ -1888,6 +2498,25 @@ logerr:
 	}
 
 done:
+	if ( si->si_batchnum ) {
+		/* apply what was collected before we stopped; on shutdown the
+		 * provider will resend it, as its cookie was not stored
+		 */
+		int rc2 = rc == SYNC_SHUTDOWN ? LDAP_SUCCESS :
+			syncrepl_batch_end( si, op );
+		syncrepl_batch_free( si );
+		if ( rc2 && !rc )
+			rc = rc2;
+	}
+
+	/* nothing more was queued by the provider */
+	if ( rc == SYNC_REPOLL || ( rc == SYNC_TIMEOUT && si->si_refreshDone )) {
+		ldap_pvt_thread_mutex_lock( &si->si_monitor_mutex );
+		si->si_caughtUp = 1;
+		si->si_lagChanges = 0;
+		ldap_pvt_thread_mutex_unlock( &si->si_monitor_mutex );
+	}
+
 	if ( err != LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_ANY,
 			"do_syncrep2: %s (%d) %s\n",
@@ -2501,9 +3130,373 @@ static Modifications *mods_dup( Operation *op, Modifications *modlist, int match
 	return modnew;
 }
 
+/* delta-mpr: CSNs of recently modified entries. An incoming modify
+ * can then be checked against the entryCSN without fetching the entry,
+ * and an older one only needs its conflicts resolved against the log
+ * when a newer change touched one of the attributes it modifies.
+ * Maintained by the overlay for all writes to the database.
+ */
+typedef struct csn_attr {
+	AttributeDescription *ca_ad;
+	char ca_csn[LDAP_PVT_CSNSTR_BUFSIZE];	/* newest change */
+} csn_attr;
+
+typedef struct csn_entry {
+	struct berval ce_ndn;
+	char ce_csn[LDAP_PVT_CSNSTR_BUFSIZE];	/* entryCSN */
+	/* attributes not in ce_attrs were last changed no later than this */
+	char ce_floor[LDAP_PVT_CSNSTR_BUFSIZE];
+	csn_attr *ce_attrs;
+	int ce_nattrs;
+	struct csn_entry *ce_lrunext, *ce_lruprev;
+} csn_entry;
+
+typedef struct csn_cache {
+	Avlnode *cc_tree;
+	csn_entry *cc_lruhead, *cc_lrutail;
+	int cc_count;
+	ldap_pvt_thread_mutex_t cc_mutex;
+} csn_cache;
+
+#define	CSN_CACHE_MAX	4096
+
+static int
+csn_entry_cmp( const void *v1, const void *v2 )
+{
+	const csn_entry *c1 = v1, *c2 = v2;
+	return ber_bvcmp( &c1->ce_ndn, &c2->ce_ndn );
+}
+
+static int
+csn_cmp( struct berval *csn, const char *buf )
+{
+	struct berval bv;
+
+	ber_str2bv( buf, 0, 0, &bv );
+	return ber_bvcmp( csn, &bv );
+}
+
+static void
+csn_entry_free( csn_entry *ce )
+{
+	ch_free( ce->ce_attrs );
+	ch_free( ce );
+}
+
+/* Caller must hold cc_mutex */
+static void
+csn_cache_unlink( csn_cache *cc, csn_entry *ce )
+{
+	if ( ce->ce_lruprev )
+		ce->ce_lruprev->ce_lrunext = ce->ce_lrunext;
+	else
+		cc->cc_lruhead = ce->ce_lrunext;
+	if ( ce->ce_lrunext )
+		ce->ce_lrunext->ce_lruprev = ce->ce_lruprev;
+	else
+		cc->cc_lrutail = ce->ce_lruprev;
+}
+
+/* Caller must hold cc_mutex */
+static void
+csn_cache_del( csn_cache *cc, csn_entry *ce )
+{
+	avl_delete( &cc->cc_tree, ce, csn_entry_cmp );
+	csn_cache_unlink( cc, ce );
+	cc->cc_count--;
+	csn_entry_free( ce );
+}
+
+/* Find an entry and make it the most recently used.
+ * Caller must hold cc_mutex.
+ */
+static csn_entry *
+csn_cache_find( csn_cache *cc, struct berval *ndn )
+{
+	csn_entry ce, *ret;
+
+	ce.ce_ndn = *ndn;
+	ret = avl_find( cc->cc_tree, &ce, csn_entry_cmp );
+	if ( ret && ret != cc->cc_lruhead ) {
+		csn_cache_unlink( cc, ret );
+		ret->ce_lruprev = NULL;
+		ret->ce_lrunext = cc->cc_lruhead;
+		cc->cc_lruhead->ce_lruprev = ret;
+		cc->cc_lruhead = ret;
+	}
+	return ret;
+}
+
+static void
+csn_cache_flush( csn_cache *cc )
+{
+	ldap_pvt_thread_mutex_lock( &cc->cc_mutex );
+	avl_free( cc->cc_tree, (AVL_FREE)csn_entry_free );
+	cc->cc_tree = NULL;
+	cc->cc_lruhead = cc->cc_lrutail = NULL;
+	cc->cc_count = 0;
+	ldap_pvt_thread_mutex_unlock( &cc->cc_mutex );
+}
+
+static void
+csn_cache_remove( csn_cache *cc, struct berval *ndn )
+{
+	csn_entry *ce;
+
+	ldap_pvt_thread_mutex_lock( &cc->cc_mutex );
+	ce = csn_cache_find( cc, ndn );
+	if ( ce )
+		csn_cache_del( cc, ce );
+	ldap_pvt_thread_mutex_unlock( &cc->cc_mutex );
+}
+
+/* Drop what the database's cache knows about ndn, or everything if
+ * ndn is NULL. Does nothing if the overlay isn't configured.
+ */
+static void
+syncrepl_csn_forget( BackendDB *be, struct berval *ndn )
+{
+	slap_overinst *on;
+	csn_cache *cc;
+
+	if ( !overlay_is_over( be ))
+		return;
+	on = ((slap_overinfo *)be->bd_info->bi_private)->oi_list;
+	for ( ; on; on = on->on_next ) {
+		if ( on->on_bi.bi_db_init == syncrepl_ov_db_init )
+			break;
+	}
+	if ( !on || !( cc = on->on_bi.bi_private ))
+		return;
+	if ( ndn )
+		csn_cache_remove( cc, ndn );
+	else
+		csn_cache_flush( cc );
+}
+
+/* Record a successful write. entrycsn is the new entryCSN, or NULL
+ * if it was left unchanged, in which case only the attributes in ml
+ * are recorded as changed at csn.
+ */
+static void
+csn_cache_update( csn_cache *cc, struct berval *ndn,
+	struct berval *entrycsn, struct berval *csn, Modifications *ml )
+{
+	csn_entry *ce;
+	int i;
+
+	if ( csn->bv_len >= LDAP_PVT_CSNSTR_BUFSIZE ) {
+		csn_cache_remove( cc, ndn );
+		return;
+	}
+
+	ldap_pvt_thread_mutex_lock( &cc->cc_mutex );
+	ce = csn_cache_find( cc, ndn );
+	if ( !ce ) {
+		if ( !entrycsn )
+			goto done;
+		/* everything in the entry is as old as its entryCSN */
+		ce = ch_malloc( sizeof( csn_entry ) + ndn->bv_len + 1 );
+		ce->ce_ndn.bv_val = (char *)(ce + 1);
+		ce->ce_ndn.bv_len = ndn->bv_len;
+		AC_MEMCPY( ce->ce_ndn.bv_val, ndn->bv_val, ndn->bv_len + 1 );
+		AC_MEMCPY( ce->ce_csn, entrycsn->bv_val, entrycsn->bv_len );
+		ce->ce_csn[entrycsn->bv_len] = '\0';
+		strcpy( ce->ce_floor, ce->ce_csn );
+		ce->ce_attrs = NULL;
+		ce->ce_nattrs = 0;
+		avl_insert( &cc->cc_tree, ce, csn_entry_cmp, avl_dup_error );
+		ce->ce_lruprev = NULL;
+		ce->ce_lrunext = cc->cc_lruhead;
+		if ( cc->cc_lruhead )
+			cc->cc_lruhead->ce_lruprev = ce;
+		else
+			cc->cc_lrutail = ce;
+		cc->cc_lruhead = ce;
+		if ( ++cc->cc_count > CSN_CACHE_MAX )
+			csn_cache_del( cc, cc->cc_lrutail );
+		goto done;
+	}
+
+	if ( entrycsn ) {
+		/* writes finishing out of order, or an entry replaced
+		 * by an older copy: we can't tell what changed when */
+		if ( csn_cmp( entrycsn, ce->ce_csn ) < 0 ) {
+			csn_cache_del( cc, ce );
+			goto done;
+		}
+		AC_MEMCPY( ce->ce_csn, entrycsn->bv_val, entrycsn->bv_len );
+		ce->ce_csn[entrycsn->bv_len] = '\0';
+	}
+
+	for ( ; ml; ml = ml->sml_next ) {
+		for ( i = 0; i < ce->ce_nattrs; i++ ) {
+			if ( ce->ce_attrs[i].ca_ad == ml->sml_desc )
+				break;
+		}
+		if ( i == ce->ce_nattrs ) {
+			if ( csn_cmp( csn, ce->ce_floor ) <= 0 )
+				continue;
+			ce->ce_attrs = ch_realloc( ce->ce_attrs,
+				( ce->ce_nattrs + 1 ) * sizeof( csn_attr ));
+			ce->ce_attrs[i].ca_ad = ml->sml_desc;
+			ce->ce_nattrs++;
+		} else if ( csn_cmp( csn, ce->ce_attrs[i].ca_csn ) <= 0 ) {
+			continue;
+		}
+		AC_MEMCPY( ce->ce_attrs[i].ca_csn, csn->bv_val, csn->bv_len );
+		ce->ce_attrs[i].ca_csn[csn->bv_len] = '\0';
+	}
+
+done:
+	ldap_pvt_thread_mutex_unlock( &cc->cc_mutex );
+}
+
+/* Did a change newer than csn touch any attribute modified by ml?
+ * Caller must hold cc_mutex.
+ */
+static int
+csn_cache_conflict( csn_entry *ce, Modifications *ml, struct berval *csn )
+{
+	int i;
+
+	for ( ; ml; ml = ml->sml_next ) {
+		/* these are dropped from older mods anyway */
+		if ( ml->sml_desc == slap_schema.si_ad_modifiersName ||
+			ml->sml_desc == slap_schema.si_ad_modifyTimestamp ||
+			ml->sml_desc == slap_schema.si_ad_entryCSN )
+			continue;
+		for ( i = 0; i < ce->ce_nattrs; i++ ) {
+			if ( ce->ce_attrs[i].ca_ad == ml->sml_desc )
+				break;
+		}
+		if ( csn_cmp( csn, i < ce->ce_nattrs ?
+			ce->ce_attrs[i].ca_csn : ce->ce_floor ) < 0 )
+			return 1;
+	}
+	return 0;
+}
+
+static struct berval *
+csn_in_mods( Modifications *ml )
+{
+	for ( ; ml; ml = ml->sml_next ) {
+		if ( ml->sml_desc == slap_schema.si_ad_entryCSN &&
+			ml->sml_nvalues && !BER_BVISNULL( &ml->sml_nvalues[0] ))
+			return &ml->sml_nvalues[0];
+	}
+	return NULL;
+}
+
+static int
+syncrepl_ov_db_init( BackendDB *be, ConfigReply *cr )
+{
+	slap_overinst *on = (slap_overinst *)be->bd_info;
+	csn_cache *cc;
+
+	cc = ch_calloc( 1, sizeof( csn_cache ));
+	ldap_pvt_thread_mutex_init( &cc->cc_mutex );
+	on->on_bi.bi_private = cc;
+	return 0;
+}
+
+static int
+syncrepl_ov_db_destroy( BackendDB *be, ConfigReply *cr )
+{
+	slap_overinst *on = (slap_overinst *)be->bd_info;
+	csn_cache *cc = on->on_bi.bi_private;
+
+	if ( cc ) {
+		csn_cache_flush( cc );
+		ldap_pvt_thread_mutex_destroy( &cc->cc_mutex );
+		ch_free( cc );
+		on->on_bi.bi_private = NULL;
+	}
+	return 0;
+}
+
+/* Keep the CSN cache current for writes that don't come from
+ * delta-mpr, see syncrepl_modify_cb for those.
+ */
+static int
+syncrepl_csn_cb( Operation *op, SlapReply *rs )
+{
+	slap_callback *sc = op->o_callback;
+	csn_cache *cc = sc->sc_private;
+	struct berval *csn;
+
+	if ( rs->sr_type != REP_RESULT )
+		return SLAP_CB_CONTINUE;
+
+	if ( rs->sr_err == LDAP_SUCCESS ) {
+		switch ( op->o_tag ) {
+		case LDAP_REQ_ADD: {
+			Attribute *a = attr_find( op->ora_e->e_attrs,
+				slap_schema.si_ad_entryCSN );
+			/* replaces any leftover of a deleted entry */
+			csn_cache_remove( cc, &op->o_req_ndn );
+			if ( a )
+				csn_cache_update( cc, &op->o_req_ndn, &a->a_nvals[0],
+					&a->a_nvals[0], NULL );
+			} break;
+		case LDAP_REQ_DELETE:
+			csn_cache_remove( cc, &op->o_req_ndn );
+			break;
+		case LDAP_REQ_MODIFY:
+			csn = csn_in_mods( op->orm_modlist );
+			if ( csn )
+				csn_cache_update( cc, &op->o_req_ndn, csn, csn,
+					op->orm_modlist );
+			else
+				csn_cache_remove( cc, &op->o_req_ndn );
+			break;
+		default:
+			/* a rename changes the DNs of the whole subtree */
+			csn_cache_flush( cc );
+			break;
+		}
+	}
+	op->o_callback = sc->sc_next;
+	op->o_tmpfree( sc, op->o_tmpmemctx );
+	return SLAP_CB_CONTINUE;
+}
+
+static int
+syncrepl_csn_track( Operation *op )
+{
+	slap_overinst *on = (slap_overinst *)op->o_bd->bd_info;
+	slap_callback *sc;
+
+	sc = op->o_tmpcalloc( 1, sizeof( slap_callback ), op->o_tmpmemctx );
+	sc->sc_response = syncrepl_csn_cb;
+	sc->sc_private = on->on_bi.bi_private;
+	sc->sc_next = op->o_callback;
+	op->o_callback = sc;
+	return SLAP_CB_CONTINUE;
+}
+
+static int
+syncrepl_op_add( Operation *op, SlapReply *rs )
+{
+	return syncrepl_csn_track( op );
+}
+
+static int
+syncrepl_op_delete( Operation *op, SlapReply *rs )
+{
+	return syncrepl_csn_track( op );
+}
+
+static int
+syncrepl_op_modrdn( Operation *op, SlapReply *rs )
+{
+	return syncrepl_csn_track( op );
+}
+
 typedef struct resolve_ctxt {
 	syncinfo_t *rx_si;
 	Modifications *rx_mods;
+	struct berval *rx_csn;
 } resolve_ctxt;
 
 static void
@@ -2545,6 +3538,12 @@ syncrepl_resolve_cb( Operation *op, SlapReply *rs )
 	if ( rs->sr_type == REP_SEARCH ) {
 		resolve_ctxt *rx = op->o_callback->sc_private;
 		Attribute *a = attr_find( rs->sr_entry->e_attrs, ad_reqMod );
+		Attribute *c = attr_find( rs->sr_entry->e_attrs,
+			slap_schema.si_ad_entryCSN );
+		/* the log is committed on its own, a log batch that was
+		 * rolled back may have left this very change in it */
+		if ( c && !ber_bvcmp( &c->a_nvals[0], rx->rx_csn ))
+			a = NULL;
 		if ( a ) {
 			Modifications *oldmods, *newmods, *m1, *m2, **prev;
 			oldmods = rx->rx_mods;
@@ -2610,6 +3609,7 @@ drop:
 typedef struct modify_ctxt {
 	Modifications *mx_orig;
 	Modifications *mx_free;
+	csn_cache *mx_cache;
 } modify_ctxt;
 
 static int
@@ -2619,6 +3619,11 @@ syncrepl_modify_cb( Operation *op, SlapReply *rs )
 	modify_ctxt *mx = sc->sc_private;
 	Modifications *ml;
 
+	/* older mods leave the entryCSN alone */
+	if ( rs->sr_err == LDAP_SUCCESS )
+		csn_cache_update( mx->mx_cache, &op->o_req_ndn,
+			csn_in_mods( op->orm_modlist ), &op->o_csn, op->orm_modlist );
+
 	op->orm_no_opattrs = 0;
 	op->orm_modlist = mx->mx_orig;
 	for ( ml = mx->mx_free; ml; ml = mx->mx_free ) {
@@ -2634,10 +3639,12 @@ static int
 syncrepl_op_modify( Operation *op, SlapReply *rs )
 {
 	slap_overinst *on = (slap_overinst *)op->o_bd->bd_info;
+	csn_cache *cc = on->on_bi.bi_private;
 	OpExtra *oex;
 	syncinfo_t *si;
 	Entry *e;
-	int rc, match = 0;
+	csn_entry *ce;
+	int rc, match = 0, resolve = 1, cached = 0;
 	Modifications *mod, *newlist;
 
 	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
@@ -2645,7 +3652,7 @@ syncrepl_op_modify( Operation *op, SlapReply *rs )
 			break;
 	}
 	if ( !oex )
-		return SLAP_CB_CONTINUE;
+		return syncrepl_csn_track( op );
 
 	si = ((OpExtraSync *)oex)->oe_si;
 
@@ -2659,8 +3666,10 @@ syncrepl_op_modify( Operation *op, SlapReply *rs )
 		if ( mod->sml_desc == slap_schema.si_ad_entryCSN ) break;
 	}
 	/* FIXME: what should we do if entryCSN is missing from the mod? */
-	if ( !mod )
+	if ( !mod ) {
+		csn_cache_remove( cc, &op->o_req_ndn );
 		return SLAP_CB_CONTINUE;
+	}
 
 	{
 		int sid = slap_parse_csn_sid( &mod->sml_nvalues[0] );
@@ -2676,8 +3685,24 @@ syncrepl_op_modify( Operation *op, SlapReply *rs )
 		}
 	}
 
-	rc = overlay_entry_get_ov( op, &op->o_req_ndn, NULL, NULL, 0, &e, on );
-	if ( rc == 0 ) {
+	ldap_pvt_thread_mutex_lock( &cc->cc_mutex );
+	ce = csn_cache_find( cc, &op->o_req_ndn );
+	if ( ce ) {
+		cached = 1;
+		match = csn_cmp( &mod->sml_nvalues[0], ce->ce_csn );
+		if ( match < 0 )
+			resolve = csn_cache_conflict( ce, op->orm_modlist,
+				&mod->sml_nvalues[0] );
+	}
+	ldap_pvt_thread_mutex_unlock( &cc->cc_mutex );
+
+	if ( cached ) {
+		Debug( LDAP_DEBUG_SYNC, "syncrepl_op_modify: %s "
+			"entryCSN from cache, mod is %s%s\n",
+			op->o_req_ndn.bv_val, match < 0 ? "older" : "newer",
+			match < 0 && !resolve ? ", no conflicts" : "" );
+	} else if ( ( rc = overlay_entry_get_ov( op, &op->o_req_ndn,
+		NULL, NULL, 0, &e, on )) == 0 ) {
 		Attribute *a;
 		const char *text;
 		a = attr_find( e->e_attrs, slap_schema.si_ad_entryCSN );
@@ -2734,8 +3759,8 @@ syncrepl_op_modify( Operation *op, SlapReply *rs )
 
 	newlist = mods_dup( op, op->orm_modlist, match );
 
-	/* mod is older */
-	if ( match < 0 ) {
+	/* mod is older, and newer mods may have touched the same attrs */
+	if ( match < 0 && resolve ) {
 		Operation op2 = *op;
 		AttributeName an[2];
 		struct berval bv;
@@ -2748,6 +3773,7 @@ syncrepl_op_modify( Operation *op, SlapReply *rs )
 
 		rx.rx_si = si;
 		rx.rx_mods = newlist;
+		rx.rx_csn = &mod->sml_nvalues[0];
 		cb.sc_private = &rx;
 
 		op2.o_tag = LDAP_REQ_SEARCH;
@@ -2809,6 +3835,7 @@ syncrepl_op_modify( Operation *op, SlapReply *rs )
 		op->orm_no_opattrs = 1;
 		mx->mx_orig = op->orm_modlist;
 		mx->mx_free = newlist;
+		mx->mx_cache = cc;
 		for ( ml = newlist; ml; ml=ml->sml_next ) {
 			if ( ml->sml_flags == SLAP_MOD_INTERNAL ) {
 				ml->sml_flags = 0;
@@ -3789,104 +4816,152 @@ typedef struct dninfo {
 	AttributeDescription *newDesc;	/* for renames */
 } dninfo;
 
-#define HASHUUID	1
+/*
+ * The present list holds every UUID seen during a present-phase refresh,
+ * which can be tens of millions of them. The first two bytes of a UUID
+ * select one of 65536 buckets and the remaining UUIDLEN-2 bytes are kept
+ * in the bucket as a packed, sorted array, so each UUID costs 14 bytes
+ * instead of a separately allocated tree node.
+ */
+#define PRESENT_HASHBITS	16
+#define PRESENT_BUCKETS		(1 << PRESENT_HASHBITS)
+#define PRESENT_KEYLEN		(UUIDLEN-2)
+
+struct presentbucket {
+	unsigned char	*pb_keys;
+	unsigned int	pb_num;
+	unsigned int	pb_max;
+};
 
-/* return 1 if inserted, 0 otherwise */
-static int
-presentlist_insert(
-	syncinfo_t* si,
+static presentbucket *
+presentlist_bucket(
+	presentbucket *pl,
 	struct berval *syncUUID )
 {
-	char *val;
-
-#ifdef HASHUUID
-	Avlnode **av;
 	unsigned short s;
 
-	if ( !si->si_presentlist )
-		si->si_presentlist = ch_calloc(65536, sizeof( Avlnode * ));
+	memcpy(&s, syncUUID->bv_val, 2);
+	return &pl[s];
+}
 
-	av = (Avlnode **)si->si_presentlist;
+/* return the slot of key in pb, or the insertion point with *found = 0 */
+static unsigned int
+presentlist_search(
+	presentbucket *pb,
+	const char *key,
+	int *found )
+{
+	unsigned int lo = 0, hi = pb->pb_num;
 
-	val = ch_malloc(UUIDLEN-2);
-	memcpy(&s, syncUUID->bv_val, 2);
-	memcpy(val, syncUUID->bv_val+2, UUIDLEN-2);
+	*found = 0;
+	while ( lo < hi ) {
+		unsigned int mid = ( lo + hi ) >> 1;
+		int rc = syncuuid_cmp( key, pb->pb_keys + mid * PRESENT_KEYLEN );
 
-	if ( avl_insert( &av[s], val,
-		syncuuid_cmp, avl_dup_error ) )
-	{
-		ch_free( val );
-		return 0;
+		if ( rc == 0 ) {
+			*found = 1;
+			return mid;
+		}
+		if ( rc < 0 )
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
-#else
-	val = ch_malloc(UUIDLEN);
+	return lo;
+}
+
+/* return 1 if inserted, 0 otherwise */
+static int
+presentlist_insert(
+	syncinfo_t* si,
+	struct berval *syncUUID )
+{
+	presentbucket *pb;
+	unsigned int i;
+	int found;
 
-	AC_MEMCPY( val, syncUUID->bv_val, UUIDLEN );
+	if ( !si->si_presentlist )
+		si->si_presentlist = ch_calloc( PRESENT_BUCKETS, sizeof( presentbucket ));
 
-	if ( avl_insert( &si->si_presentlist, val,
-		syncuuid_cmp, avl_dup_error ) )
-	{
-		ch_free( val );
+	pb = presentlist_bucket( si->si_presentlist, syncUUID );
+	i = presentlist_search( pb, syncUUID->bv_val+2, &found );
+	if ( found )
 		return 0;
+
+	if ( pb->pb_num == pb->pb_max ) {
+		pb->pb_max = pb->pb_max ? pb->pb_max * 2 : 8;
+		pb->pb_keys = ch_realloc( pb->pb_keys, pb->pb_max * PRESENT_KEYLEN );
 	}
-#endif
+	if ( i < pb->pb_num ) {
+		AC_MEMCPY( pb->pb_keys + ( i+1 ) * PRESENT_KEYLEN,
+			pb->pb_keys + i * PRESENT_KEYLEN,
+			( pb->pb_num - i ) * PRESENT_KEYLEN );
+	}
+	AC_MEMCPY( pb->pb_keys + i * PRESENT_KEYLEN, syncUUID->bv_val+2,
+		PRESENT_KEYLEN );
+	pb->pb_num++;
 
 	return 1;
 }
 
-static char *
+static int
 presentlist_find(
-	Avlnode *av,
+	presentbucket *pl,
 	struct berval *val )
 {
-#ifdef HASHUUID
-	Avlnode **a2 = (Avlnode **)av;
-	unsigned short s;
+	int found;
 
-	if (!av)
-		return NULL;
+	if ( !pl )
+		return 0;
 
-	memcpy(&s, val->bv_val, 2);
-	return avl_find( a2[s], val->bv_val+2, syncuuid_cmp );
-#else
-	return avl_find( av, val->bv_val, syncuuid_cmp );
-#endif
+	presentlist_search( presentlist_bucket( pl, val ), val->bv_val+2, &found );
+	return found;
 }
 
 static int
-presentlist_free( Avlnode *av )
+presentlist_free( presentbucket *pl )
 {
-#ifdef HASHUUID
-	Avlnode **a2 = (Avlnode **)av;
 	int i, count = 0;
 
-	if ( av ) {
-		for (i=0; i<65536; i++) {
-			if (a2[i])
-				count += avl_free( a2[i], ch_free );
+	if ( pl ) {
+		for ( i = 0; i < PRESENT_BUCKETS; i++ ) {
+			count += pl[i].pb_num;
+			if ( pl[i].pb_keys )
+				ch_free( pl[i].pb_keys );
 		}
-		ch_free( av );
+		ch_free( pl );
 	}
 	return count;
-#else
-	return avl_free( av, ch_free );
-#endif
 }
 
 static void
 presentlist_delete(
-	Avlnode **av,
+	presentbucket *pl,
 	struct berval *val )
 {
-#ifdef HASHUUID
-	Avlnode **a2 = *(Avlnode ***)av;
-	unsigned short s;
+	presentbucket *pb;
+	unsigned int i;
+	int found;
 
-	memcpy(&s, val->bv_val, 2);
-	avl_delete( &a2[s], val->bv_val+2, syncuuid_cmp );
-#else
-	avl_delete( av, val->bv_val, syncuuid_cmp );
-#endif
+	if ( !pl )
+		return;
+
+	pb = presentlist_bucket( pl, val );
+	i = presentlist_search( pb, val->bv_val+2, &found );
+	if ( !found )
+		return;
+
+	pb->pb_num--;
+	if ( i < pb->pb_num ) {
+		AC_MEMCPY( pb->pb_keys + i * PRESENT_KEYLEN,
+			pb->pb_keys + ( i+1 ) * PRESENT_KEYLEN,
+			( pb->pb_num - i ) * PRESENT_KEYLEN );
+	}
+	if ( !pb->pb_num ) {
+		ch_free( pb->pb_keys );
+		pb->pb_keys = NULL;
+		pb->pb_max = 0;
+	}
 }
 
 static int
@@ -5088,6 +6163,14 @@ syncrepl_updateCookie(
 	ldap_pvt_thread_mutex_lock( &si->si_cookieState->cs_mutex );
 
 	if ( rs_modify.sr_err == LDAP_SUCCESS ) {
+		ldap_pvt_thread_mutex_lock( &si->si_monitor_mutex );
+		if ( first.bv_len < sizeof( si->si_lastCSNbuf )) {
+			AC_MEMCPY( si->si_lastCSNbuf, first.bv_val, first.bv_len );
+			si->si_lastCSNbuf[first.bv_len] = '\0';
+			si->si_lastCSNApplied.bv_val = si->si_lastCSNbuf;
+			si->si_lastCSNApplied.bv_len = first.bv_len;
+		}
+		ldap_pvt_thread_mutex_unlock( &si->si_monitor_mutex );
 		slap_sync_cookie_free( &si->si_syncCookie, 0 );
 		ber_bvarray_free( si->si_cookieState->cs_vals );
 		ch_free( si->si_cookieState->cs_sids );
@@ -5563,7 +6646,7 @@ nonpresent_callback(
 	syncinfo_t *si = op->o_callback->sc_private;
 	Attribute *a;
 	int count = 0;
-	char *present_uuid = NULL;
+	int present_uuid = 0;
 	struct nonpresent_entry *np_entry;
 	struct sync_cookie *syncCookie = op->o_controls[slap_cids.sc_LDAPsync];
 
@@ -5591,7 +6674,7 @@ nonpresent_callback(
 			if ( a == NULL ) return 0;
 		}
 
-		if ( present_uuid == NULL ) {
+		if ( !present_uuid ) {
 			int covered = 1; /* covered by our new contextCSN? */
 
 			if ( !syncCookie )
@@ -5625,8 +6708,7 @@ nonpresent_callback(
 			}
 
 		} else {
-			presentlist_delete( &si->si_presentlist, &a->a_nvals[0] );
-			ch_free( present_uuid );
+			presentlist_delete( si->si_presentlist, &a->a_nvals[0] );
 		}
 	}
 	return LDAP_SUCCESS;
@@ -5738,11 +6820,7 @@ done:;
 static int
 syncuuid_cmp( const void* v_uuid1, const void* v_uuid2 )
 {
-#ifdef HASHUUID
-	return ( memcmp( v_uuid1, v_uuid2, UUIDLEN-2 ));
-#else
-	return ( memcmp( v_uuid1, v_uuid2, UUIDLEN ));
-#endif
+	return ( memcmp( v_uuid1, v_uuid2, PRESENT_KEYLEN ));
 }
 
 void
@@ -5802,6 +6880,9 @@ syncinfo_free( syncinfo_t *sie, int free_all )
 		if ( sie->si_logbase.bv_val ) {
 			ch_free( sie->si_logbase.bv_val );
 		}
+		if ( sie->si_batchmsgs ) {
+			ch_free( sie->si_batchmsgs );
+		}
 		if ( sie->si_be && SLAP_SYNC_SUBENTRY( sie->si_be )) {
 			ch_free( sie->si_contextdn.bv_val );
 		}
@@ -5952,6 +7033,9 @@ config_suffixm( ConfigArgs *c, syncinfo_t *si )
 #define SUFFIXMSTR		"suffixmassage"
 #define	STRICT_REFRESH	"strictrefresh"
 #define LAZY_COMMIT		"lazycommit"
+#define REFRESHBATCHSTR	"refreshbatch"
+#define SNAPSHOTSEED	"snapshotseed"
+#define LOGBATCHSTR		"logbatch"
 
 /* FIXME: undocumented */
 #define EXATTRSSTR		"exattrs"
@@ -6479,6 +7563,44 @@ parse_syncrepl_line(
 					STRLENOF( LAZY_COMMIT ) ) )
 		{
 			si->si_lazyCommit = 1;
+		} else if ( !strncasecmp( c->argv[ i ], REFRESHBATCHSTR "=",
+					STRLENOF( REFRESHBATCHSTR "=" ) ) )
+		{
+			val = c->argv[ i ] + STRLENOF( REFRESHBATCHSTR "=" );
+			if ( lutil_atoi( &si->si_refreshBatch, val ) != 0 || si->si_refreshBatch < 0 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"invalid refresh batch size \"%s\".\n",
+					val );
+				Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg );
+				return 1;
+			}
+		} else if ( !strncasecmp( c->argv[ i ], LOGBATCHSTR "=",
+					STRLENOF( LOGBATCHSTR "=" ) ) )
+		{
+			val = c->argv[ i ] + STRLENOF( LOGBATCHSTR "=" );
+			if ( lutil_atoi( &si->si_logBatch, val ) != 0 || si->si_logBatch < 0 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"invalid log batch size \"%s\".\n",
+					val );
+				Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg );
+				return 1;
+			}
+		} else if ( !strcasecmp( c->argv[ i ], SNAPSHOTSEED ) ) {
+			si->si_snapshotSeed = 1;
+		} else if ( !strncasecmp( c->argv[ i ], SNAPSHOTSEED "=",
+					STRLENOF( SNAPSHOTSEED "=" ) ) )
+		{
+			val = c->argv[ i ] + STRLENOF( SNAPSHOTSEED "=" );
+			if ( !strcasecmp( val, "yes" ) || !strcasecmp( val, "true" ) ) {
+				si->si_snapshotSeed = 1;
+			} else if ( !strcasecmp( val, "no" ) || !strcasecmp( val, "false" ) ) {
+				si->si_snapshotSeed = 0;
+			} else {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"invalid " SNAPSHOTSEED " value \"%s\"", val );
+				Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg );
+				return 1;
+			}
 		} else if ( !bindconf_parse( c->argv[i], &si->si_bindconf ) ) {
 			si->si_got |= GOT_BINDCONF;
 		} else {
@@ -6560,7 +7682,8 @@ static ObjectClass	*oc_olmSyncRepl;
 static AttributeDescription	*ad_olmProviderURIList,
 	*ad_olmConnection, *ad_olmSyncPhase,
 	*ad_olmNextConnect, *ad_olmLastConnect, *ad_olmLastContact,
-	*ad_olmLastCookieRcvd, *ad_olmLastCookieSent;
+	*ad_olmLastCookieRcvd, *ad_olmLastCookieSent,
+	*ad_olmLagTime, *ad_olmLagChanges;
 
 static struct {
 	char *name;
@@ -6636,6 +7759,22 @@ static struct {
 		"NO-USER-MODIFICATION "
 		"USAGE dSAOperation )",
 		&ad_olmLastCookieSent },
+	{ "( olmSyncReplAttributes:9 "
+		"NAME ( 'olmSRLagTime' ) "
+		"DESC 'Seconds since the CSN of the last change applied, while catching up' "
+		"SUP monitorCounter "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmLagTime },
+	{ "( olmSyncReplAttributes:10 "
+		"NAME ( 'olmSRLagChanges' ) "
+		"DESC 'Changes received since the consumer was last caught up' "
+		"SUP monitorCounter "
+		"SINGLE-VALUE "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmLagChanges },
 	{ NULL }
 };
 
@@ -6655,6 +7794,8 @@ static struct {
 			"$ olmSRLastContact "
 			"$ olmSRLastCookieRcvd "
 			"$ olmSRLastCookieSent "
+			"$ olmSRLagTime "
+			"$ olmSRLagChanges "
 			") )",
 		&oc_olmSyncRepl },
 	{ NULL }
@@ -6830,7 +7971,43 @@ syncrepl_monitor_update(
 	if ( !BER_BVISEMPTY( &si->si_lastCookieSent ) &&
 		!bvmatch( &a->a_vals[0], &si->si_lastCookieSent ))
 		ber_bvreplace( &a->a_vals[0], &si->si_lastCookieSent );
-	ldap_pvt_thread_mutex_unlock( &si->si_monitor_mutex );
+
+	a = a->a_next;
+	if ( a->a_desc != ad_olmLagTime ) {
+		ldap_pvt_thread_mutex_unlock( &si->si_monitor_mutex );
+		return SLAP_CB_CONTINUE;
+	}
+
+	{
+		struct lutil_tm tm;
+		struct lutil_timet tt;
+		char buf[ LDAP_PVT_INTTYPE_CHARS(unsigned long) ];
+		struct berval bv;
+		unsigned long changes = si->si_lagChanges;
+		long lag = 0;
+
+		/* the CSN timestamp is in generalized time */
+		if ( !si->si_caughtUp && !BER_BVISEMPTY( &si->si_lastCSNApplied ) &&
+			lutil_parsetime( si->si_lastCSNApplied.bv_val, &tm ) == 0 &&
+			lutil_tm2time( &tm, &tt ) == 0 )
+		{
+			lag = slap_get_time() - tt.tt_sec;
+			if ( lag < 0 )
+				lag = 0;
+		}
+		ldap_pvt_thread_mutex_unlock( &si->si_monitor_mutex );
+
+		bv.bv_val = buf;
+		bv.bv_len = sprintf( buf, "%ld", lag );
+		ber_bvreplace( &a->a_vals[0], &bv );
+
+		a = a->a_next;
+		if ( a->a_desc != ad_olmLagChanges )
+			return SLAP_CB_CONTINUE;
+
+		bv.bv_len = sprintf( buf, "%lu", changes );
+		ber_bvreplace( &a->a_vals[0], &bv );
+	}
 
 	return SLAP_CB_CONTINUE;
 }
@@ -6909,6 +8086,11 @@ syncrepl_monitor_add(
 		attr_merge_normalize_one( e, ad_olmLastCookieRcvd, &bv, NULL );
 		attr_merge_normalize_one( e, ad_olmLastCookieSent, &bv, NULL );
 	}
+	{
+		struct berval bv = BER_BVC("0");
+		attr_merge_normalize_one( e, ad_olmLagTime, &bv, NULL );
+		attr_merge_normalize_one( e, ad_olmLagChanges, &bv, NULL );
+	}
 	{
 		monitor_callback_t *cb = ch_calloc( sizeof( monitor_callback_t ), 1 );
 		cb->mc_update = syncrepl_monitor_update;
@@ -7294,6 +8476,23 @@ syncrepl_unparse( syncinfo_t *si, struct berval *bv )
 		ptr = lutil_strcopy( ptr, " " LAZY_COMMIT );
 	}
 
+	if ( si->si_refreshBatch ) {
+		len = snprintf( ptr, WHATSLEFT, " " REFRESHBATCHSTR "=%d", si->si_refreshBatch );
+		if ( WHATSLEFT <= len ) return;
+		ptr += len;
+	}
+
+	if ( si->si_logBatch ) {
+		len = snprintf( ptr, WHATSLEFT, " " LOGBATCHSTR "=%d", si->si_logBatch );
+		if ( WHATSLEFT <= len ) return;
+		ptr += len;
+	}
+
+	if ( si->si_snapshotSeed ) {
+		if ( WHATSLEFT <= STRLENOF( " " SNAPSHOTSEED ) ) return;
+		ptr = lutil_strcopy( ptr, " " SNAPSHOTSEED );
+	}
+
 	bc.bv_len = ptr - buf;
 	bc.bv_val = buf;
 	ber_dupbv( bv, &bc );
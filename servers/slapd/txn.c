@@ -306,6 +306,9 @@ drain:
 	while (( o = LDAP_STAILQ_FIRST( &c->c_txn_ops )) != NULL ) {
 		LDAP_STAILQ_REMOVE_HEAD( &c->c_txn_ops, o_next );
 		LDAP_STAILQ_NEXT( o, o_next ) = NULL;
+		/* the ops graduated before the commit */
+		group_cache_written( &o->o_req_ndn, NULL,
+			o->o_tag == LDAP_REQ_MODRDN );
 		slap_op_free( o, NULL );
 	}
 
@@ -0,0 +1,1042 @@
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1999-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/*
+ * This tool is a load generator.  Unlike the other slapd-* tools, each
+ * connection is driven by its own thread which keeps up to -P operations
+ * outstanding at any time, drawing binds, searches, modifies and compares
+ * from a weighted mix, given either on the command line or in a request
+ * file (-F).
+ * Throughput can be sampled every -I seconds, on completion a latency
+ * histogram for each operation type is reported, as text or as CSV (-o csv).
+ *
+ * The request file is a sequence of requests, each starting with an
+ * "<op> [<weight>]" line followed by the lines specific to that operation:
+ *
+ *	search <weight>
+ *	<base DN or ldap:///<base>??<scope> URL>
+ *	[+<attr>[,...]:]<filter>
+ *
+ *	bind <weight>
+ *	<DN>
+ *	<password>
+ *
+ *	modify <weight>
+ *	<DN>
+ *	<attribute to replace>
+ *
+ *	compare <weight>
+ *	<DN>
+ *	<attribute>:<value>
+ *
+ * Blank lines and lines starting with '#' are allowed between requests.
+ */
+
+#include "portable.h"
+
+/* Requires libldap with threads */
+#ifndef NO_THREADS
+
+#include <stdio.h>
+#include "ldap_pvt_thread.h"
+
+#include "ac/stdlib.h"
+
+#include "ac/ctype.h"
+#include "ac/param.h"
+#include "ac/socket.h"
+#include "ac/string.h"
+#include "ac/time.h"
+#include "ac/unistd.h"
+
+#include "ldap.h"
+#include "lutil.h"
+
+#include "ldap_pvt.h"
+
+#include "slapd-common.h"
+
+#define MAXCONN	512
+#define MAXDEPTH	1024
+#define MAXREQS	5000
+#define DEFAULT_FILTER	"(objectClass=*)"
+#define DEFAULT_ATTR	"description"
+#define DEFAULT_ASSERTION	"objectClass:top"
+
+enum {
+	BENCH_BIND,
+	BENCH_SEARCH,
+	BENCH_MODIFY,
+	BENCH_COMPARE,
+	BENCH_LAST
+};
+
+static const char *bench_opname[] = { "bind", "search", "modify", "compare" };
+
+/*
+ * Latency histogram in the spirit of HdrHistogram: values below
+ * 2^HIST_SUB_BITS microseconds are recorded exactly, above that each power
+ * of two range is split into 2^HIST_SUB_BITS linear buckets, which keeps the
+ * relative error of any reported value under 2^-HIST_SUB_BITS (about 3%).
+ */
+#define HIST_SUB_BITS	5
+#define HIST_SUB_COUNT	(1UL << HIST_SUB_BITS)
+#define HIST_SIZE	((sizeof(unsigned long) * 8 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct bench_hist {
+	unsigned long	h_count;
+	unsigned long	h_errors;
+	unsigned long	h_max;
+	double		h_sum;
+	unsigned long	h_buckets[HIST_SIZE];
+} bench_hist;
+
+typedef struct bench_req {
+	int		r_type;
+	int		r_weight;
+	char		*r_dn;		/* search base, bind DN or entry */
+	int		r_scope;
+	char		*r_filter;
+	char		**r_attrs;
+	char		*r_attr;	/* attribute to modify or compare */
+	struct berval	r_value;	/* value to compare */
+	struct berval	r_cred;
+} bench_req;
+
+typedef struct bench_pending {
+	int		p_msgid;
+	int		p_type;
+	struct timeval	p_start;
+} bench_pending;
+
+typedef struct bench_thread {
+	ldap_pvt_thread_t	t_tid;
+	int		t_idx;
+	unsigned int	t_seed;
+	unsigned long	t_modifies;
+	struct timeval	t_end;
+	bench_hist	t_hist[BENCH_LAST];
+} bench_thread;
+
+/*
+ * Shared globals (command line args)
+ */
+static struct tester_conn_args	*config;
+static char		*base = NULL;
+static char		*filter = DEFAULT_FILTER;
+static char		*entry = NULL;
+static char		*modattr = DEFAULT_ATTR;
+static char		*assertion = DEFAULT_ASSERTION;
+static char		*srchattrs[] = { "1.1", NULL };
+static char		**attrs = srchattrs;
+static int		noattrs = 0;
+static int		nobind = 0;
+static int		noconns = 1;
+static int		depth = 1;
+static int		verbose = 0;
+static int		csv = 0;
+static int		interval = 0;
+static int		weights[BENCH_LAST] = { 0, 1, 0, 0 };
+
+static bench_req	reqs[MAXREQS];
+static int		nreqs = 0;
+static int		weight_total = 0;
+
+static bench_thread	*threads;
+static int		finished = 0;
+static ldap_pvt_thread_mutex_t	finished_mutex;
+
+static void
+usage( char *name, char opt )
+{
+	if ( opt ) {
+		fprintf( stderr, "%s: unable to handle option \'%c\'\n\n",
+			name, opt );
+	}
+
+	fprintf( stderr, "usage: %s " TESTER_COMMON_HELP
+		"-b <searchbase> "
+		"[-A] "
+		"[-N] "
+		"[-v] "
+		"[-a <attr>] "
+		"[-c <connections>] "
+		"[-e <entry>] "
+		"[-F <request file>] "
+		"[-f <filter>] "
+		"[-I <interval>] "
+		"[-o text|csv] "
+		"[-P <outstanding ops>] "
+		"[-T <attrs>] "
+		"[-V <attr>:<value>] "
+		"[-W <op>=<weight>[,...]] "
+		"[<attrs>] "
+		"\n",
+		name );
+	exit( EXIT_FAILURE );
+}
+
+static int
+parse_weights( char *arg )
+{
+	char	**list;
+	int	i, j, rc = 0;
+
+	list = ldap_str2charray( arg, "," );
+	if ( list == NULL ) {
+		return -1;
+	}
+
+	for ( j = 0; j < BENCH_LAST; j++ ) {
+		weights[j] = 0;
+	}
+
+	for ( i = 0; list[i] != NULL; i++ ) {
+		char	*val = strchr( list[i], '=' );
+
+		if ( val == NULL ) {
+			rc = -1;
+			break;
+		}
+		*val++ = '\0';
+
+		for ( j = 0; j < BENCH_LAST; j++ ) {
+			if ( strcasecmp( list[i], bench_opname[j] ) == 0 ) {
+				break;
+			}
+		}
+		if ( j == BENCH_LAST ||
+				lutil_atoi( &weights[j], val ) != 0 || weights[j] < 0 ) {
+			rc = -1;
+			break;
+		}
+	}
+	ldap_charray_free( list );
+
+	return rc;
+}
+
+static bench_req *
+bench_req_new( int type, int weight )
+{
+	bench_req	*req;
+
+	if ( nreqs >= MAXREQS || weight <= 0 ) {
+		return NULL;
+	}
+
+	req = &reqs[nreqs++];
+	req->r_type = type;
+	req->r_weight = weight;
+	req->r_scope = LDAP_SCOPE_SUBTREE;
+	weight_total += weight;
+
+	return req;
+}
+
+/*
+ * Split an "<attribute>:<value>" compare assertion
+ */
+static int
+bench_assertion( bench_req *req, char *str )
+{
+	char	*sep = strchr( str, ':' );
+
+	if ( sep == NULL || sep == str ) {
+		return -1;
+	}
+
+	req->r_attr = strdup( str );
+	req->r_attr[sep - str] = '\0';
+	ber_str2bv( &req->r_attr[sep - str + 1], 0, 0, &req->r_value );
+
+	return 0;
+}
+
+static int
+get_line( FILE *fp, char *line, int size )
+{
+	char	*nl;
+
+	if ( fgets( line, size, fp ) == NULL ) {
+		return -1;
+	}
+	if (( nl = strchr( line, '\r' )) || ( nl = strchr( line, '\n' )))
+		*nl = '\0';
+
+	return 0;
+}
+
+/*
+ * Read the requests from filename, see the top of the file for the format.
+ * Returns the number of requests read or -1 on error.
+ */
+static int
+get_bench_requests( char *filename )
+{
+	FILE	*fp;
+	char	line[BUFSIZ], *p;
+	int	lineno = 0, type, weight;
+	int	rc = 0;
+
+	if ( (fp = fopen( filename, "r" )) == NULL ) {
+		tester_perror( "fopen", filename );
+		return -1;
+	}
+
+	while ( get_line( fp, line, sizeof(line) ) == 0 ) {
+		bench_req	*req;
+
+		lineno++;
+		for ( p = line; isspace( (unsigned char)*p ); p++ )
+			/* skip */ ;
+		if ( *p == '\0' || *p == '#' ) {
+			continue;
+		}
+
+		for ( type = 0; type < BENCH_LAST; type++ ) {
+			size_t	len = strlen( bench_opname[type] );
+
+			if ( strncasecmp( p, bench_opname[type], len ) == 0 &&
+					( p[len] == '\0' || isspace( (unsigned char)p[len] ) ) ) {
+				p += len;
+				break;
+			}
+		}
+		if ( type == BENCH_LAST ) {
+			rc = -1;
+			break;
+		}
+
+		weight = 1;
+		while ( isspace( (unsigned char)*p ) )
+			p++;
+		if ( *p != '\0' && ( lutil_atoi( &weight, p ) != 0 || weight < 0 ) ) {
+			rc = -1;
+			break;
+		}
+
+		if ( get_line( fp, line, sizeof(line) ) != 0 ) {
+			rc = -1;
+			break;
+		}
+		lineno++;
+
+		if ( weight == 0 ) {
+			/* Disabled, skip the second line too */
+			get_line( fp, line, sizeof(line) );
+			lineno++;
+			continue;
+		}
+
+		req = bench_req_new( type, weight );
+		if ( req == NULL ) {
+			rc = -1;
+			break;
+		}
+
+		if ( type == BENCH_SEARCH &&
+				strncmp( line, "ldap:///", STRLENOF( "ldap:///" ) ) == 0 ) {
+			LDAPURLDesc	*lud;
+
+			if ( ldap_url_parse( line, &lud ) != LDAP_URL_SUCCESS ) {
+				rc = -1;
+				break;
+			}
+			req->r_dn = strdup( lud->lud_dn ? lud->lud_dn : "" );
+			if ( lud->lud_scope != LDAP_SCOPE_DEFAULT ) {
+				req->r_scope = lud->lud_scope;
+			}
+			if ( lud->lud_attrs ) {
+				req->r_attrs = ldap_charray_dup( lud->lud_attrs );
+			}
+			ldap_free_urldesc( lud );
+		} else {
+			req->r_dn = strdup( line );
+		}
+
+		if ( get_line( fp, line, sizeof(line) ) != 0 ) {
+			rc = -1;
+			break;
+		}
+		lineno++;
+
+		switch ( type ) {
+		case BENCH_BIND:
+			ber_str2bv( line, 0, 1, &req->r_cred );
+			break;
+
+		case BENCH_SEARCH:
+			p = line;
+			if ( *p == '+' ) {
+				char	*sep = strchr( p, ':' );
+
+				if ( sep == NULL ) {
+					rc = -1;
+					break;
+				}
+				*sep++ = '\0';
+				req->r_attrs = ldap_str2charray( &p[1], "," );
+				p = sep;
+			}
+			req->r_filter = strdup( p );
+			break;
+
+		case BENCH_MODIFY:
+			req->r_attr = strdup( line );
+			break;
+
+		case BENCH_COMPARE:
+			if ( bench_assertion( req, line ) != 0 ) {
+				rc = -1;
+			}
+			break;
+		}
+		if ( rc ) {
+			break;
+		}
+	}
+	fclose( fp );
+
+	if ( rc ) {
+		char	errstr[BUFSIZ];
+
+		snprintf( errstr, sizeof(errstr), "%s: invalid request at line %d",
+			filename, lineno );
+		tester_error( errstr );
+		return -1;
+	}
+
+	return nreqs;
+}
+
+static unsigned int
+hist_index( unsigned long value )
+{
+	unsigned int	exp = 0;
+
+	while ( value >> exp >= 2 * HIST_SUB_COUNT ) {
+		exp++;
+	}
+
+	return exp * HIST_SUB_COUNT + ( value >> exp );
+}
+
+/* The highest value that would be recorded in the given bucket */
+static unsigned long
+hist_value( unsigned int idx )
+{
+	unsigned int	exp;
+
+	if ( idx < 2 * HIST_SUB_COUNT ) {
+		return idx;
+	}
+
+	exp = idx / HIST_SUB_COUNT - 1;
+	return ( ( HIST_SUB_COUNT + idx % HIST_SUB_COUNT ) << exp ) +
+		( 1UL << exp ) - 1;
+}
+
+static void
+hist_record( bench_hist *h, struct timeval *start, int err )
+{
+	struct timeval	now;
+	unsigned long	usec;
+
+	gettimeofday( &now, NULL );
+	usec = ( now.tv_sec - start->tv_sec ) * 1000000 +
+		now.tv_usec - start->tv_usec;
+
+	h->h_count++;
+	if ( err ) {
+		h->h_errors++;
+	}
+	if ( usec > h->h_max ) {
+		h->h_max = usec;
+	}
+	h->h_sum += usec;
+	h->h_buckets[hist_index( usec )]++;
+}
+
+static void
+hist_merge( bench_hist *to, bench_hist *from )
+{
+	unsigned int	i;
+
+	to->h_count += from->h_count;
+	to->h_errors += from->h_errors;
+	to->h_sum += from->h_sum;
+	if ( from->h_max > to->h_max ) {
+		to->h_max = from->h_max;
+	}
+	for ( i = 0; i < HIST_SIZE; i++ ) {
+		to->h_buckets[i] += from->h_buckets[i];
+	}
+}
+
+static unsigned long
+hist_percentile( bench_hist *h, double percentile )
+{
+	unsigned long	seen = 0, wanted;
+	unsigned int	i;
+
+	wanted = h->h_count * percentile / 100.0 + 0.5;
+	if ( wanted == 0 ) {
+		wanted = 1;
+	}
+
+	for ( i = 0; i < HIST_SIZE; i++ ) {
+		seen += h->h_buckets[i];
+		if ( seen >= wanted ) {
+			unsigned long	value = hist_value( i );
+
+			return value < h->h_max ? value : h->h_max;
+		}
+	}
+
+	return h->h_max;
+}
+
+static void
+hist_print( const char *name, bench_hist *h, double elapsed )
+{
+	unsigned long	seen = 0;
+	unsigned int	i;
+
+	printf( csv ?
+		"summary,%s,%lu,%lu,%.1f,%.1f,%lu,%lu,%lu,%lu,%lu\n" :
+		"%-8s ops=%lu errors=%lu ops/s=%.1f mean=%.1fus "
+		"p50=%luus p90=%luus p99=%luus p99.9=%luus max=%luus\n",
+		name, h->h_count, h->h_errors, h->h_count / elapsed,
+		h->h_sum / h->h_count,
+		hist_percentile( h, 50.0 ), hist_percentile( h, 90.0 ),
+		hist_percentile( h, 99.0 ), hist_percentile( h, 99.9 ),
+		h->h_max );
+
+	if ( !verbose ) {
+		return;
+	}
+
+	if ( !csv ) {
+		printf( "%12s %12s %10s\n", "value(us)", "count", "percentile" );
+	}
+	for ( i = 0; i < HIST_SIZE; i++ ) {
+		if ( !h->h_buckets[i] ) {
+			continue;
+		}
+		seen += h->h_buckets[i];
+		printf( csv ? "histogram,%s,%lu,%lu,%.4f\n" : "%s%12lu %12lu %10.4f\n",
+			csv ? name : "", hist_value( i ), h->h_buckets[i],
+			100.0 * seen / h->h_count );
+	}
+}
+
+static bench_req *
+bench_pick( bench_thread *t )
+{
+	int	i, n;
+
+	/* Each thread has its own generator, rand() is not thread-safe */
+	t->t_seed = t->t_seed * 1103515245 + 12345;
+	n = ( t->t_seed >> 16 ) % weight_total;
+	for ( i = 0; i < nreqs - 1; i++ ) {
+		n -= reqs[i].r_weight;
+		if ( n < 0 ) {
+			break;
+		}
+	}
+
+	return &reqs[i];
+}
+
+static int
+bench_send( LDAP *ld, bench_thread *t, bench_req *req, int *msgid )
+{
+	int	rc = LDAP_OTHER;
+
+	switch ( req->r_type ) {
+	case BENCH_BIND:
+		rc = ldap_sasl_bind( ld, req->r_dn, LDAP_SASL_SIMPLE,
+			&req->r_cred, NULL, NULL, msgid );
+		break;
+
+	case BENCH_SEARCH:
+		rc = ldap_search_ext( ld, req->r_dn, req->r_scope, req->r_filter,
+			req->r_attrs ? req->r_attrs : attrs, noattrs,
+			NULL, NULL, NULL, LDAP_NO_LIMIT, msgid );
+		break;
+
+	case BENCH_MODIFY: {
+		LDAPMod		mod, *mods[2];
+		char		value[64], *values[2];
+
+		snprintf( value, sizeof(value), "slapd-bench %d.%d.%lu",
+			pid, t->t_idx, t->t_modifies++ );
+		values[0] = value;
+		values[1] = NULL;
+
+		mod.mod_op = LDAP_MOD_REPLACE;
+		mod.mod_type = req->r_attr;
+		mod.mod_values = values;
+		mods[0] = &mod;
+		mods[1] = NULL;
+
+		rc = ldap_modify_ext( ld, req->r_dn, mods, NULL, NULL, msgid );
+		} break;
+
+	case BENCH_COMPARE:
+		rc = ldap_compare_ext( ld, req->r_dn, req->r_attr, &req->r_value,
+			NULL, NULL, msgid );
+		break;
+	}
+
+	return rc;
+}
+
+static void *
+do_bench( void *arg )
+{
+	bench_thread	*t = arg;
+	bench_pending	*pending;
+	bench_req	*next = NULL;
+	LDAP		*ld = NULL;
+	LDAPMessage	*res;
+	char		thrstr[BUFSIZ];
+	int		total, sent = 0, outstanding = 0, binding = 0;
+	int		i, rc;
+
+	total = config->outerloops * config->loops;
+
+	pending = calloc( depth, sizeof(bench_pending) );
+	if ( pending == NULL ) {
+		tester_error( "Memory error: calloc pending" );
+		exit( EXIT_FAILURE );
+	}
+
+	tester_init_ld( &ld, config, nobind );
+
+	while ( sent < total || outstanding > 0 ) {
+		while ( !binding && sent < total && outstanding < depth ) {
+			if ( next == NULL ) {
+				next = bench_pick( t );
+			}
+
+			/* Binds are never pipelined, wait for the connection to
+			 * become idle first */
+			if ( next->r_type == BENCH_BIND && outstanding > 0 ) {
+				break;
+			}
+
+			for ( i = 0; pending[i].p_msgid; i++ )
+				/* find a free slot */ ;
+
+			gettimeofday( &pending[i].p_start, NULL );
+			rc = bench_send( ld, t, next, &pending[i].p_msgid );
+			if ( rc != LDAP_SUCCESS ) {
+				tester_ldap_error( ld, "bench_send",
+					bench_opname[next->r_type] );
+				exit( EXIT_FAILURE );
+			}
+			pending[i].p_type = next->r_type;
+			if ( next->r_type == BENCH_BIND ) {
+				binding = 1;
+			}
+
+			outstanding++;
+			sent++;
+			next = NULL;
+		}
+
+		rc = ldap_result( ld, LDAP_RES_ANY, LDAP_MSG_ONE, NULL, &res );
+		if ( rc <= 0 ) {
+			tester_ldap_error( ld, "ldap_result", NULL );
+			exit( EXIT_FAILURE );
+		}
+
+		switch ( rc ) {
+		case LDAP_RES_SEARCH_ENTRY:
+		case LDAP_RES_SEARCH_REFERENCE:
+		case LDAP_RES_INTERMEDIATE:
+			ldap_msgfree( res );
+			continue;
+		}
+
+		for ( i = 0; i < depth; i++ ) {
+			if ( pending[i].p_msgid == ldap_msgid( res ) ) {
+				break;
+			}
+		}
+		if ( i == depth ) {
+			snprintf( thrstr, sizeof(thrstr),
+				"unexpected response msgid=%d", ldap_msgid( res ) );
+			tester_error( thrstr );
+			exit( EXIT_FAILURE );
+		}
+
+		if ( ldap_parse_result( ld, res, &rc, NULL, NULL, NULL, NULL, 1 )
+				!= LDAP_SUCCESS ) {
+			tester_ldap_error( ld, "ldap_parse_result", NULL );
+			exit( EXIT_FAILURE );
+		}
+
+		if ( pending[i].p_type == BENCH_COMPARE &&
+				( rc == LDAP_COMPARE_TRUE || rc == LDAP_COMPARE_FALSE ) ) {
+			rc = LDAP_SUCCESS;
+		}
+
+		if ( rc != LDAP_SUCCESS && !tester_ignore_err( rc ) ) {
+			snprintf( thrstr, sizeof(thrstr), "%s failed: %s (%d)",
+				bench_opname[pending[i].p_type],
+				ldap_err2string( rc ), rc );
+			tester_error( thrstr );
+			exit( EXIT_FAILURE );
+		}
+
+		hist_record( &t->t_hist[pending[i].p_type], &pending[i].p_start,
+			rc != LDAP_SUCCESS );
+		if ( pending[i].p_type == BENCH_BIND ) {
+			binding = 0;
+		}
+		pending[i].p_msgid = 0;
+		outstanding--;
+	}
+
+	gettimeofday( &t->t_end, NULL );
+
+	ldap_unbind_ext( ld, NULL, NULL );
+	free( pending );
+
+	ldap_pvt_thread_mutex_lock( &finished_mutex );
+	finished++;
+	ldap_pvt_thread_mutex_unlock( &finished_mutex );
+
+	return NULL;
+}
+
+static double
+time_diff( struct timeval *from, struct timeval *to )
+{
+	return ( to->tv_sec - from->tv_sec ) +
+		( to->tv_usec - from->tv_usec ) / 1000000.0;
+}
+
+/*
+ * Print the throughput since the last call, counters are updated by the
+ * connection threads without locking so the numbers are approximate.
+ */
+static void
+report_interval( struct timeval *start, struct timeval *last,
+	unsigned long *lastops, unsigned long *lasterrs )
+{
+	struct timeval	now;
+	double		elapsed;
+	int		i, j;
+
+	gettimeofday( &now, NULL );
+	elapsed = time_diff( last, &now );
+	if ( elapsed <= 0 ) {
+		return;
+	}
+
+	if ( !csv ) {
+		printf( "[%8.3fs]", time_diff( start, &now ) );
+	}
+	for ( j = 0; j < BENCH_LAST; j++ ) {
+		unsigned long	ops = 0, errs = 0;
+
+		for ( i = 0; i < noconns; i++ ) {
+			ops += threads[i].t_hist[j].h_count;
+			errs += threads[i].t_hist[j].h_errors;
+		}
+
+		if ( csv ) {
+			printf( "interval,%s,%.3f,%lu,%lu,%.1f\n",
+				bench_opname[j], time_diff( start, &now ),
+				ops - lastops[j], errs - lasterrs[j],
+				( ops - lastops[j] ) / elapsed );
+		} else {
+			printf( " %s=%.1f/s", bench_opname[j],
+				( ops - lastops[j] ) / elapsed );
+		}
+		lastops[j] = ops;
+		lasterrs[j] = errs;
+	}
+	if ( !csv ) {
+		printf( "\n" );
+	}
+	fflush( stdout );
+
+	*last = now;
+}
+
+int
+main( int argc, char **argv )
+{
+	bench_hist	*hist, all = { 0 };
+	struct timeval	start, end = { 0 };
+	double		elapsed;
+	char		*reqfile = NULL;
+	char		outstr[BUFSIZ];
+	int		i, j;
+
+	config = tester_init( "slapd-bench", TESTER_SEARCH );
+
+	while ( (i = getopt( argc, argv, TESTER_COMMON_OPTS "Aa:b:c:e:F:f:I:No:P:T:V:vW:" )) != EOF ) {
+		switch ( i ) {
+		case 'A':
+			noattrs++;
+			break;
+
+		case 'a':		/* attribute to modify */
+			modattr = optarg;
+			break;
+
+		case 'b':		/* search base */
+			base = optarg;
+			break;
+
+		case 'c':		/* the number of connections */
+			if ( lutil_atoi( &noconns, optarg ) != 0 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 'e':		/* entry to modify */
+			entry = optarg;
+			break;
+
+		case 'F':		/* file with the requests to send */
+			reqfile = optarg;
+			break;
+
+		case 'f':		/* the search request */
+			filter = optarg;
+			break;
+
+		case 'I':		/* throughput sampling interval */
+			if ( lutil_atoi( &interval, optarg ) != 0 || interval < 0 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 'N':
+			nobind = TESTER_INIT_ONLY;
+			break;
+
+		case 'o':		/* output format */
+			if ( strcasecmp( optarg, "csv" ) == 0 ) {
+				csv = 1;
+			} else if ( strcasecmp( optarg, "text" ) == 0 ) {
+				csv = 0;
+			} else {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 'P':		/* outstanding operations per connection */
+			if ( lutil_atoi( &depth, optarg ) != 0 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 'T':
+			attrs = ldap_str2charray( optarg, "," );
+			if ( attrs == NULL ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 'V':		/* compare assertion */
+			assertion = optarg;
+			break;
+
+		case 'v':
+			verbose++;
+			break;
+
+		case 'W':		/* operation mix */
+			if ( parse_weights( optarg ) != 0 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		default:
+			if ( tester_config_opt( config, i, optarg ) == LDAP_SUCCESS ) {
+				break;
+			}
+			usage( argv[0], i );
+			break;
+		}
+	}
+
+	if ( argv[optind] != NULL ) {
+		attrs = &argv[optind];
+	}
+
+	if ( reqfile != NULL ) {
+		if ( get_bench_requests( reqfile ) <= 0 ) {
+			exit( EXIT_FAILURE );
+		}
+
+	} else {
+		bench_req	*req;
+
+		if ( base == NULL && weights[BENCH_SEARCH] ) {
+			usage( argv[0], 0 );
+		}
+
+		if ( entry == NULL &&
+				( weights[BENCH_MODIFY] || weights[BENCH_COMPARE] ) ) {
+			usage( argv[0], 0 );
+		}
+
+		if ( (req = bench_req_new( BENCH_BIND, weights[BENCH_BIND] )) ) {
+			req->r_dn = config->binddn;
+			req->r_cred = config->pass;
+		}
+
+		if ( (req = bench_req_new( BENCH_SEARCH, weights[BENCH_SEARCH] )) ) {
+			req->r_dn = base;
+			req->r_filter = filter;
+		}
+
+		if ( (req = bench_req_new( BENCH_MODIFY, weights[BENCH_MODIFY] )) ) {
+			req->r_dn = entry;
+			req->r_attr = modattr;
+		}
+
+		if ( (req = bench_req_new( BENCH_COMPARE, weights[BENCH_COMPARE] )) ) {
+			req->r_dn = entry;
+			if ( bench_assertion( req, assertion ) != 0 ) {
+				usage( argv[0], 'V' );
+			}
+		}
+
+		if ( nreqs == 0 ) {
+			usage( argv[0], 0 );
+		}
+	}
+
+	if ( noconns < 1 )
+		noconns = 1;
+	if ( noconns > MAXCONN )
+		noconns = MAXCONN;
+	if ( depth < 1 )
+		depth = 1;
+	if ( depth > MAXDEPTH )
+		depth = MAXDEPTH;
+
+	threads = calloc( noconns, sizeof(bench_thread) );
+	if ( threads == NULL ) {
+		fprintf( stderr, "%s: Memory error: calloc noconns.\n",
+				argv[0] );
+		exit( EXIT_FAILURE );
+	}
+
+	tester_config_finish( config );
+	ldap_pvt_thread_initialize();
+	ldap_pvt_thread_mutex_init( &finished_mutex );
+
+	snprintf( outstr, sizeof(outstr),
+		"Bench Start: conns: %d outstanding: %d ops/conn: %d (%s)",
+		noconns, depth, config->outerloops * config->loops,
+		config->uri ? config->uri : "default" );
+	tester_error( outstr );
+
+	gettimeofday( &start, NULL );
+	for ( i = 0; i < noconns; i++ ) {
+		threads[i].t_idx = i;
+		threads[i].t_seed = pid + i;
+		ldap_pvt_thread_create( &threads[i].t_tid, 0, do_bench, &threads[i] );
+	}
+
+	if ( csv ) {
+		printf( "#interval,op,time,ops,errors,ops/s\n"
+			"#summary,op,ops,errors,ops/s,mean,p50,p90,p99,p99.9,max\n" );
+		if ( verbose ) {
+			printf( "#histogram,op,value,count,percentile\n" );
+		}
+	}
+
+	if ( interval ) {
+		unsigned long	lastops[BENCH_LAST] = { 0 },
+				lasterrs[BENCH_LAST] = { 0 };
+		struct timeval	last = start;
+		int		done;
+
+		do {
+			sleep( interval );
+
+			ldap_pvt_thread_mutex_lock( &finished_mutex );
+			done = ( finished == noconns );
+			ldap_pvt_thread_mutex_unlock( &finished_mutex );
+
+			report_interval( &start, &last, lastops, lasterrs );
+		} while ( !done );
+	}
+
+	for ( i = 0; i < noconns; i++ ) {
+		ldap_pvt_thread_join( threads[i].t_tid, NULL );
+		if ( time_diff( &end, &threads[i].t_end ) > 0 ) {
+			end = threads[i].t_end;
+		}
+	}
+
+	/* Don't count the time spent waiting for the last sample */
+	elapsed = time_diff( &start, &end );
+
+	hist = calloc( BENCH_LAST, sizeof(bench_hist) );
+	if ( hist == NULL ) {
+		fprintf( stderr, "%s: Memory error: calloc hist.\n",
+				argv[0] );
+		exit( EXIT_FAILURE );
+	}
+
+	for ( j = 0; j < BENCH_LAST; j++ ) {
+		for ( i = 0; i < noconns; i++ ) {
+			hist_merge( &hist[j], &threads[i].t_hist[j] );
+		}
+		if ( hist[j].h_count ) {
+			hist_print( bench_opname[j], &hist[j], elapsed );
+			hist_merge( &all, &hist[j] );
+		}
+	}
+	if ( !csv ) {
+		printf( "elapsed=%.3fs ", elapsed );
+	}
+	hist_print( "total", &all, elapsed );
+
+	free( hist );
+	free( threads );
+	ldap_pvt_thread_mutex_destroy( &finished_mutex );
+
+	tester_error( "Bench complete" );
+
+	exit( EXIT_SUCCESS );
+}
+
+#else /* NO_THREADS */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main( int argc, char **argv )
+{
+	fprintf( stderr, "%s: not available when configured --without-threads\n", argv[0] );
+	exit( EXIT_FAILURE );
+}
+
+#endif /* NO_THREADS */
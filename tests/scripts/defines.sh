@@ -94,6 +94,7 @@ ACLCONF=$DATADIR/slapd-acl.conf
 RCONF=$DATADIR/slapd-referrals.conf
 SRPROVIDERCONF=$DATADIR/slapd-syncrepl-provider.conf
 DSRPROVIDERCONF=$DATADIR/slapd-deltasync-provider.conf
+DLSRPROVIDERCONF=$DATADIR/slapd-syncrepl-disklog.conf
 DSRCONSUMERCONF=$DATADIR/slapd-deltasync-consumer.conf
 PPOLICYCONF=$DATADIR/slapd-ppolicy.conf
 PROXYCACHECONF=$DATADIR/slapd-proxycache.conf
@@ -158,6 +159,7 @@ LLOADDANONCONF=$DATADIR/lloadd-anon.conf
 LLOADDUNREACHABLECONF=$DATADIR/lloadd-backend-issues.conf
 LLOADDTLSCONF=$DATADIR/lloadd-tls.conf
 LLOADDSASLCONF=$DATADIR/lloadd-sasl.conf
+LLOADDBENCHCONF=$DATADIR/lloadd-bench.conf
 
 # generated files
 CONF1=$TESTDIR/slapd.1.conf
@@ -220,6 +222,7 @@ LDAPEXOP="$CLIENTDIR/ldapexop $TOOLARGS"
 SLAPDTESTER=$PROGDIR/slapd-tester
 LDIFFILTER=$PROGDIR/ldif-filter
 SLAPDMTREAD=$PROGDIR/slapd-mtread
+SLAPDBENCH=$PROGDIR/slapd-bench
 LVL=${SLAPD_DEBUG-0x4105}
 LOCALHOST=localhost
 LOCALIP=127.0.0.1
@@ -370,6 +373,7 @@ CONSUMERFLT=$SERVER2FLT
 CONSUMER2FLT=$SERVER3FLT
 
 MTREADOUT=$TESTDIR/mtread.out
+BENCHOUT=$TESTDIR/bench.out
 
 # original outputs for cmp
 PROXYCACHEOUT=$DATADIR/proxycache.out